@@ -8,8 +8,13 @@ DISABLE_WARNINGS_PUSH()
 #include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
 DISABLE_WARNINGS_POP()
+#include <cstdint>
 #include <exception>
 #include <filesystem>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 struct ShaderLoadingException : public std::runtime_error {
@@ -25,6 +30,11 @@ public:
 
     Shader& operator=(Shader&&);
 
+    // False while the driver still compiles and links a program from ShaderBuilder::submit(), never blocks.
+    // Without KHR_parallel_shader_compile there is no way to ask, so a submitted program counts as ready and
+    // its first use waits for it.
+    bool isReady() const;
+
     // ... Feel free to add more methods here (e.g. for setting uniforms or keeping track of texture units) ...
     void bind() const;
 
@@ -37,14 +47,70 @@ public:
     // Query a uniform location by its name in the shader
     GLint getUniformLocation(const std::string& name) const;
 
+    // Size of the linked program binary in bytes, a rough measure of the generated code size
+    GLint binarySize() const;
+
 private:
     friend class ShaderBuilder;
     Shader(GLuint program);
 
+    void release();
+    // Waits for a submitted program and checks the compile and link logs, every use of the program comes through here.
+    void finish() const;
+
+    struct PendingLink {
+        std::vector<GLuint> shaders;
+        bool ownsShaders; // false when they belong to the stage cache
+        std::vector<std::filesystem::path> files;
+        std::filesystem::path cacheFile; // binary is saved here once linked, empty to skip
+        size_t timelineEntry;
+    };
+
 private:
     GLuint m_program;
+    // Separable builds: a program pipeline over the cached stage programs, m_program is the last stage's
+    // program, which glUniform* calls after bind() reach
+    GLuint m_pipeline = 0;
+    mutable std::unique_ptr<PendingLink> m_pending;
+};
+
+// Totals over every ShaderBuilder::build() since startup.
+struct ShaderBuildStats {
+    int programs = 0;
+    int cacheHits = 0; // loaded with glProgramBinary instead of compiled
+    int cacheWrites = 0;
+    int stagesCompiled = 0;
+    int stageCacheHits = 0; // stages linked from an already compiled shader object
+    double totalMs = 0.0; // wall clock spent in build(), submit() and waiting on submitted programs
+};
+
+// One program in the compile timeline, times in ms since the first program was built.
+struct ShaderTimelineEntry {
+    std::string name; // stage file names
+    double submitMs = 0.0;
+    double submittedMs = 0.0; // submit() returned, the driver compiles from here on
+    double readyMs = -1.0; // first seen complete, -1 while compiling
+    bool cached = false;
 };
 
+// Stages are read when added and compiled together with the link in build().
+//
+// With a program cache directory set, build() first looks for a binary of the program saved by an earlier
+// run. The file name hashes the preprocessed stage sources (so the defines of a permutation are part of
+// it) and the GL vendor, renderer and version strings. A missing or rejected binary falls back to
+// compiling from source, after which the linked binary is saved for the next run.
+//
+// build() waits for the program and throws on errors. submit() only issues the compile and link calls,
+// so submitting every program up front lets a driver with parallel compiler threads work on all of them
+// at once; the program is waited on and checked (throwing on errors) the first time it is used.
+//
+// Stage shader objects are cached by stage type, file and defines, so a vertex shader shared by several
+// programs is compiled once and attached to each of them. Cached stages live until releaseStageCache(); a
+// stage that fails to compile is dropped from the cache when its program is checked.
+// A separable builder instead links every stage into its own GL_PROGRAM_SEPARABLE program (cached the
+// same way) and combines them in a program pipeline, so stages mix without any relinking. glUniform*
+// calls after binding such a shader only reach the last stage, so use it where earlier stages have no
+// uniforms. Separable builds skip the program cache and are checked right away.
 class ShaderBuilder {
 public:
     ShaderBuilder() = default;
@@ -52,12 +118,67 @@ public:
     ShaderBuilder(ShaderBuilder&&) = default;
     ~ShaderBuilder();
 
+    // #define name value in every stage of the program, inserted right after the #version line.
+    ShaderBuilder& addDefine(const std::string& name, const std::string& value = "1");
     ShaderBuilder& addStage(GLuint shaderStage, std::filesystem::path shaderFile);
+    ShaderBuilder& setSeparable(bool separable = true);
     Shader build();
+    Shader submit();
+
+    // Empty (the default) disables the cache.
+    static void setProgramCacheDirectory(std::filesystem::path directory);
+    static const ShaderBuildStats& stats();
+    // Disabled, every program compiles its own stages and frees them after linking (the old behaviour).
+    static void setStageCacheEnabled(bool enabled);
+    // Deletes the cached stages, call before the GL context goes away. Programs still using them keep working.
+    static void releaseStageCache();
+
+    // KHR_parallel_shader_compile (or the ARB version), asks the driver for as many compiler threads as it has.
+    static bool parallelCompileSupported();
+    // Stamps the ready time of the submitted programs the driver has finished, without waiting on any.
+    static void pollCompletion();
+    static const std::vector<ShaderTimelineEntry>& timeline();
 
 private:
+    struct Stage {
+        GLuint type;
+        std::filesystem::path file;
+        std::string source;
+    };
+
     void freeShaders();
+    Shader buildPipeline(size_t timelineEntry);
 
 private:
+    bool m_separable = false;
+    std::vector<Stage> m_stages;
+    std::vector<std::pair<std::string, std::string>> m_defines;
     std::vector<GLuint> m_shaders;
 };
+
+// #define driven variants of one program, replacing runtime feature uniforms.
+//
+// A permutation key is a bit set over the feature names: bit i defines features[i] as true, a cleared
+// bit as false. Every variant also defines PERMUTATION, so a shader can declare its switches as constants
+// under it and as uniforms otherwise (the uber-shader). Only the bits in usedFeatures reach the key, so
+// features a program ignores do not multiply its variants. Variants are submitted on first use and kept,
+// check isReady() on the result to keep drawing with the uber-shader until the variant has compiled.
+class ShaderPermutations {
+public:
+    ShaderPermutations() = default;
+    ShaderPermutations(std::vector<std::string> features, uint32_t usedFeatures = ~0u);
+
+    ShaderPermutations& addStage(GLuint shaderStage, std::filesystem::path shaderFile);
+
+    const Shader& get(uint32_t key);
+
+    uint32_t usedFeatures() const { return m_usedFeatures; }
+    const std::vector<std::string>& features() const { return m_features; }
+    const std::unordered_map<uint32_t, Shader>& variants() const { return m_variants; }
+
+private:
+    std::vector<std::string> m_features;
+    uint32_t m_usedFeatures = 0;
+    std::vector<std::pair<GLuint, std::filesystem::path>> m_stages;
+    std::unordered_map<uint32_t, Shader> m_variants;
+};
@@ -1,9 +1,14 @@
 #include "shader.h"
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
+#include <GLFW/glfw3.h>
 #include <fmt/format.h>
 DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <chrono>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -11,9 +16,37 @@ DISABLE_WARNINGS_POP()
 
 static constexpr GLuint invalid = 0xFFFFFFFF;
 
+// KHR_parallel_shader_compile, not in the generated glad loader (same values as the ARB extension)
+#ifndef GL_MAX_SHADER_COMPILER_THREADS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
 static bool checkShaderErrors(GLuint shader);
 static bool checkProgramErrors(GLuint program);
 static std::string readFile(std::filesystem::path filePath);
+static std::string injectDefines(const std::string& source, const std::vector<std::pair<std::string, std::string>>& defines);
+static GLuint loadProgramBinary(const std::filesystem::path& file);
+static bool saveProgramBinary(GLuint program, const std::filesystem::path& file);
+
+static void markReady(GLuint program, size_t timelineEntry);
+static double timelineMs();
+
+static GLbitfield stageBit(GLuint shaderStage);
+static std::string stageKey(GLuint shaderStage, const std::filesystem::path& file, const std::vector<std::pair<std::string, std::string>>& defines);
+
+static std::filesystem::path s_programCacheDirectory;
+static bool s_stageCacheEnabled = true;
+// Stage type, file and defines to the compiled shader object / separable program, and file contents by path
+static std::unordered_map<std::string, GLuint> s_stageCache;
+static std::unordered_map<std::string, GLuint> s_separableStageCache;
+static std::unordered_map<std::string, std::string> s_sourceCache;
+static ShaderBuildStats s_buildStats;
+static std::vector<ShaderTimelineEntry> s_timeline;
+// Submitted programs whose completion has not been seen yet, with their timeline entry
+static std::vector<std::pair<GLuint, size_t>> s_pendingPrograms;
 
 Shader::Shader(GLuint program)
     : m_program(program)
@@ -28,33 +61,113 @@ Shader::Shader()
 Shader::Shader(Shader&& other)
 {
     m_program = other.m_program;
+    m_pipeline = other.m_pipeline;
+    m_pending = std::move(other.m_pending);
     other.m_program = invalid;
+    other.m_pipeline = 0;
 }
 
 Shader::~Shader()
 {
-    if (m_program != invalid)
-        glDeleteProgram(m_program);
+    release();
 }
 
 Shader& Shader::operator=(Shader&& other)
 {
-    if (m_program != invalid)
-        glDeleteProgram(m_program);
+    release();
 
     m_program = other.m_program;
+    m_pipeline = other.m_pipeline;
+    m_pending = std::move(other.m_pending);
     other.m_program = invalid;
+    other.m_pipeline = 0;
     return *this;
 }
 
+void Shader::release()
+{
+    if (m_pending) {
+        if (m_pending->ownsShaders) {
+            for (GLuint shader : m_pending->shaders)
+                glDeleteShader(shader);
+        }
+        const auto pending = std::find(s_pendingPrograms.begin(), s_pendingPrograms.end(), std::pair { m_program, m_pending->timelineEntry });
+        if (pending != s_pendingPrograms.end())
+            s_pendingPrograms.erase(pending);
+        m_pending.reset();
+    }
+    if (m_pipeline != 0)
+        glDeleteProgramPipelines(1, &m_pipeline); // the stage programs belong to the cache
+    else if (m_program != invalid)
+        glDeleteProgram(m_program);
+    m_pipeline = 0;
+    m_program = invalid;
+}
+
+bool Shader::isReady() const
+{
+    if (!m_pending || !ShaderBuilder::parallelCompileSupported())
+        return true;
+
+    GLint completed = GL_FALSE;
+    glGetProgramiv(m_program, GL_COMPLETION_STATUS_KHR, &completed);
+    if (completed)
+        markReady(m_program, m_pending->timelineEntry);
+    return completed == GL_TRUE;
+}
+
+void Shader::finish() const
+{
+    if (!m_pending)
+        return;
+
+    const auto start = std::chrono::steady_clock::now();
+    const std::unique_ptr<PendingLink> pending = std::move(m_pending);
+
+    // The first status query blocks until the driver is done with the shader
+    std::string failedFile;
+    for (size_t i = 0; i < pending->shaders.size(); ++i) {
+        const GLuint stage = pending->shaders[i];
+        if (!checkShaderErrors(stage)) {
+            if (failedFile.empty())
+                failedFile = pending->files[i].string();
+            // Compiled again by the next program asking for it, e.g. after the file is fixed
+            const auto cached = std::find_if(s_stageCache.begin(), s_stageCache.end(), [&](const auto& entry) { return entry.second == stage; });
+            if (cached != s_stageCache.end()) {
+                s_stageCache.erase(cached);
+                glDeleteShader(stage);
+            }
+        }
+        if (pending->ownsShaders)
+            glDeleteShader(stage);
+    }
+    markReady(m_program, pending->timelineEntry);
+    if (!failedFile.empty())
+        throw ShaderLoadingException(fmt::format("Failed to compile shader {}", failedFile));
+    if (!checkProgramErrors(m_program))
+        throw ShaderLoadingException("Shader program failed to link");
+
+    if (!pending->cacheFile.empty() && saveProgramBinary(m_program, pending->cacheFile))
+        ++s_buildStats.cacheWrites;
+    s_buildStats.totalMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
 void Shader::bind() const
 {
     assert(m_program != invalid);
-    glUseProgram(m_program);
+    finish();
+    if (m_pipeline != 0) {
+        // A program made current with glUseProgram would take precedence over the pipeline
+        glUseProgram(0);
+        glBindProgramPipeline(m_pipeline);
+    } else {
+        glUseProgram(m_program);
+    }
 }
 
 void Shader::bindUniformBlock(const std::string& blockName, GLuint bindingLocation, GLuint uniformBlockBuffer) const
 {
+    finish();
     GLuint blockIdx = glGetUniformBlockIndex(m_program, blockName.data());
     if (blockIdx != GL_INVALID_INDEX) {
         glUniformBlockBinding(m_program, blockIdx, bindingLocation);
@@ -66,67 +179,350 @@ void Shader::bindUniformBlock(const std::string& blockName, GLuint bindingLocati
 
 GLuint Shader::getAttributeLocation(const std::string& name) const
 {
-    GLuint loc = glGetAttribLocation(m_program, name.c_str());
-    if (loc == invalid) {
+    finish();
+    GLint loc = glGetAttribLocation(m_program, name.c_str());
+    if (loc == -1) {
         std::cerr << "Warning : Could not find attribute " << name << std::endl;
     }
-    return loc;
+    return static_cast<GLuint>(loc);
 }
 
 GLint Shader::getUniformLocation(const std::string& name) const
 {
+    finish();
     GLint loc = glGetUniformLocation(m_program, name.c_str());
-    if (loc == GL_INVALID_INDEX) {
+    if (loc == -1) {
         std::cerr << "Warning : Could not find uniform " << name << std::endl;
     }
     return loc;
 }
 
+GLint Shader::binarySize() const
+{
+    finish();
+    GLint length = 0;
+    glGetProgramiv(m_program, GL_PROGRAM_BINARY_LENGTH, &length);
+    return length;
+}
+
 ShaderBuilder::~ShaderBuilder()
 {
     freeShaders();
 }
 
+ShaderBuilder& ShaderBuilder::addDefine(const std::string& name, const std::string& value)
+{
+    m_defines.emplace_back(name, value);
+    return *this;
+}
+
 ShaderBuilder& ShaderBuilder::addStage(GLuint shaderStage, std::filesystem::path shaderFile)
 {
     if (!std::filesystem::exists(shaderFile)) {
         throw ShaderLoadingException(fmt::format("File {} does not exist", shaderFile.string().c_str()));
     }
 
-    const std::string shaderSource = readFile(shaderFile);
-    const GLuint shader = glCreateShader(shaderStage);
-    const char* shaderSourcePtr = shaderSource.c_str();
-    glShaderSource(shader, 1, &shaderSourcePtr, nullptr);
-    glCompileShader(shader);
-    if (!checkShaderErrors(shader)) {
-        glDeleteShader(shader);
-        throw ShaderLoadingException(fmt::format("Failed to compile shader {}", shaderFile.string().c_str()));
-    }
+    const std::string key = shaderFile.lexically_normal().string();
+    auto source = s_sourceCache.find(key);
+    if (source == s_sourceCache.end())
+        source = s_sourceCache.emplace(key, readFile(shaderFile)).first;
 
-    m_shaders.push_back(shader);
+    m_stages.push_back({ shaderStage, shaderFile, source->second });
+    return *this;
+}
+
+ShaderBuilder& ShaderBuilder::setSeparable(bool separable)
+{
+    m_separable = separable;
     return *this;
 }
 
 Shader ShaderBuilder::build()
 {
+    Shader shader = submit();
+    shader.finish();
+    return shader;
+}
+
+Shader ShaderBuilder::submit()
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    ShaderTimelineEntry& entry = s_timeline.emplace_back();
+    const size_t timelineEntry = s_timeline.size() - 1;
+    entry.submitMs = timelineMs();
+    for (const Stage& stage : m_stages)
+        entry.name += (entry.name.empty() ? "" : " + ") + stage.file.filename().string();
+
+    if (m_separable) {
+        Shader shader = buildPipeline(timelineEntry);
+        s_buildStats.totalMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return shader;
+    }
+
+    std::vector<std::string> sources;
+    for (const Stage& stage : m_stages)
+        sources.push_back(injectDefines(stage.source, m_defines));
+
+    // Cache key: the driver strings and every preprocessed stage
+    std::filesystem::path cacheFile;
+    GLint numBinaryFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numBinaryFormats);
+    if (!s_programCacheDirectory.empty() && numBinaryFormats > 0) {
+        uint64_t hash = 14695981039346656037ull; // FNV-1a
+        const auto hashBytes = [&](const void* data, size_t size) {
+            for (size_t i = 0; i < size; ++i) {
+                hash ^= static_cast<const unsigned char*>(data)[i];
+                hash *= 1099511628211ull;
+            }
+        };
+        for (GLenum name : std::array<GLenum, 3> { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+            const char* value = reinterpret_cast<const char*>(glGetString(name));
+            if (value)
+                hashBytes(value, std::char_traits<char>::length(value) + 1);
+        }
+        for (size_t i = 0; i < m_stages.size(); ++i) {
+            hashBytes(&m_stages[i].type, sizeof(m_stages[i].type));
+            hashBytes(sources[i].c_str(), sources[i].size() + 1);
+        }
+        cacheFile = s_programCacheDirectory / fmt::format("{:016x}.bin", hash);
+    }
+
+    ++s_buildStats.programs;
+    if (const GLuint cached = cacheFile.empty() ? 0 : loadProgramBinary(cacheFile); cached != 0) {
+        ++s_buildStats.cacheHits;
+        s_timeline[timelineEntry].cached = true;
+        s_timeline[timelineEntry].submittedMs = s_timeline[timelineEntry].readyMs = timelineMs();
+        s_buildStats.totalMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return Shader(cached);
+    }
+
+    // No status queries from here on, those would wait for the driver
+    for (size_t i = 0; i < m_stages.size(); ++i) {
+        const std::string key = stageKey(m_stages[i].type, m_stages[i].file, m_defines);
+        if (const auto cached = s_stageCache.find(key); s_stageCacheEnabled && cached != s_stageCache.end()) {
+            ++s_buildStats.stageCacheHits;
+            m_shaders.push_back(cached->second);
+            continue;
+        }
+
+        const GLuint shader = glCreateShader(m_stages[i].type);
+        const char* shaderSourcePtr = sources[i].c_str();
+        glShaderSource(shader, 1, &shaderSourcePtr, nullptr);
+        glCompileShader(shader);
+        ++s_buildStats.stagesCompiled;
+        m_shaders.push_back(shader);
+        if (s_stageCacheEnabled)
+            s_stageCache.emplace(key, shader);
+    }
+
     // Combine vertex and fragment shaders into a single shader program.
     GLuint program = glCreateProgram();
+    if (!cacheFile.empty())
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     for (GLuint shader : m_shaders)
         glAttachShader(program, shader);
     glLinkProgram(program);
-    freeShaders();
 
-    if (!checkProgramErrors(program)) {
-        throw ShaderLoadingException("Shader program failed to link");
+    Shader shader(program);
+    shader.m_pending = std::make_unique<Shader::PendingLink>();
+    shader.m_pending->shaders = std::move(m_shaders);
+    shader.m_pending->ownsShaders = !s_stageCacheEnabled;
+    for (const Stage& stage : m_stages)
+        shader.m_pending->files.push_back(stage.file);
+    shader.m_pending->cacheFile = cacheFile;
+    shader.m_pending->timelineEntry = timelineEntry;
+    m_shaders.clear();
+    s_pendingPrograms.emplace_back(program, timelineEntry);
+
+    s_timeline[timelineEntry].submittedMs = timelineMs();
+    s_buildStats.totalMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return shader;
+}
+
+// One GL_PROGRAM_SEPARABLE program per stage, shared with every other pipeline using the same stage.
+Shader ShaderBuilder::buildPipeline(size_t timelineEntry)
+{
+    GLuint pipeline = 0;
+    glGenProgramPipelines(1, &pipeline);
+
+    GLuint lastProgram = 0;
+    for (const Stage& stage : m_stages) {
+        const std::string key = stageKey(stage.type, stage.file, m_defines);
+        auto cached = s_separableStageCache.find(key);
+        if (cached == s_separableStageCache.end()) {
+            const std::string source = injectDefines(stage.source, m_defines);
+            const char* sourcePtr = source.c_str();
+            const GLuint program = glCreateShaderProgramv(stage.type, 1, &sourcePtr);
+            ++s_buildStats.stagesCompiled;
+            if (!checkProgramErrors(program)) {
+                glDeleteProgram(program);
+                glDeleteProgramPipelines(1, &pipeline);
+                markReady(0, timelineEntry);
+                throw ShaderLoadingException(fmt::format("Failed to build separable stage {}", stage.file.string()));
+            }
+            cached = s_separableStageCache.emplace(key, program).first;
+        } else {
+            ++s_buildStats.stageCacheHits;
+        }
+        glUseProgramStages(pipeline, stageBit(stage.type), cached->second);
+        lastProgram = cached->second;
     }
+    glActiveShaderProgram(pipeline, lastProgram);
 
-    return Shader(program);
+    ++s_buildStats.programs;
+    s_timeline[timelineEntry].submittedMs = s_timeline[timelineEntry].readyMs = timelineMs();
+
+    Shader shader(lastProgram);
+    shader.m_pipeline = pipeline;
+    return shader;
+}
+
+void ShaderBuilder::setProgramCacheDirectory(std::filesystem::path directory)
+{
+    s_programCacheDirectory = std::move(directory);
+}
+
+const ShaderBuildStats& ShaderBuilder::stats()
+{
+    return s_buildStats;
+}
+
+void ShaderBuilder::setStageCacheEnabled(bool enabled)
+{
+    s_stageCacheEnabled = enabled;
+}
+
+void ShaderBuilder::releaseStageCache()
+{
+    for (const auto& [key, shader] : s_stageCache)
+        glDeleteShader(shader);
+    for (const auto& [key, program] : s_separableStageCache)
+        glDeleteProgram(program);
+    s_stageCache.clear();
+    s_separableStageCache.clear();
+}
+
+bool ShaderBuilder::parallelCompileSupported()
+{
+    static const bool supported = [] {
+        GLint numExtensions = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+        for (GLint i = 0; i < numExtensions; ++i) {
+            const char* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, static_cast<GLuint>(i)));
+            if (!name || (std::strcmp(name, "GL_KHR_parallel_shader_compile") != 0 && std::strcmp(name, "GL_ARB_parallel_shader_compile") != 0))
+                continue;
+
+            // 0xFFFFFFFF asks for the implementation maximum
+            using MaxShaderCompilerThreads = void(APIENTRYP)(GLuint);
+            auto maxShaderCompilerThreads = reinterpret_cast<MaxShaderCompilerThreads>(glfwGetProcAddress("glMaxShaderCompilerThreadsKHR"));
+            if (!maxShaderCompilerThreads)
+                maxShaderCompilerThreads = reinterpret_cast<MaxShaderCompilerThreads>(glfwGetProcAddress("glMaxShaderCompilerThreadsARB"));
+            if (maxShaderCompilerThreads)
+                maxShaderCompilerThreads(0xFFFFFFFF);
+            return true;
+        }
+        return false;
+    }();
+    return supported;
+}
+
+void ShaderBuilder::pollCompletion()
+{
+    if (!parallelCompileSupported())
+        return;
+
+    for (size_t i = 0; i < s_pendingPrograms.size();) {
+        const auto [program, timelineEntry] = s_pendingPrograms[i];
+        GLint completed = GL_FALSE;
+        glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &completed);
+        if (completed)
+            markReady(program, timelineEntry);
+        else
+            ++i;
+    }
+}
+
+const std::vector<ShaderTimelineEntry>& ShaderBuilder::timeline()
+{
+    return s_timeline;
 }
 
 void ShaderBuilder::freeShaders()
 {
     for (GLuint shader : m_shaders)
         glDeleteShader(shader);
+    m_shaders.clear();
+}
+
+ShaderPermutations::ShaderPermutations(std::vector<std::string> features, uint32_t usedFeatures)
+    : m_features(std::move(features))
+    , m_usedFeatures(usedFeatures)
+{
+}
+
+ShaderPermutations& ShaderPermutations::addStage(GLuint shaderStage, std::filesystem::path shaderFile)
+{
+    m_stages.emplace_back(shaderStage, std::move(shaderFile));
+    return *this;
+}
+
+const Shader& ShaderPermutations::get(uint32_t key)
+{
+    key &= m_usedFeatures;
+    if (auto it = m_variants.find(key); it != m_variants.end())
+        return it->second;
+
+    ShaderBuilder builder;
+    builder.addDefine("PERMUTATION");
+    for (size_t i = 0; i < m_features.size(); ++i)
+        builder.addDefine(m_features[i], (key >> i) & 1u ? "true" : "false");
+    for (const auto& [stage, file] : m_stages)
+        builder.addStage(stage, file);
+
+    return m_variants.emplace(key, builder.submit()).first->second;
+}
+
+static void markReady(GLuint program, size_t timelineEntry)
+{
+    if (s_timeline[timelineEntry].readyMs < 0.0)
+        s_timeline[timelineEntry].readyMs = timelineMs();
+
+    const auto pending = std::find(s_pendingPrograms.begin(), s_pendingPrograms.end(), std::pair { program, timelineEntry });
+    if (pending != s_pendingPrograms.end())
+        s_pendingPrograms.erase(pending);
+}
+
+static GLbitfield stageBit(GLuint shaderStage)
+{
+    switch (shaderStage) {
+    case GL_VERTEX_SHADER:
+        return GL_VERTEX_SHADER_BIT;
+    case GL_TESS_CONTROL_SHADER:
+        return GL_TESS_CONTROL_SHADER_BIT;
+    case GL_TESS_EVALUATION_SHADER:
+        return GL_TESS_EVALUATION_SHADER_BIT;
+    case GL_GEOMETRY_SHADER:
+        return GL_GEOMETRY_SHADER_BIT;
+    case GL_FRAGMENT_SHADER:
+        return GL_FRAGMENT_SHADER_BIT;
+    default:
+        throw ShaderLoadingException("Unsupported shader stage for a program pipeline");
+    }
+}
+
+static std::string stageKey(GLuint shaderStage, const std::filesystem::path& file, const std::vector<std::pair<std::string, std::string>>& defines)
+{
+    std::string key = fmt::format("{}|{}", shaderStage, file.lexically_normal().string());
+    for (const auto& [name, value] : defines)
+        key += fmt::format("|{}={}", name, value);
+    return key;
+}
+
+static double timelineMs()
+{
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 }
 
 static std::string readFile(std::filesystem::path filePath)
@@ -138,6 +534,81 @@ static std::string readFile(std::filesystem::path filePath)
     return buffer.str();
 }
 
+// Cache file layout: the binary format (GLenum) followed by the program binary.
+// Returns 0 when there is no file or the driver rejects the binary (e.g. after a driver update).
+static GLuint loadProgramBinary(const std::filesystem::path& file)
+{
+    std::ifstream stream(file, std::ios::binary);
+    if (!stream)
+        return 0;
+
+    GLenum format = 0;
+    stream.read(reinterpret_cast<char*>(&format), sizeof(format));
+    const std::vector<char> binary((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    if (!stream.eof() || binary.empty())
+        return 0;
+
+    const GLuint program = glCreateProgram();
+    glProgramBinary(program, format, binary.data(), static_cast<GLsizei>(binary.size()));
+
+    GLint linkSuccessful = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linkSuccessful);
+    if (!linkSuccessful) {
+        glDeleteProgram(program);
+        std::error_code error;
+        std::filesystem::remove(file, error);
+        return 0;
+    }
+    return program;
+}
+
+static bool saveProgramBinary(GLuint program, const std::filesystem::path& file)
+{
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return false;
+
+    std::vector<char> binary(static_cast<size_t>(length));
+    GLenum format = 0;
+    glGetProgramBinary(program, length, nullptr, &format, binary.data());
+
+    std::error_code error;
+    std::filesystem::create_directories(file.parent_path(), error);
+    std::ofstream stream(file, std::ios::binary);
+    if (!stream)
+        return false;
+
+    stream.write(reinterpret_cast<const char*>(&format), sizeof(format));
+    stream.write(binary.data(), static_cast<std::streamsize>(binary.size()));
+    return static_cast<bool>(stream);
+}
+
+// Inserts the defines after the #version line (which has to stay first) and resets the line numbering so
+// compile errors still point at the right line of the file.
+static std::string injectDefines(const std::string& source, const std::vector<std::pair<std::string, std::string>>& defines)
+{
+    if (defines.empty())
+        return source;
+
+    size_t insertAt = 0;
+    const size_t version = source.find("#version");
+    if (version != std::string::npos) {
+        const size_t lineEnd = source.find('\n', version);
+        insertAt = lineEnd == std::string::npos ? source.size() : lineEnd + 1;
+    }
+    const auto nextLine = std::count(source.begin(), source.begin() + static_cast<std::ptrdiff_t>(insertAt), '\n') + 1;
+
+    std::string injected;
+    for (const auto& [name, value] : defines)
+        injected += fmt::format("#define {} {}\n", name, value);
+    injected += fmt::format("#line {}\n", nextLine);
+
+    std::string result = source;
+    result.insert(insertAt, injected);
+    return result;
+}
+
 static bool checkShaderErrors(GLuint shader)
 {
     // Check if the shader compiled successfully.
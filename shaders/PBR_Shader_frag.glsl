@@ -2,7 +2,6 @@
 
 precision highp float;
 
-#define MAX_LIGHT_CNT 10
 #define PI 3.1415926535897932384626433832795
 
 // Implementation of PBR Shading
@@ -19,37 +18,29 @@ layout(std140) uniform PBR_Material
 };
 
 // Shadow Setting
+#ifdef PERMUTATION
+const bool shadowEnabled = SHADOW_ENABLED;
+const bool pcfEnabled = PCF_ENABLED;
+#else
 layout(std140) uniform shadowSetting{
     bool shadowEnabled;
     bool pcfEnabled;
 };
+#endif
 
 uniform sampler2D texShadow;
 
-//Light Setting
-struct Light {
-    vec3 position;
-    float _UNUSE_PADDING0;
-
-    vec3 color;
-    float _UNUSE_PADDING1;
-
-    vec3 direction;
-    float _UNUSE_PADDING2;
-
-    bool is_spotlight;
-    bool has_texture;
-    vec2 _UNUSE_PADDING3;
-
-    float linear;
-    float _UNUSE_PADDING4;  
-    float quadratic;
-    float radius;
-};
-
-layout(std140) uniform lights{
-   Light LightList[MAX_LIGHT_CNT];
-};
+// Clustered light lists, built on the CPU by LightClusters (src/light_clusters.h)
+uniform samplerBuffer lightPositionRadius;  // LightStore streams, one texel per light
+uniform samplerBuffer lightColor;
+uniform samplerBuffer lightAttenuation;     // (linear, quadratic)
+uniform usamplerBuffer clusterGrid;         // (offset, count) per cluster
+uniform usamplerBuffer clusterLightIndices;
+uniform ivec3 clusterDims;
+uniform int clusterTileSize;
+uniform vec2 clusterDepthParams;            // slice = log(viewDepth) * x + y
+uniform vec2 clusterNearFar;
+uniform bool useClusters;
 
 uniform int LightCount;
 
@@ -57,22 +48,42 @@ uniform mat4 lightMVP;
 
 uniform vec3 viewPos;
 
-uniform sampler2D normalMap;
-uniform sampler2D albedoMap;
-uniform sampler2D metallicMap;
-uniform sampler2D roughnessMap;
-uniform sampler2D aoMap;
-
-uniform bool hasTexCoords;
-uniform bool useMaterial;
+// Layers of texture arrays, maps of the same size and format share one
+uniform sampler2DArray normalMap;
+uniform sampler2DArray albedoMap;
+uniform sampler2DArray metallicMap;
+uniform sampler2DArray roughnessMap;
+uniform sampler2DArray aoMap;
+uniform int normalMapLayer;
+uniform int albedoMapLayer;
+uniform int metallicMapLayer;
+uniform int roughnessMapLayer;
+uniform int aoMapLayer;
 
 uniform vec3 ambientColor;
 
-uniform bool hdrEnvMapEnabled;
 uniform samplerCube irradianceMap;
 uniform samplerCube prefilteredMap;
 uniform sampler2D brdfLUT;
 
+// Order 2 spherical harmonics of the irradiance map, an alternative to sampling it
+layout(std140) uniform IrradianceSH {
+    vec4 irradianceSH[9];
+};
+
+// Feature switches: compile time constants in a ShaderPermutations variant, uniforms in the uber-shader
+#ifdef PERMUTATION
+const bool hasTexCoords = HAS_TEX_COORDS;
+const bool useMaterial = USE_MATERIAL;
+const bool hdrEnvMapEnabled = HDR_ENV_MAP_ENABLED;
+const bool useIrradianceSH = IRRADIANCE_SH;
+#else
+uniform bool hasTexCoords;
+uniform bool useMaterial;
+uniform bool hdrEnvMapEnabled;
+uniform bool useIrradianceSH;
+#endif
+
 in vec3 fragPosition;
 in vec3 fragNormal;
 in vec2 fragTexCoord;
@@ -118,12 +129,27 @@ float shadowFactorCal(vec2 shadowMapCoord, float fragLightDepth){
     return shadowFactor;
 }
 
-float getLightAttenuationFactor(vec3 lightDir) {
-    float dist = length(lightDir);
+float getLightAttenuationFactor(float dist, float radius) {
     float attenuation = 1.0 / (dist * dist); // Simple quadratic falloff
 
+    // The culling radius comes from the Phong terms and is shorter than where 1/d^2 fades out, so only
+    // the last tenth of it is windowed to reach zero there, closer lights keep their full falloff
+    float window = 1.0 - smoothstep(0.9 * radius, radius, dist);
+
     // Clamp the attenuation to avoid excessively bright values at close distances
-    return clamp(attenuation, 0.0, 1.0);
+    return clamp(attenuation, 0.0, 1.0) * window;
+}
+
+// Index of the cluster this fragment falls in, see LightClusters::build
+int clusterIndex() {
+    float zNear = clusterNearFar.x;
+    float zFar = clusterNearFar.y;
+    float ndcDepth = gl_FragCoord.z * 2.0 - 1.0;
+    float viewDepth = 2.0 * zNear * zFar / (zFar + zNear - ndcDepth * (zFar - zNear));
+
+    int slice = clamp(int(log(viewDepth) * clusterDepthParams.x + clusterDepthParams.y), 0, clusterDims.z - 1);
+    ivec2 tile = clamp(ivec2(gl_FragCoord.xy) / clusterTileSize, ivec2(0), clusterDims.xy - 1);
+    return tile.x + clusterDims.x * (tile.y + clusterDims.y * slice);
 }
 
 vec3 fresnelSchlick(float cosTheta, vec3 F0)
@@ -131,6 +157,21 @@ vec3 fresnelSchlick(float cosTheta, vec3 F0)
     return F0 + (1.0 - F0) * pow(clamp(1.0 - cosTheta, 0.0, 1.0), 5.0);
 }  
 
+// Irradiance for a normal from the SH coefficients, same basis order as spherical_harmonics.cpp
+vec3 evaluateIrradianceSH(vec3 n)
+{
+    vec3 result = irradianceSH[0].rgb * 0.282095;
+    result += irradianceSH[1].rgb * (0.488603 * n.y);
+    result += irradianceSH[2].rgb * (0.488603 * n.z);
+    result += irradianceSH[3].rgb * (0.488603 * n.x);
+    result += irradianceSH[4].rgb * (1.092548 * n.x * n.y);
+    result += irradianceSH[5].rgb * (1.092548 * n.y * n.z);
+    result += irradianceSH[6].rgb * (0.315392 * (3.0 * n.z * n.z - 1.0));
+    result += irradianceSH[7].rgb * (1.092548 * n.x * n.z);
+    result += irradianceSH[8].rgb * (0.546274 * (n.x * n.x - n.y * n.y));
+    return max(result, vec3(0.0));
+}
+
 // introduce roughness for Fresnel-Schlick equation
 vec3 fresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness)
 {
@@ -174,9 +215,11 @@ float GeometrySmith(vec3 N, vec3 V, vec3 L, float roughness)
     return g_n_v_k * g_n_l_k;
 }
 
-vec3 normalFromNormalMapGetter(sampler2D normalMap){
+vec3 normalFromNormalMapGetter(sampler2DArray normalMap, int layer){
 
-    vec3 tangentNormal = texture(normalMap, fragTexCoord).rgb * 2.0 - 1.0;
+    // z is rebuilt, BC5 normal maps only store x and y
+    vec2 tangentXY = texture(normalMap, vec3(fragTexCoord, layer)).rg * 2.0 - 1.0;
+    vec3 tangentNormal = vec3(tangentXY, sqrt(max(1.0 - dot(tangentXY, tangentXY), 0.0)));
 
     vec3 Q1 = dFdx(fragPosition);
     vec3 Q2  = dFdy(fragPosition);
@@ -207,11 +250,11 @@ void main()
     if (hasTexCoords)       { 
         //fragColor = vec4(texture(colorMap, fragTexCoord).rgb, 1);
 
-        Albedo = pow(texture(albedoMap,fragTexCoord).rgb, vec3(2.2));
-        normal = normalFromNormalMapGetter(normalMap);
-        Metallic  = texture(metallicMap, fragTexCoord).r;
-        Roughness = texture(roughnessMap, fragTexCoord).r;
-        Ao        = texture(aoMap, fragTexCoord).r;
+        Albedo = pow(texture(albedoMap, vec3(fragTexCoord, albedoMapLayer)).rgb, vec3(2.2));
+        normal = normalFromNormalMapGetter(normalMap, normalMapLayer);
+        Metallic  = texture(metallicMap, vec3(fragTexCoord, metallicMapLayer)).r;
+        Roughness = texture(roughnessMap, vec3(fragTexCoord, roughnessMapLayer)).r;
+        Ao        = texture(aoMap, vec3(fragTexCoord, aoMapLayer)).r;
 
     }
 
@@ -244,16 +287,26 @@ void main()
 
     if (useMaterial) { 
         
-        for (int idx = 0; idx < LightCount; ++idx){
+        // Without clustering every light is visited, which is the brute force reference path
+        uvec2 cluster = useClusters ? texelFetch(clusterGrid, clusterIndex()).rg : uvec2(0u, uint(LightCount));
+
+        for (uint i = 0u; i < cluster.y; ++i){
+
+            int idx = useClusters ? int(texelFetch(clusterLightIndices, int(cluster.x + i)).r) : int(i);
+
+            vec4 positionRadius = texelFetch(lightPositionRadius, idx);
+
+            float distance = length(positionRadius.xyz - fragPosition);
+            if (distance >= positionRadius.w)
+                continue;
 
-            vec3 lightDir = normalize(LightList[idx].position - fragPosition);
+            vec3 lightDir = (positionRadius.xyz - fragPosition) / distance;
             vec3 halfDir = normalize(viewDir + lightDir);
 
-            float distance = length(LightList[idx].position - fragPosition);
             // Calculate the light attenuation factor based on distance
-            float lightAttenuationFactor = getLightAttenuationFactor(lightDir);
+            float lightAttenuationFactor = getLightAttenuationFactor(distance, positionRadius.w);
 
-            vec3 radiance = LightList[idx].color * lightAttenuationFactor;
+            vec3 radiance = texelFetch(lightColor, idx).rgb * lightAttenuationFactor;
 
             // Cook Tolerance
             float NDF = DistributionGGX(normal, halfDir, Roughness);
@@ -285,7 +338,7 @@ void main()
         else {
             vec3 kS = fresnelSchlickRoughness(max(dot(normal, viewDir), 0.0), F0, Roughness); 
             vec3 kD = vec3(1.0)-kS;
-            irradiance = texture(irradianceMap, normal).rgb;
+            irradiance = useIrradianceSH ? evaluateIrradianceSH(normal) : texture(irradianceMap, normal).rgb;
             diffuse = irradiance * Albedo;
 
             const float MAX_REFLECTION_LOD = 4.0;
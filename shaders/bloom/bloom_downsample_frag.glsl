@@ -0,0 +1,74 @@
+#version 410
+
+// 13-tap downsample (Jimenez, "Next Generation Post Processing in Call of Duty: Advanced Warfare").
+// Five overlapping 2x2 boxes read with bilinear taps, which keeps the chain free of the flicker a plain box
+// filter shows on moving highlights. The first level also applies the bright-pass threshold and weighs each
+// box by 1 / (1 + luma) (Karis average) so single very bright pixels do not turn into blinking squares.
+
+uniform sampler2D source;
+uniform vec2 sourceTexelSize;
+uniform bool prefilter;
+uniform vec4 threshold;                     // (threshold, threshold - knee, 2 * knee, 0.25 / knee)
+
+layout(location = 0) in vec2 TexCoords;
+
+out vec4 FragColor;
+
+vec3 sampleSource(float x, float y)
+{
+    return texture(source, TexCoords + vec2(x, y) * sourceTexelSize).rgb;
+}
+
+float luma(vec3 color)
+{
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// Soft knee threshold: a quadratic ramp between threshold - knee and threshold + knee
+vec3 brightPass(vec3 color)
+{
+    float brightness = max(color.r, max(color.g, color.b));
+    float soft = clamp(brightness - threshold.y, 0.0, threshold.z);
+    soft = soft * soft * threshold.w;
+    float contribution = max(soft, brightness - threshold.x) / max(brightness, 1e-4);
+    return color * contribution;
+}
+
+void main()
+{
+    vec3 a = sampleSource(-2.0,  2.0);
+    vec3 b = sampleSource( 0.0,  2.0);
+    vec3 c = sampleSource( 2.0,  2.0);
+    vec3 d = sampleSource(-2.0,  0.0);
+    vec3 e = sampleSource( 0.0,  0.0);
+    vec3 f = sampleSource( 2.0,  0.0);
+    vec3 g = sampleSource(-2.0, -2.0);
+    vec3 h = sampleSource( 0.0, -2.0);
+    vec3 i = sampleSource( 2.0, -2.0);
+    vec3 j = sampleSource(-1.0,  1.0);
+    vec3 k = sampleSource( 1.0,  1.0);
+    vec3 l = sampleSource(-1.0, -1.0);
+    vec3 m = sampleSource( 1.0, -1.0);
+
+    vec3 boxes[5] = vec3[5](
+        (j + k + l + m) * 0.25,
+        (a + b + d + e) * 0.25,
+        (b + c + e + f) * 0.25,
+        (d + e + g + h) * 0.25,
+        (e + f + h + i) * 0.25);
+    const float boxWeights[5] = float[5](0.5, 0.125, 0.125, 0.125, 0.125);
+
+    vec3 color = vec3(0.0);
+    float weightSum = 0.0;
+    for (int box = 0; box < 5; ++box) {
+        float weight = boxWeights[box] * (prefilter ? 1.0 / (1.0 + luma(boxes[box])) : 1.0);
+        color += boxes[box] * weight;
+        weightSum += weight;
+    }
+    color /= weightSum;
+
+    if (prefilter)
+        color = brightPass(color);
+
+    FragColor = vec4(color, 1.0);
+}
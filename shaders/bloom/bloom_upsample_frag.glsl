@@ -0,0 +1,26 @@
+#version 410
+
+// 3x3 tent filter upsample of the next smaller mip. Blended additively onto the current mip, so every level
+// ends up holding its own detail plus the progressively wider blur of all smaller levels.
+
+uniform sampler2D source;
+uniform vec2 sourceTexelSize;
+uniform float filterRadius;                 // in source texels, fine tunes the radius between mip counts
+
+layout(location = 0) in vec2 TexCoords;
+
+out vec4 FragColor;
+
+vec3 sampleSource(float x, float y)
+{
+    return texture(source, TexCoords + vec2(x, y) * sourceTexelSize * filterRadius).rgb;
+}
+
+void main()
+{
+    vec3 color = sampleSource(0.0, 0.0) * 4.0;
+    color += (sampleSource(-1.0, 0.0) + sampleSource(1.0, 0.0) + sampleSource(0.0, -1.0) + sampleSource(0.0, 1.0)) * 2.0;
+    color += sampleSource(-1.0, -1.0) + sampleSource(1.0, -1.0) + sampleSource(-1.0, 1.0) + sampleSource(1.0, 1.0);
+
+    FragColor = vec4(color / 16.0, 1.0);
+}
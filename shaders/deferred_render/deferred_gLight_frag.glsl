@@ -1,75 +1,143 @@
 #version 410 core
 
-#define MAX_LIGHT_CNT 10
-
-//Light Setting
-struct Light {
-    vec3 position;
-    float _UNUSE_PADDING0;
-
-    vec3 color;
-    float _UNUSE_PADDING1;
-
-    vec3 direction;
-    float _UNUSE_PADDING2;
-
-    bool is_spotlight;
-    bool has_texture;
-    vec2 _UNUSE_PADDING3;
-
-    float linear;
-    float _UNUSE_PADDING4;  
-    float quadratic;
-    float radius;
-};
-
-layout(std140) uniform lights{
-   Light LightList[MAX_LIGHT_CNT];
-};
-
-uniform sampler2D gPosition;
-uniform sampler2D gNormal;
+uniform sampler2D gNormal;                  // octahedral encoded
 uniform sampler2D gAlbedoSpec;
-
+uniform sampler2D gDepth;                   // world positions are reconstructed from depth
+
+// LightStore streams (src/light_store.h), one texel per light
+uniform samplerBuffer lightPositionRadius;
+uniform samplerBuffer lightColor;
+uniform samplerBuffer lightAttenuation;     // (linear, quadratic)
+uniform int LightCount;
+uniform int firstLight;                     // shade lights [firstLight, firstLight + LightCount) when not tiled
+
+// Tiled shading: per tile light lists binned on the CPU by LightClusters (one depth slice)
+// and per tile view depth bounds written by deferred_tile_depth_frag.glsl
+uniform usamplerBuffer clusterGrid;         // (offset, count) per tile
+uniform usamplerBuffer clusterLightIndices;
+uniform ivec3 clusterDims;
+uniform sampler2D tileDepthBounds;
+
+// Blurred SSAO at a lower resolution, (occlusion, linear view depth) per texel
+uniform sampler2D ssaoOcclusion;
+uniform bool useOcclusion;
+uniform bool showOcclusion;
+
+uniform mat4 view;
+uniform mat4 invViewProjection;
 uniform vec3 viewPos;
+uniform vec2 viewportSize;
+uniform bool addAmbient;
 
-in vec2 TexCoords;
+flat in int tileIndex;                      // -1 outside of the tiled pass
 
 out vec4 outColor;
 
-float getLightAttenuationFactor(Light curLight,vec3 lightDir) {
-    float dist = length(lightDir);
-    float attenuation = 1.0 / (1.0+ curLight.linear * dist + curLight.quadratic*dist * dist); // Simple quadratic falloff
+float getLightAttenuationFactor(float dist, float linear, float quadratic, float radius) {
+    float attenuation = 1.0 / (1.0+ linear * dist + quadratic*dist * dist); // Simple quadratic falloff
+
+    // Window the falloff to reach zero at the culling radius so culled lights do not pop
+    float window = clamp(1.0 - pow(dist / radius, 4.0), 0.0, 1.0);
 
     // Clamp the attenuation to avoid excessively bright values at close distances
-    return clamp(attenuation, 0.0, 1.0);
+    return clamp(attenuation, 0.0, 1.0) * window * window;
+}
+
+vec3 decodeNormal(vec2 encoded) {
+    encoded = encoded * 2.0 - 1.0;
+    vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    float t = clamp(-n.z, 0.0, 1.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
+vec3 reconstructPosition(vec2 uv, float depth) {
+    vec4 position = invViewProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    return position.xyz / position.w;
 }
 
+// Joint bilateral upsample: the bilinear weights of the four nearest SSAO texels are scaled down by their
+// depth difference to this pixel, so occlusion from the background does not leak onto foreground edges.
+float upsampleOcclusion(vec2 uv, float viewDepth) {
+    ivec2 size = textureSize(ssaoOcclusion, 0);
+    vec2 texel = uv * vec2(size) - 0.5;
+    ivec2 base = ivec2(floor(texel));
+    vec2 f = fract(texel);
+
+    float sum = 0.0;
+    float weightSum = 0.0;
+    for (int i = 0; i < 4; ++i) {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        vec2 value = texelFetch(ssaoOcclusion, clamp(base + offset, ivec2(0), size - 1), 0).rg;
+
+        float bilinear = (offset.x == 1 ? f.x : 1.0 - f.x) * (offset.y == 1 ? f.y : 1.0 - f.y);
+        float weight = (bilinear + 1e-3) / (1e-3 + abs(value.g - viewDepth) / viewDepth);
+        sum += value.r * weight;
+        weightSum += weight;
+    }
+    return sum / weightSum;
+}
 
 void main(){
 
-    vec3 fragPos = texture(gPosition,TexCoords).rgb;
-    vec3 normal = texture(gNormal,TexCoords).rgb;
+    vec2 TexCoords = gl_FragCoord.xy / viewportSize;
+
+    // nothing was rendered here, leave the background alone
+    float depth = texture(gDepth, TexCoords).r;
+    if (depth >= 1.0)
+        discard;
+
+    vec3 fragPos = reconstructPosition(TexCoords, depth);
+    vec3 normal = decodeNormal(texture(gNormal,TexCoords).rg);
     vec3 Diffuse = texture(gAlbedoSpec,TexCoords).rgb;
     float Specular = texture(gAlbedoSpec, TexCoords).a;
 
+    float occlusion = useOcclusion ? upsampleOcclusion(TexCoords, -(view * vec4(fragPos, 1.0)).z) : 1.0;
+    if (showOcclusion) {
+        if (!addAmbient)
+            discard;
+        outColor = vec4(vec3(occlusion), 1.0);
+        return;
+    }
+
     vec3 viewDir = normalize(viewPos - fragPos);
-    vec3 finalColor = Diffuse * 0.1;  // simple ambient
+    vec3 finalColor = addAmbient ? Diffuse * 0.1 * occlusion : vec3(0.0);  // simple ambient
+
+    uint first = uint(firstLight);
+    uint count = uint(LightCount);
+    vec2 depthBounds = vec2(0.0, 1e30);
+    if (tileIndex >= 0) {
+        uvec2 tileLights = texelFetch(clusterGrid, tileIndex).rg;
+        first = tileLights.x;
+        count = tileLights.y;
+        depthBounds = texelFetch(tileDepthBounds, ivec2(tileIndex % clusterDims.x, tileIndex / clusterDims.x), 0).rg;
+    }
+
+    for(uint i = 0u; i < count; ++i){
 
-    for(int i = 0; i < MAX_LIGHT_CNT; ++i){
+        int idx = tileIndex >= 0 ? int(texelFetch(clusterLightIndices, int(first + i)).r) : int(first + i);
+        vec4 positionRadius = texelFetch(lightPositionRadius, idx);
+
+        // depth bounds test, takes the same branch for every pixel of a tile
+        float lightDepth = -(view * vec4(positionRadius.xyz, 1.0)).z;
+        if (lightDepth + positionRadius.w < depthBounds.x || lightDepth - positionRadius.w > depthBounds.y)
+            continue;
+
+        float distance = length(positionRadius.xyz - fragPos);
+        if(distance < positionRadius.w){
+            vec3 color = texelFetch(lightColor, idx).rgb;
+            vec2 attenuationParams = texelFetch(lightAttenuation, idx).rg;
 
-        float distance = length(LightList[i].position - fragPos);
-        if(distance < LightList[i].radius){
             // diffuse
-            vec3 lightDir = normalize(LightList[i].position - fragPos);
-            vec3 diffuse = max(dot(normal, lightDir), 0.0) * Diffuse * LightList[i].color;
+            vec3 lightDir = (positionRadius.xyz - fragPos) / distance;
+            vec3 diffuse = max(dot(normal, lightDir), 0.0) * Diffuse * color;
 
             // specular
             vec3 halfwayDir = normalize(lightDir + viewDir);  
             float spec = pow(max(dot(normal, halfwayDir), 0.0), 16.0);
-            vec3 specular = LightList[i].color * spec * Specular;
+            vec3 specular = color * spec * Specular;
             // attenuation
-            float attenuation = getLightAttenuationFactor(LightList[i],lightDir);
+            float attenuation = getLightAttenuationFactor(distance, attenuationParams.x, attenuationParams.y, positionRadius.w);
 
             diffuse *= attenuation;
             specular *= attenuation;
@@ -79,4 +147,4 @@ void main(){
     }
 
     outColor = vec4(finalColor,1.0);
-}
\ No newline at end of file
+}
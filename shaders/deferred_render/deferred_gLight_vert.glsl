@@ -4,9 +4,11 @@ layout(location = 0) in vec3 fragPos;
 layout(location = 1) in vec2 fragTexCoords;
 
 out vec2 TexCoords;
+flat out int tileIndex;
 
 void main()
 {
 	TexCoords = fragTexCoords;
+	tileIndex = -1;
 	gl_Position = vec4(fragPos,1.0);
-}
\ No newline at end of file
+}
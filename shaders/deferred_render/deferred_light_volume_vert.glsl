@@ -0,0 +1,14 @@
+#version 410 core
+
+// Light volume (unit cube scaled by the light radius) for the stencil light volume fallback
+layout(location = 0) in vec3 fragPos;
+
+uniform mat4 mvpMatrix;
+
+flat out int tileIndex;
+
+void main()
+{
+	tileIndex = -1;
+	gl_Position = mvpMatrix * vec4(fragPos, 1.0);
+}
@@ -0,0 +1,35 @@
+#version 410 core
+
+// Rendered at tile resolution: every fragment reduces the G-buffer depth of its tile to a view depth range
+uniform sampler2D gDepth;
+uniform int tileSize;
+uniform ivec2 gBufferSize;
+uniform vec2 depthUnproject;        // (projection[2][2], projection[3][2])
+
+out vec2 outBounds;                 // (min, max) view depth, (0, 0) for tiles without geometry
+
+float viewDepth(float depth) {
+    return depthUnproject.y / (depth * 2.0 - 1.0 + depthUnproject.x);
+}
+
+void main()
+{
+    ivec2 origin = ivec2(gl_FragCoord.xy) * tileSize;
+    ivec2 end = min(origin + ivec2(tileSize), gBufferSize);
+
+    float minDepth = 1.0;
+    float maxDepth = 0.0;
+    bool hasGeometry = false;
+    for (int y = origin.y; y < end.y; ++y) {
+        for (int x = origin.x; x < end.x; ++x) {
+            float depth = texelFetch(gDepth, ivec2(x, y), 0).r;
+            if (depth < 1.0) {
+                minDepth = min(minDepth, depth);
+                maxDepth = max(maxDepth, depth);
+                hasGeometry = true;
+            }
+        }
+    }
+
+    outBounds = hasGeometry ? vec2(viewDepth(minDepth), viewDepth(maxDepth)) : vec2(0.0);
+}
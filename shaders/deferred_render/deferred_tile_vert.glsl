@@ -0,0 +1,28 @@
+#version 410 core
+
+// One instance of the unit quad per 16x16 screen tile
+layout(location = 0) in vec3 fragPos;
+layout(location = 1) in vec2 fragTexCoords;
+
+uniform ivec3 clusterDims;          // tiles in x / y, set by LightClusters::bind
+uniform int clusterTileSize;
+uniform vec2 gBufferSize;
+uniform sampler2D tileDepthBounds;
+
+flat out int tileIndex;
+
+void main()
+{
+	tileIndex = gl_InstanceID;
+	ivec2 tile = ivec2(gl_InstanceID % clusterDims.x, gl_InstanceID / clusterDims.x);
+
+	// sky / background tiles collapse to a point outside the viewport and produce no fragments
+	if (texelFetch(tileDepthBounds, tile, 0).g <= 0.0) {
+		gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+		return;
+	}
+
+	vec2 tileMin = vec2(tile * clusterTileSize) / gBufferSize;
+	vec2 tileMax = min(vec2((tile + 1) * clusterTileSize) / gBufferSize, vec2(1.0));
+	gl_Position = vec4(mix(tileMin, tileMax, fragTexCoords) * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -1,8 +1,8 @@
 #version 410
 
-layout(location = 0) out vec3 gPos;
-layout(location = 1) out vec3 gNor;
-layout(location = 2) out vec4 gCol;
+// Compact G-buffer: no position (reconstructed from depth), octahedral normal, albedo + specular
+layout(location = 0) out vec2 gNor;
+layout(location = 1) out vec4 gCol;
 
 in vec3 fragPos;
 in vec3 fragNormal;
@@ -11,10 +11,22 @@ in vec2 fragTexCoords;
 uniform sampler2D texture_diffuse;
 uniform sampler2D texture_specular;
 
+vec2 octWrap(vec2 v)
+{
+	return (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+// Octahedral normal encoding into [0, 1]^2, decoded in deferred_gLight_frag.glsl
+vec2 encodeNormal(vec3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	n.xy = n.z >= 0.0 ? n.xy : octWrap(n.xy);
+	return n.xy * 0.5 + 0.5;
+}
+
 void main()
 {
-	gPos = fragPos;
-	gNor = normalize(fragNormal);
+	gNor = encodeNormal(normalize(fragNormal));
 	gCol.rgb = texture(texture_diffuse, fragTexCoords).rgb;
 	gCol.a = texture(texture_specular, fragTexCoords).r;
 }
@@ -0,0 +1,37 @@
+#version 410 core
+
+// One direction of a separable depth aware gaussian blur over (occlusion, linear view depth).
+// Samples from another surface (a large relative depth difference) barely contribute, so the blur does not
+// bleed occlusion across silhouettes.
+
+uniform sampler2D ssaoInput;
+uniform ivec2 direction;                    // (1, 0) or (0, 1)
+uniform float depthSharpness;
+
+out vec2 outOcclusion;
+
+const int BLUR_RADIUS = 4;
+const float WEIGHTS[BLUR_RADIUS + 1] = float[BLUR_RADIUS + 1](0.2270270270, 0.1945945946, 0.1216216216, 0.0540540541, 0.0162162162);
+
+void main()
+{
+    ivec2 size = textureSize(ssaoInput, 0);
+    ivec2 center = ivec2(gl_FragCoord.xy);
+    vec2 centerValue = texelFetch(ssaoInput, center, 0).rg;
+
+    float sum = centerValue.r * WEIGHTS[0];
+    float weightSum = WEIGHTS[0];
+    for (int i = 1; i <= BLUR_RADIUS; ++i) {
+        for (int side = -1; side <= 1; side += 2) {
+            ivec2 coord = clamp(center + direction * (i * side), ivec2(0), size - 1);
+            vec2 value = texelFetch(ssaoInput, coord, 0).rg;
+
+            float depthWeight = exp(-abs(value.g - centerValue.g) / max(centerValue.g, 1e-3) * depthSharpness);
+            float weight = WEIGHTS[i] * depthWeight;
+            sum += value.r * weight;
+            weightSum += weight;
+        }
+    }
+
+    outOcclusion = vec2(sum / weightSum, centerValue.g);
+}
@@ -0,0 +1,74 @@
+#version 410 core
+
+// Screen space ambient occlusion at the resolution of the bound target, read from the full resolution G-buffer.
+// Writes (occlusion, linear view depth) so the blur and the upsample in the lighting pass can weigh by depth.
+
+uniform sampler2D gNormal;                  // octahedral encoded, world space
+uniform sampler2D gDepth;
+uniform sampler2D texNoise;                 // 4x4 random rotations around the normal, repeated over the screen
+
+uniform vec3 samples[64];                   // hemisphere kernel from generateSSAOKernel
+uniform int kernelSize;
+uniform int sampleOffset;                   // temporal accumulation: this frame takes samples sampleOffset, + sampleStride, ...
+uniform int sampleStride;                   // 1 without temporal accumulation
+uniform float radius;
+uniform float bias;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform mat4 invProjection;
+uniform vec2 noiseScale;                    // target size / noise size
+uniform vec2 noiseOffset;                   // per frame jitter of the noise lookup, in noise texels
+
+in vec2 TexCoords;
+
+out vec2 outOcclusion;
+
+vec3 decodeNormal(vec2 encoded) {
+    encoded = encoded * 2.0 - 1.0;
+    vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    float t = clamp(-n.z, 0.0, 1.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
+vec3 viewPosition(vec2 uv) {
+    float depth = texture(gDepth, uv).r;
+    vec4 position = invProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    return position.xyz / position.w;
+}
+
+void main()
+{
+    // sky, nothing to occlude
+    if (texture(gDepth, TexCoords).r >= 1.0) {
+        outOcclusion = vec2(1.0, 60000.0);
+        return;
+    }
+
+    vec3 fragPos = viewPosition(TexCoords);
+    vec3 normal = normalize(mat3(view) * decodeNormal(texture(gNormal, TexCoords).rg));
+
+    // Gram-Schmidt a random vector into a tangent frame around the normal
+    vec3 randomVec = normalize(vec3(texture(texNoise, TexCoords * noiseScale + noiseOffset).xy, 0.0));
+    vec3 tangent = normalize(randomVec - normal * dot(randomVec, normal));
+    vec3 bitangent = cross(normal, tangent);
+    mat3 TBN = mat3(tangent, bitangent, normal);
+
+    float occlusion = 0.0;
+    int numSamples = 0;
+    for (int i = sampleOffset; i < kernelSize; i += sampleStride) {
+        vec3 samplePos = fragPos + TBN * samples[i] * radius;
+
+        vec4 offset = projection * vec4(samplePos, 1.0);
+        vec2 sampleUV = offset.xy / offset.w * 0.5 + 0.5;
+        float sampleDepth = viewPosition(sampleUV).z;
+
+        // occluders far outside the radius are a different object, fade them out
+        float rangeCheck = smoothstep(0.0, 1.0, radius / abs(fragPos.z - sampleDepth));
+        occlusion += (sampleDepth >= samplePos.z + bias ? 1.0 : 0.0) * rangeCheck;
+        ++numSamples;
+    }
+
+    outOcclusion = vec2(1.0 - occlusion / float(max(numSamples, 1)), -fragPos.z);
+}
@@ -0,0 +1,70 @@
+#version 410 core
+
+// Temporal accumulation of the SSAO, run at the SSAO resolution between the SSAO pass and its blur.
+// Each frame only evaluates a subset of the kernel; the pixel is reprojected into last frame's history with
+// the previous view-projection matrix and blended in with a running average over up to maxFrames frames.
+// History that saw another surface (disocclusion, a large relative difference between its linear depth and
+// the expected one) or that left the screen is dropped, the rest is clamped into the mean +- clampGamma
+// standard deviations of this frame's 3x3 neighbourhood so stale occlusion cannot linger.
+// Writes (occlusion, linear view depth, frames accumulated): the blur reads the first two like raw SSAO.
+
+uniform sampler2D ssaoInput;                // this frame, (occlusion, linear view depth)
+uniform sampler2D history;                  // last frame's output, bilinear
+uniform sampler2D gDepth;
+
+uniform mat4 invViewProjection;
+uniform mat4 prevViewProjection;
+uniform bool historyValid;
+uniform float maxFrames;
+uniform float clampGamma;
+uniform float disocclusionThreshold;        // relative linear depth difference
+
+in vec2 TexCoords;
+
+out vec4 outHistory;
+
+void main()
+{
+    ivec2 size = textureSize(ssaoInput, 0);
+    ivec2 center = ivec2(gl_FragCoord.xy);
+    vec2 current = texelFetch(ssaoInput, center, 0).rg;
+
+    float depth = texture(gDepth, TexCoords).r;
+    if (!historyValid || depth >= 1.0) {
+        outHistory = vec4(current, 1.0, 1.0);
+        return;
+    }
+
+    // Reproject into the previous frame, clip space w is the linear view depth there
+    vec4 worldPos = invViewProjection * vec4(vec3(TexCoords, depth) * 2.0 - 1.0, 1.0);
+    worldPos /= worldPos.w;
+    vec4 prevClip = prevViewProjection * worldPos;
+    vec2 prevUV = prevClip.xy / prevClip.w * 0.5 + 0.5;
+    if (any(lessThan(prevUV, vec2(0.0))) || any(greaterThan(prevUV, vec2(1.0)))) {
+        outHistory = vec4(current, 1.0, 1.0);
+        return;
+    }
+
+    vec3 previous = texture(history, prevUV).rgb;
+    if (abs(previous.g - prevClip.w) > disocclusionThreshold * prevClip.w) {
+        outHistory = vec4(current, 1.0, 1.0);
+        return;
+    }
+
+    // Neighbourhood box of this frame's occlusion
+    float m1 = 0.0;
+    float m2 = 0.0;
+    for (int y = -1; y <= 1; ++y) {
+        for (int x = -1; x <= 1; ++x) {
+            float value = texelFetch(ssaoInput, clamp(center + ivec2(x, y), ivec2(0), size - 1), 0).r;
+            m1 += value;
+            m2 += value * value;
+        }
+    }
+    m1 /= 9.0;
+    float sigma = sqrt(max(m2 / 9.0 - m1 * m1, 0.0));
+    float clampedHistory = clamp(previous.r, m1 - clampGamma * sigma, m1 + clampGamma * sigma);
+
+    float frames = min(previous.b + 1.0, maxFrames);
+    outHistory = vec4(mix(clampedHistory, current.r, 1.0 / frames), current.g, frames, 1.0);
+}
@@ -6,6 +6,9 @@ in vec3 localPos;
 
 uniform samplerCube environmentMap;
 uniform float roughness;
+uniform int sampleCount;
+uniform float sourceResolution; // face size of environmentMap's top level
+uniform bool useSourceMips;     // sample each direction from the mip whose texels cover its share of the lobe
 
 const float PI = 3.14159265359;
 
@@ -60,40 +63,36 @@ void main()
 	vec3 R = normal;
 	vec3 V = R;
 
-	const uint SAMPLE_COUNT = 1024u;
+	uint numSamples = uint(sampleCount);
 	float totalWeight = 0.0;
 
 	vec3 prefilteredColor = vec3(0.0);
 
-	for(uint i = 0u; i < SAMPLE_COUNT; ++i){
+	// Solid angle of a top level texel
+	float saTexel = 4.0 * PI / (6.0 * sourceResolution * sourceResolution);
+
+	for(uint i = 0u; i < numSamples; ++i){
 		
-		vec2 Xi = Hammersley(i, SAMPLE_COUNT); // low discrepeacny value
+		vec2 Xi = Hammersley(i, numSamples); // low discrepeacny value
 		vec3 H = ImportanceSampleGGX(Xi, normal,roughness);
         vec3 L = normalize(2.0*dot(V,H) * H - V);
     
 
         float NdotL = max(dot(normal,L), 0.0);
         if(NdotL > 0.0){
-            
-            if(false){
-
-                // Calculate PDF and mip level for roughness
-                float resolution = 512.0;
+            float mipLevel = 0.0;
+            if(useSourceMips && roughness > 0.0){
+                // Solid angle this sample stands for, from the PDF of L (N = V)
                 float NdotH = max(dot(normal, H), 0.0);
                 float HdotV = max(dot(H, V), 0.0);
                 float D     = DistributionGGX(NdotH, roughness);
                 float pdf   = (D * NdotH / (4.0 * HdotV)) + 0.0001;
 
-                float saTexel  = 4.0 * PI / (6.0 * resolution * resolution);
-                float saSample = 1.0 / (float(SAMPLE_COUNT) * pdf + 0.0001);
-                float mipLevel = roughness == 0.0 ? 0.0 : 0.5 * log2(saSample / saTexel);
-
-                // Sample the environment map at the calculated mip level
-                prefilteredColor += textureLod(environmentMap, L, mipLevel).rgb * NdotL;
-                totalWeight += NdotL;
+                float saSample = 1.0 / (float(numSamples) * pdf + 0.0001);
+                mipLevel = 0.5 * log2(saSample / saTexel);
             }
 
-            prefilteredColor += texture(environmentMap, L).rgb * NdotL;
+            prefilteredColor += textureLod(environmentMap, L, mipLevel).rgb * NdotL;
             totalWeight      += NdotL;
         }
 	}
@@ -101,4 +100,4 @@ void main()
     prefilteredColor = prefilteredColor/totalWeight;
 
     fragColor = vec4(prefilteredColor,1.0);
-}
\ No newline at end of file
+}
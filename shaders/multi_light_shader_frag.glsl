@@ -1,7 +1,5 @@
 #version 410
 
-#define MAX_LIGHT_CNT 10
-
 // Material Setting
 layout(std140) uniform Material // Must match the GPUMaterial defined in src/mesh.h
 {
@@ -12,54 +10,54 @@ layout(std140) uniform Material // Must match the GPUMaterial defined in src/mes
 };
 
 // Shadow Setting
+#ifdef PERMUTATION
+const bool shadowEnabled = SHADOW_ENABLED;
+const bool pcfEnabled = PCF_ENABLED;
+#else
 layout(std140) uniform shadowSetting{
 
     bool shadowEnabled;
     bool pcfEnabled;
     bool transparencyEnabled;
 };
-
-//Light Setting
-struct Light {
-    vec3 position;
-    float _UNUSE_PADDING0;
-
-    vec3 color;
-    float _UNUSE_PADDING1;
-
-    vec3 direction;
-    float _UNUSE_PADDING2;
-
-    bool is_spotlight;
-    bool has_texture;
-    vec2 _UNUSE_PADDING3;
-
-    float linear;
-    float _UNUSE_PADDING4;  
-    float quadratic;
-    float radius;
-};
-
-layout(std140) uniform lights{
-   Light LightList[MAX_LIGHT_CNT];
-};
+#endif
+
+// Clustered light lists, built on the CPU by LightClusters (src/light_clusters.h)
+uniform samplerBuffer lightPositionRadius;  // LightStore streams, one texel per light
+uniform samplerBuffer lightColor;
+uniform samplerBuffer lightAttenuation;     // (linear, quadratic)
+uniform usamplerBuffer clusterGrid;         // (offset, count) per cluster
+uniform usamplerBuffer clusterLightIndices;
+uniform ivec3 clusterDims;
+uniform int clusterTileSize;
+uniform vec2 clusterDepthParams;            // slice = log(viewDepth) * x + y
+uniform vec2 clusterNearFar;
+uniform bool useClusters;
 
 uniform int LightCount;
 
-uniform sampler2D texShadows[MAX_LIGHT_CNT];
-uniform mat4 lightMVPs[MAX_LIGHT_CNT];
+uniform sampler2D texShadow;
+uniform mat4 lightMVP;
 
 uniform vec3 viewPos;
 
 uniform sampler2D colorMap;
-uniform bool hasTexCoords;
-uniform bool useMaterial;
 
 uniform vec3 ambientColor;
 
 //Env Mapping
 uniform samplerCube SkyBox;
+
+// Feature switches: compile time constants in a ShaderPermutations variant, uniforms in the uber-shader
+#ifdef PERMUTATION
+const bool hasTexCoords = HAS_TEX_COORDS;
+const bool useMaterial = USE_MATERIAL;
+const bool useEnvMap = USE_ENV_MAP;
+#else
+uniform bool hasTexCoords;
+uniform bool useMaterial;
 uniform bool useEnvMap;
+#endif
 
 in vec3 fragPosition;
 in vec3 fragNormal;
@@ -69,7 +67,7 @@ in vec2 fragTexCoord;
 layout(location = 0) out vec4 fragColor;
 
 
-float shadowFactorCal(int lightIdx,vec2 shadowMapCoord, float fragLightDepth){
+float shadowFactorCal(vec2 shadowMapCoord, float fragLightDepth){
 
     const float bias = 0.005; 
 
@@ -79,7 +77,7 @@ float shadowFactorCal(int lightIdx,vec2 shadowMapCoord, float fragLightDepth){
     if(!pcfEnabled)
     {
          // Retrieve the shadow map depth value at this coordinate
-        float shadowMapDepth = texture(texShadows[lightIdx], shadowMapCoord).x;
+        float shadowMapDepth = texture(texShadow, shadowMapCoord).x;
         shadowFactor = (fragLightDepth > shadowMapDepth + bias) ? 1.0: 0.0; // Shadow factor
     } 
 
@@ -88,12 +86,12 @@ float shadowFactorCal(int lightIdx,vec2 shadowMapCoord, float fragLightDepth){
         // PCF 
         float shadowSum = 0.0;
         float sampleCount = 9.0f; // Total number of samples
-        vec2 texelSize  = 1.0/textureSize(texShadows[lightIdx],0); // Radius for PCF sampling
+        vec2 texelSize  = 1.0/textureSize(texShadow,0); // Radius for PCF sampling
 
         for (int x = -1; x <= 1; ++x) {
             for (int y = -1; y <= 1; ++y) {
                 vec2 offset = vec2(float(x), float(y)) * texelSize;
-                float shadowMapDepth = texture(texShadows[lightIdx], shadowMapCoord + offset).r;
+                float shadowMapDepth = texture(texShadow, shadowMapCoord + offset).r;
                 shadowSum += (fragLightDepth > shadowMapDepth + bias) ? 1.0 : 0.0;
             }
          }
@@ -106,12 +104,26 @@ float shadowFactorCal(int lightIdx,vec2 shadowMapCoord, float fragLightDepth){
     return shadowFactor;
 }
 
-float getLightAttenuationFactor(Light curLight,vec3 lightDir) {
-    float dist = length(lightDir);
-    float attenuation = 1.0 / (1.0+ curLight.linear * dist + curLight.quadratic*dist * dist); // Simple quadratic falloff
+float getLightAttenuationFactor(float dist, float linear, float quadratic, float radius) {
+    float attenuation = 1.0 / (1.0+ linear * dist + quadratic*dist * dist); // Simple quadratic falloff
+
+    // Window the falloff so it reaches zero at the light radius used for culling
+    float window = clamp(1.0 - pow(dist / radius, 4.0), 0.0, 1.0);
 
     // Clamp the attenuation to avoid excessively bright values at close distances
-    return clamp(attenuation, 0.0, 1.0);
+    return clamp(attenuation, 0.0, 1.0) * window * window;
+}
+
+// Index of the cluster this fragment falls in, see LightClusters::build
+int clusterIndex() {
+    float zNear = clusterNearFar.x;
+    float zFar = clusterNearFar.y;
+    float ndcDepth = gl_FragCoord.z * 2.0 - 1.0;
+    float viewDepth = 2.0 * zNear * zFar / (zFar + zNear - ndcDepth * (zFar - zNear));
+
+    int slice = clamp(int(log(viewDepth) * clusterDepthParams.x + clusterDepthParams.y), 0, clusterDims.z - 1);
+    ivec2 tile = clamp(ivec2(gl_FragCoord.xy) / clusterTileSize, ivec2(0), clusterDims.xy - 1);
+    return tile.x + clusterDims.x * (tile.y + clusterDims.y * slice);
 }
 
 void main()
@@ -150,27 +162,34 @@ void main()
     
     else if (useMaterial)   
     { 
-        for (int idx = 0; idx < LightCount; idx++){
+        vec4 fragLightCoord = lightMVP * vec4(fragPosition, 1.0);
+        // Convert to normalized device coordinates
+        fragLightCoord.xyz /= fragLightCoord.w; // Homogeneous divide
 
-    
-            vec4 fragLightCoord = lightMVPs[idx] * vec4(fragPosition, 1.0);
-            // Convert to normalized device coordinates
-            fragLightCoord.xyz /= fragLightCoord.w; // Homogeneous divide
-    
-            // Transform from NDC to texture space (0 to 1)
+        // Transform from NDC to texture space (0 to 1)
+        fragLightCoord.xyz = fragLightCoord.xyz * 0.5 + 0.5;
 
-            fragLightCoord.xyz = fragLightCoord.xyz * 0.5 + 0.5;
-    
-            // Fragment depth in light space
-            float fragLightDepth = fragLightCoord.z;
+        float shadowFactor = (shadowEnabled)? shadowFactorCal(fragLightCoord.xy, fragLightCoord.z) : 0.0f;
 
-            // Shadow map coordinates (XY)
-            vec2 shadowMapCoord = fragLightCoord.xy;
+        // Without clustering every light is visited, which is the brute force reference path
+        uvec2 cluster = useClusters ? texelFetch(clusterGrid, clusterIndex()).rg : uvec2(0u, uint(LightCount));
 
-            float shadowFactor = (shadowEnabled)? shadowFactorCal(idx,shadowMapCoord,fragLightDepth) : 0.0f;
-        
+        fragColor = vec4(0.0);
+
+        for (uint i = 0u; i < cluster.y; ++i){
+
+            int idx = useClusters ? int(texelFetch(clusterLightIndices, int(cluster.x + i)).r) : int(i);
+
+            vec4 positionRadius = texelFetch(lightPositionRadius, idx);
+
+            vec3 toLight = positionRadius.xyz - fragPosition;
+            float dist = length(toLight);
+            if (dist >= positionRadius.w)
+                continue;
 
-            vec3 lightDir = normalize(LightList[idx].position - fragPosition);
+            vec3 color = texelFetch(lightColor, idx).rgb;
+            vec2 attenuation = texelFetch(lightAttenuation, idx).rg;
+            vec3 lightDir = toLight / dist;
             
             vec3 halfDir = normalize(lightDir + viewDir);
             float lambert = max(dot(normal,lightDir),0.0);
@@ -181,17 +200,18 @@ void main()
             //basic phong model
             if(lambert >= 0.0f) {
                 Specular = ks * pow(max(dot(halfDir, normal), 0.0f), shininess);
-                Specular = (hasTexCoords)? texColor.rgb * Specular : Specular * LightList[idx].color;
+                Specular = (hasTexCoords)? texColor.rgb * Specular : Specular * color;
             }
         
             // Calculate the light attenuation factor based on distance
-            float lightAttenuationFactor = getLightAttenuationFactor(LightList[idx],lightDir);
+            float lightAttenuationFactor = getLightAttenuationFactor(dist, attenuation.x, attenuation.y, positionRadius.w);
 
             //vec3 finalColor = (ambient + diffuse + Specular);
             finalColor = (diffuse + Specular) * (1-shadowFactor) * lightAttenuationFactor;
             //vec3 finalColor = diffuse;
             fragColor += vec4(finalColor, 1.0);
         }
+        fragColor.a = 1.0;
     }
 
     else  { 
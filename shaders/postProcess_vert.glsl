@@ -2,7 +2,11 @@
 layout(location = 0) in vec2 aPos;
 layout(location = 1) in vec2 aTexCoords;
 
-out vec2 TexCoords;
+// Explicit locations and gl_PerVertex so the stage can be linked on its own as a separable program
+layout(location = 0) out vec2 TexCoords;
+out gl_PerVertex {
+    vec4 gl_Position;
+};
 
 void main()
 {
@@ -12,12 +12,17 @@ layout(std140) uniform Material // Must match the GPUMaterial defined in src/mes
 };
 
 // Shadow Setting
+#ifdef PERMUTATION
+const bool shadowEnabled = SHADOW_ENABLED;
+const bool pcfEnabled = PCF_ENABLED;
+#else
 layout(std140) uniform shadowSetting{
     bool shadowEnabled;
     bool pcfEnabled;
     bool _UNUSE_PADDING6;
     bool _UNUSE_PADDING7;
 };
+#endif
 uniform sampler2D texShadow;
 
 //Light Setting
@@ -45,24 +50,46 @@ uniform mat4 lightMVP;
 
 uniform vec3 viewPos;
 
-uniform sampler2D colorMap;
-uniform bool hasTexCoords;
-uniform bool useMaterial;
-
-uniform bool ignoreLightDirection;
 uniform float sunlightStrength;
-uniform bool useNormalMapping;
 uniform bool useParallaxMapping;
-uniform sampler2D normalTex;
 uniform sampler2D heightTex;
 
+#ifdef TEXTURE_ARRAYS
+// Layers of arrays shared with other draws, which pick theirs by index
+uniform sampler2DArray colorMap;
+uniform sampler2DArray normalTex;
+uniform int colorMapLayer;
+uniform int normalTexLayer;
+#define sampleColorMap(coords) texture(colorMap, vec3(coords, colorMapLayer))
+#define sampleNormalTex(coords) texture(normalTex, vec3(coords, normalTexLayer))
+#else
+uniform sampler2D colorMap;
+uniform sampler2D normalTex;
+#define sampleColorMap(coords) texture(colorMap, coords)
+#define sampleNormalTex(coords) texture(normalTex, coords)
+#endif
+
 uniform vec3 ambientColor;
 
 uniform mat3 normalModelMatrix;
 
 //Env Mapping
 uniform samplerCube SkyBox;
+
+// Feature switches: compile time constants in a ShaderPermutations variant, uniforms in the uber-shader
+#ifdef PERMUTATION
+const bool hasTexCoords = HAS_TEX_COORDS;
+const bool useMaterial = USE_MATERIAL;
+const bool ignoreLightDirection = IGNORE_LIGHT_DIRECTION;
+const bool useNormalMapping = USE_NORMAL_MAPPING;
+const bool useEnvMap = USE_ENV_MAP;
+#else
+uniform bool hasTexCoords;
+uniform bool useMaterial;
+uniform bool ignoreLightDirection;
+uniform bool useNormalMapping;
 uniform bool useEnvMap;
+#endif
 
 in vec3 fragPosition;
 in vec3 fragNormal;
@@ -159,8 +186,8 @@ void main()
     
     if (useNormalMapping)
     {
-        normal = texture(normalTex, texCoord).rgb; // Take the normal from the normal map texture.
-        normal = normal * 2.0 - 1.0; // Re-convert from [0, 1] to [-1, 1].
+        vec2 tangentXY = sampleNormalTex(texCoord).rg * 2.0 - 1.0; // Take the normal from the normal map texture, re-converted from [0, 1] to [-1, 1].
+        normal = vec3(tangentXY, sqrt(max(1.0 - dot(tangentXY, tangentXY), 0.0))); // z is rebuilt, BC5 normal maps only store x and y.
         normal = normalize(TBN * normal); // Transform with TBN.
     }
     else
@@ -201,7 +228,7 @@ void main()
     vec4 texColor = vec4(0.0f);
 
     if (hasTexCoords) {
-       texColor = texture(colorMap, texCoord); 
+       texColor = sampleColorMap(texCoord); 
     }
 
     // Env Mapping
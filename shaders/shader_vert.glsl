@@ -5,9 +5,16 @@ uniform mat4 modelMatrix;
 // Normals should be transformed differently than positions:
 // https://paroj.github.io/gltut/Illumination/Tut09%20Normal%20Transformation.html
 uniform mat3 normalModelMatrix;
+uniform bool useParallaxMapping;
+
+// Feature switches: compile time constants in a ShaderPermutations variant, uniforms in the uber-shader
+#ifdef PERMUTATION
+const bool hasTexCoords = HAS_TEX_COORDS;
+const bool useNormalMapping = USE_NORMAL_MAPPING;
+#else
 uniform bool hasTexCoords;
 uniform bool useNormalMapping;
-uniform bool useParallaxMapping;
+#endif
 
 layout(location = 0) in vec3 position;
 layout(location = 1) in vec3 normal;
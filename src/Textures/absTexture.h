@@ -36,6 +36,9 @@ public:
 
 	virtual void bind(GLint) = 0;
 
+	// Binds through bind() since the application last reset it, it keeps one count per frame
+	static inline int bindCount = 0;
+
 	GLuint& getTextureRef() { return m_texture; }
 
 protected:
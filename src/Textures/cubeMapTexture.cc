@@ -61,7 +61,7 @@ cubeMapTex::cubeMapTex(int renderChoice)
         for (GLuint i = 0; i < 6; ++i)
         {
             glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F,
-                1024, 1024, 0, GL_RGB, GL_FLOAT, nullptr);
+                HDR_CUBE_MAP_SIZE, HDR_CUBE_MAP_SIZE, 0, GL_RGB, GL_FLOAT, nullptr);
         }
 
     }
@@ -80,7 +80,7 @@ cubeMapTex::cubeMapTex(int renderChoice)
         for (GLuint i = 0; i < 6; ++i)
         {
             glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F,
-                128, 128, 0, GL_RGB, GL_FLOAT, nullptr);
+                PREFILTER_SIZE, PREFILTER_SIZE, 0, GL_RGB, GL_FLOAT, nullptr);
         }
     }
 
@@ -88,26 +88,65 @@ cubeMapTex::cubeMapTex(int renderChoice)
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
-    if (renderChoice == RENDER_HDR_CUBE_MAP || renderChoice == RENDER_HDR_IRRIDIANCE_MAP) {
+    if (renderChoice == RENDER_HDR_IRRIDIANCE_MAP) {
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     }
-    else if ( //renderChoice == RENDER_HDR_CUBE_MAP ||
+    else if (renderChoice == RENDER_HDR_CUBE_MAP ||
         renderChoice == RENDER_PRE_FILTER_HDR_MAP) {
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);  //enable trilinear filtering
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-        if (renderChoice == RENDER_PRE_FILTER_HDR_MAP) {
-            glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
-        }
+        // The environment cube's mips are what the prefilter samples wide lobes from, refilled once it is rendered
+        glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
     }
 
     glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
 
 }
 
+cubeMapTex::cubeMapTex(const glm::vec4& placeholderColor)
+{
+    const glm::u8vec4 texel { glm::clamp(placeholderColor, 0.0f, 1.0f) * 255.0f + 0.5f };
+
+    glGenTextures(1, &m_texture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, m_texture);
+
+    for (GLuint i = 0; i < 6; ++i)
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, &texel);
+
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+}
+
+void cubeMapTex::uploadHalfFaces(const uint16_t* halfPixels, int faceSize)
+{
+    glBindTexture(GL_TEXTURE_CUBE_MAP, m_texture);
+
+    // Rows of 6 byte texels are only 2 byte aligned
+    GLint unpackAlignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    const size_t faceValues = size_t(faceSize) * size_t(faceSize) * 3;
+    for (GLuint i = 0; i < 6; ++i)
+    {
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F,
+            faceSize, faceSize, 0, GL_RGB, GL_HALF_FLOAT, halfPixels + i * faceValues);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+}
+
 void cubeMapTex::bind(GLint textureSlot)
 {
-    glActiveTexture(textureSlot);
+    glActiveTexture(static_cast<GLenum>(textureSlot));
     glBindTexture(GL_TEXTURE_CUBE_MAP, m_texture);
+    ++bindCount;
 }
@@ -3,6 +3,7 @@
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
 #include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
 DISABLE_WARNINGS_POP()
 
 #include "absTexture.h"
@@ -13,6 +14,11 @@ DISABLE_WARNINGS_POP()
 #define RENDER_HDR_IRRIDIANCE_MAP 2
 #define RENDER_PRE_FILTER_HDR_MAP 3
 
+// Face sizes of the HDR environment cube and the prefiltered map, which has a mip per roughness step
+#define HDR_CUBE_MAP_SIZE 1024
+#define PREFILTER_SIZE 128
+#define PREFILTER_MIPS 5
+
 // this file will handle cubeMap class for environment mapping
 struct cubeMapLoadingException : public std::runtime_error {
 	using std::runtime_error::runtime_error;
@@ -25,9 +31,15 @@ public:
 
 	cubeMapTex(int renderChoice = 0);
 
+	// 1x1 faces shown until the TextureLoader has the images in
+	explicit cubeMapTex(const glm::vec4& placeholderColor);
+
 	cubeMapTex(const cubeMapTex&) = delete;
 	cubeMapTex& operator=(const cubeMapTex&) = delete;
 
+	// Replaces level 0 of every face with RGB half floats (faces in GL order, one after the other) and rebuilds the mips
+	void uploadHalfFaces(const uint16_t* halfPixels, int faceSize);
+
 	void bind(GLint textureSlot) override;
 };
 
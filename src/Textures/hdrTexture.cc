@@ -9,7 +9,9 @@ DISABLE_WARNINGS_POP()
 #include <framework/image.h>
 
 #include <iostream>
+#include <vector>
 #include "hdrTexture.h"
+#include "../rgbe_decoder.h"
 
 
 hdrTexture::hdrTexture()
@@ -19,36 +21,42 @@ hdrTexture::hdrTexture()
 
 hdrTexture::hdrTexture(std::filesystem::path filePath)
 {
-    stbi_set_flip_vertically_on_load(true);
-
-    int width, height, nrComponents;
-    float* data = stbi_loadf(filePath.string().c_str(), &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        // Create a texture on the GPU and bind it for parameter setting
-        glGenTextures(1, &m_texture);
-        glBindTexture(GL_TEXTURE_2D, m_texture);
-
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, data); // note how we specify the texture's data value to be float
+    try {
+        // Decoded straight to half floats, the texture's own format
+        const RgbeImage image(filePath);
+        std::vector<uint16_t> pixels(image.outputSize(RgbeOutput::HALF_RGB) / sizeof(uint16_t));
+        image.decode(RgbeOutput::HALF_RGB, pixels.data());
+        *this = hdrTexture(pixels.data(), image.width(), image.height());
+    }
+    catch (const std::runtime_error& e) {
+        std::cout << "Failed to load HDR image: " << e.what() << std::endl;
+    }
+}
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+hdrTexture::hdrTexture(const uint16_t* halfPixels, int width, int height)
+{
+    // Create a texture on the GPU and bind it for parameter setting
+    glGenTextures(1, &m_texture);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
 
+    // Rows of 6 byte texels are only 2 byte aligned
+    GLint unpackAlignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_HALF_FLOAT, halfPixels); // half floats, nothing left for the driver to convert
+    glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
 
-        glBindTexture(GL_TEXTURE_2D, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Failed to load HDR image." << std::endl;
-    }
+    glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 void hdrTexture::bind(GLint textureSlot)
 {
-    glActiveTexture(textureSlot);
+    glActiveTexture(static_cast<GLenum>(textureSlot));
     glBindTexture(GL_TEXTURE_2D, m_texture);
+    ++bindCount;
 }
\ No newline at end of file
@@ -20,9 +20,13 @@ class hdrTexture: public abstractTexture{
 public:
     hdrTexture();
     hdrTexture(std::filesystem::path filePath);
+    // Already decoded RGB half floats, rows bottom to top
+    hdrTexture(const uint16_t* halfPixels, int width, int height);
 
     hdrTexture(const hdrTexture&) = delete;
+    hdrTexture(hdrTexture&&) noexcept = default;
     hdrTexture& operator=(const hdrTexture&) = delete;
+    hdrTexture& operator=(hdrTexture&&) noexcept = default;
 
     void bind(GLint textureSlot) override;
 };
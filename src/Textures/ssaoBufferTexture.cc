@@ -18,8 +18,8 @@ ssaoBufferTex::ssaoBufferTex(TexGenCode textureGenCod) :
 	}
 
 	else if (textureGenCod == SSAO_GBUFFER_NOR) {
-
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
+		// octahedral encoded normal, 4 bytes instead of a RGBA16F vector
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RG, GL_UNSIGNED_SHORT, NULL);
 
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -32,6 +32,13 @@ ssaoBufferTex::ssaoBufferTex(TexGenCode textureGenCod) :
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	}
 
+	else if (textureGenCod == SSAO_GBUFFER_DEPTH) {
+		// sampled by the tile depth bounds pass, the stencil bits are used by the light volume fallback
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	}
+
 	else if (textureGenCod == SSAO_COLOR_BUFF) {
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RED, GL_FLOAT, NULL);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -80,6 +87,7 @@ ssaoBufferTex::~ssaoBufferTex()
 
 void ssaoBufferTex::bind(GLint textureSlot)
 {
-	glActiveTexture(textureSlot);
+	glActiveTexture(static_cast<GLenum>(textureSlot));
 	glBindTexture(GL_TEXTURE_2D, m_texture);
+	++bindCount;
 }
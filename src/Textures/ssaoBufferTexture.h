@@ -6,18 +6,26 @@ DISABLE_WARNINGS_POP()
 
 #include "absTexture.h"
 
+#include <vector>
+
 #define SSAO_GBUFFER_POS 1
 #define SSAO_GBUFFER_NOR 2
 #define SSAO_GBUFFER_COL 3
 #define SSAO_COLOR_BUFF 4
 #define SSAO_COLOR_BLUR 5
 #define SSAO_NOISE_TEX 6
+#define SSAO_GBUFFER_DEPTH 7
 
 typedef int TexGenCode;
 
 const int SCREEN_WIDTH = 1920;
 const int SCREEN_HEIGHT = 1080;
 
+// G-buffer bytes per pixel: RG16 normal + RGBA8 albedo / specular + D24S8 depth. Positions are reconstructed
+// from depth; the previous layout also stored a RGBA16F position and a RGBA16F normal.
+const int GBUFFER_BYTES_PER_PIXEL = 4 + 4 + 4;
+const int GBUFFER_LEGACY_BYTES_PER_PIXEL = 8 + 8 + 4 + 4;
+
 class ssaoBufferTex : public abstractTexture {
 public:
     ssaoBufferTex() = default;
@@ -1,4 +1,5 @@
 #include "texture.h"
+#include "../brdf_lut.h"
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
 #include <fmt/format.h>
@@ -7,47 +8,58 @@ DISABLE_WARNINGS_POP()
 
 #include <iostream>
 
-Texture::Texture(std::filesystem::path filePath)
+Texture::Texture(std::filesystem::path filePath, TextureRole role)
 {
     // Load image from disk to CPU memory.
     // Image class is defined in <framework/image.h>
     Image cpuTexture { filePath };
 
-    // Create a texture on the GPU and bind it for parameter setting
-    glGenTextures(1, &m_texture);
-    glBindTexture(GL_TEXTURE_2D, m_texture);
-
-    // Set behavior for when texture coordinates are outside the [0, 1] range (wrap around).
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-    // Set interpolation for texture sampling (bilinear interpolation across mip-maps).
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    // Define GPU texture parameters and upload corresponding data based on number of image channels
+    GLenum format;
     switch (cpuTexture.channels) {
         case 1:
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, cpuTexture.width, cpuTexture.height, 0, GL_RED, GL_UNSIGNED_BYTE, cpuTexture.get_data());
+            format = GL_RED;
             break;
         case 3:
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, cpuTexture.width, cpuTexture.height, 0, GL_RGB, GL_UNSIGNED_BYTE, cpuTexture.get_data());
+            format = GL_RGB;
             break;
         case 4:
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, cpuTexture.width, cpuTexture.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, cpuTexture.get_data());
+            format = GL_RGBA;
             break;
         default:
             std::cerr << "Number of channels read for texture is not supported" << std::endl;
             throw std::exception();
     }
 
-    // Generate mip-maps
-    glGenerateMipmap(GL_TEXTURE_2D);
+    // Mip-maps filtered on the CPU (linear light for colour, renormalised normals) instead of glGenerateMipmap's box filter
+    const MipChain mips = buildMipChain(cpuTexture.get_data(), cpuTexture.width, cpuTexture.height, cpuTexture.channels, role, true);
+
+    // Create a texture on the GPU and bind it for parameter setting
+    glGenTextures(1, &m_texture);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+
+    // Set behavior for when texture coordinates are outside the [0, 1] range (wrap around).
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+    // Set interpolation for texture sampling (bilinear interpolation across mip-maps).
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(mips.levels.size() - 1));
+
+    // Rows of 1 and 3 channel levels are not 4 byte aligned
+    GLint unpackAlignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (size_t level = 0; level < mips.levels.size(); ++level) {
+        const CookedLevel& mip = mips.levels[level];
+        glTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(level), format, mip.width, mip.height, 0, format, GL_UNSIGNED_BYTE, mips.data.data() + mip.offset);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
 
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
-Texture::Texture(int textureGenCod)
+Texture::Texture(int textureGenCod, const float* data)
 {
 
     if (textureGenCod == BRDF_2D_TEXTURE){
@@ -55,7 +67,7 @@ Texture::Texture(int textureGenCod)
         glGenTextures(1, &m_texture);
         glBindTexture(GL_TEXTURE_2D, m_texture);
 
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, 512,512, 0, GL_RG, GL_FLOAT, 0);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, BRDF_LUT_SIZE, BRDF_LUT_SIZE, 0, GL_RG, GL_FLOAT, data);
 
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -70,6 +82,24 @@ Texture::Texture(int textureGenCod)
     }
 }
 
+Texture::Texture(const glm::vec4& placeholderColor)
+{
+    const glm::u8vec4 texel { glm::clamp(placeholderColor, 0.0f, 1.0f) * 255.0f + 0.5f };
+
+    glGenTextures(1, &m_texture);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    // A single level, complete without mips
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, &texel);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
 Texture::Texture(Texture&& other) noexcept
     : abstractTexture(std::move(other))
 {}
@@ -84,7 +114,8 @@ Texture::~Texture()
 
 void Texture::bind(GLint textureSlot)
 {
-    glActiveTexture(textureSlot);
+    glActiveTexture(static_cast<GLenum>(textureSlot));
     glBindTexture(GL_TEXTURE_2D, m_texture);
+    ++bindCount;
 }
 
@@ -2,9 +2,11 @@
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
 #include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
 DISABLE_WARNINGS_POP()
 
 #include "absTexture.h"
+#include "../texture_cooker.h"
 
 #define BRDF_2D_TEXTURE 10
 
@@ -14,9 +16,11 @@ struct ImageLoadingException : public std::runtime_error {
 
 class Texture: public abstractTexture{
 public:
-    Texture(std::filesystem::path filePath);
+    Texture(std::filesystem::path filePath, TextureRole role = TextureRole::COLOR); // role: how the mips are filtered
 
-    Texture(int textureGenCod); // Constructor specified for generating BRDF Texture
+    Texture(int textureGenCod, const float* data = nullptr); // Constructor specified for the BRDF Texture, data: the RG LUT of brdf_lut.h
+
+    explicit Texture(const glm::vec4& placeholderColor); // 1x1 texture shown until the TextureLoader has the image in
 
     Texture(const Texture&) = delete;
     Texture(Texture&&) noexcept;
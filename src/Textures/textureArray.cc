@@ -0,0 +1,40 @@
+#include "textureArray.h"
+
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/vec4.hpp>
+DISABLE_WARNINGS_POP()
+
+TextureArray::TextureArray(const std::vector<glm::vec4>& placeholderColors)
+{
+    std::vector<glm::u8vec4> texels;
+    for (const glm::vec4& color : placeholderColors)
+        texels.emplace_back(glm::clamp(color, 0.0f, 1.0f) * 255.0f + 0.5f);
+
+    glGenTextures(1, &m_texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    // A single level, complete without mips
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, 1, 1, static_cast<GLsizei>(texels.size()), 0, GL_RGBA, GL_UNSIGNED_BYTE, texels.data());
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+TextureArray::~TextureArray()
+{
+    if (m_texture != INVALID)
+        glDeleteTextures(1, &m_texture);
+}
+
+void TextureArray::bind(GLint textureSlot)
+{
+    glActiveTexture(static_cast<GLenum>(textureSlot));
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+    ++bindCount;
+}
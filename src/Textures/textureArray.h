@@ -0,0 +1,27 @@
+#pragma once
+
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec4.hpp>
+DISABLE_WARNINGS_POP()
+
+#include "absTexture.h"
+
+#include <vector>
+
+// A GL_TEXTURE_2D_ARRAY, shaders pick the layer per draw
+class TextureArray : public abstractTexture {
+public:
+    TextureArray() = default;
+    // 1x1 layers, one per colour, shown until the TextureLoader has the images in
+    explicit TextureArray(const std::vector<glm::vec4>& placeholderColors);
+
+    TextureArray(const TextureArray&) = delete;
+    TextureArray(TextureArray&&) noexcept = default;
+    ~TextureArray();
+
+    TextureArray& operator=(const TextureArray&) = delete;
+    TextureArray& operator=(TextureArray&&) = default;
+
+    void bind(GLint textureSlot) override;
+};
@@ -1,13 +1,15 @@
 // Define More header if needed
 #include "application.h"
 
+#include <thread>
+
 // Constructor
 Application::Application()
     : m_window("Final Project", glm::ivec2(1024, 1024), OpenGLVersion::GL41)
     , texturePath("resources/texture/brickwall.jpg")
     // , texturePath("resources/celestial_bodies/moon.jpg")
-    , m_texture(RESOURCE_ROOT "resources/texture/checkerboard.png")
-    , m_projectionMatrix(glm::perspective(glm::radians(80.0f), m_window.getAspectRatio(), 0.1f, 30.0f))
+    , m_texture(glm::vec4(0.5f, 0.5f, 0.5f, 1.0f))
+    , m_projectionMatrix(glm::perspective(glm::radians(80.0f), m_window.getAspectRatio(), CAMERA_NEAR, CAMERA_FAR))
     , m_viewMatrix(glm::lookAt(glm::vec3(-1, 1, -1), glm::vec3(0), glm::vec3(0, 1, 0)))
     , m_modelMatrix(1.0f)
     , cameras{
@@ -19,23 +21,16 @@ Application::Application()
     m_PbrMaterial{ glm::vec3{ 0.8, 0.6, 0.4 }, 1.0f, 0.2f, 1.0f }
 
     //init skyboxTex
-    , skyboxTexture(celestialFaces)
-    , celestialSkyboxTexture(celestialFaces)
+    , skyboxTexture(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f))
+    , celestialSkyboxTexture(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f))
     //init hdrTex and hdr cubemap
-    , hdrTextureMap(hdrSamplePath)
     , hdrCubeMap(RENDER_HDR_CUBE_MAP)
     , hdrIrradianceMap(RENDER_HDR_IRRIDIANCE_MAP)
     , hdrPrefilteredMap(RENDER_PRE_FILTER_HDR_MAP)
-    , BRDFTexture(BRDF_2D_TEXTURE)
 
     // SSAO Buffer Generation
-    , m_diffuseTex(RESOURCE_ROOT "resources/texture/2k_earth_map_diffuse.jpg")
-    , m_specularTex(RESOURCE_ROOT "resources/texture/2k_earth_map_specular.png")
-    , gPos(SSAO_GBUFFER_POS)
-    , gNor(SSAO_GBUFFER_NOR)
-    , gCol(SSAO_GBUFFER_COL)
-    , ssaoColorBuff(SSAO_COLOR_BUFF)
-    , ssaoColorBlurBuff(SSAO_COLOR_BLUR)
+    , m_diffuseTex(glm::vec4(0.5f, 0.5f, 0.5f, 1.0f))
+    , m_specularTex(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f))
     , ssaoNoiseTex()
     , trackball{ &m_window, glm::radians(50.0f) }
     
@@ -43,16 +38,21 @@ Application::Application()
     , celestialBodies { CelestialBody::Sun(), CelestialBody::Earth(), CelestialBody::Moon() }
     , sun_light { }
 {
-    // lights must be initialized here since light is still struct not class
-    lights.push_back(
-        { glm::vec3(1, 3, -2), glm::vec3(1), -glm::vec3(0, 0, 3), false, false, /*std::nullopt*/ }
-    );
+    CpuTimer startupTimer;
+    startupTimer.begin();
+    // First, so the files decode while the shaders compile
+    m_textureLoader.setCompression(compressTextures, RESOURCE_ROOT "texture_cache");
+    requestTextures();
 
-    lights.push_back(
-        { glm::vec3(-1, 3, 2), glm::vec3(1), -glm::vec3(0, 0, 3), false, false, /*std::nullopt*/ }
-    );
+    // Linked programs are saved here and reloaded on the next launch instead of compiling from source
+    ShaderBuilder::setProgramCacheDirectory(RESOURCE_ROOT "shader_cache");
+    // Stages shared between programs (shader_vert.glsl, skybox_vert.glsl, ...) compile once, false to compare
+    ShaderBuilder::setStageCacheEnabled(true);
+
+    resetLights();
 
-    initCelestialTextures();
+    m_deferredTiles.tileSizePx = DEFERRED_TILE_SIZE;
+    m_deferredTiles.numSlices = 1;
 
     // init normal material
     m_Material.kd = glm::vec3{ 0.5f, 0.5f, 1.0f };
@@ -60,7 +60,6 @@ Application::Application()
     m_Material.shininess = 3.0f;
 
     selectedCamera = &cameras.at(curCameraIndex);
-    selectedLight = &lights.at(curLightIndex);
 
     glm::vec3 look_at = { 0.0, 1.0, -1.0 };
     glm::vec3 rotations = { 0.2, 0.0, 0.0 };
@@ -82,100 +81,128 @@ Application::Application()
             onMouseReleased(button, mods);
     });
 
-    // generate env maps
-    initPBRTexures();
-    generateSkyBox();
-    generateHdrMap();
-
-    // then before rendering, configure the viewport to the original framebuffer's screen dimensions
-    glm::ivec2 windowSizes = m_window.getWindowSize();
-    //glViewport(0, 0, windowSizes.x, windowSizes.y);
-    glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
-
-    initMaterialTexture();
-
     // ===  Create All Shader ===
+    // Only submitted here, the driver compiles them while the env maps below are generated and each one is
+    // waited on when first used
     try {
         ShaderBuilder debugShader;
         debugShader.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/shader_vert.glsl");
         debugShader.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/debug_frag.glsl");
-        m_debugShader = debugShader.build();
+        m_debugShader = debugShader.submit();
 
         ShaderBuilder defaultBuilder;
         defaultBuilder.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/shader_vert.glsl");
         defaultBuilder.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/shader_frag.glsl");
-        m_defaultShader = defaultBuilder.build();
+        m_defaultShader = defaultBuilder.submit();
+
+        // The same with colorMap and normalTex as texture array layers, for the solar system
+        ShaderBuilder celestialArrayBuilder;
+        celestialArrayBuilder.addDefine("TEXTURE_ARRAYS");
+        celestialArrayBuilder.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/shader_vert.glsl");
+        celestialArrayBuilder.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/shader_frag.glsl");
+        m_celestialArrayShader = celestialArrayBuilder.submit();
 
         ShaderBuilder shadowBuilder;
         shadowBuilder.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/shadow_vert.glsl");
         shadowBuilder.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "Shaders/shadow_frag.glsl");
-        m_shadowShader = shadowBuilder.build();
+        m_shadowShader = shadowBuilder.submit();
 
         ShaderBuilder multiLightBuilder;
         multiLightBuilder.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/shader_vert.glsl");
         multiLightBuilder.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "Shaders/multi_light_shader_frag.glsl");
-        m_multiLightShader = multiLightBuilder.build();
+        m_multiLightShader = multiLightBuilder.submit();
 
         ShaderBuilder PbrBuilder;
         PbrBuilder.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/shader_vert.glsl");
         PbrBuilder.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "Shaders/PBR_Shader_frag.glsl");
-        m_pbrShader = PbrBuilder.build();
+        m_pbrShader = PbrBuilder.submit();
+
+        // Variants of the three forward shaders, compiled when a feature set is first drawn with
+        const std::vector<std::string> features(shaderFeatureDefines.begin(), shaderFeatureDefines.end());
+        const uint32_t commonFeatures = shaderFeatureBit(ShaderFeature::TEX_COORDS) | shaderFeatureBit(ShaderFeature::NORMAL_MAPPING)
+            | shaderFeatureBit(ShaderFeature::MATERIAL) | shaderFeatureBit(ShaderFeature::SHADOW) | shaderFeatureBit(ShaderFeature::PCF);
+        m_defaultPermutations = ShaderPermutations(features,
+            commonFeatures | shaderFeatureBit(ShaderFeature::ENV_MAP) | shaderFeatureBit(ShaderFeature::IGNORE_LIGHT_DIRECTION));
+        m_defaultPermutations.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/shader_vert.glsl");
+        m_defaultPermutations.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/shader_frag.glsl");
+        m_multiLightPermutations = ShaderPermutations(features, commonFeatures | shaderFeatureBit(ShaderFeature::ENV_MAP));
+        m_multiLightPermutations.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/shader_vert.glsl");
+        m_multiLightPermutations.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "Shaders/multi_light_shader_frag.glsl");
+        m_pbrPermutations = ShaderPermutations(features,
+            commonFeatures | shaderFeatureBit(ShaderFeature::HDR_ENV_MAP) | shaderFeatureBit(ShaderFeature::IRRADIANCE_SH));
+        m_pbrPermutations.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/shader_vert.glsl");
+        m_pbrPermutations.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "Shaders/PBR_Shader_frag.glsl");
 
         // set up light Shader
         ShaderBuilder lightShaderBuilder;
         lightShaderBuilder
             .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/lights/light_vert.glsl")
             .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/lights/light_frag.glsl");
-        m_lightShader = lightShaderBuilder.build();
+        m_lightShader = lightShaderBuilder.submit();
 
         ShaderBuilder skyBoxBuilder;
         skyBoxBuilder
             .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/skybox_vert.glsl")
             .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/skybox_frag.glsl");
-        m_skyBoxShader = skyBoxBuilder.build();
+        m_skyBoxShader = skyBoxBuilder.submit();
 
         ShaderBuilder hdrSkyBoxBuilder;
         hdrSkyBoxBuilder
             .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/skybox_vert.glsl")
             .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/hdr_skybox_frag.glsl");
-        m_hdrSkyBoxShader = hdrSkyBoxBuilder.build();
+        m_hdrSkyBoxShader = hdrSkyBoxBuilder.submit();
 
         ShaderBuilder borderShader;
         borderShader.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/border_vert.glsl");
         borderShader.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/border_frag.glsl");
-        m_borderShader = borderShader.build();
+        m_borderShader = borderShader.submit();
 
         ShaderBuilder pointShader;
         pointShader.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/border_vert.glsl");
         pointShader.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/border_frag.glsl");
-        m_pointShader = pointShader.build();
+        m_pointShader = pointShader.submit();
 
         ShaderBuilder postProcessShader;
+        // The full screen passes share one separable vertex program through program pipelines
+        postProcessShader.setSeparable();
         postProcessShader.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/postProcess_vert.glsl");
         postProcessShader.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/postProcess_frag.glsl");
-        m_postProcessShader = postProcessShader.build();
+        m_postProcessShader = postProcessShader.submit();
 
-        /*
-        ShaderBuilder ssaoBuilder;
-        ssaoBuilder
-            .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/lights/light_vert.glsl")
-            .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/lights/light_frag.glsl");
-        m_shaderSSAO = ssaoBuilder.build();
+        ShaderBuilder bloomDownsampleBuilder;
+        bloomDownsampleBuilder.setSeparable();
+        bloomDownsampleBuilder.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/postProcess_vert.glsl");
+        bloomDownsampleBuilder.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/bloom/bloom_downsample_frag.glsl");
+        m_bloomDownsampleShader = bloomDownsampleBuilder.submit();
 
-        ShaderBuilder ssaoBlurBuilder;
-        ssaoBlurBuilder
-            .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/lights/light_vert.glsl")
-            .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/lights/light_frag.glsl");
-        m_shaderSSAOBlur = ssaoBuilder.build();
-        */
+        ShaderBuilder bloomUpsampleBuilder;
+        bloomUpsampleBuilder.setSeparable();
+        bloomUpsampleBuilder.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/postProcess_vert.glsl");
+        bloomUpsampleBuilder.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/bloom/bloom_upsample_frag.glsl");
+        m_bloomUpsampleShader = bloomUpsampleBuilder.submit();
 
-        initPostProcess();
         applyNormalTexture();
     }
     catch (ShaderLoadingException e) {
         std::cerr << e.what() << std::endl;
     }
 
+    // generate env maps
+    initPBRTexures();
+    // Every PBR map is registered by now, the celestial maps wait for the solar system to be drawn
+    m_textureArrays.load(m_textureLoader, streamTextures);
+    generateSkyBox();
+    generateBrdfLut();
+    generateHdrMap();
+
+    // then before rendering, configure the viewport to the original framebuffer's screen dimensions
+    m_window.registerWindowResizeCallback([this](const glm::ivec2&) {
+        onFramebufferResize();
+    });
+    onFramebufferResize();
+
+    initMaterialTexture();
+
     // === Create Shadow Texture ===
     try {
         //m_shadowTex = ShadowTexture(SHADOWTEX_WIDTH, SHADOWTEX_HEIGHT);
@@ -184,6 +211,202 @@ Application::Application()
     catch (shadowLoadingException e) {
         std::cerr << e.what() << std::endl;
     }
+
+    if (!asyncTextureLoading)
+        m_textureLoader.finish();
+    m_startupMs = startupTimer.end();
+    std::cout << "Startup: " << m_startupMs << " ms, textures " << (asyncTextureLoading ? "loading in the background" : "loaded") << std::endl;
+}
+
+Application::~Application()
+{
+    // The shader members are deleted after this, while the window and its context are still there
+    ShaderBuilder::releaseStageCache();
+}
+
+/**
+ * Starts loading the image textures drawn with the scene, the PBR and celestial maps are requested where they are set up.
+ */
+void Application::requestTextures()
+{
+    loadSceneTexture(m_texture, RESOURCE_ROOT "resources/texture/checkerboard.png");
+    m_textureLoader.loadCube(skyboxTexture, celestialFaces);
+    m_textureLoader.loadCube(celestialSkyboxTexture, celestialFaces);
+    loadSceneTexture(m_diffuseTex, RESOURCE_ROOT "resources/texture/2k_earth_map_diffuse.jpg");
+    loadSceneTexture(m_specularTex, RESOURCE_ROOT "resources/texture/2k_earth_map_specular.png", TextureRole::SINGLE_CHANNEL);
+}
+
+/**
+ * Loads a texture drawn on the scene's meshes, streamed unless streaming is off.
+ */
+void Application::loadSceneTexture(abstractTexture& target, std::filesystem::path file, TextureRole role)
+{
+    if (streamTextures)
+        m_textureLoader.loadStreamed(target, std::move(file), role);
+    else
+        m_textureLoader.load(target, std::move(file), role);
+}
+
+/**
+ * Tells the loader how much of a texture a mesh drawn with modelMatrix needs, from how tall its bounding sphere
+ * is on screen. The textures wrap around the meshes (equirectangular on the spheres), so their width spans
+ * about pi times that.
+ */
+void Application::requestTextureDetail(const abstractTexture& texture, const GPUMesh& mesh, const glm::mat4& modelMatrix, const glm::mat4& view, const glm::mat4& projection)
+{
+    const glm::vec4& sphere = mesh.boundingSphere();
+    const glm::vec3 center = view * modelMatrix * glm::vec4(glm::vec3(sphere), 1.0f);
+    const float scale = std::max({ glm::length(glm::vec3(modelMatrix[0])), glm::length(glm::vec3(modelMatrix[1])), glm::length(glm::vec3(modelMatrix[2])) });
+    const float radius = sphere.w * scale;
+    const float distance = glm::length(center);
+    // From inside the sphere it covers the screen at any detail
+    const float diameterPixels = distance > radius ? radius * projection[1][1] * m_renderHeight / distance : std::numeric_limits<float>::max() / 4.0f;
+    m_textureLoader.requestDetail(texture, glm::pi<float>() * diameterPixels);
+}
+
+/**
+ * Prints how long the textures took to become resident and what loading them cost the frames in the meantime.
+ */
+void Application::reportTextureLoading() const
+{
+    const TextureLoaderStats& stats = m_textureLoader.stats();
+    char line[256];
+    std::snprintf(line, sizeof(line), "Textures: %d loaded (%d failed), %.1f MB uploaded, resident %.1f ms after the first request; "
+                                      "decode %.1f ms on the workers, longest upload step %.2f ms, longest frame while loading %.2f ms",
+        stats.completed, stats.failed, double(stats.uploadedBytes) / (1024.0 * 1024.0), double(stats.residentMs), double(stats.decodeMs), double(stats.maxStepMs),
+        double(m_loadingMaxFrameMs));
+    std::cout << line << std::endl;
+    std::snprintf(line, sizeof(line), "Texture memory: %.1f MB, %.1f MB uncompressed; %d images from the cooked cache, %.1f ms of mips and encoding for the others",
+        double(stats.textureBytes) / (1024.0 * 1024.0), double(stats.uncompressedTextureBytes) / (1024.0 * 1024.0), stats.cacheHits, double(stats.encodeMs));
+    std::cout << line << std::endl;
+    const TextureStreamingStats& streaming = m_textureLoader.streamingStats();
+    if (streaming.textures > 0) {
+        std::snprintf(line, sizeof(line), "Texture streaming: %d textures, %.1f of %.1f MB resident (budget %.1f MB)",
+            streaming.textures, double(streaming.residentBytes) / (1024.0 * 1024.0), double(streaming.fullBytes) / (1024.0 * 1024.0),
+            double(streaming.budgetBytes) / (1024.0 * 1024.0));
+        std::cout << line << std::endl;
+    }
+}
+
+/**
+ * Makes the mips of the earth diffuse map with glGenerateMipmap and with buildMipChain, and prints per level how
+ * far each is from an area average in linear light and how much brightness it lost against level 0, along
+ * with the time of both and of reading the cooked texture.
+ */
+void Application::compareMipGeneration() const
+{
+    const std::filesystem::path file = RESOURCE_ROOT "resources/texture/2k_earth_map_diffuse.jpg";
+    int width = 0, height = 0, channels = 0;
+    const std::unique_ptr<stbi_uc, decltype(&stbi_image_free)> pixels(stbi_load(file.string().c_str(), &width, &height, &channels, STBI_rgb), &stbi_image_free);
+    if (!pixels) {
+        std::cerr << "Failed to read texture " << file << ": " << stbi_failure_reason() << std::endl;
+        return;
+    }
+
+    GLint unpackAlignment, packAlignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+    glGetIntegerv(GL_PACK_ALIGNMENT, &packAlignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+    glFinish();
+    CpuTimer timer;
+    timer.begin();
+    GLuint gpuTexture;
+    glGenTextures(1, &gpuTexture);
+    glBindTexture(GL_TEXTURE_2D, gpuTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels.get());
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glFinish();
+    const float gpuMs = timer.end();
+
+    timer.begin();
+    const MipChain mips = buildMipChain(pixels.get(), width, height, 3, TextureRole::COLOR, true);
+    const float cpuMs = timer.end();
+    timer.begin();
+    GLuint cpuTexture;
+    glGenTextures(1, &cpuTexture);
+    glBindTexture(GL_TEXTURE_2D, cpuTexture);
+    for (size_t level = 0; level < mips.levels.size(); ++level)
+        glTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(level), GL_RGB8, mips.levels[level].width, mips.levels[level].height, 0, GL_RGB, GL_UNSIGNED_BYTE, mips.data.data() + mips.levels[level].offset);
+    glFinish();
+    const float uploadMs = timer.end();
+
+    float cookedMs = 0.0f;
+    bool cookedFromCache = false;
+    try {
+        timer.begin();
+        cookedFromCache = cookTexture(file, TextureRole::COLOR, RESOURCE_ROOT "texture_cache").fromCache;
+        cookedMs = timer.end();
+    }
+    catch (const TextureCookingException& e) {
+        std::cerr << e.what() << std::endl;
+    }
+
+    char line[256];
+    std::snprintf(line, sizeof(line), "Mips of %s: glGenerateMipmap %.1f ms; CPU Kaiser filter %.1f ms + upload of every level %.1f ms; cooked texture %.1f ms (%s)",
+        file.filename().string().c_str(), double(gpuMs), double(cpuMs), double(uploadMs), double(cookedMs), cookedFromCache ? "read from the cache" : "cooked now");
+    std::cout << line << std::endl;
+
+    std::array<float, 256> toLinear;
+    for (size_t i = 0; i < toLinear.size(); ++i) {
+        const float value = static_cast<float>(i) / 255.0f;
+        toLinear[i] = i <= 10 ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+    }
+    const auto meanLinear = [&](const uint8_t* values, size_t count) {
+        double sum = 0.0;
+        for (size_t i = 0; i < count; ++i)
+            sum += double(toLinear[values[i]]);
+        return sum / double(std::max<size_t>(count, 1));
+    };
+    const double sourceMean = meanLinear(pixels.get(), size_t(width) * size_t(height) * 3);
+
+    std::vector<uint8_t> gpuLevel, reference;
+    glBindTexture(GL_TEXTURE_2D, gpuTexture);
+    for (size_t level = 1; level < mips.levels.size(); ++level) {
+        const CookedLevel& mip = mips.levels[level];
+        if (std::min(mip.width, mip.height) < 4)
+            break;
+        gpuLevel.resize(mip.size);
+        glGetTexImage(GL_TEXTURE_2D, static_cast<GLint>(level), GL_RGB, GL_UNSIGNED_BYTE, gpuLevel.data());
+
+        // What the level ideally holds: the mean light of the source texels it covers
+        const size_t mipWidth = static_cast<size_t>(mip.width), mipHeight = static_cast<size_t>(mip.height);
+        const size_t blockWidth = static_cast<size_t>(width) / mipWidth, blockHeight = static_cast<size_t>(height) / mipHeight;
+        reference.resize(mip.size);
+        for (size_t y = 0; y < mipHeight; ++y) {
+            for (size_t x = 0; x < mipWidth; ++x) {
+                for (size_t channel = 0; channel < 3; ++channel) {
+                    double sum = 0.0;
+                    for (size_t sy = y * blockHeight; sy < (y + 1) * blockHeight; ++sy) {
+                        for (size_t sx = x * blockWidth; sx < (x + 1) * blockWidth; ++sx)
+                            sum += double(toLinear[pixels.get()[(sy * static_cast<size_t>(width) + sx) * 3 + channel]]);
+                    }
+                    const float mean = static_cast<float>(sum / double(blockWidth * blockHeight));
+                    const float encoded = mean <= 0.0031308f ? mean * 12.92f : 1.055f * std::pow(mean, 1.0f / 2.4f) - 0.055f;
+                    reference[(y * mipWidth + x) * 3 + channel] = static_cast<uint8_t>(std::clamp(encoded, 0.0f, 1.0f) * 255.0f + 0.5f);
+                }
+            }
+        }
+
+        const uint8_t* cpuLevel = mips.data.data() + mip.offset;
+        const auto psnr = [&](const uint8_t* values) {
+            double squared = 0.0;
+            for (size_t i = 0; i < mip.size; ++i)
+                squared += double(values[i] - reference[i]) * (values[i] - reference[i]);
+            return 10.0 * std::log10(255.0 * 255.0 / std::max(squared / double(mip.size), 1e-12));
+        };
+        std::snprintf(line, sizeof(line), "  level %zu (%dx%d): PSNR against linear light average glGenerateMipmap %.1f dB, CPU %.1f dB; brightness against level 0 %+.2f%%, %+.2f%%",
+            level, mip.width, mip.height, psnr(gpuLevel.data()), psnr(cpuLevel),
+            100.0 * (meanLinear(gpuLevel.data(), mip.size) / sourceMean - 1.0), 100.0 * (meanLinear(cpuLevel, mip.size) / sourceMean - 1.0));
+        std::cout << line << std::endl;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glDeleteTextures(1, &gpuTexture);
+    glDeleteTextures(1, &cpuTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+    glPixelStorei(GL_PACK_ALIGNMENT, packAlignment);
 }
 
 void Application::applyNormalTexture()
@@ -211,25 +434,32 @@ void Application::update() {
     while (!m_window.shouldClose()) {
         m_window.updateInput();
         windowSizes = m_window.getWindowSize(); 
+        ShaderBuilder::pollCompletion();
+
+        // Blocks only when framesInFlight frames are already queued on the GPU
+        m_framePacer.setFramesInFlight(framesInFlight);
+        m_framePacer.beginFrame();
+        m_uniformRing.beginFrame(m_framePacer.slot());
+
+        m_frameCpuTimer.begin();
+        m_frameGpuTimer.begin();
+        m_textureBindsLastFrame = abstractTexture::bindCount;
+        abstractTexture::bindCount = 0;
 
         m_materialChangedByUser = false;
 
         this->imgui();
+        stepPrefilter(prefilterFacesPerFrame);
+        const bool texturesLoading = m_textureLoader.busy();
+        m_textureLoader.setStreamingBudget(static_cast<size_t>(textureStreamingBudgetMB * 1024.0f * 1024.0f));
+        m_textureLoader.step(textureUploadBudgetMs);
         selectedCamera->updateInput();
         m_viewMatrix = selectedCamera->viewMatrix();
 
-        if (usePostProcess) {
-            // 绑定自定义的帧缓冲对象
-            glBindFramebuffer(GL_FRAMEBUFFER, framebufferPostProcess);
-        }
-        else {
-            // 绑定默认帧缓冲对象（屏幕）
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        }
-
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
-        glClearDepth(1.0);
+        m_renderTargets.setRenderScale(renderScale);
+        const glm::ivec2 outputSize = m_renderTargets.outputSize();
+        const glm::ivec2 renderSize = m_renderTargets.renderSize();
+        m_renderHeight = static_cast<float>(renderSize.y);
 
         glDisable(GL_CULL_FACE);
         glEnable(GL_DEPTH_TEST);
@@ -243,83 +473,104 @@ void Application::update() {
 
         const glm::mat4 mvpMatrix = m_projectionMatrix * m_viewMatrix * m_modelMatrix;
 
-        glm::mat4 lightViewMatrix = glm::lookAt(selectedLight->position, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        glm::mat4 lightViewMatrix = glm::lookAt(m_lightStore.get(selectedLight).position, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
         glm::mat4 lightMVP = m_projectionMatrix * lightViewMatrix;
         
         const glm::mat3 normalModelMatrix = glm::inverseTranspose(glm::mat3(m_modelMatrix));
 
-        // Either render the (simplified) solar system, or another scene.
-        if (showSolarSystem)
-        {
-            // Render the solar system
-            renderSolarSystem();
-        }
-        
         if (!showSolarSystem) {
-            // Render the other scene
-
-            #pragma region Mesh render loop
-            // Mesh render loop
-            for (GPUMesh& mesh : m_meshes) {
-
-                //shadow maps generates the shadows
-                #pragma region shadow Map Genereates
-                    if (false)
-                    {
-                        mesh.drawShadowMap(m_shadowShader, lightMVP, m_shadowTex.getFramebuffer(), SHADOWTEX_WIDTH, SHADOWTEX_HEIGHT);
-                    }
-                #pragma endregion
-
-                // set new Material every time it is updated
-                GLuint newUBOMaterial;
-                GPUMaterial gpuMat = GPUMaterial(m_Material);
-                genUboBufferObj(gpuMat, newUBOMaterial);
-                mesh.setUBOMaterial(newUBOMaterial);
-
-                // generate UBO for shadowSetting
-                GLuint shadowSettingUbo;
-                genUboBufferObj(shadowSettings, shadowSettingUbo);
-
-                //// Draw mesh into depth buffer but disable color writes.
-                //glDepthMask(GL_TRUE);
-                //glDepthFunc(GL_LEQUAL);
-                //glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-
-                //m_debugShader.bind();
-                //glUniformMatrix4fv(m_debugShader.getUniformLocation("mvpMatrix"), 1, GL_FALSE, glm::value_ptr(mvpMatrix));
-                //glUniformMatrix3fv(m_debugShader.getUniformLocation("normalModelMatrix"), 1, GL_FALSE, glm::value_ptr(normalModelMatrix));
-                //glUniformMatrix4fv(m_debugShader.getUniformLocation("modelMatrix"), 1, GL_FALSE, glm::value_ptr(m_modelMatrix));
-                //mesh.drawBasic(m_debugShader);
-
-                //// Draw the mesh again for each light / shading model.
-                //glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE); // Enable color writes.
-                //glDepthMask(GL_FALSE); // Disable depth writes.
-                //glDepthFunc(GL_EQUAL); // Only draw a pixel if it's depth matches the value stored in the depth buffer.
-                //glEnable(GL_BLEND); // Enable blending.
-                //glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-
-                // ssao will set a completely different render pipeline
-                if (ssaoEnabled) 
-                {
-                    genDeferredRenderBuffer(defRenderBufferGenerated);
-
-                    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-                    m_selShader = &m_shaderGeometryPass;
+            // The deferred pipeline spawns its own lights, switching back restores the forward ones
+            if (ssaoEnabled) {
+                genDeferredRenderBuffer(defRenderBufferGenerated);
+                defRenderLightGen = true;
+            }
+            else if (defRenderLightGen) {
+                resetLights();
+                defRenderLightGen = false;
+            }
 
-                    // GeoMetryPass
-                    glBindFramebuffer(GL_FRAMEBUFFER, gBuffer);
-                    //glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-                    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-                    glDisable(GL_BLEND);
+            // Send the lights that changed since the last frame to the GPU
+            animateLights();
+            m_lightStore.upload();
 
-                    m_selShader->bind();
+            // Bin the lights into the froxel grid once per frame for the forward multi-light shaders
+            if (multiLightShadingEnabled && !ssaoEnabled) {
+                m_lightClusters.build(m_lightStore.positionRadius(), m_viewMatrix, m_projectionMatrix, outputSize, CAMERA_NEAR, CAMERA_FAR, m_framePacer.slot());
+            }
+        }
 
-                    glUniform1i(m_selShader->getUniformLocation("ignoreLightDirection"), GL_FALSE);
-                    glUniform1f(m_selShader->getUniformLocation("sunlightStrength"), 1.0f);
-                    glUniformMatrix4fv(m_selShader->getUniformLocation("view"), 1, GL_FALSE, glm::value_ptr(view));
-                    glUniformMatrix4fv(m_selShader->getUniformLocation("projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        // === Render graph ===
+        // Without post-processing the scene is drawn straight into the window. With it the scene is kept in
+        // floating point so bloom sees highlights above 1.
+        RenderGraph graph(m_renderTargets);
+        const RenderResource backbuffer = graph.importFramebuffer("Backbuffer", 0, outputSize);
+        RenderResource sceneColor = backbuffer;
+        RenderResource sceneDepth = backbuffer;
+        if (usePostProcess) {
+            sceneColor = graph.createTexture("SceneColor", { outputSize, GL_R11F_G11F_B10F });
+            sceneDepth = graph.createTexture("SceneDepth", { outputSize, GL_DEPTH24_STENCIL8 });
+        }
+        const auto writeScene = [&](RenderGraph::PassBuilder& builder) {
+            builder.write(sceneColor);
+            builder.write(sceneDepth);
+        };
+
+        graph.addPass("Clear", writeScene, []() {
+            glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
+            glClearDepth(1.0);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        });
 
+        // Either render the (simplified) solar system, or another scene.
+        if (showSolarSystem)
+        {
+            m_temporal.invalidate();
+            graph.addPass("SolarSystem", writeScene, [this]() {
+                renderSolarSystem();
+            });
+        }
+        else if (ssaoEnabled)
+        {
+            // Deferred pipeline, the G-buffer is rendered at the scaled render size
+            const RenderResource gNormal = graph.createTexture("GNormal", { renderSize, GL_RG16 });
+            const RenderResource gAlbedoSpec = graph.createTexture("GAlbedoSpec", { renderSize, GL_RGBA8 });
+            const RenderResource gBufferDepth = graph.createTexture("GDepth", { renderSize, GL_DEPTH24_STENCIL8 });
+            const glm::ivec2 tileCount = (renderSize + DEFERRED_TILE_SIZE - 1) / DEFERRED_TILE_SIZE;
+            const RenderResource tileDepth = graph.createTexture("TileDepthBounds", { tileCount, GL_RG32F });
+            const bool tiled = deferredLightingMode == DeferredLightingMode::TILED;
+
+            const int ssaoDivisor = 1 << static_cast<int>(ssaoResolution);
+            const glm::ivec2 ssaoSize = glm::max((renderSize + ssaoDivisor - 1) / ssaoDivisor, glm::ivec2(1));
+            const RenderResource ssaoRaw = graph.createTexture("SSAO", { ssaoSize, GL_RG16F });
+            const RenderResource ssaoBlurH = graph.createTexture("SSAOBlurH", { ssaoSize, GL_RG16F });
+            const RenderResource ssaoBlurred = graph.createTexture("SSAOBlurred", { ssaoSize, GL_RG16F });
+            const bool occlusion = ssaoOcclusionEnabled;
+            const bool temporal = occlusion && ssaoTemporalEnabled;
+            m_temporal.beginFrame(view, projection);
+
+            graph.addPass("GBuffer", [&](RenderGraph::PassBuilder& builder) {
+                builder.write(gNormal);
+                builder.write(gAlbedoSpec);
+                builder.write(gBufferDepth);
+            }, [=, this]() {
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+                glDisable(GL_BLEND);
+
+                m_selShader = &m_shaderGeometryPass;
+                m_selShader->bind();
+
+                glUniform1i(m_selShader->getUniformLocation("ignoreLightDirection"), GL_FALSE);
+                glUniform1f(m_selShader->getUniformLocation("sunlightStrength"), 1.0f);
+                glUniformMatrix4fv(m_selShader->getUniformLocation("view"), 1, GL_FALSE, glm::value_ptr(view));
+                glUniformMatrix4fv(m_selShader->getUniformLocation("projection"), 1, GL_FALSE, glm::value_ptr(projection));
+
+                m_diffuseTex.bind(GL_TEXTURE10);
+                glUniform1i(m_selShader->getUniformLocation("texture_diffuse"), 10);
+
+                m_specularTex.bind(GL_TEXTURE11);
+                glUniform1i(m_selShader->getUniformLocation("texture_specular"), 11);
+
+                for (GPUMesh& mesh : m_meshes) {
                     for (GLuint i = 0; i < objectPositions.size(); ++i) {
 
                         auto modelMatrix = glm::translate(model, objectPositions[i]);
@@ -329,103 +580,127 @@ void Application::update() {
                         auto normalMatrix = glm::inverseTranspose(glm::mat3(modelMatrix));
                         glUniformMatrix3fv(m_selShader->getUniformLocation("normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
 
-                        m_diffuseTex.bind(GL_TEXTURE10);
-                        glUniform1i(m_selShader->getUniformLocation("texture_diffuse"), 10);
-
-                        m_specularTex.bind(GL_TEXTURE11);
-                        glUniform1i(m_selShader->getUniformLocation("texture_specular"), 11);
-
+                        requestTextureDetail(m_diffuseTex, mesh, modelMatrix, view, projection);
+                        requestTextureDetail(m_specularTex, mesh, modelMatrix, view, projection);
                         mesh.drawBasic(*m_selShader);
                     }
-                    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-                    
-                    // Lighting Pass
-                    m_selShader = &m_shaderLightingPass;
-                    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-                    m_selShader->bind();
-
-                    gPos.bind(GL_TEXTURE0);
-                    gNor.bind(GL_TEXTURE1);
-                    gCol.bind(GL_TEXTURE2);
-
-                    glUniform1i(m_selShader->getUniformLocation("gPosition"), true ? 0 : -1);
-                    glUniform1i(m_selShader->getUniformLocation("gNormal"), true ? 1 : -1);
-                    glUniform1i(m_selShader->getUniformLocation("gAlbedoSpec"), true ? 2 : -1);
-
-                    for (auto& light : lights) {
-                        light.radius = calculateLightRadius(light);
-                    }
-
-                    genUboBufferObj(lights, lightUBO, MAX_LIGHT_CNT);  // pass the light into the buffer
-
-                    m_selShader->bindUniformBlock("lights", 3, lightUBO);
-
-                    glUniform3fv(m_selShader->getUniformLocation("viewPos"), 1, glm::value_ptr(cameraPos));
-
-                    renderQuad(quadVAO, quadVBO, quadVertices, 20);
-
-                    // copy depth buffer to default framebuffer's depth buffer
-                    glBindFramebuffer(GL_READ_FRAMEBUFFER, gBuffer);
-                    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0); 
-
-                    glBlitFramebuffer(0, 0, WIDTH, HEIGHT, 0, 0, WIDTH, HEIGHT, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
-                    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-                    
-                    // render Light at the end 
-                    m_selShader = &m_deferredLightShader;
-                    m_selShader->bind();
-
-
-                    for (const Light& light : lights) {
-
-                        auto modelMatrix = glm::translate(model, light.position);
-                        modelMatrix = glm::scale(modelMatrix, glm::vec3(0.125f));
-                        glUniformMatrix4fv(m_selShader->getUniformLocation("mvpMatrix"), 1, GL_FALSE, glm::value_ptr(projection * view * modelMatrix));
-                        glUniform3fv(m_lightShader.getUniformLocation("color"), 1, glm::value_ptr(light.color));
-                        glUniform4fv(m_lightShader.getUniformLocation("pos"), 1, glm::value_ptr(light.position));
-
-                        renderHDRCubeMap(cubeVAO, cubeVBO, hdrMapVertices, 288);
-                    }
-
-                    defRenderLightGen = true;
-
-                    /*
-                    m_deferredDebugShader.bind();
-                    gNor.bind(GL_TEXTURE0);
-                    glUniform1i(m_deferredDebugShader.getUniformLocation("fboDebug"), true ? 0 : -1);
-
-                    renderQuad(quadVAO, quadVBO, quadVertices, 20);
-                    */
                 }
+            });
+
+            // Only read by the tiled lighting mode, culled otherwise
+            graph.addPass("TileDepth", [&](RenderGraph::PassBuilder& builder) {
+                builder.read(gBufferDepth);
+                builder.write(tileDepth);
+            }, [=, this, &graph]() {
+                gDepth = graph.texture(gBufferDepth);
+                tileDepthPass(view, projection);
+            });
+
+            // SSAO and its separable blur, culled when the lighting pass does not read the result.
+            // The vertical blur reuses the texture of the raw SSAO, which is dead by then.
+            graph.addPass("SSAO", [&](RenderGraph::PassBuilder& builder) {
+                builder.read(gNormal);
+                builder.read(gBufferDepth);
+                builder.write(ssaoRaw);
+            }, [=, this, &graph]() {
+                m_ssaoGpuTimer.begin();
+                gNor = graph.texture(gNormal);
+                gDepth = graph.texture(gBufferDepth);
+                ssaoPass(view, projection);
+            });
+
+            // Temporal accumulation into a history that outlives the frame, so it is imported rather than transient
+            RenderResource ssaoBlurInput = ssaoRaw;
+            GLuint ssaoHistoryTexture = 0;
+            if (temporal) {
+                m_ssaoHistory.beginFrame(m_temporal, ssaoSize, GL_RGBA16F);
+                ssaoHistoryTexture = m_ssaoHistory.current();
+                ssaoBlurInput = graph.importFramebuffer("SSAOHistory", m_ssaoHistory.currentFramebuffer(), ssaoSize);
+                graph.addPass("SSAOTemporal", [&](RenderGraph::PassBuilder& builder) {
+                    builder.read(ssaoRaw);
+                    builder.read(gBufferDepth);
+                    builder.write(ssaoBlurInput);
+                }, [=, this, &graph]() {
+                    gDepth = graph.texture(gBufferDepth);
+                    ssaoTemporalPass(graph.texture(ssaoRaw));
+                });
+            }
 
-                else 
-                {
-                    if (defRenderLightGen) {
-                        lights.clear();
-
-                        // lights must be initialized here since light is still struct not class
-                        lights.push_back(
-                            { glm::vec3(1, 3, -2), glm::vec3(1), -glm::vec3(0, 0, 3), false, false, /*std::nullopt*/ }
-                        );
-
-                        lights.push_back(
-                            { glm::vec3(-1, 3, 2), glm::vec3(1), -glm::vec3(0, 0, 3), false, false, /*std::nullopt*/ }
-                        );
+            graph.addPass("SSAOBlurH", [&](RenderGraph::PassBuilder& builder) {
+                builder.read(ssaoBlurInput);
+                builder.write(ssaoBlurH);
+            }, [=, this, &graph]() {
+                ssaoBlurPass(temporal ? ssaoHistoryTexture : graph.texture(ssaoRaw), glm::ivec2(1, 0));
+            });
+            graph.addPass("SSAOBlurV", [&](RenderGraph::PassBuilder& builder) {
+                builder.read(ssaoBlurH);
+                builder.write(ssaoBlurred);
+            }, [=, this, &graph]() {
+                ssaoBlurPass(graph.texture(ssaoBlurH), glm::ivec2(0, 1));
+                m_ssaoGpuTimer.end();
+            });
+
+            // Also copies the G-buffer depth into the scene depth and upsamples the SSAO
+            graph.addPass("DeferredLighting", [&](RenderGraph::PassBuilder& builder) {
+                builder.read(gNormal);
+                builder.read(gAlbedoSpec);
+                builder.read(gBufferDepth);
+                if (tiled)
+                    builder.read(tileDepth);
+                if (occlusion)
+                    builder.read(ssaoBlurred);
+                writeScene(builder);
+            }, [=, this, &graph]() {
+                gNor = graph.texture(gNormal);
+                gCol = graph.texture(gAlbedoSpec);
+                gDepth = graph.texture(gBufferDepth);
+                if (tiled)
+                    tileDepthTex = graph.texture(tileDepth);
+                ssaoTex = occlusion ? graph.texture(ssaoBlurred) : 0;
+                deferredLightingPass(view, projection, cameraPos);
+            });
+
+            // render Light at the end 
+            graph.addPass("LightMarkers", writeScene, [=, this]() {
+                m_selShader = &m_deferredLightShader;
+                m_selShader->bind();
+
+                const size_t numMarkers = std::min<size_t>(m_lightStore.size(), MAX_LIGHT_MARKERS);
+                for (size_t i = 0; i < numMarkers; ++i) {
+                    const Light& light = m_lightStore.lights()[i];
+
+                    auto modelMatrix = glm::translate(model, light.position);
+                    modelMatrix = glm::scale(modelMatrix, glm::vec3(0.125f));
+                    glUniformMatrix4fv(m_selShader->getUniformLocation("mvpMatrix"), 1, GL_FALSE, glm::value_ptr(projection * view * modelMatrix));
+                    glUniform3fv(m_selShader->getUniformLocation("color"), 1, glm::value_ptr(light.color));
+
+                    renderHDRCubeMap(cubeVAO, cubeVBO, hdrMapVertices, 288);
+                }
+            });
+        }
+        else
+        {
+            m_temporal.invalidate();
+            graph.addPass("Forward", writeScene, [&]() {
+                // The same maps for every mesh, the draws only pass their layers
+                bindPbrMaps();
 
-                        defRenderLightGen = false;
-                    }
+                #pragma region Mesh render loop
+                // Mesh render loop
+                for (GPUMesh& mesh : m_meshes) {
 
-                    GLuint PbrUBO;
+                    // set new Material every time it is updated
+                    mesh.setUBOMaterial(m_uniformRing.push(GPUMaterial(m_Material)));
 
-                    if (multiLightShadingEnabled) {
-                        m_selShader = usePbrShading ? &m_pbrShader : &m_multiLightShader;
-                    }
-                    else {
-                        m_selShader = &m_defaultShader;
-                    }
+                    // UBO for shadowSetting
+                    const GLuint shadowSettingUbo = m_uniformRing.push(shadowSettings);
 
+                    // Texture and material settings
+                    bool hasTexCoords = mesh.hasTextureCoords();
+                    const uint32_t features = forwardShaderFeatures(hasTexCoords && textureEnabled);
+                    m_selShader = selectForwardShader(features);
                     m_selShader->bind();
+                    setShaderFeatureUniforms(*m_selShader, features, shadowSettingUbo);
 
                     // Set up matrices and view position
                     glUniformMatrix4fv(m_selShader->getUniformLocation("mvpMatrix"), 1, GL_FALSE, glm::value_ptr(mvpMatrix));
@@ -433,27 +708,13 @@ void Application::update() {
                     glUniformMatrix4fv(m_selShader->getUniformLocation("modelMatrix"), 1, GL_FALSE, glm::value_ptr(m_modelMatrix));
                     glUniformMatrix4fv(m_selShader->getUniformLocation("lightMVP"), 1, GL_FALSE, glm::value_ptr(lightMVP));
                     glUniform3fv(m_selShader->getUniformLocation("viewPos"), 1, glm::value_ptr(cameraPos));
-                    glUniform1i(m_selShader->getUniformLocation("ignoreLightDirection"), GL_FALSE);
                     glUniform1f(m_selShader->getUniformLocation("sunlightStrength"), 1.0f);
 
-                    // Texture and material settings
-                    bool hasTexCoords = mesh.hasTextureCoords();
                     m_texture.bind(hasTexCoords ? GL_TEXTURE0 : 0);
-
-                    // PBR Material Texture
-                    auto bindSlot = GL_TEXTURE10;
-                    for (auto& pbrTexture : m_pbrTextures) {
-                        pbrTexture.bind(bindSlot);
-                        bindSlot++;
-                    }
+                    requestTextureDetail(m_texture, mesh, m_modelMatrix, m_viewMatrix, m_projectionMatrix);
 
                     hasTexCoords = hasTexCoords && textureEnabled;
-                    glUniform1i(m_selShader->getUniformLocation("hasTexCoords"), hasTexCoords);
                     glUniform1i(m_selShader->getUniformLocation("colorMap"), hasTexCoords ? 0 : -1);
-                    glUniform1i(m_selShader->getUniformLocation("useMaterial"),m_useMaterial);
-
-                    // Pass in shadow settings as UBO
-                    m_selShader->bindUniformBlock("shadowSetting", 2, shadowSettingUbo);
 
                     glBindVertexArray(mesh.getVao());
                     m_shadowTex.bind(GL_TEXTURE1);
@@ -470,28 +731,24 @@ void Application::update() {
                     selectedSkybox->bind(GL_TEXTURE20);
                     glDrawArrays(GL_TRIANGLES, 0, 36);
                     glUniform1i(m_selShader->getUniformLocation("SkyBox"), 20);
-                    glUniform1i(m_selShader->getUniformLocation("useEnvMap"), envMapEnabled);
                     glBindVertexArray(0);
 
                     if (useNormalMapping) {
-                        glUniform1i(m_selShader->getUniformLocation("useNormalMapping"), GL_TRUE);
                         glActiveTexture(GL_TEXTURE3);
                         glBindTexture(GL_TEXTURE_2D, normalTex);
                         glUniform1i(m_selShader->getUniformLocation("normalTex"), 3);
-                    } else {
-                        glUniform1i(m_selShader->getUniformLocation("useNormalMapping"), GL_FALSE);
                     }
 
 
                     // Generate UBOs and draw
                     drawMultiLightShader(mesh, multiLightShadingEnabled);
-                    
-                    int lightsCnt = static_cast<int>(lights.size());
+                
                     glBindVertexArray(mesh.getVao());
                     m_lightShader.bind();
                     {
-                        const glm::vec4 screenPos = mvpMatrix * glm::vec4(selectedLight->position, 1.0f);
-                        const glm::vec3 color = selectedLight->color;
+                        const Light& light = m_lightStore.get(selectedLight);
+                        const glm::vec4 screenPos = mvpMatrix * glm::vec4(light.position, 1.0f);
+                        const glm::vec3 color = light.color;
 
                         glPointSize(40.0f);
                         glUniform4fv(m_lightShader.getUniformLocation("pos"), 1, glm::value_ptr(screenPos));
@@ -499,7 +756,10 @@ void Application::update() {
                         glDrawArrays(GL_POINTS, 0, 1);
                     }
 
-                    for (const Light& light : lights) {
+                    // One draw call per marker, only worth it for small light counts
+                    const size_t numMarkers = std::min<size_t>(m_lightStore.size(), MAX_LIGHT_MARKERS);
+                    for (size_t i = 0; i < numMarkers; ++i) {
+                        const Light& light = m_lightStore.lights()[i];
                         const glm::vec4 screenPos = mvpMatrix * glm::vec4(light.position, 1.0f);
 
                         glPointSize(10.0f);
@@ -516,34 +776,104 @@ void Application::update() {
                         renderMiniMapItem(m_modelMatrix);
                     }
                 }
-            }
-            #pragma endregion
+                #pragma endregion
+            });
         }
 
         //Draw Env Map
-        drawEnvMap(envMapEnabled, hdrMapEnabled);//MARK
+        if (envMapEnabled) {
+            graph.addPass("Skybox", writeScene, [this]() {
+                drawEnvMap(envMapEnabled, hdrMapEnabled);//MARK
+            });
+        }
 
         if (render_minimap)
         {
-            renderMiniMap();
+            graph.addPass("Minimap", writeScene, [this]() {
+                renderMiniMap();
+            });
         }
-        
-        GLint viewport[4];
-        glGetIntegerv(GL_VIEWPORT, viewport);
 
         if (usePostProcess) {
-            // 绑定默认帧缓冲对象，将结果绘制到屏幕
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
-            runPostProcess();
-            glFinish();
+            // Bloom mip chain: mip i is outputSize >> (i + 1)
+            const int bloomMips = bloomEnabled ? bloomMipCount(outputSize) : 0;
+            const float bloomFilter = bloomFilterRadius(bloomMips);
+            std::vector<RenderResource> bloomChain;
+            std::vector<glm::ivec2> bloomSizes;
+            for (int i = 0; i < bloomMips; ++i) {
+                bloomSizes.push_back(glm::max((i == 0 ? outputSize : bloomSizes.back()) / 2, glm::ivec2(1)));
+                bloomChain.push_back(graph.createTexture("BloomMip", { bloomSizes.back(), GL_R11F_G11F_B10F }));
+            }
+
+            // Threshold the scene into the first mip, then downsample each mip from the previous one
+            for (size_t i = 0; i < bloomChain.size(); ++i) {
+                const RenderResource source = i == 0 ? sceneColor : bloomChain[i - 1];
+                const RenderResource target = bloomChain[i];
+                const glm::ivec2 sourceSize = i == 0 ? outputSize : bloomSizes[i - 1];
+                graph.addPass(("BloomDown" + std::to_string(i)).c_str(), [=](RenderGraph::PassBuilder& builder) {
+                    builder.read(source);
+                    builder.write(target);
+                }, [=, this, &graph]() {
+                    if (i == 0)
+                        m_bloomGpuTimer.begin();
+                    bloomDownsamplePass(graph.texture(source), sourceSize, i == 0);
+                });
+            }
+
+            // Walk back up, adding the tent filtered smaller mip onto the larger one
+            for (size_t i = bloomChain.size(); i-- > 1;) {
+                const RenderResource source = bloomChain[i];
+                const RenderResource target = bloomChain[i - 1];
+                const glm::ivec2 sourceSize = bloomSizes[i];
+                graph.addPass(("BloomUp" + std::to_string(i - 1)).c_str(), [=](RenderGraph::PassBuilder& builder) {
+                    builder.read(source);
+                    builder.write(target);
+                }, [=, this, &graph]() {
+                    bloomUpsamplePass(graph.texture(source), sourceSize, bloomFilter);
+                });
+            }
+
+            // 将结果绘制到屏幕
+            const RenderResource bloomTop = bloomMips > 0 ? bloomChain.front() : RenderResource {};
+            graph.addPass("PostProcess", [=](RenderGraph::PassBuilder& builder) {
+                builder.read(sceneColor);
+                if (bloomMips > 0)
+                    builder.read(bloomTop);
+                builder.write(backbuffer);
+            }, [=, this, &graph]() {
+                texturePostProcess = graph.texture(sceneColor);
+                textureBloom = bloomMips > 0 ? graph.texture(bloomTop) : 0;
+                runPostProcess(bloomMips);
+                if (bloomMips > 0)
+                    m_bloomGpuTimer.end();
+            });
         }
 
+        graph.compile();
+        (ssaoEnabled && !showSolarSystem ? m_deferredGraphStats : m_forwardGraphStats) = graph.stats();
+        graph.execute();
+        m_renderTargets.endFrame();
+
         /*glDisable(GL_DEPTH_TEST);
         m_brdfShader.bind();
         renderQuad(quadVAO,quadVBO,quadVertices,20);
         glEnable(GL_DEPTH_TEST);*/
 
+        m_frameGpuTimer.end();
+        m_benchmark.onFrame(m_frameCpuTimer.end(), m_frameGpuTimer.lastMs(), m_framePacer.lastFrameMs());
+
         m_window.swapBuffers();
+        m_framePacer.endFrame();
+
+        if (texturesLoading) {
+            m_loadingMaxFrameMs = std::max(m_loadingMaxFrameMs, m_framePacer.lastFrameMs());
+            if (!m_textureLoader.busy())
+                reportTextureLoading();
+        }
+
+        // Startup ends with the first frame, which waited on every program it used
+        if (m_startupShaderStats.programs == 0)
+            reportStartupShaders();
     }
 
     glDeleteTextures(1, &normalTex);
@@ -595,6 +925,66 @@ void Application::generateHdrMap()
     // === Create HDR FrameBuffer ===
     glDepthFunc(GL_LEQUAL);
 
+    // Describes how the maps below are generated, change it with the generation so old cache files are not used.
+    // The shaders generating them are hashed into the key as well.
+    const std::string iblParameters = std::string(cpuEquirectToCube ? "cube 1024 reinhard cpu box, " : "cube 1024 reinhard, ") + "irradiance 32 delta 0.025, prefilter 128 5 mips source lod 32 << mip spp, sh9";
+    const IblCache iblCache(RESOURCE_ROOT "ibl_cache", hdrSamplePath, iblParameters,
+        { RESOURCE_ROOT "shaders/hdr_to_cube_vert.glsl", RESOURCE_ROOT "shaders/hdr_to_cube_frag.glsl",
+            RESOURCE_ROOT "shaders/hdr_cube_to_irradiance_frag.glsl", RESOURCE_ROOT "shaders/hdr_cube_to_prefilter_frag.glsl" });
+    const std::vector<IblCacheTexture> iblTextures {
+        { GL_TEXTURE_CUBE_MAP, hdrCubeMap.getTextureRef(), GL_RGB16F, GL_RGB },
+        { GL_TEXTURE_CUBE_MAP, hdrIrradianceMap.getTextureRef(), GL_RGB16F, GL_RGB },
+        { GL_TEXTURE_CUBE_MAP, hdrPrefilteredMap.getTextureRef(), GL_RGB16F, GL_RGB },
+    };
+
+    const auto uploadIrradianceSH = [this]() {
+        std::array<glm::vec4, 9> coefficients = m_irradianceSH.std140();
+        genUboBufferObj(coefficients, irradianceShUBO);
+    };
+
+    // Also kept for regenerating the prefiltered map at runtime, whether or not the maps come from the cache
+    ShaderBuilder hdrPrefilteredShaderBuilder;
+    hdrPrefilteredShaderBuilder
+        .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/hdr_to_cube_vert.glsl")
+        .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/hdr_cube_to_prefilter_frag.glsl");
+    m_hdrPrefilterShader = hdrPrefilteredShaderBuilder.submit();
+
+    m_iblTimer.begin();
+    std::vector<float> iblConstants;
+    m_iblFromCache = iblCache.load(iblTextures, iblConstants) && iblConstants.size() == 27;
+    if (m_iblFromCache) {
+        for (size_t k = 0; k < m_irradianceSH.coefficients.size(); ++k)
+            m_irradianceSH.coefficients[k] = glm::vec3(iblConstants[k * 3], iblConstants[k * 3 + 1], iblConstants[k * 3 + 2]);
+        uploadIrradianceSH();
+        glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+        std::cout << "IBL maps loaded from " << iblCache.file().string() << " in " << m_iblTimer.end() << " ms" << std::endl;
+        return;
+    }
+
+    // Only decoded when the maps have to be generated, once for both the GPU maps and the spherical harmonics
+    std::vector<uint16_t> hdrPixels;
+    int hdrWidth = 0, hdrHeight = 0;
+    try {
+        CpuTimer decodeTimer;
+        decodeTimer.begin();
+        const RgbeImage hdrImage(hdrSamplePath);
+        hdrWidth = hdrImage.width();
+        hdrHeight = hdrImage.height();
+        hdrPixels.resize(hdrImage.outputSize(RgbeOutput::HALF_RGB) / sizeof(uint16_t));
+        hdrImage.decode(RgbeOutput::HALF_RGB, hdrPixels.data());
+        std::cout << "HDR environment decoded in " << decodeTimer.end() << " ms (" << hdrWidth << " x " << hdrHeight << ")" << std::endl;
+    }
+    catch (const std::runtime_error& e) {
+        std::cerr << "Failed to load HDR image: " << e.what() << std::endl;
+        return;
+    }
+    // Projected from the same Reinhard mapped radiance the cube (and so the irradiance map) is made of
+    CpuTimer shTimer;
+    shTimer.begin();
+    m_irradianceSH = projectEquirect(hdrPixels.data(), hdrWidth, hdrHeight, 3, true).irradiance();
+    const float shProjectionMs = shTimer.end();
+    uploadIrradianceSH();
+
     try {
         glGenFramebuffers(1, &captureFBO);
         glGenRenderbuffers(1, &captureRBO);
@@ -608,37 +998,36 @@ void Application::generateHdrMap()
 
         // init cube to render hdr map
 
-        // This Shader convert HDR Texture we got and put it onto the hdr_cube_map
-        ShaderBuilder hdrToCubeMapShaderBuilder;
-        hdrToCubeMapShaderBuilder
-            .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/hdr_to_cube_vert.glsl")
-            .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/hdr_to_cube_frag.glsl");
-        m_hdrToCubeShader = hdrToCubeMapShaderBuilder.build();
-
-        m_hdrToCubeShader.bind();
-        glUniformMatrix4fv(m_hdrToCubeShader.getUniformLocation("projection"), 1, GL_FALSE, glm::value_ptr(captureProjection));
-
-        hdrTextureMap.bind(GL_TEXTURE0);
-        glUniform1i(m_hdrToCubeShader.getUniformLocation("equirectangularMap"), 0);
-
-        //glViewport(0, 0, 1024, 1024);//VIEWPORT
-        glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
-
-        glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-        for (GLuint i = 0; i < 6; ++i)
-        {
-            glUniformMatrix4fv(m_hdrToCubeShader.getUniformLocation("view"), 1, GL_FALSE, glm::value_ptr(captureViews[i]));
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, hdrCubeMap.getTextureRef(), 0);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        // The programs are submitted before the first is used so they compile side by side
 
-            renderHDRCubeMap(cubeVAO, cubeVBO, hdrMapVertices, 288);
+        // This Shader convert HDR Texture we got and put it onto the hdr_cube_map
+        if (!cpuEquirectToCube) {
+            ShaderBuilder hdrToCubeMapShaderBuilder;
+            hdrToCubeMapShaderBuilder
+                .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/hdr_to_cube_vert.glsl")
+                .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/hdr_to_cube_frag.glsl");
+            m_hdrToCubeShader = hdrToCubeMapShaderBuilder.submit();
         }
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-        //// let OpenGL generate mipmaps from first mip face (combatting visible dots artifact)
-        //glBindFramebuffer(GL_TEXTURE_CUBE_MAP, hdrCubeMap.getTextureRef());
-        //glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
-        //glBindFramebuffer(GL_TEXTURE_CUBE_MAP, 0);
+        ShaderBuilder hdrToIrradianceShaderBuilder;
+        hdrToIrradianceShaderBuilder
+            .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/hdr_to_cube_vert.glsl")
+            .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/hdr_cube_to_irradiance_frag.glsl");
+        m_hdrToIrradianceShader = hdrToIrradianceShaderBuilder.submit();
+
+        CpuTimer cubeTimer;
+        cubeTimer.begin();
+        if (cpuEquirectToCube) {
+            // Only the cube reaches the GPU, the source never needs GPU memory
+            hdrCubeMap.uploadHalfFaces(equirectToCube(hdrPixels.data(), hdrWidth, hdrHeight, HDR_CUBE_MAP_SIZE, true).data(), HDR_CUBE_MAP_SIZE);
+        } else {
+            hdrTextureMap = hdrTexture(hdrPixels.data(), hdrWidth, hdrHeight);
+            renderEquirectToCube(m_hdrToCubeShader, hdrTextureMap, hdrCubeMap);
+            // Not sampled again once the cube is made
+            hdrTextureMap = hdrTexture();
+        }
+        glFinish();
+        std::cout << "Environment cube made " << (cpuEquirectToCube ? "on the CPU" : "on the GPU") << " in " << cubeTimer.end() << " ms" << std::endl;
 
         // integral convolution to create hdr irridiance map
 
@@ -646,14 +1035,8 @@ void Application::generateHdrMap()
         glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
         glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 32, 32);  // rebuild buffer for irridiance map
 
-        ShaderBuilder hdrToIrradianceShaderBuilder;
-        hdrToIrradianceShaderBuilder
-            .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/hdr_to_cube_vert.glsl")
-            .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/hdr_cube_to_irradiance_frag.glsl");
-        m_hdrToIrradianceShader = hdrToIrradianceShaderBuilder.build();
-
         m_hdrToIrradianceShader.bind();
-        glUniformMatrix4fv(m_hdrToCubeShader.getUniformLocation("projection"), 1, GL_FALSE, glm::value_ptr(captureProjection));
+        glUniformMatrix4fv(m_hdrToIrradianceShader.getUniformLocation("projection"), 1, GL_FALSE, glm::value_ptr(captureProjection));
 
         hdrCubeMap.bind(GL_TEXTURE0);
         glUniform1i(m_hdrToIrradianceShader.getUniformLocation("environmentMap"), 0);
@@ -661,6 +1044,10 @@ void Application::generateHdrMap()
         glViewport(0, 0, 32, 32);
         glViewport(0, 0, 32, 32);
 
+        // glFinish on both sides so the time is the convolution alone, compared against the SH projection
+        glFinish();
+        CpuTimer irradianceTimer;
+        irradianceTimer.begin();
         glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
         for (GLuint i = 0; i < 6; ++i)
         {
@@ -671,200 +1058,934 @@ void Application::generateHdrMap()
             renderHDRCubeMap(cubeVAO, cubeVBO, hdrMapVertices, 288);
         }
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glFinish();
+        reportIrradianceSH(hdrPixels.data(), hdrWidth, hdrHeight, shProjectionMs, irradianceTimer.end());
 
 
         // enable seamless cubemap sampling for lower mip levels in the pre-filter map.
         glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
 
         // generate hdr prefiltered Map
-        ShaderBuilder hdrPrefilteredShaderBuilder;
-        hdrPrefilteredShaderBuilder
-            .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/hdr_to_cube_vert.glsl")
-            .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/hdr_cube_to_prefilter_frag.glsl");
-        m_hdrPrefilterShader = hdrPrefilteredShaderBuilder.build();
+        glFinish();
+        CpuTimer prefilterTimer;
+        prefilterTimer.begin();
+        for (int face = 0; face < PREFILTER_MIPS * 6; ++face)
+            renderPrefilterFace(hdrPrefilteredMap.getTextureRef(), face / 6, face % 6, prefilterFromSourceMips, prefilterSampleCount(face / 6));
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glFinish();
+        m_prefilterMs = prefilterTimer.end();
+        std::cout << "Prefiltered map generated in " << m_prefilterMs << " ms" << std::endl;
+
+        // only needed while the IBL maps are baked
+        glDeleteFramebuffers(1, &captureFBO);
+        glDeleteRenderbuffers(1, &captureRBO);
+
+        // Reading the maps back waits for the GPU, so the time includes the generation itself
+        std::vector<float> shConstants;
+        for (const glm::vec3& coefficient : m_irradianceSH.coefficients)
+            shConstants.insert(shConstants.end(), { coefficient.r, coefficient.g, coefficient.b });
+        iblCache.save(iblTextures, shConstants);
+        std::cout << "IBL maps generated in " << m_iblTimer.end() << " ms, saved to " << iblCache.file().string() << std::endl;
+    }
 
-        m_hdrPrefilterShader.bind();
+    catch (std::runtime_error e) {
+        std::cerr << e.what() << std::endl;
+    }
+}
 
-        glUniformMatrix4fv(m_hdrPrefilterShader.getUniformLocation("projection"), 1, GL_FALSE, glm::value_ptr(captureProjection));
+/**
+ * GGX samples per texel of a prefiltered mip. Mip 0 is a mirror, one sample is exact; wider lobes get more,
+ * the source mips keep them from aliasing.
+ */
+int Application::prefilterSampleCount(int mip) const
+{
+    return mip == 0 ? 1 : std::min(32 << mip, PREFILTER_REFERENCE_SAMPLES);
+}
 
-        hdrCubeMap.bind(GL_TEXTURE0);
-        glUniform1i(m_hdrPrefilterShader.getUniformLocation("environmentMap"), 0);
+/**
+ * Renders one face of one mip of a prefiltered map from hdrCubeMap, into the prefilter framebuffer.
+ */
+void Application::renderPrefilterFace(GLuint cubeMap, int mip, int face, bool fromSourceMips, int sampleCount)
+{
+    if (m_prefilterFBO == 0)
+        glGenFramebuffers(1, &m_prefilterFBO);
+
+    // No depth attachment, the cube covers every texel once
+    glBindFramebuffer(GL_FRAMEBUFFER, m_prefilterFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + static_cast<GLenum>(face), cubeMap, mip);
+    glViewport(0, 0, PREFILTER_SIZE >> mip, PREFILTER_SIZE >> mip);
+
+    m_hdrPrefilterShader.bind();
+    glUniformMatrix4fv(m_hdrPrefilterShader.getUniformLocation("projection"), 1, GL_FALSE, glm::value_ptr(captureProjection));
+    glUniformMatrix4fv(m_hdrPrefilterShader.getUniformLocation("view"), 1, GL_FALSE, glm::value_ptr(captureViews[face]));
+    // A float: set with glUniform1i it was truncated to 0 for every mip but the last
+    glUniform1f(m_hdrPrefilterShader.getUniformLocation("roughness"), static_cast<float>(mip) / (PREFILTER_MIPS - 1));
+    glUniform1i(m_hdrPrefilterShader.getUniformLocation("sampleCount"), sampleCount);
+    glUniform1f(m_hdrPrefilterShader.getUniformLocation("sourceResolution"), static_cast<float>(HDR_CUBE_MAP_SIZE));
+    glUniform1i(m_hdrPrefilterShader.getUniformLocation("useSourceMips"), fromSourceMips);
+
+    hdrCubeMap.bind(GL_TEXTURE0);
+    glUniform1i(m_hdrPrefilterShader.getUniformLocation("environmentMap"), 0);
+
+    renderHDRCubeMap(cubeVAO, cubeVBO, hdrMapVertices, 288);
+}
 
-        glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-        GLuint maxMipLevels = 5;
-        for (GLuint mip = 0; mip < maxMipLevels; ++mip)
-        {
-            // reisze framebuffer according to mip-level size.
-            GLuint mipWidth = static_cast<GLuint>(128 * std::pow(0.5, mip));
-            GLuint mipHeight = static_cast<GLuint>(128 * std::pow(0.5, mip));
-            glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-            glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, mipWidth, mipHeight);
-            glViewport(0, 0, mipWidth, mipHeight);
+/**
+ * Starts regenerating the prefiltered map into a new cube, prefilterFacesPerFrame faces each frame.
+ */
+void Application::startPrefilter()
+{
+    m_prefilterTarget = std::make_unique<cubeMapTex>(RENDER_PRE_FILTER_HDR_MAP);
+    m_prefilterNextFace = 0;
+    m_prefilterFrames = 0;
+    m_prefilterMs = 0.0f;
+}
 
-            float roughness = (float)mip / (float)(maxMipLevels - 1);
-            glUniform1i(m_hdrPrefilterShader.getUniformLocation("roughness"), roughness);
+/**
+ * Renders the next maxFaces faces of a running regeneration. The finished cube replaces hdrPrefilteredMap
+ * as a whole, so the lighting never samples a partly updated map.
+ */
+void Application::stepPrefilter(int maxFaces)
+{
+    if (!m_prefilterTarget)
+        return;
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    CpuTimer stepTimer;
+    stepTimer.begin();
+    for (int i = 0; i < maxFaces && m_prefilterNextFace < PREFILTER_MIPS * 6; ++i, ++m_prefilterNextFace) {
+        const int mip = m_prefilterNextFace / 6;
+        renderPrefilterFace(m_prefilterTarget->getTextureRef(), mip, m_prefilterNextFace % 6, prefilterFromSourceMips, prefilterSampleCount(mip));
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    // Submission time only, the GPU work overlaps the frame
+    m_prefilterMs += stepTimer.end();
+    ++m_prefilterFrames;
+
+    if (m_prefilterNextFace == PREFILTER_MIPS * 6) {
+        std::swap(hdrPrefilteredMap.getTextureRef(), m_prefilterTarget->getTextureRef());
+        m_prefilterTarget.reset();
+        std::cout << "Prefiltered map regenerated over " << m_prefilterFrames << " frames, " << m_prefilterMs << " ms submitting" << std::endl;
+    }
+}
 
-            for (GLuint i = 0; i < 6; ++i)
-            {
-                glUniformMatrix4fv(m_hdrPrefilterShader.getUniformLocation("view"), 1, GL_FALSE, glm::value_ptr(captureViews[i]));
-                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, hdrPrefilteredMap.getTextureRef(), mip);
+/**
+ * Prefilters into temporary cubes with source mips, and from the top level only with 1024 samples as before,
+ * and prints the time of each and their error against a top level reference with PREFILTER_REFERENCE_SAMPLES.
+ */
+void Application::comparePrefilter()
+{
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    // Every mip of a prefiltered cube, faces in GL order
+    const auto prefilter = [this](bool fromSourceMips, int sampleCount, float& ms) {
+        cubeMapTex cube(RENDER_PRE_FILTER_HDR_MAP);
+        glFinish();
+        CpuTimer timer;
+        timer.begin();
+        for (int face = 0; face < PREFILTER_MIPS * 6; ++face) {
+            const int mip = face / 6;
+            renderPrefilterFace(cube.getTextureRef(), mip, face % 6, fromSourceMips, sampleCount > 0 ? sampleCount : prefilterSampleCount(mip));
+        }
+        glFinish();
+        ms = timer.end();
+
+        std::vector<std::vector<float>> mips(PREFILTER_MIPS);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, cube.getTextureRef());
+        for (int mip = 0; mip < PREFILTER_MIPS; ++mip) {
+            std::vector<float>& texels = mips[static_cast<size_t>(mip)];
+            const size_t faceSize = size_t(PREFILTER_SIZE >> mip) * size_t(PREFILTER_SIZE >> mip) * 3;
+            texels.resize(faceSize * 6);
+            for (size_t face = 0; face < 6; ++face)
+                glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + static_cast<GLenum>(face), mip, GL_RGB, GL_FLOAT, texels.data() + face * faceSize);
+        }
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        return mips;
+    };
 
-                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-                renderHDRCubeMap(cubeVAO, cubeVBO, hdrMapVertices, 288);
+    try {
+        float referenceMs, mipFilteredMs, topLevelMs;
+        const auto reference = prefilter(false, PREFILTER_REFERENCE_SAMPLES, referenceMs);
+        const auto mipFiltered = prefilter(true, 0, mipFilteredMs);
+        const auto topLevel = prefilter(false, 1024, topLevelMs);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+        // Relative RMS error of one mip: |a - reference| / |reference| over all texels and channels
+        const auto error = [&](const std::vector<std::vector<float>>& result, size_t mip) {
+            double difference = 0.0, magnitude = 0.0;
+            for (size_t i = 0; i < reference[mip].size(); ++i) {
+                const double d = double(result[mip][i]) - double(reference[mip][i]);
+                difference += d * d;
+                magnitude += double(reference[mip][i]) * double(reference[mip][i]);
             }
+            return 100.0 * std::sqrt(difference / std::max(magnitude, 1e-12));
+        };
+
+        char line[160];
+        std::snprintf(line, sizeof(line), "Prefilter: source mips %.2f ms, top level 1024 spp %.2f ms, reference %d spp %.2f ms",
+            double(mipFilteredMs), double(topLevelMs), PREFILTER_REFERENCE_SAMPLES, double(referenceMs));
+        std::cout << line << std::endl;
+        for (int mip = 0; mip < PREFILTER_MIPS; ++mip) {
+            std::snprintf(line, sizeof(line), "  mip %d (%4d spp): error %.3f%% with source mips, %.3f%% top level", mip, prefilterSampleCount(mip),
+                error(mipFiltered, static_cast<size_t>(mip)), error(topLevel, static_cast<size_t>(mip)));
+            std::cout << line << std::endl;
         }
+    }
+    catch (const std::runtime_error& e) {
+        std::cerr << e.what() << std::endl;
+    }
+}
+
+/**
+ * Renders an equirectangular HDR texture onto the faces of a cube with hdr_to_cube_frag.glsl and rebuilds its mips.
+ */
+void Application::renderEquirectToCube(const Shader& shader, hdrTexture& equirect, cubeMapTex& cube)
+{
+    GLuint fbo;
+    glGenFramebuffers(1, &fbo);
+
+    shader.bind();
+    glUniformMatrix4fv(shader.getUniformLocation("projection"), 1, GL_FALSE, glm::value_ptr(captureProjection));
+
+    equirect.bind(GL_TEXTURE0);
+    glUniform1i(shader.getUniformLocation("equirectangularMap"), 0);
+
+    glViewport(0, 0, HDR_CUBE_MAP_SIZE, HDR_CUBE_MAP_SIZE);
+
+    // No depth attachment, the cube covers every texel once
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    for (GLuint i = 0; i < 6; ++i)
+    {
+        glUniformMatrix4fv(shader.getUniformLocation("view"), 1, GL_FALSE, glm::value_ptr(captureViews[i]));
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, cube.getTextureRef(), 0);
+        renderHDRCubeMap(cubeVAO, cubeVBO, hdrMapVertices, 288);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+
+    // let OpenGL generate mipmaps from first mip face (combatting visible dots artifact), the prefilter picks its source level from them
+    glBindTexture(GL_TEXTURE_CUBE_MAP, cube.getTextureRef());
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+}
+
+/**
+ * Makes the environment cube both ways from a fresh decode and prints their time, the GPU memory each needs
+ * at its peak and how far the CPU resampling is from the shader.
+ */
+void Application::compareEquirectToCube()
+{
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    try {
+        const RgbeImage image(hdrSamplePath);
+        std::vector<uint16_t> pixels(image.outputSize(RgbeOutput::HALF_RGB) / sizeof(uint16_t));
+        image.decode(RgbeOutput::HALF_RGB, pixels.data());
+
+        ShaderBuilder hdrToCubeMapShaderBuilder;
+        hdrToCubeMapShaderBuilder
+            .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/hdr_to_cube_vert.glsl")
+            .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/hdr_to_cube_frag.glsl");
+        const Shader hdrToCubeShader = hdrToCubeMapShaderBuilder.build();
+
+        glFinish();
+        CpuTimer timer;
+        timer.begin();
+        cubeMapTex cpuCube(RENDER_HDR_CUBE_MAP);
+        cpuCube.uploadHalfFaces(equirectToCube(pixels.data(), image.width(), image.height(), HDR_CUBE_MAP_SIZE, true).data(), HDR_CUBE_MAP_SIZE);
+        glFinish();
+        const float cpuMs = timer.end();
+
+        timer.begin();
+        hdrTexture equirect(pixels.data(), image.width(), image.height());
+        cubeMapTex gpuCube(RENDER_HDR_CUBE_MAP);
+        renderEquirectToCube(hdrToCubeShader, equirect, gpuCube);
+        glFinish();
+        const float gpuMs = timer.end();
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+        // Level 0 of both, the difference is mostly the filtering: the shader takes one bilinear tap per texel
+        const size_t faceValues = size_t(HDR_CUBE_MAP_SIZE) * HDR_CUBE_MAP_SIZE * 3;
+        std::vector<float> cpuFace(faceValues), gpuFace(faceValues);
+        double difference = 0.0, magnitude = 0.0;
+        for (GLuint face = 0; face < 6; ++face) {
+            glBindTexture(GL_TEXTURE_CUBE_MAP, cpuCube.getTextureRef());
+            glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGB, GL_FLOAT, cpuFace.data());
+            glBindTexture(GL_TEXTURE_CUBE_MAP, gpuCube.getTextureRef());
+            glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGB, GL_FLOAT, gpuFace.data());
+            for (size_t i = 0; i < faceValues; ++i) {
+                const double d = double(cpuFace[i]) - double(gpuFace[i]);
+                difference += d * d;
+                magnitude += double(gpuFace[i]) * double(gpuFace[i]);
+            }
+        }
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+        // RGB16F: the cube with its mips, plus the equirect texture for the shader path
+        const double cubeMB = 6.0 * faceValues * sizeof(uint16_t) * 4.0 / 3.0 / (1024.0 * 1024.0);
+        const double equirectMB = double(pixels.size()) * sizeof(uint16_t) / (1024.0 * 1024.0);
+        char line[200];
+        std::snprintf(line, sizeof(line), "Environment cube: CPU %.1f ms, %.0f MB GPU peak; GPU %.1f ms, %.0f MB GPU peak; relative RMS difference %.3f%%",
+            double(cpuMs), cubeMB, double(gpuMs), cubeMB + equirectMB, 100.0 * std::sqrt(difference / std::max(magnitude, 1e-12)));
+        std::cout << line << std::endl;
+    }
+    catch (const std::runtime_error& e) {
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        std::cerr << e.what() << std::endl;
+    }
+}
+
+/**
+ * Decodes the environment HDR with stbi_loadf (floats) and RgbeImage (half floats and RGB9E5), and prints the
+ * time of each, the memory each holds at its peak and the largest difference between the two.
+ */
+void Application::compareHdrDecoders() const
+{
+    try {
+        CpuTimer timer;
+        timer.begin();
+        // Flipped for this load only, the other stbi loads on this thread expect top to bottom rows
+        stbi_set_flip_vertically_on_load_thread(1);
+        int width = 0, height = 0, channels = 0;
+        const std::unique_ptr<float, decltype(&stbi_image_free)> stbPixels(
+            stbi_loadf(hdrSamplePath.string().c_str(), &width, &height, &channels, 3), &stbi_image_free);
+        stbi_set_flip_vertically_on_load_thread(0);
+        const float stbMs = timer.end();
+        if (!stbPixels) {
+            std::cerr << "stbi_loadf failed on " << hdrSamplePath.string() << std::endl;
+            return;
+        }
+
+        timer.begin();
+        const RgbeImage image(hdrSamplePath);
+        std::vector<uint16_t> halfPixels(image.outputSize(RgbeOutput::HALF_RGB) / sizeof(uint16_t));
+        image.decode(RgbeOutput::HALF_RGB, halfPixels.data());
+        const float halfMs = timer.end();
+
+        timer.begin();
+        std::vector<uint32_t> sharedExponentPixels(image.outputSize(RgbeOutput::RGB9E5) / sizeof(uint32_t));
+        image.decode(RgbeOutput::RGB9E5, sharedExponentPixels.data());
+        const float rgb9e5Ms = timer.end();
+
+        // RGBE has 8 bit mantissas, both decoders should agree up to the half's rounding
+        float maxError = 0.0f;
+        for (size_t i = 0; i < halfPixels.size(); ++i) {
+            const float reference = stbPixels.get()[i];
+            maxError = std::max(maxError, std::abs(glm::unpackHalf1x16(halfPixels[i]) - reference) / std::max(reference, 1e-4f));
+        }
+
+        // Heap held at the peak: the decoded image and the row buffers; the mapped file is page cache, not heap
+        const size_t texels = size_t(width) * size_t(height);
+        const size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+        const size_t rowBytes = numThreads * size_t(width) * 16;
+        const double stbMB = double(texels * 3 * sizeof(float) + size_t(width) * 4) / (1024.0 * 1024.0);
+        const double halfMB = double(texels * RgbeImage::texelSize(RgbeOutput::HALF_RGB) + rowBytes) / (1024.0 * 1024.0);
+        const double rgb9e5MB = double(texels * RgbeImage::texelSize(RgbeOutput::RGB9E5) + rowBytes) / (1024.0 * 1024.0);
+
+        char line[200];
+        std::snprintf(line, sizeof(line), "HDR decode %d x %d: stbi_loadf %.1f ms %.0f MB, half %.1f ms %.0f MB, RGB9E5 %.1f ms %.0f MB (%zu threads), max relative difference %.5f",
+            width, height, double(stbMs), stbMB, double(halfMs), halfMB, double(rgb9e5Ms), rgb9e5MB, numThreads, double(maxError));
+        std::cout << line << std::endl;
+    }
+    catch (const std::runtime_error& e) {
+        std::cerr << e.what() << std::endl;
+    }
+}
+
+/**
+ * Uploads the split-sum BRDF LUT, integrated on the CPU the first time and read from the cache after that.
+ */
+void Application::generateBrdfLut()
+{
+    CpuTimer lutTimer;
+    lutTimer.begin();
+    bool fromCache = false;
+    const std::vector<float> lut = loadBrdfLut(RESOURCE_ROOT "ibl_cache", fromCache);
+    BRDFTexture = Texture(BRDF_2D_TEXTURE, lut.data());
+    const float lutMs = lutTimer.end();
+
+    if (fromCache) {
+        std::cout << "BRDF LUT loaded from the cache in " << lutMs << " ms" << std::endl;
+        return;
+    }
+    std::cout << "BRDF LUT integrated on the CPU in " << lutMs << " ms" << std::endl;
+    verifyBrdfLut(lut);
+}
+
+/**
+ * Renders the LUT with brdf_frag.glsl as it used to be made at startup, and prints its time and difference to the CPU LUT.
+ */
+void Application::verifyBrdfLut(const std::vector<float>& lut)
+{
+    try {
+        glFinish();
+        CpuTimer gpuTimer;
+        gpuTimer.begin();
+
+        ShaderBuilder brdfShaderBuilder;
+        brdfShaderBuilder
+            .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/texture_vert.glsl")
+            .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/brdf_frag.glsl");
+        m_brdfShader = brdfShaderBuilder.build();
+
+        Texture gpuLut(BRDF_2D_TEXTURE);
+        GLuint fbo;
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gpuLut.getTextureRef(), 0);
+        glViewport(0, 0, BRDF_LUT_SIZE, BRDF_LUT_SIZE);
+        m_brdfShader.bind();
+        renderQuad(quadVAO, quadVBO, quadVertices, 20);
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &fbo);
+
+        // What a startup paid before: the compile, the draw and waiting for it
+        std::vector<float> gpuPixels(lut.size());
+        glBindTexture(GL_TEXTURE_2D, gpuLut.getTextureRef());
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RG, GL_FLOAT, gpuPixels.data());
+        glBindTexture(GL_TEXTURE_2D, 0);
+        const float gpuMs = gpuTimer.end();
+
+        // Both are compared after the RG16F round trip
+        std::vector<float> cpuPixels(lut.size());
+        Texture cpuLut(BRDF_2D_TEXTURE, lut.data());
+        glBindTexture(GL_TEXTURE_2D, cpuLut.getTextureRef());
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RG, GL_FLOAT, cpuPixels.data());
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        float maxError = 0.0f;
+        double sumError = 0.0;
+        for (size_t i = 0; i < lut.size(); ++i) {
+            const float error = std::abs(cpuPixels[i] - gpuPixels[i]);
+            maxError = std::max(maxError, error);
+            sumError += double(error);
+        }
+
+        // A later startup only reads the cache file
+        CpuTimer loadTimer;
+        loadTimer.begin();
+        bool fromCache = false;
+        loadBrdfLut(RESOURCE_ROOT "ibl_cache", fromCache);
+        const float loadMs = loadTimer.end();
+
+        char line[200];
+        std::snprintf(line, sizeof(line), "BRDF LUT: GPU render %.2f ms vs %.2f ms from the cache, %.2f ms saved per startup; |CPU - GPU| max %.5f mean %.6f",
+            double(gpuMs), double(loadMs), double(gpuMs - loadMs), double(maxError), sumError / double(lut.size()));
+        std::cout << line << std::endl;
+    }
+    catch (const std::runtime_error& e) {
+        std::cerr << e.what() << std::endl;
+    }
+}
+
+/**
+ * Prints how far the SH irradiance is from a CPU run of the irradiance shader's loop, and the time of
+ * the SH projection against the GPU convolution.
+ */
+void Application::reportIrradianceSH(const uint16_t* pixels, int width, int height, float projectionMs, float gpuMs) const
+{
+    // Axes, and diagonals that fall between the irradiance map's texels
+    std::vector<glm::vec3> normals { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+    for (int i = 0; i < 8; ++i)
+        normals.push_back(glm::normalize(glm::vec3(i & 1 ? 1 : -1, i & 2 ? 1 : -1, i & 4 ? 1 : -1)));
+
+    float maxError = 0.0f;
+    double sumSquaredError = 0.0;
+    for (const glm::vec3& normal : normals) {
+        const glm::vec3 reference = integrateIrradiance(pixels, width, height, 3, true, normal, 0.025f);
+        const glm::vec3 sh = glm::max(m_irradianceSH.evaluate(normal), glm::vec3(0.0f));
+        const float error = glm::length(sh - reference) / std::max(glm::length(reference), 1e-4f);
+        maxError = std::max(maxError, error);
+        sumSquaredError += double(error) * double(error);
+    }
+
+    char line[160];
+    std::snprintf(line, sizeof(line), "SH9 irradiance: %.2f ms on the CPU vs %.2f ms GPU convolution, relative error max %.2f%% rms %.2f%% over %zu normals",
+        double(projectionMs), double(gpuMs), 100.0 * double(maxError), 100.0 * std::sqrt(sumSquaredError / double(normals.size())), normals.size());
+    std::cout << line << std::endl;
+}
+
+/**
+ * generate deferred rendering buffer before the pipeline begin, this should be only excuted once
+ */
+void Application::genDeferredRenderBuffer(bool& defRenderBufferGenerated)
+{
+    // deferred rendering pipeline generation
+    if (!defRenderBufferGenerated) {
+        try
+        {
+            // Submitted together, the first deferred frame waits on each as it is used
+            ShaderBuilder shaderGeometryPassBuilder;
+            shaderGeometryPassBuilder
+                .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/deferred_render/gGeo_shader_vert.glsl")
+                .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/deferred_render/gGeo_shader_frag.glsl");
+            m_shaderGeometryPass = shaderGeometryPassBuilder.submit();
+
+            ShaderBuilder shaderLightingPassBuilder;
+            shaderLightingPassBuilder
+                .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/deferred_render/deferred_gLight_vert.glsl")
+                .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/deferred_render/deferred_gLight_frag.glsl");
+            m_shaderLightingPass = shaderLightingPassBuilder.submit();
+
+            ShaderBuilder tiledLightingPassBuilder;
+            tiledLightingPassBuilder
+                .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/deferred_render/deferred_tile_vert.glsl")
+                .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/deferred_render/deferred_gLight_frag.glsl");
+            m_tiledLightingShader = tiledLightingPassBuilder.submit();
+
+            ShaderBuilder lightVolumeBuilder;
+            lightVolumeBuilder
+                .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/deferred_render/deferred_light_volume_vert.glsl")
+                .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/deferred_render/deferred_gLight_frag.glsl");
+            m_lightVolumeShader = lightVolumeBuilder.submit();
+
+            ShaderBuilder tileDepthBuilder;
+            tileDepthBuilder
+                .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/deferred_render/deferred_gLight_vert.glsl")
+                .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/deferred_render/deferred_tile_depth_frag.glsl");
+            m_tileDepthShader = tileDepthBuilder.submit();
+
+            ShaderBuilder ssaoBuilder;
+            ssaoBuilder
+                .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/deferred_render/deferred_gLight_vert.glsl")
+                .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/deferred_render/ssao_frag.glsl");
+            m_shaderSSAO = ssaoBuilder.submit();
+
+            ShaderBuilder ssaoBlurBuilder;
+            ssaoBlurBuilder
+                .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/deferred_render/deferred_gLight_vert.glsl")
+                .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/deferred_render/ssao_blur_frag.glsl");
+            m_shaderSSAOBlur = ssaoBlurBuilder.submit();
+
+            ShaderBuilder ssaoTemporalBuilder;
+            ssaoTemporalBuilder
+                .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/deferred_render/deferred_gLight_vert.glsl")
+                .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/deferred_render/ssao_temporal_frag.glsl");
+            m_shaderSSAOTemporal = ssaoTemporalBuilder.submit();
+
+
+            ShaderBuilder deferredLightShaderBuilder;
+            deferredLightShaderBuilder
+                .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/lights/deferred_light_vert.glsl")
+                .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/lights/light_frag.glsl");
+            m_deferredLightShader = deferredLightShaderBuilder.submit();
+
+            ShaderBuilder deferredFBOdebugShaderBuilder;
+            deferredFBOdebugShaderBuilder
+                .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/deferred_render/deferred_fbo_debug_vert.glsl")
+                .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/deferred_render/deferred_fbo_debug_frag.glsl");
+            m_deferredDebugShader = deferredFBOdebugShaderBuilder.submit();
+
+            // the G-buffer and tile depth targets come from m_renderTargets each frame, sized to the render size
+
+            initSSAO();
+
+            generateRandomLights(MAX_LIGHT_CNT);
+        }
+        catch (std::runtime_error e)
+        {
+            std::cerr << e.what() << std::endl;
+        }
+
+        defRenderBufferGenerated = true;
+    }
+}
+
+void Application::deferredRenderPipeLine()
+{
+
+}
+
+/**
+ * Reduces the G-buffer depth to a view depth range per DEFERRED_TILE_SIZE tile, into the tile depth target
+ * bound by the render graph, and bins the lights into the same screen tiles.
+ */
+void Application::tileDepthPass(const glm::mat4& view, const glm::mat4& projection)
+{
+    const glm::ivec2 gBufferSize = m_renderTargets.renderSize();
+
+    glDisable(GL_DEPTH_TEST);
+    m_tileDepthShader.bind();
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, gDepth);
+    glUniform1i(m_tileDepthShader.getUniformLocation("gDepth"), 0);
+    glUniform1i(m_tileDepthShader.getUniformLocation("tileSize"), DEFERRED_TILE_SIZE);
+    glUniform2iv(m_tileDepthShader.getUniformLocation("gBufferSize"), 1, glm::value_ptr(gBufferSize));
+    glUniform2f(m_tileDepthShader.getUniformLocation("depthUnproject"), projection[2][2], projection[3][2]);
+    renderQuad(quadVAO, quadVBO, quadVertices, 20);
+    glEnable(GL_DEPTH_TEST);
+
+    // Bin the lights into the screen tiles, the depth bounds are tested per tile on the GPU
+    m_deferredTiles.build(m_lightStore.positionRadius(), view, projection, gBufferSize, TRACKBALL_NEAR, TRACKBALL_FAR, m_framePacer.slot());
+}
+
+/**
+ * Lights the G-buffer into the scene framebuffer bound by the render graph with the selected deferred lighting mode.
+ * The G-buffer depth is copied over first so light volumes and forward rendered objects can test against it.
+ */
+void Application::deferredLightingPass(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& cameraPos)
+{
+    const glm::ivec2 gBufferSize = m_renderTargets.renderSize();
+    const glm::ivec2 outputSize = m_renderTargets.outputSize();
+    const glm::ivec2 tileCount = (gBufferSize + DEFERRED_TILE_SIZE - 1) / DEFERRED_TILE_SIZE;
+
+    GLint sceneFramebuffer;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &sceneFramebuffer);
+
+    glDisable(GL_DEPTH_TEST);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+    // copy depth buffer to the scene framebuffer's depth buffer
+    gBuffer = m_renderTargets.framebuffer({ gNor, gCol }, gDepth);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, gBuffer);
+    glBlitFramebuffer(0, 0, gBufferSize.x, gBufferSize.y, 0, 0, outputSize.x, outputSize.y, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(sceneFramebuffer));
+
+    glDepthMask(GL_FALSE);
+
+    switch (deferredLightingMode) {
+    case DeferredLightingMode::FULLSCREEN:
+        m_shaderLightingPass.bind();
+        bindDeferredLightingInputs(m_shaderLightingPass, view, projection, cameraPos);
+        renderQuad(quadVAO, quadVBO, quadVertices, 20);
+        break;
+
+    case DeferredLightingMode::TILED:
+        // One quad per tile, sky tiles are dropped in the vertex shader
+        m_tiledLightingShader.bind();
+        bindDeferredLightingInputs(m_tiledLightingShader, view, projection, cameraPos);
+        m_deferredTiles.bind(m_tiledLightingShader, 8);
+
+        glActiveTexture(GL_TEXTURE10);
+        glBindTexture(GL_TEXTURE_2D, tileDepthTex);
+        glUniform1i(m_tiledLightingShader.getUniformLocation("tileDepthBounds"), 10);
+        glUniform2f(m_tiledLightingShader.getUniformLocation("gBufferSize"), static_cast<float>(gBufferSize.x), static_cast<float>(gBufferSize.y));
+
+        renderQuadInstanced(quadVAO, quadVBO, quadVertices, 20, tileCount.x * tileCount.y);
+        break;
+
+    default:
+        lightVolumePass(view, projection, cameraPos);
+        break;
+    }
+
+    glDepthMask(GL_TRUE);
+    glEnable(GL_DEPTH_TEST);
+}
+
+/**
+ * Binds the G-buffer and the light store and sets the uniforms shared by all deferred lighting shaders.
+ */
+void Application::bindDeferredLightingInputs(const Shader& shader, const glm::mat4& view, const glm::mat4& projection, const glm::vec3& cameraPos)
+{
+    const GLuint gBufferTextures[] = { gNor, gCol, gDepth };
+    for (GLuint i = 0; i < 3; ++i) {
+        glActiveTexture(GL_TEXTURE1 + i);
+        glBindTexture(GL_TEXTURE_2D, gBufferTextures[i]);
+    }
 
+    glUniform1i(shader.getUniformLocation("gNormal"), 1);
+    glUniform1i(shader.getUniformLocation("gAlbedoSpec"), 2);
+    glUniform1i(shader.getUniformLocation("gDepth"), 3);
+
+    glActiveTexture(GL_TEXTURE11);
+    glBindTexture(GL_TEXTURE_2D, ssaoTex);
+    glUniform1i(shader.getUniformLocation("ssaoOcclusion"), 11);
+    glUniform1i(shader.getUniformLocation("useOcclusion"), ssaoTex != 0);
+    glUniform1i(shader.getUniformLocation("showOcclusion"), ssaoShowOcclusion);
+
+    m_lightStore.bind(shader, 4);
+    glUniform1i(shader.getUniformLocation("firstLight"), 0);
+    glUniform1i(shader.getUniformLocation("addAmbient"), GL_TRUE);
+
+    const glm::mat4 invViewProjection = glm::inverse(projection * view);
+    glUniformMatrix4fv(shader.getUniformLocation("view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(shader.getUniformLocation("invViewProjection"), 1, GL_FALSE, glm::value_ptr(invViewProjection));
+    glUniform3fv(shader.getUniformLocation("viewPos"), 1, glm::value_ptr(cameraPos));
+    const glm::ivec2 outputSize = m_renderTargets.outputSize();
+    glUniform2f(shader.getUniformLocation("viewportSize"), static_cast<float>(outputSize.x), static_cast<float>(outputSize.y));
+}
 
-        // Gen BRDF Texture
-        ShaderBuilder brdfShaderBuilder;
-        brdfShaderBuilder
-            .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/texture_vert.glsl")
-            .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/brdf_frag.glsl");
-        m_brdfShader = brdfShaderBuilder.build();
+/**
+ * Stencil light volume fallback: an ambient pass, then per light a stencil pass marking the pixels whose
+ * G-buffer surface lies inside the light's volume (a cube around its radius) and a shading pass for those pixels.
+ */
+void Application::lightVolumePass(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& cameraPos)
+{
+    m_shaderLightingPass.bind();
+    bindDeferredLightingInputs(m_shaderLightingPass, view, projection, cameraPos);
+    glUniform1i(m_shaderLightingPass.getUniformLocation("LightCount"), 0);
+    renderQuad(quadVAO, quadVBO, quadVertices, 20);
+
+    m_lightVolumeShader.bind();
+    bindDeferredLightingInputs(m_lightVolumeShader, view, projection, cameraPos);
+    glUniform1i(m_lightVolumeShader.getUniformLocation("LightCount"), 1);
+    glUniform1i(m_lightVolumeShader.getUniformLocation("addAmbient"), GL_FALSE);
+
+    glEnable(GL_STENCIL_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+
+    const glm::mat4 viewProjection = projection * view;
+    const std::vector<glm::vec4>& lights = m_lightStore.positionRadius();
+    for (size_t i = 0; i < lights.size(); ++i) {
+        glm::mat4 volumeMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(lights[i]));
+        volumeMatrix = viewProjection * glm::scale(volumeMatrix, glm::vec3(lights[i].w));
+
+        // Faces behind the G-buffer surface change the stencil, front and back cancel out unless the
+        // surface is inside the volume. Works for either winding and with the camera inside the volume.
+        m_deferredLightShader.bind();
+        glUniformMatrix4fv(m_deferredLightShader.getUniformLocation("mvpMatrix"), 1, GL_FALSE, glm::value_ptr(volumeMatrix));
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glEnable(GL_DEPTH_TEST);
+        glStencilFunc(GL_ALWAYS, 0, 0xFF);
+        glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+        glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+        renderHDRCubeMap(cubeVAO, cubeVBO, hdrMapVertices, 288);
+
+        // Shade the marked pixels once and reset their stencil for the next light
+        m_lightVolumeShader.bind();
+        glUniformMatrix4fv(m_lightVolumeShader.getUniformLocation("mvpMatrix"), 1, GL_FALSE, glm::value_ptr(volumeMatrix));
+        glUniform1i(m_lightVolumeShader.getUniformLocation("firstLight"), static_cast<GLint>(i));
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDisable(GL_DEPTH_TEST);
+        glStencilFunc(GL_NOTEQUAL, 0, 0xFF);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
+        renderHDRCubeMap(cubeVAO, cubeVBO, hdrMapVertices, 288);
+    }
 
-        glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-        glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 512, 512);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, BRDFTexture.getTextureRef(), 0);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+    glDisable(GL_BLEND);
+    glDisable(GL_STENCIL_TEST);
+}
 
-        glViewport(0, 0, 512, 512);
+/**
+ * Replaces the lights with the two default point lights of the forward scene.
+ */
+void Application::resetLights()
+{
+    m_lightStore.clear();
 
-        m_brdfShader.bind();
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    selectedLight = m_lightStore.add(
+        { glm::vec3(1, 3, -2), glm::vec3(1), -glm::vec3(0, 0, 3), false, false, /*std::nullopt*/ }
+    );
 
-        renderQuad(quadVAO, quadVBO, quadVertices, 20);
+    m_lightStore.add(
+        { glm::vec3(-1, 3, 2), glm::vec3(1), -glm::vec3(0, 0, 3), false, false, /*std::nullopt*/ }
+    );
+}
 
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+/**
+ * Replaces the lights with randomly placed and colored point lights.
+ */
+void Application::generateRandomLights(int count, float linear, float quadratic)
+{
+    m_lightStore.clear();
+    m_lightStore.reserve(static_cast<size_t>(count));
+    for (GLint i = 0; i < count; ++i) {
+
+        float xPos = static_cast<float>(((rand() % 100) / 100.0) * 6.0 - 3.0);
+        float yPos = static_cast<float>(((rand() % 100) / 100.0) * 6.0 - 4.0);
+        float zPos = static_cast<float>(((rand() % 100) / 100.0) * 6.0 - 3.0);
+        // also calculate random color
+        float rColor = static_cast<float>(rand() % 100) / 200.0f + 0.5f; // between 0.5 and 1.)
+        float gColor = static_cast<float>(rand() % 100) / 200.0f + 0.5f; // between 0.5 and 1.)
+        float bColor = static_cast<float>(rand() % 100) / 200.0f + 0.5f; // between 0.5 and 1.)
+
+        auto lightPos = glm::vec3(xPos, yPos, zPos);
+        m_lightStore.add(
+            { lightPos,glm::vec3(rColor, gColor, bColor),-lightPos,false,false,linear,quadratic }
+        );
     }
 
-    catch (std::runtime_error e) {
-        std::cerr << e.what() << std::endl;
-    }
+    selectedLight = m_lightStore.handleAt(0);
 }
 
 /**
- * generate deferred rendering buffer before the pipeline begin, this should be only excuted once
+ * Moves the first animatedLightCount lights on small circles, to exercise incremental light uploads.
  */
-void Application::genDeferredRenderBuffer(bool& defRenderBufferGenerated)
+void Application::animateLights()
 {
-    // deferred rendering pipeline generation
-    if (!defRenderBufferGenerated) {
-        try
-        {
-            ShaderBuilder shaderGeometryPassBuilder;
-            shaderGeometryPassBuilder
-                .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/deferred_render/gGeo_shader_vert.glsl")
-                .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/deferred_render/gGeo_shader_frag.glsl");
-            m_shaderGeometryPass = shaderGeometryPassBuilder.build();
+    const size_t count = std::min(static_cast<size_t>(animatedLightCount), m_lightStore.size());
+    const float time = static_cast<float>(glfwGetTime());
+    for (size_t i = 0; i < count; ++i) {
+        const LightHandle handle = m_lightStore.handleAt(i);
+        const float phase = time * 2.0f + static_cast<float>(i);
+        const glm::vec3 offset = 0.01f * glm::vec3(std::cos(phase), 0.0f, std::sin(phase));
+        m_lightStore.setPosition(handle, m_lightStore.get(handle).position + offset);
+    }
+}
 
-            ShaderBuilder shaderLightingPassBuilder;
-            shaderLightingPassBuilder
-                .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/deferred_render/deferred_gLight_vert.glsl")
-                .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/deferred_render/deferred_gLight_frag.glsl");
-            m_shaderLightingPass = shaderLightingPassBuilder.build();
+/**
+ * Sweeps the number of lights in the deferred pipeline and records frame times for one lighting mode.
+ */
+void Application::startDeferredLightingBenchmark(DeferredLightingMode mode)
+{
+    showSolarSystem = false;
+    ssaoEnabled = true;
+    deferredLightingMode = mode;
 
+    // Create the G-buffer now, the first deferred frame would otherwise replace the benchmark lights
+    genDeferredRenderBuffer(defRenderBufferGenerated);
 
-            ShaderBuilder deferredLightShaderBuilder;
-            deferredLightShaderBuilder
-                .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/lights/deferred_light_vert.glsl")
-                .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/lights/light_frag.glsl");
-            m_deferredLightShader = deferredLightShaderBuilder.build();
+    m_benchmark.start(std::string("Deferred lighting (") + deferredLightingModeNames[static_cast<size_t>(mode)] + ")",
+        { 10, 100, 1000, 10000 },
+        [this](int count) { generateRandomLights(count, 0.7f, randomLightQuadratic); });
+}
 
-            ShaderBuilder deferredFBOdebugShaderBuilder;
-            deferredFBOdebugShaderBuilder
-                .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/deferred_render/deferred_fbo_debug_vert.glsl")
-                .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/deferred_render/deferred_fbo_debug_frag.glsl");
-            m_deferredDebugShader = deferredFBOdebugShaderBuilder.build();
-
-            glGenFramebuffers(1, &gBuffer);
-            glBindFramebuffer(GL_FRAMEBUFFER, gBuffer);
-
-            if (gPos.gBufferCode == SSAO_GBUFFER_POS)
-                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gPos.getTextureRef(), 0);
-            if (gNor.gBufferCode == SSAO_GBUFFER_NOR)
-                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gNor.getTextureRef(), 0);
-            if (gCol.gBufferCode == SSAO_GBUFFER_COL)
-                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, gCol.getTextureRef(), 0);
-
-            GLuint attachments[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
-            glDrawBuffers(3, attachments);
-
-            // render buffer
-            glGenRenderbuffers(1, &renderDepth);
-            glBindRenderbuffer(GL_RENDERBUFFER, renderDepth);
-            glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, WIDTH, HEIGHT);
-            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderDepth);
-
-            // finally check if framebuffer is complete
-            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-                std::cout << "Framebuffer not complete!" << std::endl;
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-            //genSSAOFrameBuffer();
-
-            lights.clear();
-            for (GLint i = 0; i < MAX_LIGHT_CNT; ++i) {
-
-                float xPos = static_cast<float>(((rand() % 100) / 100.0) * 6.0 - 3.0);
-                float yPos = static_cast<float>(((rand() % 100) / 100.0) * 6.0 - 4.0);
-                float zPos = static_cast<float>(((rand() % 100) / 100.0) * 6.0 - 3.0);
-                // also calculate random color
-                float rColor = static_cast<float>(((rand() % 100) / 200.0f) + 0.5); // between 0.5 and 1.)
-                float gColor = static_cast<float>(((rand() % 100) / 200.0f) + 0.5); // between 0.5 and 1.)
-                float bColor = static_cast<float>(((rand() % 100) / 200.0f) + 0.5); // between 0.5 and 1.)
-
-                auto lightPos = glm::vec3(xPos, yPos, zPos);
-                lights.push_back(
-                    { lightPos,glm::vec3(rColor, gColor, bColor),-lightPos,false,false }
-                );
-            }
-        }
-        catch (std::runtime_error e)
-        {
-            std::cerr << e.what() << std::endl;
-        }
+/**
+ * Sweeps the number of lights in the forward multi-light path and records frame times,
+ * either with clustered culling or with every fragment looping over all lights.
+ */
+void Application::startLightScalingBenchmark(bool clustered)
+{
+    multiLightShadingEnabled = true;
+    ssaoEnabled = false;
+    showSolarSystem = false;
+    clusteredLightingEnabled = clustered;
+
+    m_benchmark.start(clustered ? "Light scaling (clustered)" : "Light scaling (brute force)",
+        { 16, 64, 256, 1024, 2048, 4096 },
+        [this](int count) { generateRandomLights(count, 0.7f, randomLightQuadratic); });
+}
 
-        defRenderBufferGenerated = true;
-    }
+/**
+ * Creates the SSAO noise texture, the kernel is (re)generated by ssaoPass when its size changes.
+ */
+void Application::initSSAO()
+{
+    std::vector<glm::vec3> ssaoNoise = generateSSAONoise();
+    ssaoNoiseTex = ssaoBufferTex(SSAO_NOISE_TEX, ssaoNoise);
 }
 
-void Application::deferredRenderPipeLine()
+/**
+ * Evaluates SSAO into the target bound by the render graph, which may be smaller than the G-buffer.
+ */
+void Application::ssaoPass(const glm::mat4& view, const glm::mat4& projection)
 {
+    if (static_cast<int>(ssaoKernel.size()) != ssaoKernelSize)
+        ssaoKernel = generateSSAOKernel(static_cast<GLuint>(ssaoKernelSize));
 
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    glDisable(GL_DEPTH_TEST);
+    m_shaderSSAO.bind();
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, gNor);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, gDepth);
+    ssaoNoiseTex.bind(GL_TEXTURE2);
+    glUniform1i(m_shaderSSAO.getUniformLocation("gNormal"), 0);
+    glUniform1i(m_shaderSSAO.getUniformLocation("gDepth"), 1);
+    glUniform1i(m_shaderSSAO.getUniformLocation("texNoise"), 2);
+
+    glUniform3fv(m_shaderSSAO.getUniformLocation("samples"), ssaoKernelSize, glm::value_ptr(ssaoKernel[0]));
+    glUniform1i(m_shaderSSAO.getUniformLocation("kernelSize"), ssaoKernelSize);
+    glUniform1f(m_shaderSSAO.getUniformLocation("radius"), ssaoRadius);
+    glUniform1f(m_shaderSSAO.getUniformLocation("bias"), ssaoBias);
+
+    const glm::mat4 invProjection = glm::inverse(projection);
+    glUniformMatrix4fv(m_shaderSSAO.getUniformLocation("view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(m_shaderSSAO.getUniformLocation("projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    glUniformMatrix4fv(m_shaderSSAO.getUniformLocation("invProjection"), 1, GL_FALSE, glm::value_ptr(invProjection));
+    glUniform2f(m_shaderSSAO.getUniformLocation("noiseScale"), static_cast<float>(viewport[2]) / 4.0f, static_cast<float>(viewport[3]) / 4.0f);
+
+    // Temporal accumulation: interleaved subsets of the kernel and a jittered noise tile per frame
+    const int stride = ssaoTemporalEnabled ? glm::clamp(ssaoTemporalDivisor, 1, ssaoKernelSize) : 1;
+    const glm::vec2 noiseOffset = ssaoTemporalEnabled ? m_temporal.jitter() * 4.0f : glm::vec2(0.0f);
+    glUniform1i(m_shaderSSAO.getUniformLocation("sampleOffset"), static_cast<int>(m_temporal.frameIndex() % static_cast<uint64_t>(stride)));
+    glUniform1i(m_shaderSSAO.getUniformLocation("sampleStride"), stride);
+    glUniform2fv(m_shaderSSAO.getUniformLocation("noiseOffset"), 1, glm::value_ptr(noiseOffset));
+
+    renderQuad(quadVAO, quadVBO, quadVertices, 20);
+    glEnable(GL_DEPTH_TEST);
 }
 
-// unused
-void Application::genSSAOFrameBuffer()
+/**
+ * Blends this frame's SSAO from input into the reprojected history, writing the history bound by the render graph.
+ */
+void Application::ssaoTemporalPass(GLuint input)
 {
-    glGenFramebuffers(1, &ssaoFBO);
-    glGenFramebuffers(1, &ssaoBlurFBO);
-    glBindFramebuffer(GL_FRAMEBUFFER, ssaoFBO);
-
-    if (ssaoColorBuff.gBufferCode == SSAO_COLOR_BUFF)
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, ssaoColorBuff.getTextureRef(), 0);
+    glDisable(GL_DEPTH_TEST);
+    m_shaderSSAOTemporal.bind();
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, input);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, m_ssaoHistory.previous());
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, gDepth);
+    glUniform1i(m_shaderSSAOTemporal.getUniformLocation("ssaoInput"), 0);
+    glUniform1i(m_shaderSSAOTemporal.getUniformLocation("history"), 1);
+    glUniform1i(m_shaderSSAOTemporal.getUniformLocation("gDepth"), 2);
+
+    glUniformMatrix4fv(m_shaderSSAOTemporal.getUniformLocation("invViewProjection"), 1, GL_FALSE, glm::value_ptr(m_temporal.invViewProjection()));
+    glUniformMatrix4fv(m_shaderSSAOTemporal.getUniformLocation("prevViewProjection"), 1, GL_FALSE, glm::value_ptr(m_temporal.previousViewProjection()));
+    glUniform1i(m_shaderSSAOTemporal.getUniformLocation("historyValid"), m_ssaoHistory.valid());
+    glUniform1f(m_shaderSSAOTemporal.getUniformLocation("maxFrames"), ssaoTemporalMaxFrames);
+    glUniform1f(m_shaderSSAOTemporal.getUniformLocation("clampGamma"), ssaoTemporalClampGamma);
+    glUniform1f(m_shaderSSAOTemporal.getUniformLocation("disocclusionThreshold"), ssaoDisocclusionThreshold);
+
+    renderQuad(quadVAO, quadVBO, quadVertices, 20);
+    glEnable(GL_DEPTH_TEST);
+}
 
-    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-        std::cout << "SSAO Framebuffer not complete!" << std::endl;
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+/**
+ * One direction of the depth aware SSAO blur, from input into the target bound by the render graph.
+ */
+void Application::ssaoBlurPass(GLuint input, const glm::ivec2& direction)
+{
+    glDisable(GL_DEPTH_TEST);
+    m_shaderSSAOBlur.bind();
 
-    glBindFramebuffer(GL_FRAMEBUFFER, ssaoBlurFBO);
-    if (ssaoColorBlurBuff.gBufferCode == SSAO_COLOR_BLUR)
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, ssaoColorBlurBuff.getTextureRef(), 0);
-    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-        std::cout << "SSAO Framebuffer not complete!" << std::endl;
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, input);
+    glUniform1i(m_shaderSSAOBlur.getUniformLocation("ssaoInput"), 0);
+    glUniform2iv(m_shaderSSAOBlur.getUniformLocation("direction"), 1, glm::value_ptr(direction));
+    glUniform1f(m_shaderSSAOBlur.getUniformLocation("depthSharpness"), ssaoBlurSharpness);
 
-    std::uniform_real_distribution<GLfloat> randomFloats(0.0, 1.0); // generates random floats between 0.0 and 1.0
-    std::default_random_engine generator;
+    renderQuad(quadVAO, quadVBO, quadVertices, 20);
+    glEnable(GL_DEPTH_TEST);
+}
 
-    // generate sample kernel
-    std::vector<glm::vec3> ssaoKernel = generateSSAOKernel();
+/**
+ * Sweeps the SSAO resolution in the deferred pipeline: 0 turns SSAO off, otherwise the value is the
+ * divisor of the G-buffer resolution.
+ */
+void Application::startSsaoBenchmark()
+{
+    showSolarSystem = false;
+    ssaoEnabled = true;
+    genDeferredRenderBuffer(defRenderBufferGenerated);
 
-    // generate noise
-    std::vector<glm::vec3> ssaoNoise = generateSSAONoise();
+    m_benchmark.start("SSAO (0 = off, resolution divisor)", { 0, 1, 2, 4 }, [this](int divisor) {
+        ssaoOcclusionEnabled = divisor > 0;
+        ssaoResolution = divisor == 1 ? SsaoResolution::FULL : divisor == 2 ? SsaoResolution::HALF : SsaoResolution::QUARTER;
+    });
+}
 
-    ssaoNoiseTex = std::move(ssaoBufferTex(SSAO_NOISE_TEX, ssaoNoise));
+/**
+ * Compares the per frame SSAO cost at matched converged quality: a 64 sample kernel either evaluated every
+ * frame (1) or spread over 2, 4 or 8 frames by the temporal accumulation.
+ */
+void Application::startSsaoTemporalBenchmark()
+{
+    showSolarSystem = false;
+    ssaoEnabled = true;
+    genDeferredRenderBuffer(defRenderBufferGenerated);
+    ssaoOcclusionEnabled = true;
+    ssaoKernelSize = SSAO_MAX_KERNEL_SIZE;
+
+    m_benchmark.start("SSAO temporal (kernel 64, frames per kernel)", { 1, 2, 4, 8 }, [this](int divisor) {
+        ssaoTemporalEnabled = divisor > 1;
+        ssaoTemporalDivisor = divisor;
+    });
 }
 
 /**
@@ -902,6 +2023,21 @@ void Application::imgui() {
     ImGui::Text("Environment Map parameters");
     ImGui::Checkbox("Enable Environment Map", &envMapEnabled); // only for single light now
     ImGui::Checkbox("Enable HDR Environment", &hdrMapEnabled);
+    if (hdrMapEnabled) {
+        ImGui::Checkbox("SH9 diffuse irradiance (off: irradiance cubemap)", &useIrradianceSH);
+        ImGui::Checkbox("Prefilter from source mips", &prefilterFromSourceMips);
+        ImGui::SliderInt("Prefilter faces per frame", &prefilterFacesPerFrame, 1, PREFILTER_MIPS * 6);
+        if (m_prefilterTarget)
+            ImGui::Text("Prefiltering: %d/%d faces", m_prefilterNextFace, PREFILTER_MIPS * 6);
+        else if (ImGui::Button("Regenerate prefiltered map"))
+            startPrefilter();
+        if (ImGui::Button("Compare prefilter with reference"))
+            comparePrefilter();
+        if (ImGui::Button("Compare HDR decoders"))
+            compareHdrDecoders();
+        if (ImGui::Button("Compare equirect to cube paths"))
+            compareEquirectToCube();
+    }
 
     ImGui::Separator();
 
@@ -930,13 +2066,9 @@ void Application::imgui() {
         std::strncpy(file_path_buffer, texturePath.c_str(), sizeof(file_path_buffer) - 1);
         ImGui::InputText("Texture Path:", file_path_buffer, sizeof(file_path_buffer));
         if (ImGui::Button("Regenerate Texture")) {
-            try {
-                texturePath = file_path_buffer;
-                m_texture = Texture(RESOURCE_ROOT + texturePath);
-            }
-            catch (textureLoadingException e) {
-                std::cerr << e.what() << std::endl;
-            }
+            // The current texture stays until the new one is in, a file that fails to load is reported then
+            texturePath = file_path_buffer;
+            loadSceneTexture(m_texture, RESOURCE_ROOT + texturePath);
         }
     }
     else if (static_cast<MaterialModel>(curMaterialIndex) == MaterialModel::PBR) {
@@ -1004,44 +2136,64 @@ void Application::imgui() {
         ImGui::Text("Lights");
         ImGui::Checkbox("MultiLightShading", &multiLightShadingEnabled);
 
-        itemStrings.clear();
-        itemCStrings.clear();
-        tempSelectedItem = static_cast<int>(curLightIndex);
+        // Labels are generated on demand so only the visible rows cost anything with many lights.
+        // They show the handle slot, which stays the same when other lights are removed.
+        tempSelectedItem = static_cast<int>(m_lightStore.indexOf(selectedLight));
+        auto lightLabel = [](void* data, int idx, const char** outText) {
+            static char label[32];
+            const LightStore& store = *static_cast<const LightStore*>(data);
+            std::snprintf(label, sizeof(label), "Light %u", store.handleAt(static_cast<size_t>(idx)).slot);
+            *outText = label;
+            return true;
+        };
+
+        if (ImGui::ListBox("Lights", &tempSelectedItem, lightLabel, &m_lightStore, static_cast<int>(m_lightStore.size()), 4)) {
+            selectedLight = m_lightStore.handleAt(static_cast<size_t>(tempSelectedItem));
+        }
+
+        Light light = m_lightStore.get(selectedLight);
+        ImGui::Text("Selected Light: %u (radius %.2f)", selectedLight.slot, double(light.radius));
 
-        for (size_t i = 0; i < lights.size(); i++) {
-            auto string = "Light " + std::to_string(i);
-            itemStrings.push_back(string);
+        if (ImGui::ColorEdit3("Light Color", &light.color[0])) {
+            m_lightStore.setColor(selectedLight, light.color);
         }
 
-        for (const auto& string : itemStrings) {
-            itemCStrings.push_back(string.c_str());
+        if (ImGui::InputFloat3("Position", &light.position[0])) {
+            m_lightStore.setPosition(selectedLight, light.position);
         }
 
-        if (ImGui::ListBox("Lights", &tempSelectedItem, itemCStrings.data(), (int)itemCStrings.size(), 4)) {
-            curLightIndex = static_cast<size_t>(tempSelectedItem);
+        if (ImGui::DragFloat("Linear", &light.linear, 0.01f, 0.0f, 10.0f) | ImGui::DragFloat("Quadratic", &light.quadratic, 0.05f, 0.01f, 200.0f)) {
+            m_lightStore.setAttenuation(selectedLight, light.linear, light.quadratic);
         }
 
-        selectedLight = &lights[curLightIndex];
-        ImGui::Text("Selected Light Index: %d", curLightIndex);
+        ImGui::Text("Light upload: %zu bytes in %zu ranges", m_lightStore.lastUploadBytes(), m_lightStore.lastUploadRanges());
+        ImGui::SliderInt("Animated lights", &animatedLightCount, 0, 100000);
 
-        ImGui::ColorEdit3("Light Color", &selectedLight->color[0]);
+        ImGui::Checkbox("Clustered light culling", &clusteredLightingEnabled);
+        const glm::ivec3 clusterDims = m_lightClusters.dims();
+        ImGui::Text("Clusters: %d x %d x %d", clusterDims.x, clusterDims.y, clusterDims.z);
+        ImGui::Text("Light indices: %d (max %d per cluster)", m_lightClusters.numIndices(), m_lightClusters.maxLightsPerCluster());
 
-        ImGui::InputFloat3("Position", &selectedLight->position[0]);
+        ImGui::SliderInt("Random light count", &randomLightCount, 1, 100000);
+        ImGui::SliderFloat("Random light quadratic", &randomLightQuadratic, 1.8f, 200.0f);
+        if (ImGui::Button("Spawn Random Lights")) {
+            generateRandomLights(randomLightCount, 0.7f, randomLightQuadratic);
+        }
 
         if (ImGui::Button("Add Lights")) {
-            lights.push_back(Light{ glm::vec3(1, 3, -2), glm::vec3(1), -glm::vec3(0, 0, 3), false, false, /*std::nullopt*/ });
+            selectedLight = m_lightStore.add(Light{ glm::vec3(1, 3, -2), glm::vec3(1), -glm::vec3(0, 0, 3), false, false, /*std::nullopt*/ });
         }
 
-        if (ImGui::Button("Remove Lights")) {
-            lights.erase(lights.begin() + curLightIndex);
-            if (curLightIndex >= lights.size()) {
-                curLightIndex = lights.size() - 1;
-            }
+        // Keep at least one light around, the shadow pass and the single light shader need a selection
+        if (ImGui::Button("Remove Lights") && m_lightStore.size() > 1) {
+            const size_t index = m_lightStore.indexOf(selectedLight);
+            m_lightStore.remove(selectedLight);
+            selectedLight = m_lightStore.handleAt(std::min(index, m_lightStore.size() - 1));
         }
 
         // Button for clearing lights
         if (ImGui::Button("Reset Lights")) {
-            //resetObjList(lights,defaultLight);
+            resetLights();
         }
     }
 
@@ -1049,7 +2201,186 @@ void Application::imgui() {
 
     if (ImGui::CollapsingHeader("Enable Alternative rendering process")) {
         ImGui::Checkbox("Switch to Deferred Rendering Pipeline", &ssaoEnabled);
+
+        int lightingMode = static_cast<int>(deferredLightingMode);
+        if (ImGui::Combo("Deferred lighting", &lightingMode, deferredLightingModeNames.data(), static_cast<int>(DeferredLightingMode::CNT))) {
+            deferredLightingMode = static_cast<DeferredLightingMode>(lightingMode);
+        }
+
+        // Every G-buffer target is written by the geometry pass and read by the lighting pass once per frame
+        const auto gBufferTrafficMB = [](int bytesPerPixel, int width, int height) {
+            return 2.0 * bytesPerPixel * width * height / (1024.0 * 1024.0);
+        };
+        ImGui::Text("G-buffer: %d bytes/px (was %d)", GBUFFER_BYTES_PER_PIXEL, GBUFFER_LEGACY_BYTES_PER_PIXEL);
+        ImGui::Text("Traffic saved: %.1f MB/frame at 1080p, %.1f MB/frame at 4K",
+            gBufferTrafficMB(GBUFFER_LEGACY_BYTES_PER_PIXEL - GBUFFER_BYTES_PER_PIXEL, 1920, 1080),
+            gBufferTrafficMB(GBUFFER_LEGACY_BYTES_PER_PIXEL - GBUFFER_BYTES_PER_PIXEL, 3840, 2160));
+        ImGui::Checkbox("SSAO", &ssaoOcclusionEnabled);
+        if (ssaoOcclusionEnabled) {
+            int resolution = static_cast<int>(ssaoResolution);
+            if (ImGui::Combo("SSAO resolution", &resolution, ssaoResolutionNames.data(), static_cast<int>(SsaoResolution::CNT))) {
+                ssaoResolution = static_cast<SsaoResolution>(resolution);
+            }
+            ImGui::SliderInt("SSAO kernel size", &ssaoKernelSize, 4, SSAO_MAX_KERNEL_SIZE);
+            ImGui::SliderFloat("SSAO radius", &ssaoRadius, 0.05f, 2.0f);
+            ImGui::SliderFloat("SSAO bias", &ssaoBias, 0.0f, 0.1f);
+            ImGui::SliderFloat("SSAO blur sharpness", &ssaoBlurSharpness, 0.0f, 64.0f);
+            ImGui::Checkbox("SSAO temporal accumulation", &ssaoTemporalEnabled);
+            if (ssaoTemporalEnabled) {
+                ImGui::SliderInt("Frames per kernel", &ssaoTemporalDivisor, 1, 8);
+                ImGui::SliderFloat("History frames", &ssaoTemporalMaxFrames, 1.0f, 32.0f);
+                ImGui::SliderFloat("History clamp (sigma)", &ssaoTemporalClampGamma, 0.5f, 4.0f);
+                ImGui::SliderFloat("Disocclusion threshold", &ssaoDisocclusionThreshold, 0.005f, 0.5f);
+                ImGui::Text("Samples per frame: %d of %d", (ssaoKernelSize + ssaoTemporalDivisor - 1) / ssaoTemporalDivisor, ssaoKernelSize);
+            }
+            ImGui::Checkbox("Show occlusion only", &ssaoShowOcclusion);
+            ImGui::Text("SSAO + blur GPU: %.3f ms", double(m_ssaoGpuTimer.lastMs()));
+        }
+
         ImGui::Checkbox("usePostProcess", &usePostProcess);
+        if (usePostProcess) {
+            ImGui::Checkbox("Bloom", &bloomEnabled);
+            if (bloomEnabled) {
+                ImGui::SliderFloat("Bloom threshold", &bloomThreshold, 0.0f, 4.0f);
+                ImGui::SliderFloat("Bloom soft knee", &bloomSoftKnee, 0.0f, 1.0f);
+                ImGui::SliderFloat("Bloom intensity", &bloomIntensity, 0.0f, 4.0f);
+                ImGui::SliderFloat("Bloom radius (px)", &bloomRadius, 2.0f, 512.0f, "%.0f", ImGuiSliderFlags_Logarithmic);
+                const int mips = bloomMipCount(m_renderTargets.outputSize());
+                ImGui::Text("Bloom: %d mips, tent radius %.2f texels, GPU %.3f ms", mips, double(bloomFilterRadius(mips)), double(m_bloomGpuTimer.lastMs()));
+            }
+        }
+
+        ImGui::SliderFloat("Render scale", &renderScale, 0.25f, 2.0f);
+        const glm::ivec2 renderSize = m_renderTargets.renderSize();
+        const glm::ivec2 outputSize = m_renderTargets.outputSize();
+        ImGui::Text("Render %d x %d, output %d x %d", renderSize.x, renderSize.y, outputSize.x, outputSize.y);
+        ImGui::Text("Render targets: %zu, %.1f MB VRAM", m_renderTargets.numTargets(), double(m_renderTargets.vramBytes()) / (1024.0 * 1024.0));
+
+        // Peak render target memory of the last frame of each path: every transient on its own vs. aliased by the graph
+        const auto renderGraphStats = [](const char* path, const RenderGraphStats& stats) {
+            ImGui::Text("%s graph: %d/%d passes, peak %.1f MB (%.1f MB unaliased)", path, stats.numPasses - stats.numCulledPasses, stats.numPasses,
+                double(stats.peakBytes) / (1024.0 * 1024.0), double(stats.unaliasedBytes) / (1024.0 * 1024.0));
+            ImGui::TextWrapped("  %s", stats.executionOrder.c_str());
+        };
+        renderGraphStats("Forward", m_forwardGraphStats);
+        renderGraphStats("Deferred", m_deferredGraphStats);
+    }
+
+    ImGui::Separator();
+
+    if (ImGui::CollapsingHeader("Profiling")) {
+        ImGui::Text("Frame CPU: %.3f ms, GPU: %.3f ms", double(m_frameCpuTimer.lastMs()), double(m_frameGpuTimer.lastMs()));
+        ImGui::SliderInt("Frames in flight (0 = glFinish)", &framesInFlight, 0, FramePacer::MAX_FRAMES_IN_FLIGHT);
+        ImGui::Text("Frame: %.3f ms, CPU wait: %.3f ms, CPU/GPU overlap: %.0f%%", double(m_framePacer.lastFrameMs()), double(m_framePacer.lastWaitMs()),
+            100.0 * double(FramePacer::overlap(m_frameCpuTimer.lastMs(), m_frameGpuTimer.lastMs(), m_framePacer.lastFrameMs())));
+
+        // Code size of the forward uber-shaders against the variants compiled so far, as a proxy for instruction count
+        const ShaderBuildStats& shaderStats = ShaderBuilder::stats();
+        ImGui::Text("Startup shaders: %d programs, %.1f ms, %d cached", m_startupShaderStats.programs, m_startupShaderStats.totalMs, m_startupShaderStats.cacheHits);
+        ImGui::Text("All shaders: %d programs, %.1f ms, %d cached, %d saved", shaderStats.programs, shaderStats.totalMs, shaderStats.cacheHits, shaderStats.cacheWrites);
+        ImGui::Text("Shader stages: %d compiled, %d reused", shaderStats.stagesCompiled, shaderStats.stageCacheHits);
+        ImGui::Text("IBL maps: %.1f ms (%s)", double(m_iblTimer.lastMs()), m_iblFromCache ? "loaded from cache" : "generated");
+        ImGui::Text("Prefiltered map: %.1f ms", double(m_prefilterMs));
+        const TextureLoaderStats& textureStats = m_textureLoader.stats();
+        ImGui::Text("Startup: %.1f ms, textures %d/%d in after %.1f ms", double(m_startupMs), textureStats.completed, textureStats.requested, double(textureStats.residentMs));
+        ImGui::Text("Texture upload: %.2f ms last frame, %.2f ms longest", double(textureStats.lastStepMs), double(textureStats.maxStepMs));
+        ImGui::Text("Texture memory: %.1f MB (%.1f MB uncompressed), %d cooked images cached", double(textureStats.textureBytes) / (1024.0 * 1024.0),
+            double(textureStats.uncompressedTextureBytes) / (1024.0 * 1024.0), textureStats.cacheHits);
+        ImGui::SliderFloat("Texture upload budget (ms)", &textureUploadBudgetMs, 0.25f, 16.0f);
+        const TextureStreamingStats& streamingStats = m_textureLoader.streamingStats();
+        ImGui::Text("Streamed textures: %d, %d below the detail drawn; levels %d uploaded, %d evicted", streamingStats.textures, streamingStats.belowWanted,
+            streamingStats.levelsUploaded, streamingStats.levelsEvicted);
+        ImGui::Text("Streamed memory: %.1f MB resident of %.1f MB, budget %.1f MB", double(streamingStats.residentBytes) / (1024.0 * 1024.0),
+            double(streamingStats.fullBytes) / (1024.0 * 1024.0), double(streamingStats.budgetBytes) / (1024.0 * 1024.0));
+        ImGui::SliderFloat("Texture streaming budget (MB)", &textureStreamingBudgetMB, 1.0f, 256.0f);
+        ImGui::Checkbox("Stream textures (on reload)", &streamTextures);
+        ImGui::Text("Texture binds last frame: %d; %zu texture arrays holding %zu maps", m_textureBindsLastFrame,
+            m_textureArrays.arrayCount() + m_celestialArrays.arrayCount(), m_textureArrays.layerCount() + m_celestialArrays.layerCount());
+        ImGui::Checkbox("Solar system from texture arrays", &useTextureArrays);
+        if (ImGui::TreeNode("Texture residency")) {
+            for (const TextureResidency& texture : m_textureLoader.residency()) {
+                ImGui::Text("%s: %d x %d of %d x %d, %.2f MB, drawn %llu frames ago", texture.name.c_str(), texture.residentWidth, texture.residentHeight,
+                    texture.wantedWidth, texture.wantedHeight, double(texture.residentBytes) / (1024.0 * 1024.0), static_cast<unsigned long long>(texture.framesSinceUse));
+            }
+            ImGui::TreePop();
+        }
+        if (ImGui::Button("Compare mip generation"))
+            compareMipGeneration();
+        if (ImGui::TreeNode("Shader compile timeline")) {
+            // One row per program: submission (grey) and compiling until ready (green), cache hits in blue
+            const std::vector<ShaderTimelineEntry>& timeline = ShaderBuilder::timeline();
+            double endMs = 1.0;
+            for (const ShaderTimelineEntry& entry : timeline)
+                endMs = std::max(endMs, std::max(entry.submittedMs, entry.readyMs));
+
+            const float width = ImGui::GetContentRegionAvail().x * 0.5f;
+            const float rowHeight = ImGui::GetTextLineHeight();
+            ImDrawList* drawList = ImGui::GetWindowDrawList();
+            for (const ShaderTimelineEntry& entry : timeline) {
+                const ImVec2 origin = ImGui::GetCursorScreenPos();
+                const auto x = [&](double ms) { return origin.x + static_cast<float>(ms / endMs) * width; };
+                const double readyMs = entry.readyMs < 0.0 ? endMs : entry.readyMs;
+                drawList->AddRectFilled(ImVec2(x(entry.submitMs), origin.y), ImVec2(x(entry.submittedMs) + 1.0f, origin.y + rowHeight), IM_COL32(160, 160, 160, 255));
+                drawList->AddRectFilled(ImVec2(x(entry.submittedMs), origin.y), ImVec2(x(readyMs) + 1.0f, origin.y + rowHeight),
+                    entry.cached ? IM_COL32(80, 140, 220, 255) : IM_COL32(80, 200, 100, 255));
+                ImGui::Dummy(ImVec2(width, rowHeight));
+                ImGui::SameLine();
+                ImGui::Text("%.1f ms %s", readyMs - entry.submitMs, entry.name.c_str());
+            }
+            ImGui::TreePop();
+        }
+        ImGui::Checkbox("Shader permutations", &useShaderPermutations);
+        if (ImGui::TreeNode("Forward shader variants")) {
+            const auto variantList = [](const char* name, const Shader& uber, const ShaderPermutations& permutations) {
+                ImGui::Text("%s uber-shader: %d bytes", name, uber.binarySize());
+                for (const auto& [key, variant] : permutations.variants()) {
+                    std::string enabled;
+                    for (size_t i = 0; i < permutations.features().size(); ++i) {
+                        if (key & (1u << i))
+                            enabled += (enabled.empty() ? "" : " ") + permutations.features()[i];
+                    }
+                    ImGui::Text("  0x%02x: %d bytes [%s]", key, variant.binarySize(), enabled.c_str());
+                }
+            };
+            variantList("Default", m_defaultShader, m_defaultPermutations);
+            variantList("Multi-light", m_multiLightShader, m_multiLightPermutations);
+            variantList("PBR", m_pbrShader, m_pbrPermutations);
+            ImGui::TreePop();
+        }
+
+        if (!m_benchmark.running()) {
+            if (ImGui::Button("Light Scaling: Clustered")) {
+                startLightScalingBenchmark(true);
+            }
+            if (ImGui::Button("Light Scaling: Brute Force")) {
+                startLightScalingBenchmark(false);
+            }
+            if (ImGui::Button("SSAO Resolution")) {
+                startSsaoBenchmark();
+            }
+            if (ImGui::Button("SSAO Temporal Accumulation")) {
+                startSsaoTemporalBenchmark();
+            }
+            if (ImGui::Button("Bloom Radius")) {
+                startBloomBenchmark();
+            }
+            if (ImGui::Button("Frame Pacing")) {
+                startFramePacingBenchmark();
+            }
+            if (ImGui::Button("Shader Permutations")) {
+                startShaderPermutationBenchmark();
+            }
+            if (ImGui::Button("Texture Arrays")) {
+                startTextureArrayBenchmark();
+            }
+            for (size_t mode = 0; mode < static_cast<size_t>(DeferredLightingMode::CNT); ++mode) {
+                const std::string label = std::string("Deferred Lighting: ") + deferredLightingModeNames[mode];
+                if (ImGui::Button(label.c_str())) {
+                    startDeferredLightingBenchmark(static_cast<DeferredLightingMode>(mode));
+                }
+            }
+        }
+        m_benchmark.imgui();
     }
 
     ImGui::End();
@@ -1099,12 +2430,18 @@ void Application::renderMiniMapItem(glm::mat4 modelMatrix)
     glUniformMatrix4fv(m_selShader->getUniformLocation("normalModelMatrix"), 1, GL_FALSE, glm::value_ptr(normalModelMatrix));
     glUniformMatrix4fv(m_selShader->getUniformLocation("modelMatrix"), 1, GL_FALSE, glm::value_ptr(modelMatrix));
     glUniform3fv(m_selShader->getUniformLocation("viewPos"), 1, glm::value_ptr(minimap.cameraPos()));
+    // The froxel grid is built for the main camera, so the minimap visits every light instead
+    if (multiLightShadingEnabled) {
+        glUniform1i(m_selShader->getUniformLocation("useClusters"), GL_FALSE);
+    }
     // glUniform3fv(m_selShader->getUniformLocation("viewPos"), 1, glm::value_ptr(glm::vec3(0.0f, 80.0f, 0.0f)));
 
     // 渲染小地图内容
+    if (usePbrShading)
+        PbrUBO = m_uniformRing.push(m_PbrMaterial);
     for (GPUMesh& mesh : m_meshes) {
         if (usePbrShading) {
-            mesh.drawPBR(*m_selShader, PbrUBO, lightUBO);
+            mesh.drawPBR(*m_selShader, PbrUBO);
         }
         else {
             mesh.draw(*m_selShader);
@@ -1112,7 +2449,7 @@ void Application::renderMiniMapItem(glm::mat4 modelMatrix)
     }
 
     // 恢复主视口
-    glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+    glViewport(0, 0, m_renderTargets.outputSize().x, m_renderTargets.outputSize().y);
     glEnable(GL_DEPTH);
     glBindBuffer(GL_ARRAY_BUFFER, previousVBO);
 }
@@ -1135,7 +2472,7 @@ void Application::renderMiniMap() {
     drawCameraPositionOnMinimap(cameraPosInMinimap);
 
     // 恢复主视口
-    glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+    glViewport(0, 0, m_renderTargets.outputSize().x, m_renderTargets.outputSize().y);
     drawMiniMapBorder();
     glEnable(GL_DEPTH);
     glBindBuffer(GL_ARRAY_BUFFER, previousVBO);
@@ -1237,43 +2574,115 @@ void Application::drawCameraPositionOnMinimap(const glm::vec4& cameraPosInMinima
 }
 
 /**
- * Initializes the post-processing settings.
+ * Follows the window framebuffer size: the render targets are re-created at the new size on their next use.
  */
-void Application::initPostProcess() {
-    // 创建帧缓冲对象
-    glGenFramebuffers(1, &framebufferPostProcess);
-    glBindFramebuffer(GL_FRAMEBUFFER, framebufferPostProcess);
-
-    // 创建颜色纹理附件
-    //glActiveTexture(GL_TEXTURE7); // 激活 GL_TEXTURE7
-    glGenTextures(1, &texturePostProcess);
-    glBindTexture(GL_TEXTURE_2D, texturePostProcess);
-    //glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, WIDTH, HEIGHT, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, WINDOW_WIDTH, WINDOW_HEIGHT, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texturePostProcess, 0);
+void Application::onFramebufferResize()
+{
+    const glm::ivec2 framebufferSize = m_window.getFrameBufferSize();
+    // minimized windows report a zero sized framebuffer, keep rendering at the last size
+    if (framebufferSize.x <= 0 || framebufferSize.y <= 0)
+        return;
+
+    m_renderTargets.setOutputSize(framebufferSize);
+    m_projectionMatrix = glm::perspective(glm::radians(80.0f), m_window.getAspectRatio(), CAMERA_NEAR, CAMERA_FAR);
+    glViewport(0, 0, framebufferSize.x, framebufferSize.y);
+}
+
+/**
+ * Sweeps the number of frames in flight: 0 is the old glFinish() after every frame, 2 and 3 let the CPU
+ * record ahead while the GPU works. Compare the frame column against cpu + gpu to see the overlap.
+ */
+void Application::startFramePacingBenchmark()
+{
+    m_benchmark.start("Frames in flight (0 = glFinish)", { 0, 1, 2, 3 }, [this](int frames) {
+        framesInFlight = frames;
+    });
+}
 
-    // 创建深度渲染缓冲附件
-    glGenRenderbuffers(1, &depthbufferPostProcess);
-    glBindRenderbuffer(GL_RENDERBUFFER, depthbufferPostProcess);
-    //glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, WIDTH, HEIGHT);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, WINDOW_WIDTH, WINDOW_HEIGHT);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthbufferPostProcess);
+/**
+ * Number of bloom mips needed for bloomRadius: the blur of mip n reaches about 2^(n + 1) output pixels.
+ * Stops before a mip would get smaller than 2 pixels.
+ */
+int Application::bloomMipCount(const glm::ivec2& size) const
+{
+    int mips = glm::clamp(static_cast<int>(std::ceil(std::log2(std::max(bloomRadius, 2.0f)))) - 1, 1, BLOOM_MAX_MIPS);
+    while (mips > 1 && glm::min(size.x, size.y) >> mips < 2)
+        --mips;
+    return mips;
+}
+
+/**
+ * Upsample tent filter radius in texels, scales the radius continuously between two mip counts.
+ */
+float Application::bloomFilterRadius(int mipCount) const
+{
+    return glm::clamp(bloomRadius / static_cast<float>(1 << (mipCount + 1)), 0.5f, 2.0f);
+}
+
+/**
+ * Downsamples source into the currently bound bloom mip, applying the bright-pass for the first mip.
+ */
+void Application::bloomDownsamplePass(GLuint source, const glm::ivec2& sourceSize, bool prefilter)
+{
+    const float knee = std::max(bloomThreshold * bloomSoftKnee, 1e-4f);
 
-    // 检查帧缓冲对象是否完整
-    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-        std::cerr << "Framebuffer is not complete!" << std::endl;
+    m_bloomDownsampleShader.bind();
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, source);
+    glBindSampler(0, m_renderTargets.linearSampler());
+    glUniform1i(m_bloomDownsampleShader.getUniformLocation("source"), 0);
+    glUniform2fv(m_bloomDownsampleShader.getUniformLocation("sourceTexelSize"), 1, glm::value_ptr(1.0f / glm::vec2(sourceSize)));
+    glUniform1i(m_bloomDownsampleShader.getUniformLocation("prefilter"), prefilter);
+    glUniform4f(m_bloomDownsampleShader.getUniformLocation("threshold"), bloomThreshold, bloomThreshold - knee, 2.0f * knee, 0.25f / knee);
 
-    // 解绑帧缓冲对象，防止意外修改
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    renderQuad(quadVAO, quadVBO, quadVertices, 20);
+    glEnable(GL_DEPTH_TEST);
+
+    glBindSampler(0, 0);
+}
+
+/**
+ * Tent filters the smaller mip source and adds it onto the currently bound bloom mip.
+ */
+void Application::bloomUpsamplePass(GLuint source, const glm::ivec2& sourceSize, float filterRadius)
+{
+    m_bloomUpsampleShader.bind();
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, source);
+    glBindSampler(0, m_renderTargets.linearSampler());
+    glUniform1i(m_bloomUpsampleShader.getUniformLocation("source"), 0);
+    glUniform2fv(m_bloomUpsampleShader.getUniformLocation("sourceTexelSize"), 1, glm::value_ptr(1.0f / glm::vec2(sourceSize)));
+    glUniform1f(m_bloomUpsampleShader.getUniformLocation("filterRadius"), filterRadius);
+
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    renderQuad(quadVAO, quadVBO, quadVertices, 20);
+    glDisable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
+
+    glBindSampler(0, 0);
+}
+
+/**
+ * Sweeps the bloom radius (in output pixels) to compare its GPU cost against the effective radius.
+ */
+void Application::startBloomBenchmark()
+{
+    usePostProcess = true;
+    bloomEnabled = true;
+
+    m_benchmark.start("Bloom radius (px)", { 4, 8, 16, 32, 64, 128, 256, 512 }, [this](int radius) {
+        bloomRadius = static_cast<float>(radius);
+    });
 }
 
 /**
- * Runs the post-processing pipeline.
+ * Runs the post-processing pipeline, compositing the first bloom mip when bloomMips > 0.
  */
-void Application::runPostProcess() {
+void Application::runPostProcess(int bloomMips) {
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
     // 清除默认帧缓冲区，避免重影
@@ -1289,28 +2698,53 @@ void Application::runPostProcess() {
     // 设置着色器中的采样器
     glUniform1i(m_postProcessShader.getUniformLocation("scene"), 7);
 
+    // 泛光：半分辨率的第一级，双线性放大
+    glActiveTexture(GL_TEXTURE8);
+    glBindTexture(GL_TEXTURE_2D, textureBloom);
+    glBindSampler(8, m_renderTargets.linearSampler());
+    glUniform1i(m_postProcessShader.getUniformLocation("bloom"), 8);
+    glUniform1i(m_postProcessShader.getUniformLocation("bloomEnabled"), bloomMips > 0);
+    glUniform1f(m_postProcessShader.getUniformLocation("bloomStrength"), bloomMips > 0 ? bloomIntensity / static_cast<float>(bloomMips) : 0.0f);
+
     glDisable(GL_DEPTH_TEST);
 
     // 渲染全屏四边形，应用后期处理效果
     renderQuad(quadVAO, quadVBO, quadVertices, 18);
 
     glEnable(GL_DEPTH_TEST);
+    glBindSampler(8, 0);
 }
 
 /**
  * Initializes some PBR textures.
  */
 void Application::initPBRTexures() {
-    // m_pbrTextures.emplace_back(std::move(Texture(RESOURCE_ROOT "resources/texture/gold_scuffed/normal.png")));
-    // m_pbrTextures.emplace_back(std::move(Texture(RESOURCE_ROOT "resources/texture/gold_scuffed/albedo.png")));
-    // m_pbrTextures.emplace_back(std::move(Texture(RESOURCE_ROOT "resources/texture/gold_scuffed/metallic.png")));
-    // m_pbrTextures.emplace_back(std::move(Texture(RESOURCE_ROOT "resources/texture/gold_scuffed/roughness.png")));
-    // m_pbrTextures.emplace_back(std::move(Texture(RESOURCE_ROOT "resources/texture/gold_scuffed/ao.png")));
-    m_pbrTextures.emplace_back(std::move(Texture(RESOURCE_ROOT "resources/texture/rusted_iron_pbr/normal.png")));
-    m_pbrTextures.emplace_back(std::move(Texture(RESOURCE_ROOT "resources/texture/rusted_iron_pbr/albedo.png")));
-    m_pbrTextures.emplace_back(std::move(Texture(RESOURCE_ROOT "resources/texture/rusted_iron_pbr/metallic.png")));
-    m_pbrTextures.emplace_back(std::move(Texture(RESOURCE_ROOT "resources/texture/rusted_iron_pbr/roughness.png")));
-    m_pbrTextures.emplace_back(std::move(Texture(RESOURCE_ROOT "resources/texture/rusted_iron_pbr/ao.png")));
+    // resources/texture/gold_scuffed has the same five maps
+    // Layers of texture arrays, shared by maps of the same size and format. Flat normal, grey albedo,
+    // dielectric, rough and unoccluded until the maps are in.
+    const std::tuple<const char*, TextureRole, glm::vec4> maps[] = { { "normal", TextureRole::NORMAL, glm::vec4(0.5f, 0.5f, 1.0f, 1.0f) },
+        { "albedo", TextureRole::COLOR, glm::vec4(0.5f, 0.5f, 0.5f, 1.0f) }, { "metallic", TextureRole::SINGLE_CHANNEL, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f) },
+        { "roughness", TextureRole::SINGLE_CHANNEL, glm::vec4(1.0f) }, { "ao", TextureRole::SINGLE_CHANNEL, glm::vec4(1.0f) } };
+    for (size_t i = 0; i < m_pbrMaps.size(); ++i) {
+        const auto& [name, role, placeholderColor] = maps[i];
+        m_pbrMaps[i] = m_textureArrays.add(std::string(RESOURCE_ROOT "resources/texture/rusted_iron_pbr/") + name + ".png", role, placeholderColor);
+    }
+}
+
+/**
+ * Binds the texture arrays holding the PBR maps from unit 10 on, an array holding several of them only once.
+ */
+void Application::bindPbrMaps()
+{
+    std::vector<TextureArray*> bound;
+    for (size_t map = 0; map < m_pbrMaps.size(); ++map) {
+        auto array = std::find(bound.begin(), bound.end(), m_pbrMaps[map].array);
+        if (array == bound.end()) {
+            m_pbrMaps[map].array->bind(GL_TEXTURE10 + static_cast<GLint>(bound.size()));
+            array = bound.insert(bound.end(), m_pbrMaps[map].array);
+        }
+        m_pbrMapUnits[map] = 10 + static_cast<GLint>(array - bound.begin());
+    }
 }
 
 /**
@@ -1369,23 +2803,142 @@ void Application::drawEnvMap(bool envMapEnabled, bool hdrMapEnabled) {
     }
 }
 
+/**
+ * Feature set of a forward draw, the permutation key of the forward shaders.
+ */
+uint32_t Application::forwardShaderFeatures(bool hasTexCoords) const
+{
+    uint32_t features = 0;
+    if (hasTexCoords)
+        features |= shaderFeatureBit(ShaderFeature::TEX_COORDS);
+    if (useNormalMapping)
+        features |= shaderFeatureBit(ShaderFeature::NORMAL_MAPPING);
+    if (envMapEnabled)
+        features |= shaderFeatureBit(ShaderFeature::ENV_MAP);
+    if (m_useMaterial)
+        features |= shaderFeatureBit(ShaderFeature::MATERIAL);
+    if (shadowSettings.shadowEnabled)
+        features |= shaderFeatureBit(ShaderFeature::SHADOW);
+    // PCF only changes anything with shadows on, leaving it out saves a variant
+    if (shadowSettings.shadowEnabled && shadowSettings.pcfEnabled)
+        features |= shaderFeatureBit(ShaderFeature::PCF);
+    if (hdrMapEnabled)
+        features |= shaderFeatureBit(ShaderFeature::HDR_ENV_MAP);
+    if (hdrMapEnabled && useIrradianceSH)
+        features |= shaderFeatureBit(ShaderFeature::IRRADIANCE_SH);
+    return features;
+}
+
+/**
+ * Picks the forward shader for the current shading mode: the variant for the feature set, or the uber-shader.
+ */
+const Shader* Application::selectForwardShader(uint32_t features)
+{
+    if (!useShaderPermutations)
+        return multiLightShadingEnabled ? (usePbrShading ? &m_pbrShader : &m_multiLightShader) : &m_defaultShader;
+
+    // The uber-shader renders the same image, it stands in until the variant has compiled
+    ShaderPermutations& permutations = multiLightShadingEnabled ? (usePbrShading ? m_pbrPermutations : m_multiLightPermutations) : m_defaultPermutations;
+    const Shader& variant = permutations.get(features);
+    if (!variant.isReady())
+        return multiLightShadingEnabled ? (usePbrShading ? &m_pbrShader : &m_multiLightShader) : &m_defaultShader;
+    return &variant;
+}
+
+/**
+ * Sets the feature switches of an uber-shader as uniforms. Variants have them compiled in, nothing to do.
+ */
+void Application::setShaderFeatureUniforms(const Shader& shader, uint32_t features, GLuint shadowSettingUbo) const
+{
+    if (&shader != &m_defaultShader && &shader != &m_multiLightShader && &shader != &m_pbrShader)
+        return;
+
+    const ShaderPermutations& permutations = multiLightShadingEnabled ? (usePbrShading ? m_pbrPermutations : m_multiLightPermutations) : m_defaultPermutations;
+    for (size_t feature = 0; feature < static_cast<size_t>(ShaderFeature::CNT); ++feature) {
+        const uint32_t bit = shaderFeatureBit(static_cast<ShaderFeature>(feature));
+        if ((permutations.usedFeatures() & bit) && shaderFeatureUniforms[feature] != nullptr)
+            glUniform1i(shader.getUniformLocation(shaderFeatureUniforms[feature]), (features & bit) != 0);
+    }
+
+    // Pass in shadow settings as UBO
+    shader.bindUniformBlock("shadowSetting", 2, shadowSettingUbo);
+}
+
+/**
+ * Compares the uber-shaders (0) against the permutation variants (1) for the current feature set.
+ */
+void Application::startShaderPermutationBenchmark()
+{
+    m_benchmark.start("Shader permutations (0 = uber-shader)", { 0, 1 }, [this](int permutations) {
+        useShaderPermutations = permutations != 0;
+    });
+}
+
+/**
+ * Compares the solar system drawn with a texture per body (0) against texture array layers (1).
+ */
+void Application::startTextureArrayBenchmark()
+{
+    m_benchmark.start("Texture arrays (0 = texture per body)", { 0, 1 }, [this](int arrays) {
+        useTextureArrays = arrays != 0;
+    });
+}
+
+/**
+ * Prints the programs built up to the end of the first frame: when each was submitted, when the driver
+ * had it ready and how many were compiling at the same time.
+ */
+void Application::reportStartupShaders()
+{
+    m_startupShaderStats = ShaderBuilder::stats();
+    const std::vector<ShaderTimelineEntry>& timeline = ShaderBuilder::timeline();
+
+    // Peak number of programs between submission and ready
+    std::vector<std::pair<double, int>> events;
+    for (const ShaderTimelineEntry& entry : timeline) {
+        if (entry.cached || entry.readyMs < 0.0)
+            continue;
+        events.emplace_back(entry.submittedMs, 1);
+        events.emplace_back(entry.readyMs, -1);
+    }
+    std::sort(events.begin(), events.end());
+    int compiling = 0, peakOverlap = 0;
+    for (const auto& [time, delta] : events)
+        peakOverlap = std::max(peakOverlap, compiling += delta);
+
+    std::cout << "Startup shaders: " << m_startupShaderStats.programs << " programs, " << m_startupShaderStats.totalMs << " ms on the CPU ("
+              << m_startupShaderStats.cacheHits << " from the program cache), " << m_startupShaderStats.stagesCompiled << " stages compiled, "
+              << m_startupShaderStats.stageCacheHits << " reused, up to " << peakOverlap << " compiling at once"
+              << (ShaderBuilder::parallelCompileSupported() ? "" : " (no KHR_parallel_shader_compile, ready = first use)") << std::endl;
+    std::cout << "    submit submitted    ready" << std::endl;
+    for (const ShaderTimelineEntry& entry : timeline) {
+        char row[64];
+        std::snprintf(row, sizeof(row), "  %8.1f %8.1f %8.1f ms  ", entry.submitMs, entry.submittedMs, entry.readyMs);
+        std::cout << row << entry.name << (entry.cached ? " (cached)" : "") << std::endl;
+    }
+}
+
 /**
  * Draws using the multi-light shader.
  */
 void Application::drawMultiLightShader(GPUMesh& mesh,bool multiLightShadingEnabled) {
     if (multiLightShadingEnabled) {
-        genUboBufferObj(lights, lightUBO, MAX_LIGHT_CNT);
-        glUniform1i(m_selShader->getUniformLocation("LightCount"), static_cast<GLint>(lights.size()));
+        m_lightStore.bind(*m_selShader, 21);
+        m_lightClusters.bind(*m_selShader, 24);
+        glUniform1i(m_selShader->getUniformLocation("useClusters"), clusteredLightingEnabled);
 
         if (usePbrShading) {
 
-            genUboBufferObj(m_PbrMaterial, PbrUBO);
+            PbrUBO = m_uniformRing.push(m_PbrMaterial);
+            for (const TextureArraySlot& map : m_pbrMaps)
+                requestTextureDetail(*map.array, mesh, m_modelMatrix, m_viewMatrix, m_projectionMatrix);
 
-            glUniform1i(m_selShader->getUniformLocation("normalMap"), true ? 10 : -1);
-            glUniform1i(m_selShader->getUniformLocation("albedoMap"), true ? 11 : -1);
-            glUniform1i(m_selShader->getUniformLocation("metallicMap"), true ? 12 : -1);
-            glUniform1i(m_selShader->getUniformLocation("roughnessMap"), true ? 13 : -1);
-            glUniform1i(m_selShader->getUniformLocation("aoMap"), true ? 14 : -1);
+            // Units of the arrays bindPbrMaps() bound, and the layers in them
+            const char* const pbrMapNames[] = { "normalMap", "albedoMap", "metallicMap", "roughnessMap", "aoMap" };
+            for (size_t map = 0; map < m_pbrMaps.size(); ++map) {
+                glUniform1i(m_selShader->getUniformLocation(pbrMapNames[map]), m_pbrMapUnits[map]);
+                glUniform1i(m_selShader->getUniformLocation(std::string(pbrMapNames[map]) + "Layer"), m_pbrMaps[map].layer);
+            }
 
             hdrIrradianceMap.bind(GL_TEXTURE15);
             glUniform1i(m_selShader->getUniformLocation("irradianceMap"), true ? 15 : -1);
@@ -1396,16 +2949,17 @@ void Application::drawMultiLightShader(GPUMesh& mesh,bool multiLightShadingEnabl
             BRDFTexture.bind(GL_TEXTURE17);
             glUniform1i(m_selShader->getUniformLocation("brdfLUT"), true ? 17 : -1);
 
-            glUniform1i(m_selShader->getUniformLocation("hdrEnvMapEnabled"), hdrMapEnabled);
+            if (irradianceShUBO != 0)
+                m_selShader->bindUniformBlock("IrradianceSH", 3, irradianceShUBO);
 
-            mesh.drawPBR(*m_selShader, PbrUBO, lightUBO);
+            mesh.drawPBR(*m_selShader, PbrUBO);
         }
         else {
-            mesh.draw(*m_selShader, lightUBO, multiLightShadingEnabled);
+            mesh.draw(*m_selShader);
         }
     }
     else {
-        genUboBufferObj(*selectedLight, lightUBO); // Pass single Light
+        updateUboBufferObj(m_lightStore.get(selectedLight), lightUBO); // Pass single Light
         mesh.draw(*m_selShader, lightUBO, multiLightShadingEnabled);
     }
 }
@@ -1423,7 +2977,18 @@ void Application::renderSolarSystem() {
         updateFrameNumber();
     }
 
-    m_selShader = &m_defaultShader;
+    if (textureEnabled)
+        initCelestialTextures();
+    m_selShader = useTextureArrays ? &m_celestialArrayShader : &m_defaultShader;
+    // Arrays on the colour and normal map units, bound again only for a body whose layer is in another
+    const TextureArray* boundColorArray = nullptr;
+    const TextureArray* boundNormalArray = nullptr;
+    if (useTextureArrays) {
+        // Samplers of different types may not share a unit, heightTex and SkyBox would otherwise sit on the colour map's 0
+        m_selShader->bind();
+        glUniform1i(m_selShader->getUniformLocation("heightTex"), 2);
+        glUniform1i(m_selShader->getUniformLocation("SkyBox"), 20);
+    }
 
     GLint previousVBO;
     glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &previousVBO);
@@ -1466,16 +3031,14 @@ void Application::renderSolarSystem() {
 
             m_selShader->bind();
 
-            GLuint newUBOMaterial;
             GPUMaterial gpuMat = GPUMaterial(m_Material);
             gpuMat.kd = body.kd();
             gpuMat.ks = glm::vec3(0.0f);    // No specular reflection in space
             gpuMat.shininess = 0.0f;
-            genUboBufferObj(gpuMat, newUBOMaterial);
-            mesh.setUBOMaterial(newUBOMaterial);
+            mesh.setUBOMaterial(m_uniformRing.push(gpuMat));
 
-            GLuint shadowSettingUbo;
-            genUboBufferObj(shadowSettings, shadowSettingUbo);
+            // Pass in shadow settings as UBO
+            m_selShader->bindUniformBlock("shadowSetting", 2, m_uniformRing.push(shadowSettings));
 
             glUniformMatrix4fv(m_selShader->getUniformLocation("mvpMatrix"), 1, GL_FALSE, glm::value_ptr(mvpMatrix));
             glUniformMatrix4fv(m_selShader->getUniformLocation("normalModelMatrix"), 1, GL_FALSE, glm::value_ptr(normalModelMatrix));
@@ -1493,13 +3056,42 @@ void Application::renderSolarSystem() {
             glUniform1i(m_selShader->getUniformLocation("useEnvMap"), GL_FALSE);
 
             // Render planet textures.
-            if (textureEnabled)
+            if (textureEnabled && useTextureArrays)
+            {
+                const bool hasTexCoords = mesh.hasTextureCoords();
+                const auto colorSlot = celestialTextureSlots.find(body.getTexturePath() + ".jpg");
+                if (colorSlot != celestialTextureSlots.end() && hasTexCoords) {
+                    if (boundColorArray != colorSlot->second.array) {
+                        colorSlot->second.array->bind(GL_TEXTURE0);
+                        boundColorArray = colorSlot->second.array;
+                    }
+                    requestTextureDetail(*colorSlot->second.array, mesh, newMatrix, view, projection);
+                    glUniform1i(m_selShader->getUniformLocation("colorMap"), 0);
+                    glUniform1i(m_selShader->getUniformLocation("colorMapLayer"), colorSlot->second.layer);
+                }
+                glUniform1i(m_selShader->getUniformLocation("hasTexCoords"), colorSlot != celestialTextureSlots.end() && hasTexCoords);
+
+                const auto normalSlot = celestialTextureSlots.find(body.getTexturePath() + "_normal.png");
+                const bool normalMapped = useNormalMapping && normalSlot != celestialTextureSlots.end();
+                if (normalMapped) {
+                    if (boundNormalArray != normalSlot->second.array) {
+                        normalSlot->second.array->bind(GL_TEXTURE3);
+                        boundNormalArray = normalSlot->second.array;
+                    }
+                    requestTextureDetail(*normalSlot->second.array, mesh, newMatrix, view, projection);
+                    glUniform1i(m_selShader->getUniformLocation("normalTex"), 3);
+                    glUniform1i(m_selShader->getUniformLocation("normalTexLayer"), normalSlot->second.layer);
+                }
+                glUniform1i(m_selShader->getUniformLocation("useNormalMapping"), normalMapped);
+            }
+            else if (textureEnabled)
             {
                 Texture* bodyTexture = findCelestialTexture(body.getTexturePath() + ".jpg");
                 if (bodyTexture != NULL)
                 {
                     bool hasTexCoords = mesh.hasTextureCoords();
                     bodyTexture->bind(hasTexCoords ? GL_TEXTURE0 : 0);
+                    requestTextureDetail(*bodyTexture, mesh, newMatrix, view, projection);
                     glUniform1i(m_selShader->getUniformLocation("hasTexCoords"), hasTexCoords);
                     glUniform1i(m_selShader->getUniformLocation("colorMap"), hasTexCoords ? 0 : -1);
                 } else {
@@ -1514,6 +3106,7 @@ void Application::renderSolarSystem() {
                     {
                         glUniform1i(m_selShader->getUniformLocation("useNormalMapping"), GL_TRUE);
                         normalTexture->bind(GL_TEXTURE3);
+                        requestTextureDetail(*normalTexture, mesh, newMatrix, view, projection);
                         glUniform1i(m_selShader->getUniformLocation("normalTex"), 3);
                     }
                     else
@@ -1536,14 +3129,9 @@ void Application::renderSolarSystem() {
             sun_light.position  = (i == 0) ? glm::vec3(0.0f) : glm::vec3(translate(inverse(newMatrix), -1.0f * newPos)[3]);
             sun_light.color     = body.kd();
             
-            if (usePbrShading) {
-                genUboBufferObj(sun_light, lightUBO); // Pass single Light
-                mesh.drawPBR(*m_selShader, PbrUBO, lightUBO);
-            }
-            else {
-                genUboBufferObj(sun_light, lightUBO); // Pass single Light
-                mesh.draw(*m_selShader, lightUBO, false);
-            }
+            // The solar system is always drawn with the single light default shader
+            updateUboBufferObj(sun_light, lightUBO); // Pass single Light
+            mesh.draw(*m_selShader, lightUBO, false);
 
             glBindVertexArray(0);
         }
@@ -1560,23 +3148,41 @@ void Application::renderSolarSystem() {
 }
 
 /**
- * Initializes the textures and normal maps for the celestial bodies.
+ * Starts loading the textures and normal maps for the celestial bodies, the first time the solar system is drawn
+ * with them. Only the form useTextureArrays draws with is loaded, as array layers or as a texture per map.
  */
 void Application::initCelestialTextures()
 {
+    bool& loaded = useTextureArrays ? m_celestialArraysLoaded : m_celestialTexturesLoaded;
+    if (loaded)
+        return;
+    loaded = true;
+
     for (auto& body : celestialBodies)
     {
         std::string path = body.getTexturePath();
-        try
-        {
-            celestialTextures[path + ".jpg"] = Texture(std::string(RESOURCE_ROOT) + path + ".jpg");
-            celestialTextures[path + "_normal.png"] = Texture(std::string(RESOURCE_ROOT) + path + "_normal.png");
+        const std::filesystem::path colorPath = std::string(RESOURCE_ROOT) + path + ".jpg";
+        // Only bodies that have a normal map get one, the others render without normal mapping
+        const std::filesystem::path normalPath = std::string(RESOURCE_ROOT) + path + "_normal.png";
+        const bool hasNormalMap = std::filesystem::exists(normalPath);
+        if (useTextureArrays) {
+            // The maps of every body are the same size
+            celestialTextureSlots[path + ".jpg"] = m_celestialArrays.add(colorPath, TextureRole::COLOR, glm::vec4(0.5f, 0.5f, 0.5f, 1.0f));
+            if (hasNormalMap)
+                celestialTextureSlots[path + "_normal.png"] = m_celestialArrays.add(normalPath, TextureRole::NORMAL, glm::vec4(0.5f, 0.5f, 1.0f, 1.0f));
+            continue;
         }
-        catch (textureLoadingException e)
-        {
-            std::cerr << e.what() << std::endl;
+
+        // Map nodes do not move, so the loader can fill them in later
+        Texture& texture = celestialTextures[path + ".jpg"] = Texture(glm::vec4(0.5f, 0.5f, 0.5f, 1.0f));
+        loadSceneTexture(texture, colorPath);
+        if (hasNormalMap) {
+            Texture& normalTexture = celestialTextures[path + "_normal.png"] = Texture(glm::vec4(0.5f, 0.5f, 1.0f, 1.0f));
+            loadSceneTexture(normalTexture, normalPath, TextureRole::NORMAL);
         }
     }
+    if (useTextureArrays)
+        m_celestialArrays.load(m_textureLoader, streamTextures);
 }
 
 /**
@@ -9,8 +9,27 @@
 #include "Textures/ssaoBufferTexture.h"
 
 #include "celestial_body.h"
-
+#include "light_clusters.h"
+#include "light_store.h"
+#include "profiler.h"
+#include "render_graph.h"
+#include "frame_pacer.h"
+#include "uniform_buffer_ring.h"
+#include "ibl_cache.h"
+#include "spherical_harmonics.h"
+#include "brdf_lut.h"
+#include "rgbe_decoder.h"
+#include "equirect_to_cube.h"
+#include "texture_loader.h"
+#include "texture_array_manager.h"
+#include "temporal.h"
+
+// Number of random lights spawned when the deferred pipeline is first enabled
 #define MAX_LIGHT_CNT 10
+// Lights drawn as point markers in the forward scene
+#define MAX_LIGHT_MARKERS 256
+// GGX samples per texel of the prefilter reference, and the most the prefilter itself uses
+#define PREFILTER_REFERENCE_SAMPLES 4096
 #include "minimap.h"
 #include <stb/stb_image.h>
 
@@ -30,15 +49,33 @@ private:
 
     Shader m_debugShader;
     Shader m_defaultShader;
+    Shader m_celestialArrayShader; // m_defaultShader sampling texture arrays
     Shader m_multiLightShader;
     Shader m_pbrShader;
-    Shader* m_selShader;
+    const Shader* m_selShader;
+
+    // #define variants of the default, multi-light and PBR shaders, picked per draw from the active features
+    bool useShaderPermutations = true;
+    ShaderPermutations m_defaultPermutations;
+    ShaderPermutations m_multiLightPermutations;
+    ShaderPermutations m_pbrPermutations;
+    uint32_t forwardShaderFeatures(bool hasTexCoords) const;
+    const Shader* selectForwardShader(uint32_t features);
+    void setShaderFeatureUniforms(const Shader& shader, uint32_t features, GLuint shadowSettingUbo) const;
+    void startShaderPermutationBenchmark();
+    void startTextureArrayBenchmark();
+
+    // Programs built up to the end of the first frame (env map generation included), split into cache hits and source compiles
+    ShaderBuildStats m_startupShaderStats;
+    void reportStartupShaders();
 
     Shader m_shadowShader;
     Shader m_lightShader;
     Shader m_borderShader;
     Shader m_pointShader;
     Shader m_postProcessShader;
+    Shader m_bloomDownsampleShader;
+    Shader m_bloomUpsampleShader;
 
     // Shader m_celestialBodyShader;
 
@@ -74,6 +111,23 @@ private:
     void generateSkyBox();
 
     void generateHdrMap();
+    void generateBrdfLut();
+    void verifyBrdfLut(const std::vector<float>& lut);
+    // Time to generate the IBL maps, or to load them when they were cached
+    CpuTimer m_iblTimer;
+    bool m_iblFromCache = false;
+
+    // Diffuse irradiance as order 2 spherical harmonics (IrradianceSH block) instead of sampling hdrIrradianceMap
+    bool useIrradianceSH = true;
+    SphericalHarmonics9 m_irradianceSH;
+    GLuint irradianceShUBO = 0;
+    void reportIrradianceSH(const uint16_t* pixels, int width, int height, float projectionMs, float gpuMs) const;
+    // Resample the equirect environment into the cube on the CPU instead of uploading it for hdr_to_cube_frag.glsl
+    bool cpuEquirectToCube = true;
+    void renderEquirectToCube(const Shader& shader, hdrTexture& equirect, cubeMapTex& cube);
+    void compareEquirectToCube();
+    // Times stbi_loadf against RgbeImage on the environment HDR and checks they decode the same values
+    void compareHdrDecoders() const;
 
     // Definition HDR cubemap settings
     bool hdrMapEnabled = false;
@@ -95,6 +149,21 @@ private:
     cubeMapTex hdrPrefilteredMap;
     Shader m_hdrPrefilterShader;
 
+    // Prefiltered map: each GGX sample reads the hdrCubeMap mip matching its share of the lobe (off: the top level),
+    // with prefilterSampleCount() samples. Regenerating it at runtime spreads the faces over frames.
+    bool prefilterFromSourceMips = true;
+    int prefilterFacesPerFrame = 6;
+    GLuint m_prefilterFBO = 0;
+    std::unique_ptr<cubeMapTex> m_prefilterTarget; // cube being regenerated, swapped in once complete
+    int m_prefilterNextFace = 0;
+    int m_prefilterFrames = 0;
+    float m_prefilterMs = 0.0f;
+    int prefilterSampleCount(int mip) const;
+    void renderPrefilterFace(GLuint cubeMap, int mip, int face, bool fromSourceMips, int sampleCount);
+    void startPrefilter();
+    void stepPrefilter(int maxFaces);
+    void comparePrefilter();
+
     Texture BRDFTexture;
     Shader m_brdfShader;
     GLuint quadVAO = 0, quadVBO = 0;
@@ -115,23 +184,60 @@ private:
     Shader m_deferredLightShader;
     Shader m_deferredDebugShader;
 
+    // G-buffer targets of the current frame, set by the render graph passes that use them
     GLuint gBuffer = 0;
-    ssaoBufferTex gPos, gNor, gCol;
-
-    GLuint renderDepth;
+    GLuint gNor = 0, gCol = 0, gDepth = 0;
     
     void genDeferredRenderBuffer(bool& defRenderBufferGenerated);
     void deferredRenderPipeLine();
 
-    // unused
-    GLuint ssaoFBO = 0, ssaoBlurFBO = 0;
-    ssaoBufferTex ssaoColorBuff, ssaoColorBlurBuff;
+    // Deferred lighting: fullscreen, tiled (DEFERRED_TILE_SIZE tiles with depth bounds) or stencil light volumes
+    DeferredLightingMode deferredLightingMode = DeferredLightingMode::TILED;
+    LightClusters m_deferredTiles;
+    GLuint tileDepthTex = 0;
+    Shader m_tileDepthShader;
+    Shader m_tiledLightingShader;
+    Shader m_lightVolumeShader;
+
+    void tileDepthPass(const glm::mat4& view, const glm::mat4& projection);
+    void deferredLightingPass(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& cameraPos);
+    void bindDeferredLightingInputs(const Shader& shader, const glm::mat4& view, const glm::mat4& projection, const glm::vec3& cameraPos);
+    void lightVolumePass(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& cameraPos);
+    void startDeferredLightingBenchmark(DeferredLightingMode mode);
+
+    // SSAO: evaluated at ssaoResolution from the G-buffer, blurred and upsampled in the lighting pass
+    bool ssaoOcclusionEnabled = true;
+    bool ssaoShowOcclusion = false;
+    SsaoResolution ssaoResolution = SsaoResolution::HALF;
+    int ssaoKernelSize = 32;
+    float ssaoRadius = 0.5f;
+    float ssaoBias = 0.025f;
+    float ssaoBlurSharpness = 16.0f;
+    std::vector<glm::vec3> ssaoKernel;
     ssaoBufferTex ssaoNoiseTex;
+    GLuint ssaoTex = 0;
+    GpuTimer m_ssaoGpuTimer;
+
+    // Temporal accumulation of the SSAO: each frame evaluates 1 / ssaoTemporalDivisor of the kernel and
+    // the history converges to the full kernel over a few frames
+    bool ssaoTemporalEnabled = true;
+    int ssaoTemporalDivisor = 4;
+    float ssaoTemporalMaxFrames = 16.0f;
+    float ssaoTemporalClampGamma = 1.5f;
+    float ssaoDisocclusionThreshold = 0.05f;
+    TemporalReprojection m_temporal;
+    TemporalHistory m_ssaoHistory;
 
     Shader m_shaderSSAO;
     Shader m_shaderSSAOBlur;
+    Shader m_shaderSSAOTemporal;
 
-    void genSSAOFrameBuffer();
+    void initSSAO();
+    void ssaoPass(const glm::mat4& view, const glm::mat4& projection);
+    void ssaoTemporalPass(GLuint input);
+    void ssaoBlurPass(GLuint input, const glm::ivec2& direction);
+    void startSsaoBenchmark();
+    void startSsaoTemporalBenchmark();
 
     // Definition for model Obejcts includeing texture and Material
     std::vector<GPUMesh> m_meshes;
@@ -140,14 +246,17 @@ private:
     char file_path_buffer[256];
     std::string texturePath;
 
-    std::vector<Texture> m_pbrTextures;
+    // normal, albedo, metallic, roughness and ao, and the units bindPbrMaps() put their arrays on
+    std::array<TextureArraySlot, 5> m_pbrMaps;
+    std::array<GLint, 5> m_pbrMapUnits {};
+    void bindPbrMaps();
 
     bool textureEnabled = true;
 
     Material m_Material;
     PBRMaterial m_PbrMaterial;
 
-    GLuint PbrUBO;
+    GLuint PbrUBO = 0;
 
     bool m_useMaterial = true;
     bool m_materialChangedByUser = false;
@@ -166,8 +275,19 @@ private:
     Camera* selectedCamera;
 
     // Definition for Lights
-    std::vector<Light> lights{};
-    Light* selectedLight;
+    LightStore m_lightStore;
+    LightHandle selectedLight;
+
+    void resetLights();
+    void generateRandomLights(int count, float linear = 0.7f, float quadratic = 1.8f);
+    void animateLights();
+
+    // Clustered light culling for the forward multi-light / PBR shaders
+    LightClusters m_lightClusters;
+    bool clusteredLightingEnabled = true;
+    int randomLightCount = 256;
+    float randomLightQuadratic = 75.0f;
+    int animatedLightCount = 0;
 
     //Shadow
     shadowSetting shadowSettings;
@@ -194,11 +314,30 @@ private:
 
     //Post-Process Shader
     bool usePostProcess = false;
-    void initPostProcess();
-    void runPostProcess();
-    GLuint framebufferPostProcess;
-    GLuint texturePostProcess;
-    GLuint depthbufferPostProcess;
+    void runPostProcess(int bloomMips);
+    GLuint texturePostProcess = 0;
+
+    // Bloom: bright-pass into a chain of half sized mips, tent filtered back up and added onto the scene.
+    // The radius picks the number of mips, so the cost stays around 4/3 of the first (half resolution) level.
+    bool bloomEnabled = true;
+    float bloomThreshold = 0.8f;
+    float bloomSoftKnee = 0.5f;
+    float bloomIntensity = 0.6f;
+    float bloomRadius = 32.0f;
+    GLuint textureBloom = 0;
+    GpuTimer m_bloomGpuTimer;
+
+    int bloomMipCount(const glm::ivec2& size) const;
+    float bloomFilterRadius(int mipCount) const;
+    void bloomDownsamplePass(GLuint source, const glm::ivec2& sourceSize, bool prefilter);
+    void bloomUpsamplePass(GLuint source, const glm::ivec2& sourceSize, float filterRadius);
+    void startBloomBenchmark();
+
+    // Screen sized targets of all passes, handed out by the per frame render graph
+    RenderTargetPool m_renderTargets;
+    RenderGraphStats m_forwardGraphStats, m_deferredGraphStats;
+    float renderScale = 1.0f;
+    void onFramebufferResize();
     const int WINDOW_WIDTH = 1024;
     const int WINDOW_HEIGHT = 1024;
     glm::ivec2 windowSizes;
@@ -216,6 +355,13 @@ private:
     glm::uint frame = 0;
     std::array<CelestialBody, 3> celestialBodies;
     std::map<std::string, Texture> celestialTextures;
+    // The same maps as layers of texture arrays, drawn with these when useTextureArrays is on
+    std::map<std::string, TextureArraySlot> celestialTextureSlots;
+    TextureArrayManager m_celestialArrays;
+    bool useTextureArrays = true;
+    // Which of the two forms has been requested, each once it is first drawn
+    bool m_celestialTexturesLoaded = false;
+    bool m_celestialArraysLoaded = false;
     void initCelestialTextures();
     Texture* findCelestialTexture(std::string celestialTexturePath);
     void updateFrameNumber();
@@ -224,8 +370,46 @@ private:
     float sunlight_strength = 2.8f;
     Light sun_light;
 
+    // Image textures decode on worker threads and upload a slice per frame, with placeholders until then
+    TextureLoader m_textureLoader;
+    // false waits for every texture at the end of the constructor, as loading them one by one did
+    bool asyncTextureLoading = true;
+    // Cook image textures to BC1/BC3/BC4/BC5 by role, cached in texture_cache
+    bool compressTextures = true;
+    float textureUploadBudgetMs = 2.0f;
+    // Mesh textures start at 64x64 and stream finer levels in as they get larger on screen, within this much GPU memory
+    bool streamTextures = true;
+    float textureStreamingBudgetMB = 16.0f;
+    float m_renderHeight = 1.0f;
+    // PBR maps grouped by size and format into GL_TEXTURE_2D_ARRAY layers
+    TextureArrayManager m_textureArrays;
+    // Texture binds of the last frame, through abstractTexture::bind()
+    int m_textureBindsLastFrame = 0;
+    float m_startupMs = 0.0f;
+    // Longest frame while textures were still loading, reported once they are all in
+    float m_loadingMaxFrameMs = 0.0f;
+    void requestTextures();
+    void loadSceneTexture(abstractTexture& target, std::filesystem::path file, TextureRole role = TextureRole::COLOR);
+    void requestTextureDetail(const abstractTexture& texture, const GPUMesh& mesh, const glm::mat4& modelMatrix, const glm::mat4& view, const glm::mat4& projection);
+    void reportTextureLoading() const;
+    void compareMipGeneration() const;
+
+    // Profiling
+    CpuTimer m_frameCpuTimer;
+    GpuTimer m_frameGpuTimer;
+    SweepBenchmark m_benchmark;
+    void startLightScalingBenchmark(bool clustered);
+
+    // Frame pacing: 0 frames in flight means glFinish() after every frame
+    FramePacer m_framePacer;
+    int framesInFlight = 2;
+    // Material, shadow setting and PBR blocks of the draws, refilled every frame
+    UniformBufferRing m_uniformRing;
+    void startFramePacingBenchmark();
+
 public:
     Application();
+    ~Application();
     void update();
     void onKeyPressed(int key, int mods);
     void onKeyReleased(int key, int mods);
@@ -0,0 +1,224 @@
+#include "block_compression.h"
+
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec3.hpp>
+#include <cstring>
+#define STB_DXT_IMPLEMENTATION
+#include <stb/stb_dxt.h>
+DISABLE_WARNINGS_POP()
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <thread>
+
+namespace {
+// The 8 (or 6 plus 0 and 255) values a BC4 block interpolates between its two endpoints
+std::array<uint8_t, 8> bc4Palette(uint8_t a, uint8_t b)
+{
+    std::array<uint8_t, 8> palette { a, b };
+    if (a > b) {
+        for (int i = 1; i < 7; ++i)
+            palette[static_cast<size_t>(i + 1)] = static_cast<uint8_t>(((7 - i) * a + i * b) / 7);
+    } else {
+        for (int i = 1; i < 5; ++i)
+            palette[static_cast<size_t>(i + 1)] = static_cast<uint8_t>(((5 - i) * a + i * b) / 5);
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+    return palette;
+}
+
+// Writes one channel of a 4x4 RGBA8 block
+void decodeBc4(const uint8_t* block, uint8_t* texels, int channel)
+{
+    const std::array<uint8_t, 8> palette = bc4Palette(block[0], block[1]);
+    uint64_t indices = 0;
+    for (int i = 0; i < 6; ++i)
+        indices |= uint64_t(block[2 + i]) << (8 * i);
+    for (int i = 0; i < 16; ++i)
+        texels[i * 4 + channel] = palette[(indices >> (3 * i)) & 7];
+}
+
+glm::ivec3 unpack565(uint16_t color)
+{
+    const int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+    return { (r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 3) };
+}
+
+void decodeBc1(const uint8_t* block, uint8_t* texels, bool alwaysFourColors)
+{
+    const uint16_t c0 = uint16_t(block[0] | (block[1] << 8)), c1 = uint16_t(block[2] | (block[3] << 8));
+    std::array<glm::ivec3, 4> palette { unpack565(c0), unpack565(c1) };
+    std::array<uint8_t, 4> alpha { 255, 255, 255, 255 };
+    if (c0 > c1 || alwaysFourColors) {
+        palette[2] = (2 * palette[0] + palette[1]) / 3;
+        palette[3] = (palette[0] + 2 * palette[1]) / 3;
+    } else {
+        palette[2] = (palette[0] + palette[1]) / 2;
+        palette[3] = glm::ivec3(0);
+        alpha[3] = 0;
+    }
+    const uint32_t indices = block[4] | (block[5] << 8) | (block[6] << 16) | (uint32_t(block[7]) << 24);
+    for (int i = 0; i < 16; ++i) {
+        const uint32_t index = (indices >> (2 * i)) & 3;
+        texels[i * 4 + 0] = static_cast<uint8_t>(palette[index].r);
+        texels[i * 4 + 1] = static_cast<uint8_t>(palette[index].g);
+        texels[i * 4 + 2] = static_cast<uint8_t>(palette[index].b);
+        texels[i * 4 + 3] = alpha[index];
+    }
+}
+
+int blocksAcross(int size)
+{
+    return (size + 3) / 4;
+}
+}
+
+size_t blockBytes(BlockFormat format)
+{
+    return format == BlockFormat::BC1 || format == BlockFormat::BC4 ? 8 : 16;
+}
+
+GLenum blockInternalFormat(BlockFormat format)
+{
+    switch (format) {
+    case BlockFormat::BC1:
+        return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case BlockFormat::BC3:
+        return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case BlockFormat::BC4:
+        return GL_COMPRESSED_RED_RGTC1;
+    default:
+        return GL_COMPRESSED_RG_RGTC2;
+    }
+}
+
+const char* blockFormatName(BlockFormat format)
+{
+    switch (format) {
+    case BlockFormat::BC1:
+        return "BC1";
+    case BlockFormat::BC3:
+        return "BC3";
+    case BlockFormat::BC4:
+        return "BC4";
+    default:
+        return "BC5";
+    }
+}
+
+size_t compressedSize(BlockFormat format, int width, int height)
+{
+    return static_cast<size_t>(blocksAcross(width)) * static_cast<size_t>(blocksAcross(height)) * blockBytes(format);
+}
+
+std::vector<uint8_t> compressImage(BlockFormat format, const uint8_t* rgba, int width, int height, int numThreads)
+{
+    if (numThreads <= 0)
+        numThreads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+
+    const int blocksX = blocksAcross(width), blocksY = blocksAcross(height);
+    const size_t size = blockBytes(format);
+    std::vector<uint8_t> blocks(size * static_cast<size_t>(blocksX) * static_cast<size_t>(blocksY));
+
+    std::atomic<int> nextRow { 0 };
+    const auto compressRows = [&]() {
+        std::array<uint8_t, 64> texels;
+        std::array<uint8_t, 32> channels;
+        for (int by = nextRow++; by < blocksY; by = nextRow++) {
+            for (int bx = 0; bx < blocksX; ++bx) {
+                for (int i = 0; i < 16; ++i) {
+                    const int x = std::min(bx * 4 + i % 4, width - 1), y = std::min(by * 4 + i / 4, height - 1);
+                    std::copy_n(rgba + (static_cast<size_t>(y) * static_cast<size_t>(width) + static_cast<size_t>(x)) * 4, 4, texels.data() + i * 4);
+                }
+                uint8_t* block = blocks.data() + static_cast<size_t>(by * blocksX + bx) * size;
+                switch (format) {
+                case BlockFormat::BC1:
+                    stb_compress_dxt_block(block, texels.data(), 0, STB_DXT_HIGHQUAL);
+                    break;
+                case BlockFormat::BC3:
+                    stb_compress_dxt_block(block, texels.data(), 1, STB_DXT_HIGHQUAL);
+                    break;
+                case BlockFormat::BC4:
+                    for (size_t i = 0; i < 16; ++i)
+                        channels[i] = texels[i * 4];
+                    stb_compress_bc4_block(block, channels.data());
+                    break;
+                case BlockFormat::BC5:
+                    for (size_t i = 0; i < 16; ++i) {
+                        channels[i * 2 + 0] = texels[i * 4 + 0];
+                        channels[i * 2 + 1] = texels[i * 4 + 1];
+                    }
+                    stb_compress_bc5_block(block, channels.data());
+                    break;
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int thread = 1; thread < std::min(numThreads, blocksY); ++thread)
+        threads.emplace_back(compressRows);
+    compressRows();
+    for (std::thread& thread : threads)
+        thread.join();
+    return blocks;
+}
+
+std::vector<uint8_t> decompressImage(BlockFormat format, const uint8_t* blocks, int width, int height)
+{
+    const int blocksX = blocksAcross(width), blocksY = blocksAcross(height);
+    const size_t size = blockBytes(format);
+    std::vector<uint8_t> rgba(static_cast<size_t>(width) * static_cast<size_t>(height) * 4);
+    std::array<uint8_t, 64> texels;
+    for (int by = 0; by < blocksY; ++by) {
+        for (int bx = 0; bx < blocksX; ++bx) {
+            const uint8_t* block = blocks + static_cast<size_t>(by * blocksX + bx) * size;
+            texels.fill(0);
+            switch (format) {
+            case BlockFormat::BC1:
+                decodeBc1(block, texels.data(), false);
+                break;
+            case BlockFormat::BC3:
+                decodeBc1(block + 8, texels.data(), true);
+                decodeBc4(block, texels.data(), 3);
+                break;
+            case BlockFormat::BC4:
+                decodeBc4(block, texels.data(), 0);
+                break;
+            case BlockFormat::BC5:
+                decodeBc4(block, texels.data(), 0);
+                decodeBc4(block + 8, texels.data(), 1);
+                break;
+            }
+            if (format == BlockFormat::BC4 || format == BlockFormat::BC5) {
+                for (size_t i = 0; i < 16; ++i)
+                    texels[i * 4 + 3] = 255;
+            }
+            for (int i = 0; i < 16; ++i) {
+                const int x = bx * 4 + i % 4, y = by * 4 + i / 4;
+                if (x < width && y < height)
+                    std::copy_n(texels.data() + i * 4, 4, rgba.data() + (static_cast<size_t>(y) * static_cast<size_t>(width) + static_cast<size_t>(x)) * 4);
+            }
+        }
+    }
+    return rgba;
+}
+
+float blockPsnr(BlockFormat format, const uint8_t* reference, const uint8_t* decoded, int width, int height)
+{
+    const int channels = format == BlockFormat::BC1 ? 3 : format == BlockFormat::BC3 ? 4 : format == BlockFormat::BC4 ? 1 : 2;
+    double squaredError = 0.0;
+    for (size_t i = 0; i < static_cast<size_t>(width) * static_cast<size_t>(height); ++i) {
+        for (size_t channel = 0; channel < static_cast<size_t>(channels); ++channel) {
+            const double difference = double(reference[i * 4 + channel]) - decoded[i * 4 + channel];
+            squaredError += difference * difference;
+        }
+    }
+    const double mse = squaredError / (double(width) * height * channels);
+    return mse > 0.0 ? static_cast<float>(10.0 * std::log10(255.0 * 255.0 / mse)) : std::numeric_limits<float>::infinity();
+}
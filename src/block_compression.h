@@ -0,0 +1,38 @@
+#pragma once
+
+#include <framework/opengl_includes.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// S3TC is an extension every desktop driver has, glad was generated without it
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// 4x4 block formats the texture cooker writes
+enum class BlockFormat {
+    BC1, // RGB, 8 bytes a block
+    BC3, // RGBA, BC1 colour plus a BC4 alpha block
+    BC4, // R, 8 bytes a block
+    BC5, // RG, two BC4 blocks
+};
+
+size_t blockBytes(BlockFormat format);
+GLenum blockInternalFormat(BlockFormat format);
+const char* blockFormatName(BlockFormat format);
+// Size of a width x height image, partial blocks at the edges count whole
+size_t compressedSize(BlockFormat format, int width, int height);
+
+// Compresses an RGBA8 image with stb_dxt (BC4 takes R, BC5 R and G), rows of blocks split over
+// numThreads threads (0: one per core). Edge blocks repeat the last row and column.
+std::vector<uint8_t> compressImage(BlockFormat format, const uint8_t* rgba, int width, int height, int numThreads = 0);
+// Back to RGBA8 (unused channels 0, alpha 255), to measure what compression lost
+std::vector<uint8_t> decompressImage(BlockFormat format, const uint8_t* blocks, int width, int height);
+
+// Peak signal to noise ratio in dB between two RGBA8 images over the channels the format stores
+float blockPsnr(BlockFormat format, const uint8_t* reference, const uint8_t* decoded, int width, int height);
@@ -0,0 +1,150 @@
+#include "brdf_lut.h"
+
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/format.h>
+#include <glm/geometric.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+namespace {
+constexpr std::array<char, 4> MAGIC { 'B', 'R', 'D', 'F' };
+constexpr uint32_t VERSION = 1;
+
+struct FileHeader {
+    std::array<char, 4> magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t numSamples;
+};
+
+float radicalInverseVdC(uint32_t bits)
+{
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return float(bits) * 2.3283064365386963e-10f;
+}
+
+// ImportanceSampleGGX around N = (0, 0, 1), whose tangent frame is (0, -1, 0), (1, 0, 0)
+glm::vec3 importanceSampleGGX(const glm::vec2& xi, float roughness)
+{
+    const float a = roughness * roughness;
+    const float phi = glm::two_pi<float>() * xi.x;
+    const float cosTheta = std::sqrt((1.0f - xi.y) / (1.0f + (a * a - 1.0f) * xi.y));
+    const float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+    const glm::vec3 h { std::cos(phi) * sinTheta, std::sin(phi) * sinTheta, cosTheta };
+    return glm::normalize(glm::vec3(h.y, -h.x, h.z));
+}
+
+// Same k as brdf_frag.glsl
+float geometrySchlickGGX(float NdotV, float roughness)
+{
+    const float r = roughness + 1.0f;
+    const float k = (r * r) / 2.0f;
+    return NdotV / (NdotV * (1.0f - k) + k);
+}
+
+std::filesystem::path cacheFile(const std::filesystem::path& directory)
+{
+    return directory / fmt::format("brdf_lut_{}_{}.bin", BRDF_LUT_SIZE, BRDF_LUT_SAMPLES);
+}
+}
+
+std::vector<float> integrateBrdfLut(int size, int numSamples, int numThreads)
+{
+    if (numThreads <= 0)
+        numThreads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    numThreads = std::min(numThreads, size);
+
+    std::vector<glm::vec2> hammersley(static_cast<size_t>(numSamples));
+    for (size_t i = 0; i < hammersley.size(); ++i)
+        hammersley[i] = { float(i) / float(numSamples), radicalInverseVdC(static_cast<uint32_t>(i)) };
+
+    std::vector<float> lut(static_cast<size_t>(size) * static_cast<size_t>(size) * 2);
+    const auto integrateRows = [&](int thread) {
+        // The half vectors only depend on the row's roughness, shared by every N.V of the row
+        std::vector<glm::vec3> halfVectors(hammersley.size());
+        for (int row = size * thread / numThreads; row < size * (thread + 1) / numThreads; ++row) {
+            const float roughness = (float(row) + 0.5f) / float(size);
+            for (size_t i = 0; i < halfVectors.size(); ++i)
+                halfVectors[i] = importanceSampleGGX(hammersley[i], roughness);
+
+            for (int column = 0; column < size; ++column) {
+                const float NdotV = (float(column) + 0.5f) / float(size);
+                const glm::vec3 viewDir { std::sqrt(1.0f - NdotV * NdotV), 0.0f, NdotV };
+                const float geometryV = geometrySchlickGGX(NdotV, roughness);
+
+                float scale = 0.0f, bias = 0.0f;
+                for (const glm::vec3& halfDir : halfVectors) {
+                    const float VdotH = glm::dot(viewDir, halfDir);
+                    const float NdotL = 2.0f * VdotH * halfDir.z - viewDir.z;
+                    if (NdotL <= 0.0f)
+                        continue;
+                    const float clampedVdotH = std::max(VdotH, 0.0f);
+                    const float G = geometryV * geometrySchlickGGX(NdotL, roughness);
+                    const float visibility = (G * clampedVdotH) / (std::max(halfDir.z, 0.0f) * NdotV);
+                    const float t = 1.0f - clampedVdotH;
+                    const float fresnel = t * t * t * t * t;
+                    scale += (1.0f - fresnel) * visibility;
+                    bias += fresnel * visibility;
+                }
+
+                float* texel = &lut[(static_cast<size_t>(row) * static_cast<size_t>(size) + static_cast<size_t>(column)) * 2];
+                texel[0] = scale / float(numSamples);
+                texel[1] = bias / float(numSamples);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int thread = 1; thread < numThreads; ++thread)
+        threads.emplace_back(integrateRows, thread);
+    integrateRows(0);
+    for (std::thread& thread : threads)
+        thread.join();
+    return lut;
+}
+
+std::vector<float> loadBrdfLut(const std::filesystem::path& directory, bool& fromCache)
+{
+    const std::filesystem::path file = cacheFile(directory);
+    std::vector<float> lut(size_t(BRDF_LUT_SIZE) * BRDF_LUT_SIZE * 2);
+
+    std::ifstream input(file, std::ios::binary);
+    FileHeader header;
+    if (input.read(reinterpret_cast<char*>(&header), sizeof(header)) && header.magic == MAGIC && header.version == VERSION
+        && header.size == BRDF_LUT_SIZE && header.numSamples == BRDF_LUT_SAMPLES
+        && input.read(reinterpret_cast<char*>(lut.data()), static_cast<std::streamsize>(lut.size() * sizeof(float)))) {
+        fromCache = true;
+        return lut;
+    }
+
+    fromCache = false;
+    lut = integrateBrdfLut(BRDF_LUT_SIZE, BRDF_LUT_SAMPLES);
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    std::ofstream output(file, std::ios::binary);
+    const FileHeader newHeader { MAGIC, VERSION, BRDF_LUT_SIZE, BRDF_LUT_SAMPLES };
+    output.write(reinterpret_cast<const char*>(&newHeader), sizeof(newHeader));
+    output.write(reinterpret_cast<const char*>(lut.data()), static_cast<std::streamsize>(lut.size() * sizeof(float)));
+    if (!output) {
+        output.close();
+        std::filesystem::remove(file, error);
+        std::cerr << "BRDF LUT: cannot write " << file.string() << std::endl;
+    }
+    return lut;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <filesystem>
+#include <vector>
+
+// Split-sum BRDF LUT: BRDF_LUT_SIZE x BRDF_LUT_SIZE, BRDF_LUT_SAMPLES GGX samples per texel
+#define BRDF_LUT_SIZE 512
+#define BRDF_LUT_SAMPLES 1024
+
+// Integrates the split-sum scale and bias (RG) the way brdf_frag.glsl does: N.V along x, roughness along y,
+// texel centres, rows bottom to top. Rows are split over numThreads threads (0: one per core).
+std::vector<float> integrateBrdfLut(int size, int numSamples, int numThreads = 0);
+
+// The LUT cached in directory, or integrated and written there when there is no valid file yet.
+std::vector<float> loadBrdfLut(const std::filesystem::path& directory, bool& fromCache);
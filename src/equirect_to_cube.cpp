@@ -0,0 +1,128 @@
+#include "equirect_to_cube.h"
+#include "rgbe_decoder.h"
+
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/geometric.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/packing.hpp>
+DISABLE_WARNINGS_POP()
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+namespace {
+constexpr int TILE_ROWS = 32;
+
+// Every half float value, a table lookup beats converting each of the many taps
+const std::vector<float>& halfToFloatTable()
+{
+    static const std::vector<float> table = [] {
+        std::vector<float> values(1 << 16);
+        for (uint32_t i = 0; i < values.size(); ++i)
+            values[i] = glm::unpackHalf1x16(static_cast<uint16_t>(i));
+        return values;
+    }();
+    return table;
+}
+
+struct Equirect {
+    const uint16_t* pixels;
+    int width;
+    int height;
+    const float* toFloat;
+
+    glm::vec3 texel(int x, int y) const
+    {
+        const uint16_t* p = pixels + (size_t(y) * size_t(width) + size_t(x)) * 3;
+        return { toFloat[p[0]], toFloat[p[1]], toFloat[p[2]] };
+    }
+
+    // Bilinear, wrapping around the seam and clamped at the poles
+    glm::vec3 sample(const glm::vec3& direction) const
+    {
+        const float u = std::atan2(direction.z, direction.x) / glm::two_pi<float>() + 0.5f;
+        const float v = std::asin(std::clamp(direction.y, -1.0f, 1.0f)) / glm::pi<float>() + 0.5f;
+        const float x = u * float(width) - 0.5f;
+        const float y = std::clamp(v * float(height) - 0.5f, 0.0f, float(height - 1));
+        const int x0 = static_cast<int>(std::floor(x));
+        const int y0 = static_cast<int>(y);
+        const float fx = x - float(x0), fy = y - float(y0);
+        const int xa = (x0 % width + width) % width, xb = (xa + 1) % width;
+        const int ya = y0, yb = std::min(y0 + 1, height - 1);
+        const glm::vec3 bottom = texel(xa, ya) * (1.0f - fx) + texel(xb, ya) * fx;
+        const glm::vec3 top = texel(xa, yb) * (1.0f - fx) + texel(xb, yb) * fx;
+        return bottom * (1.0f - fy) + top * fy;
+    }
+};
+}
+
+glm::vec3 cubeFaceDirection(int face, float s, float t)
+{
+    // Inverse of the face selection table in the GL specification
+    switch (face) {
+    case 0:
+        return glm::normalize(glm::vec3(1.0f, -t, -s));
+    case 1:
+        return glm::normalize(glm::vec3(-1.0f, -t, s));
+    case 2:
+        return glm::normalize(glm::vec3(s, 1.0f, t));
+    case 3:
+        return glm::normalize(glm::vec3(s, -1.0f, -t));
+    case 4:
+        return glm::normalize(glm::vec3(s, -t, 1.0f));
+    default:
+        return glm::normalize(glm::vec3(-s, -t, -1.0f));
+    }
+}
+
+std::vector<uint16_t> equirectToCube(const uint16_t* pixels, int width, int height, int faceSize, bool reinhard, int numThreads)
+{
+    if (numThreads <= 0)
+        numThreads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+
+    const Equirect source { pixels, width, height, halfToFloatTable().data() };
+    // A face spans a quarter of the equirect's width, enough taps per axis to cover its texels at the equator
+    const int taps = std::max(1, (width + 4 * faceSize - 1) / (4 * faceSize));
+    const size_t faceTexels = size_t(faceSize) * size_t(faceSize);
+    std::vector<uint16_t> faces(faceTexels * 6 * 3);
+
+    const int tilesPerFace = (faceSize + TILE_ROWS - 1) / TILE_ROWS;
+    std::atomic<int> nextTile { 0 };
+    const auto resampleTiles = [&]() {
+        std::vector<float> row(size_t(faceSize) * 3);
+        for (int tile = nextTile++; tile < 6 * tilesPerFace; tile = nextTile++) {
+            const int face = tile / tilesPerFace;
+            const int firstRow = (tile % tilesPerFace) * TILE_ROWS;
+            for (int y = firstRow; y < std::min(firstRow + TILE_ROWS, faceSize); ++y) {
+                for (int x = 0; x < faceSize; ++x) {
+                    glm::vec3 color { 0.0f };
+                    for (int j = 0; j < taps; ++j) {
+                        for (int i = 0; i < taps; ++i) {
+                            const float s = 2.0f * (float(x) + (float(i) + 0.5f) / float(taps)) / float(faceSize) - 1.0f;
+                            const float t = 2.0f * (float(y) + (float(j) + 0.5f) / float(taps)) / float(faceSize) - 1.0f;
+                            color += source.sample(cubeFaceDirection(face, s, t));
+                        }
+                    }
+                    color /= float(taps * taps);
+                    if (reinhard)
+                        color /= color + glm::vec3(1.0f);
+                    row[size_t(x) * 3 + 0] = color.r;
+                    row[size_t(x) * 3 + 1] = color.g;
+                    row[size_t(x) * 3 + 2] = color.b;
+                }
+                floatsToHalf(row.data(), faces.data() + (size_t(face) * faceTexels + size_t(y) * size_t(faceSize)) * 3, row.size());
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int thread = 1; thread < numThreads; ++thread)
+        threads.emplace_back(resampleTiles);
+    resampleTiles();
+    for (std::thread& thread : threads)
+        thread.join();
+    return faces;
+}
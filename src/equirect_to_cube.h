@@ -0,0 +1,20 @@
+#pragma once
+
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+
+#include <cstdint>
+#include <vector>
+
+// Direction through a cube map texel; face in GL order (+X, -X, +Y, -Y, +Z, -Z), s and t in [-1, 1] along
+// the face's rows and columns as glTexImage2D lays them out.
+glm::vec3 cubeFaceDirection(int face, float s, float t);
+
+// Resamples an equirectangular RGB half float image (rows bottom to top, the mapping of hdr_to_cube_frag.glsl)
+// into the six faces of a faceSize cube, returned face after face as RGB half floats. Every cube texel
+// averages a grid of bilinear taps sized to the source texels it covers, so an 8k source is not point
+// sampled; reinhard applies c / (c + 1) to the average like the shader does. Faces are split into tiles
+// which numThreads threads (0: one per core) take in turn.
+std::vector<uint16_t> equirectToCube(const uint16_t* pixels, int width, int height, int faceSize, bool reinhard, int numThreads = 0);
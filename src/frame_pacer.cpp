@@ -0,0 +1,83 @@
+#include "frame_pacer.h"
+
+#include <algorithm>
+
+FramePacer::~FramePacer()
+{
+    for (GLsync& fence : m_fences) {
+        if (fence)
+            glDeleteSync(fence);
+        fence = nullptr;
+    }
+}
+
+void FramePacer::setFramesInFlight(int frames)
+{
+    m_requestedFramesInFlight = std::clamp(frames, 0, MAX_FRAMES_IN_FLIGHT);
+}
+
+void FramePacer::beginFrame()
+{
+    const auto now = std::chrono::steady_clock::now();
+    if (m_started)
+        m_lastFrameMs = std::chrono::duration<float, std::milli>(now - m_lastBegin).count();
+    m_lastBegin = now;
+    m_started = true;
+
+    // Slots are only meaningful for one ring size, drain the old ring before switching
+    if (m_requestedFramesInFlight != m_framesInFlight) {
+        waitForAll();
+        m_framesInFlight = m_requestedFramesInFlight;
+    }
+
+    m_slot = m_framesInFlight > 0 ? static_cast<int>(m_frame % static_cast<uint64_t>(m_framesInFlight)) : 0;
+    if (m_framesInFlight > 0) {
+        const auto waitStart = std::chrono::steady_clock::now();
+        waitForFence(m_slot);
+        m_lastWaitMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - waitStart).count();
+    }
+}
+
+void FramePacer::endFrame()
+{
+    if (m_framesInFlight == 0) {
+        const auto waitStart = std::chrono::steady_clock::now();
+        glFinish();
+        m_lastWaitMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - waitStart).count();
+    } else {
+        m_fences[static_cast<size_t>(m_slot)] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    ++m_frame;
+}
+
+float FramePacer::overlap(float cpuMs, float gpuMs, float frameMs)
+{
+    const float shorter = std::min(cpuMs, gpuMs);
+    if (shorter <= 0.0f)
+        return 0.0f;
+    return std::clamp((cpuMs + gpuMs - frameMs) / shorter, 0.0f, 1.0f);
+}
+
+void FramePacer::waitForFence(int slot)
+{
+    GLsync& fence = m_fences[static_cast<size_t>(slot)];
+    if (!fence)
+        return;
+
+    // The first call flushes so the fence is guaranteed to get signaled, then wait in 1 ms steps
+    GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    for (;;) {
+        const GLenum result = glClientWaitSync(fence, flags, 1000000);
+        if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED)
+            break;
+        flags = 0;
+    }
+    glDeleteSync(fence);
+    fence = nullptr;
+}
+
+void FramePacer::waitForAll()
+{
+    for (int slot = 0; slot < MAX_FRAMES_IN_FLIGHT; ++slot)
+        waitForFence(slot);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <framework/opengl_includes.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+// Limits how many frames the CPU may queue ahead of the GPU.
+//
+// endFrame() puts a fence behind the commands of each frame. beginFrame() of frame N waits for the fence of
+// frame N - framesInFlight, so the CPU only blocks once that many frames are queued and the GPU keeps busy
+// with them in the meantime. slot() (frame index modulo framesInFlight) picks the copy of a per frame
+// resource the CPU may overwrite: the frame that used the same slot before has passed its fence.
+// framesInFlight == 0 calls glFinish() after every frame instead, which serializes CPU and GPU completely.
+//
+// GpuTimer keeps a ring of 4 query pairs, more than MAX_FRAMES_IN_FLIGHT, so reading its results never waits.
+class FramePacer {
+public:
+    static constexpr int MAX_FRAMES_IN_FLIGHT = 3;
+
+    FramePacer() = default;
+    FramePacer(const FramePacer&) = delete;
+    ~FramePacer();
+
+    FramePacer& operator=(const FramePacer&) = delete;
+
+    // Takes effect at the next beginFrame(), after waiting for every outstanding frame.
+    void setFramesInFlight(int frames);
+    int framesInFlight() const { return m_framesInFlight; }
+
+    void beginFrame();
+    void endFrame();
+
+    // Index into per frame resources, in [0, max(framesInFlight, 1)).
+    int slot() const { return m_slot; }
+
+    // Time the CPU spent blocked on the GPU for the last frame (fence wait or glFinish) in milliseconds.
+    float lastWaitMs() const { return m_lastWaitMs; }
+    // Wall-clock time between the last two beginFrame() calls in milliseconds.
+    float lastFrameMs() const { return m_lastFrameMs; }
+
+    // Fraction of the shorter of CPU and GPU frame time that ran concurrently with the other:
+    // 0 when the frame takes cpuMs + gpuMs (serialized), 1 when it takes max(cpuMs, gpuMs).
+    static float overlap(float cpuMs, float gpuMs, float frameMs);
+
+private:
+    void waitForFence(int slot);
+    void waitForAll();
+
+    std::array<GLsync, MAX_FRAMES_IN_FLIGHT> m_fences {};
+    int m_framesInFlight = 2;
+    int m_requestedFramesInFlight = 2;
+    int m_slot = 0;
+    uint64_t m_frame = 0;
+
+    std::chrono::steady_clock::time_point m_lastBegin {};
+    bool m_started = false;
+    float m_lastWaitMs = 0.0f;
+    float m_lastFrameMs = 0.0f;
+};
@@ -0,0 +1,224 @@
+#include "ibl_cache.h"
+
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/format.h>
+DISABLE_WARNINGS_POP()
+
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+constexpr std::array<char, 4> MAGIC { 'I', 'B', 'L', 'C' };
+constexpr uint32_t VERSION = 2;
+constexpr uint32_t MAX_SIZE = 16384;
+
+struct FileHeader {
+    std::array<char, 4> magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t numTextures;
+    uint32_t numConstants;
+};
+
+struct TextureHeader {
+    uint32_t target;
+    uint32_t internalFormat;
+    uint32_t format;
+    uint32_t numLevels;
+};
+
+struct LevelHeader {
+    uint32_t width;
+    uint32_t height;
+};
+
+// FNV-1a over 8 byte words, the source HDR can be a few hundred MB
+uint64_t hashBytes(uint64_t hash, const char* data, size_t size)
+{
+    constexpr uint64_t prime = 1099511628211ull;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * prime;
+    }
+    for (; i < size; ++i)
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * prime;
+    return hash;
+}
+
+uint64_t hashFile(uint64_t hash, const std::filesystem::path& file)
+{
+    std::ifstream stream(file, std::ios::binary);
+    std::vector<char> chunk(1 << 20);
+    while (stream) {
+        stream.read(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+        hash = hashBytes(hash, chunk.data(), static_cast<size_t>(stream.gcount()));
+    }
+    return hash;
+}
+
+size_t numChannels(GLenum format)
+{
+    switch (format) {
+    case GL_RED:
+        return 1;
+    case GL_RG:
+        return 2;
+    case GL_RGB:
+        return 3;
+    default:
+        return 4;
+    }
+}
+
+GLenum imageTarget(GLenum target)
+{
+    return target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : target;
+}
+
+GLuint numFaces(GLenum target)
+{
+    return target == GL_TEXTURE_CUBE_MAP ? 6 : 1;
+}
+
+struct Level {
+    LevelHeader size;
+    std::vector<uint16_t> pixels; // every face, half floats
+};
+}
+
+IblCache::IblCache(const std::filesystem::path& directory, const std::filesystem::path& sourceHdr, const std::string& parameters,
+    const std::vector<std::filesystem::path>& generators)
+{
+    uint64_t hash = hashFile(14695981039346656037ull, sourceHdr);
+    hash = hashBytes(hash, parameters.data(), parameters.size());
+    for (const std::filesystem::path& generator : generators)
+        hash = hashFile(hash, generator);
+
+    m_key = hash;
+    m_file = directory / fmt::format("{}_{:016x}.ibl", sourceHdr.stem().string(), hash);
+}
+
+bool IblCache::load(const std::vector<IblCacheTexture>& textures, std::vector<float>& constants) const
+{
+    std::ifstream stream(m_file, std::ios::binary);
+    if (!stream)
+        return false;
+
+    FileHeader header;
+    stream.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!stream || header.magic != MAGIC || header.version != VERSION || header.key != m_key || header.numTextures != textures.size()
+        || header.numConstants > 1024)
+        return false;
+
+    std::vector<float> fileConstants(header.numConstants);
+    stream.read(reinterpret_cast<char*>(fileConstants.data()), static_cast<std::streamsize>(fileConstants.size() * sizeof(float)));
+    if (!stream)
+        return false;
+
+    // Read and validate everything before touching a texture, a truncated file leaves them as they are
+    std::vector<std::vector<Level>> levels(textures.size());
+    for (size_t t = 0; t < textures.size(); ++t) {
+        const IblCacheTexture& texture = textures[t];
+        TextureHeader textureHeader;
+        stream.read(reinterpret_cast<char*>(&textureHeader), sizeof(textureHeader));
+        if (!stream || textureHeader.target != texture.target || textureHeader.internalFormat != texture.internalFormat
+            || textureHeader.format != texture.format || textureHeader.numLevels == 0 || textureHeader.numLevels > 16)
+            return false;
+
+        for (uint32_t l = 0; l < textureHeader.numLevels; ++l) {
+            Level& level = levels[t].emplace_back();
+            stream.read(reinterpret_cast<char*>(&level.size), sizeof(level.size));
+            if (!stream || level.size.width == 0 || level.size.height == 0 || level.size.width > MAX_SIZE || level.size.height > MAX_SIZE)
+                return false;
+
+            level.pixels.resize(size_t(level.size.width) * level.size.height * numChannels(texture.format) * numFaces(texture.target));
+            stream.read(reinterpret_cast<char*>(level.pixels.data()), static_cast<std::streamsize>(level.pixels.size() * sizeof(uint16_t)));
+            if (!stream)
+                return false;
+        }
+    }
+
+    GLint unpackAlignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (size_t t = 0; t < textures.size(); ++t) {
+        const IblCacheTexture& texture = textures[t];
+        glBindTexture(texture.target, texture.texture);
+        for (size_t l = 0; l < levels[t].size(); ++l) {
+            const Level& level = levels[t][l];
+            const size_t faceSize = level.pixels.size() / numFaces(texture.target);
+            for (GLuint face = 0; face < numFaces(texture.target); ++face) {
+                glTexImage2D(imageTarget(texture.target) + face, static_cast<GLint>(l), static_cast<GLint>(texture.internalFormat),
+                    static_cast<GLsizei>(level.size.width), static_cast<GLsizei>(level.size.height), 0, texture.format, GL_HALF_FLOAT,
+                    level.pixels.data() + face * faceSize);
+            }
+        }
+        glTexParameteri(texture.target, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(levels[t].size()) - 1);
+        glBindTexture(texture.target, 0);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+
+    constants = std::move(fileConstants);
+    return true;
+}
+
+bool IblCache::save(const std::vector<IblCacheTexture>& textures, const std::vector<float>& constants) const
+{
+    std::error_code error;
+    std::filesystem::create_directories(m_file.parent_path(), error);
+    std::ofstream stream(m_file, std::ios::binary);
+    if (!stream) {
+        std::cerr << "IblCache: cannot write " << m_file.string() << std::endl;
+        return false;
+    }
+
+    const FileHeader header { MAGIC, VERSION, m_key, static_cast<uint32_t>(textures.size()), static_cast<uint32_t>(constants.size()) };
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    stream.write(reinterpret_cast<const char*>(constants.data()), static_cast<std::streamsize>(constants.size() * sizeof(float)));
+
+    GLint packAlignment;
+    glGetIntegerv(GL_PACK_ALIGNMENT, &packAlignment);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+    std::vector<uint16_t> pixels;
+    for (const IblCacheTexture& texture : textures) {
+        glBindTexture(texture.target, texture.texture);
+
+        // Every level the texture has storage for
+        std::vector<LevelHeader> sizes;
+        for (GLint level = 0; level < 16; ++level) {
+            GLint width = 0, height = 0;
+            glGetTexLevelParameteriv(imageTarget(texture.target), level, GL_TEXTURE_WIDTH, &width);
+            glGetTexLevelParameteriv(imageTarget(texture.target), level, GL_TEXTURE_HEIGHT, &height);
+            if (width == 0 || height == 0)
+                break;
+            sizes.push_back({ static_cast<uint32_t>(width), static_cast<uint32_t>(height) });
+        }
+
+        const TextureHeader textureHeader { texture.target, texture.internalFormat, texture.format, static_cast<uint32_t>(sizes.size()) };
+        stream.write(reinterpret_cast<const char*>(&textureHeader), sizeof(textureHeader));
+        for (size_t level = 0; level < sizes.size(); ++level) {
+            stream.write(reinterpret_cast<const char*>(&sizes[level]), sizeof(sizes[level]));
+            pixels.resize(size_t(sizes[level].width) * sizes[level].height * numChannels(texture.format));
+            for (GLuint face = 0; face < numFaces(texture.target); ++face) {
+                glGetTexImage(imageTarget(texture.target) + face, static_cast<GLint>(level), texture.format, GL_HALF_FLOAT, pixels.data());
+                stream.write(reinterpret_cast<const char*>(pixels.data()), static_cast<std::streamsize>(pixels.size() * sizeof(uint16_t)));
+            }
+        }
+        glBindTexture(texture.target, 0);
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, packAlignment);
+
+    if (!stream) {
+        stream.close();
+        std::filesystem::remove(m_file, error);
+        std::cerr << "IblCache: failed writing " << m_file.string() << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <framework/opengl_includes.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// A texture the IBL precomputation fills in, every mip level it has is cached.
+struct IblCacheTexture {
+    GLenum target; // GL_TEXTURE_2D or GL_TEXTURE_CUBE_MAP
+    GLuint texture;
+    GLenum internalFormat; // half float formats only
+    GLenum format; // GL_RED, GL_RG or GL_RGB
+};
+
+// On-disk cache for the results of the IBL precomputation (environment cube, irradiance, prefiltered
+// environment and BRDF LUT), so later startups upload them instead of rendering them again.
+//
+// The file name is a hash of the source HDR's contents, a parameter string describing how the results
+// were generated and the contents of the files generating them (the shaders); changing any of them
+// misses the cache. The file holds a small header, a list
+// of float constants (e.g. spherical harmonics) and then every level (cube faces in GL order) of every
+// texture as half floats, read back with glGetTexImage.
+class IblCache {
+public:
+    IblCache(const std::filesystem::path& directory, const std::filesystem::path& sourceHdr, const std::string& parameters,
+        const std::vector<std::filesystem::path>& generators = {});
+
+    // Respecifies every level of the given textures from the file, false if there is no valid file for them.
+    bool load(const std::vector<IblCacheTexture>& textures, std::vector<float>& constants) const;
+    bool save(const std::vector<IblCacheTexture>& textures, const std::vector<float>& constants) const;
+
+    const std::filesystem::path& file() const { return m_file; }
+    uint64_t key() const { return m_key; }
+
+private:
+    std::filesystem::path m_file;
+    uint64_t m_key = 0;
+};
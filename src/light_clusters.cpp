@@ -0,0 +1,173 @@
+#include "light_clusters.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Refill a texture buffer of the current frame slot. The FramePacer guarantees the frame that last used the
+// slot is done on the GPU, so the store is only re-specified (with headroom) when it has to grow.
+static void uploadTextureBuffer(GLuint buffer, size_t& capacity, const void* data, size_t bytes)
+{
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    if (bytes > capacity || capacity == 0) {
+        capacity = std::max<size_t>(bytes + bytes / 2, 16);
+        glBufferData(GL_TEXTURE_BUFFER, static_cast<GLsizeiptr>(capacity), nullptr, GL_DYNAMIC_DRAW);
+    }
+    if (bytes > 0)
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, static_cast<GLsizeiptr>(bytes), data);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+static void createTextureBuffer(GLuint& buffer, GLuint& texture, size_t& capacity, GLenum format)
+{
+    glGenBuffers(1, &buffer);
+    uploadTextureBuffer(buffer, capacity, nullptr, 0);
+
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_BUFFER, texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+LightClusters::~LightClusters()
+{
+    if (!m_initialized)
+        return;
+
+    for (const FrameBuffers& frame : m_frames) {
+        const GLuint textures[] = { frame.grid.texture, frame.indices.texture };
+        const GLuint buffers[] = { frame.grid.buffer, frame.indices.buffer };
+        glDeleteTextures(2, textures);
+        glDeleteBuffers(2, buffers);
+    }
+}
+
+void LightClusters::initBuffers()
+{
+    for (FrameBuffers& frame : m_frames) {
+        createTextureBuffer(frame.grid.buffer, frame.grid.texture, frame.grid.capacity, GL_RG32UI);
+        createTextureBuffer(frame.indices.buffer, frame.indices.texture, frame.indices.capacity, GL_R32UI);
+    }
+    m_initialized = true;
+}
+
+int LightClusters::sliceOf(float viewDepth) const
+{
+    const int slice = static_cast<int>(std::floor(std::log(viewDepth) * m_sliceScale + m_sliceBias));
+    return std::clamp(slice, 0, m_dims.z - 1);
+}
+
+void LightClusters::build(const std::vector<glm::vec4>& lights, const glm::mat4& view, const glm::mat4& projection,
+    const glm::ivec2& viewportSize, float zNear, float zFar, int frameSlot)
+{
+    if (!m_initialized)
+        initBuffers();
+
+    m_frameSlot = static_cast<size_t>(frameSlot);
+    m_viewportSize = viewportSize;
+    m_zNear = zNear;
+    m_zFar = zFar;
+    m_dims = glm::ivec3(
+        (viewportSize.x + tileSizePx - 1) / tileSizePx,
+        (viewportSize.y + tileSizePx - 1) / tileSizePx,
+        numSlices);
+
+    // slice = log(z / near) / log(far / near) * numSlices, split into a scale and bias on log(z).
+    m_sliceScale = static_cast<float>(numSlices) / std::log(zFar / zNear);
+    m_sliceBias = -static_cast<float>(numSlices) * std::log(zNear) / std::log(zFar / zNear);
+
+    m_ranges.clear();
+    m_rangeLights.clear();
+
+    const size_t numClusters = static_cast<size_t>(m_dims.x) * static_cast<size_t>(m_dims.y) * static_cast<size_t>(m_dims.z);
+    m_grid.assign(numClusters, glm::uvec2(0));
+
+    // Pass 1: find the cluster range every light overlaps and count lights per cluster.
+    for (size_t i = 0; i < lights.size(); ++i) {
+        const float radius = lights[i].w;
+        const glm::vec3 center = glm::vec3(view * glm::vec4(glm::vec3(lights[i]), 1.0f));
+        const float minDepth = -center.z - radius;
+        const float maxDepth = -center.z + radius;
+        if (maxDepth < zNear || minDepth > zFar)
+            continue;
+
+        // Conservative screen bounds: project the corners of the sphere's view-space AABB, with the
+        // box clipped against the near plane so every corner lies in front of the camera.
+        const float boxFront = std::min(center.z + radius, -zNear);
+        const float boxBack = center.z - radius;
+        glm::vec2 ndcMin { 1.0f }, ndcMax { -1.0f };
+        for (int corner = 0; corner < 8; ++corner) {
+            const glm::vec4 cornerPos {
+                center.x + ((corner & 1) ? radius : -radius),
+                center.y + ((corner & 2) ? radius : -radius),
+                (corner & 4) ? boxFront : boxBack,
+                1.0f
+            };
+            const glm::vec4 clip = projection * cornerPos;
+            const glm::vec2 ndc = glm::vec2(clip) / clip.w;
+            ndcMin = glm::min(ndcMin, ndc);
+            ndcMax = glm::max(ndcMax, ndc);
+        }
+        if (ndcMax.x < -1.0f || ndcMax.y < -1.0f || ndcMin.x > 1.0f || ndcMin.y > 1.0f)
+            continue;
+
+        const glm::vec2 pixelMin = (glm::clamp(ndcMin, -1.0f, 1.0f) * 0.5f + 0.5f) * glm::vec2(viewportSize);
+        const glm::vec2 pixelMax = (glm::clamp(ndcMax, -1.0f, 1.0f) * 0.5f + 0.5f) * glm::vec2(viewportSize);
+
+        ClusterRange range;
+        range.min = glm::ivec3(glm::ivec2(pixelMin) / tileSizePx, sliceOf(std::max(minDepth, zNear)));
+        range.max = glm::ivec3(glm::ivec2(pixelMax) / tileSizePx, sliceOf(std::min(maxDepth, zFar)));
+        range.min = glm::clamp(range.min, glm::ivec3(0), m_dims - 1);
+        range.max = glm::clamp(range.max, glm::ivec3(0), m_dims - 1);
+
+        for (int z = range.min.z; z <= range.max.z; ++z)
+            for (int y = range.min.y; y <= range.max.y; ++y)
+                for (int x = range.min.x; x <= range.max.x; ++x)
+                    ++m_grid[static_cast<size_t>(x + m_dims.x * (y + m_dims.y * z))].y;
+
+        m_ranges.push_back(range);
+        m_rangeLights.push_back(static_cast<int>(i));
+    }
+
+    // Pass 2: prefix sum over the counts gives every cluster its offset in the index list.
+    GLuint offset = 0;
+    m_maxLightsPerCluster = 0;
+    for (glm::uvec2& cluster : m_grid) {
+        cluster.x = offset;
+        offset += cluster.y;
+        m_maxLightsPerCluster = std::max(m_maxLightsPerCluster, static_cast<int>(cluster.y));
+        cluster.y = 0;
+    }
+
+    // Pass 3: scatter the light indices, restoring the counts as we go.
+    m_indices.resize(offset);
+    for (size_t r = 0; r < m_ranges.size(); ++r) {
+        const ClusterRange& range = m_ranges[r];
+        for (int z = range.min.z; z <= range.max.z; ++z)
+            for (int y = range.min.y; y <= range.max.y; ++y)
+                for (int x = range.min.x; x <= range.max.x; ++x) {
+                    glm::uvec2& cluster = m_grid[static_cast<size_t>(x + m_dims.x * (y + m_dims.y * z))];
+                    m_indices[cluster.x + cluster.y++] = static_cast<GLuint>(m_rangeLights[r]);
+                }
+    }
+
+    FrameBuffers& frame = m_frames[m_frameSlot];
+    uploadTextureBuffer(frame.grid.buffer, frame.grid.capacity, m_grid.data(), m_grid.size() * sizeof(glm::uvec2));
+    uploadTextureBuffer(frame.indices.buffer, frame.indices.capacity, m_indices.data(), m_indices.size() * sizeof(GLuint));
+}
+
+void LightClusters::bind(const Shader& shader, GLint firstTextureUnit) const
+{
+    const FrameBuffers& frame = m_frames[m_frameSlot];
+    const GLuint textures[] = { frame.grid.texture, frame.indices.texture };
+    for (GLint i = 0; i < 2; ++i) {
+        glActiveTexture(GL_TEXTURE0 + static_cast<GLenum>(firstTextureUnit + i));
+        glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+    }
+
+    glUniform1i(shader.getUniformLocation("clusterGrid"), firstTextureUnit);
+    glUniform1i(shader.getUniformLocation("clusterLightIndices"), firstTextureUnit + 1);
+    glUniform1i(shader.getUniformLocation("clusterTileSize"), tileSizePx);
+    glUniform3iv(shader.getUniformLocation("clusterDims"), 1, glm::value_ptr(m_dims));
+    glUniform2f(shader.getUniformLocation("clusterDepthParams"), m_sliceScale, m_sliceBias);
+    glUniform2f(shader.getUniformLocation("clusterNearFar"), m_zNear, m_zFar);
+}
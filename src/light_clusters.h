@@ -0,0 +1,87 @@
+#pragma once
+
+#include "frame_pacer.h"
+#include "protocol.h"
+
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
+DISABLE_WARNINGS_POP()
+#include <framework/shader.h>
+
+#include <array>
+#include <vector>
+
+// Clustered light culling for the forward shaders.
+//
+// The view frustum is split into a froxel grid: screen tiles of tileSizePx pixels in x/y and numSlices
+// exponentially distributed slices in view depth. Every frame the lights are binned on the CPU into the
+// clusters their sphere of influence overlaps. The result is uploaded as two texture buffers, which the
+// fragment shaders read to loop over only the lights of their own cluster:
+//  - clusterGrid:         RG32UI (offset, count) per cluster into clusterLightIndices
+//  - clusterLightIndices: R32UI compact list of indices into the LightStore buffers
+// There is one pair of buffers per FramePacer slot, so the upload never touches memory an earlier frame
+// that may still be in flight reads from.
+class LightClusters {
+public:
+    LightClusters() = default;
+    LightClusters(const LightClusters&) = delete;
+    ~LightClusters();
+
+    LightClusters& operator=(const LightClusters&) = delete;
+
+    // Bin the lights (position + radius, as kept by LightStore) for the given camera. viewportSize is the size in pixels of the viewport the
+    // clustered shaders render into (gl_FragCoord is assumed to start at the viewport origin). frameSlot is FramePacer::slot().
+    void build(const std::vector<glm::vec4>& lights, const glm::mat4& view, const glm::mat4& projection,
+        const glm::ivec2& viewportSize, float zNear, float zFar, int frameSlot);
+
+    // Bind the texture buffers to firstTextureUnit and firstTextureUnit + 1 and set the cluster uniforms.
+    void bind(const Shader& shader, GLint firstTextureUnit) const;
+
+    int numIndices() const { return static_cast<int>(m_indices.size()); }
+    int maxLightsPerCluster() const { return m_maxLightsPerCluster; }
+    glm::ivec3 dims() const { return m_dims; }
+
+    int tileSizePx = 64;
+    int numSlices = 24;
+
+private:
+    struct ClusterRange {
+        glm::ivec3 min;
+        glm::ivec3 max;
+    };
+
+    struct TextureBuffer {
+        GLuint buffer = 0;
+        GLuint texture = 0;
+        size_t capacity = 0;
+    };
+
+    struct FrameBuffers {
+        TextureBuffer grid;
+        TextureBuffer indices;
+    };
+
+    void initBuffers();
+    int sliceOf(float viewDepth) const;
+
+    std::array<FrameBuffers, FramePacer::MAX_FRAMES_IN_FLIGHT> m_frames;
+    size_t m_frameSlot = 0;
+    bool m_initialized = false;
+
+    std::vector<glm::uvec2> m_grid;
+    std::vector<GLuint> m_indices;
+    std::vector<ClusterRange> m_ranges;
+    std::vector<int> m_rangeLights;
+
+    glm::ivec3 m_dims { 0 };
+    glm::ivec2 m_viewportSize { 0 };
+    float m_zNear = 0.1f;
+    float m_zFar = 30.0f;
+    float m_sliceScale = 0.0f;
+    float m_sliceBias = 0.0f;
+
+    int m_maxLightsPerCluster = 0;
+};
@@ -0,0 +1,291 @@
+#include "light_store.h"
+
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/gtc/packing.hpp>
+DISABLE_WARNINGS_POP()
+
+#include <algorithm>
+#include <stdexcept>
+
+static constexpr std::array<GLenum, 3> STREAM_FORMATS = { GL_RGBA32F, GL_RGBA16F, GL_RG16F };
+static constexpr std::array<size_t, 3> STREAM_STRIDES = { sizeof(glm::vec4), sizeof(glm::u16vec4), sizeof(glm::u16vec2) };
+static constexpr std::array<const char*, 3> STREAM_SAMPLERS = { "lightPositionRadius", "lightColor", "lightAttenuation" };
+
+// Dirty lights at most this many entries apart are uploaded with a single glBufferSubData call;
+// re-sending a few clean lights is cheaper than issuing another call.
+static constexpr uint32_t MERGE_GAP = 32;
+
+LightStore::~LightStore()
+{
+    for (GpuStream& stream : m_streams) {
+        if (stream.buffer == 0)
+            continue;
+        glDeleteTextures(1, &stream.texture);
+        glDeleteBuffers(1, &stream.buffer);
+    }
+}
+
+LightHandle LightStore::add(const Light& light)
+{
+    uint32_t slot;
+    if (!m_freeSlots.empty()) {
+        slot = m_freeSlots.back();
+        m_freeSlots.pop_back();
+    } else {
+        slot = static_cast<uint32_t>(m_slots.size());
+        m_slots.emplace_back();
+    }
+
+    const uint32_t index = static_cast<uint32_t>(m_lights.size());
+    m_slots[slot].index = index;
+    m_slots[slot].alive = true;
+
+    m_lights.push_back(light);
+    m_lights.back().radius = calculateLightRadius(light);
+    m_indexToSlot.push_back(slot);
+    m_positionRadius.emplace_back();
+    m_color.emplace_back();
+    m_attenuation.emplace_back();
+
+    writePacked(index);
+    markAllDirty(index);
+
+    return { slot, m_slots[slot].generation };
+}
+
+void LightStore::remove(LightHandle handle)
+{
+    const uint32_t index = checkedIndex(handle);
+    const uint32_t last = static_cast<uint32_t>(m_lights.size() - 1);
+
+    // Keep the arrays dense by moving the last light into the hole, only that one light is re-uploaded.
+    if (index != last) {
+        m_lights[index] = m_lights[last];
+        m_positionRadius[index] = m_positionRadius[last];
+        m_color[index] = m_color[last];
+        m_attenuation[index] = m_attenuation[last];
+        m_indexToSlot[index] = m_indexToSlot[last];
+        m_slots[m_indexToSlot[index]].index = index;
+        markAllDirty(index);
+    }
+
+    m_lights.pop_back();
+    m_positionRadius.pop_back();
+    m_color.pop_back();
+    m_attenuation.pop_back();
+    m_indexToSlot.pop_back();
+
+    Slot& slot = m_slots[handle.slot];
+    slot.alive = false;
+    ++slot.generation;
+    m_freeSlots.push_back(handle.slot);
+}
+
+void LightStore::clear()
+{
+    for (uint32_t slot : m_indexToSlot) {
+        m_slots[slot].alive = false;
+        ++m_slots[slot].generation;
+        m_freeSlots.push_back(slot);
+    }
+
+    m_lights.clear();
+    m_indexToSlot.clear();
+    m_positionRadius.clear();
+    m_color.clear();
+    m_attenuation.clear();
+
+    for (GpuStream& stream : m_streams) {
+        for (uint32_t index : stream.dirty)
+            stream.isDirty[index] = 0;
+        stream.dirty.clear();
+    }
+}
+
+void LightStore::reserve(size_t count)
+{
+    m_lights.reserve(count);
+    m_indexToSlot.reserve(count);
+    m_slots.reserve(count);
+    m_positionRadius.reserve(count);
+    m_color.reserve(count);
+    m_attenuation.reserve(count);
+}
+
+bool LightStore::contains(LightHandle handle) const
+{
+    return handle.slot < m_slots.size() && m_slots[handle.slot].alive && m_slots[handle.slot].generation == handle.generation;
+}
+
+const Light& LightStore::get(LightHandle handle) const
+{
+    return m_lights[checkedIndex(handle)];
+}
+
+void LightStore::setPosition(LightHandle handle, const glm::vec3& position)
+{
+    const uint32_t index = checkedIndex(handle);
+    m_lights[index].position = position;
+    m_positionRadius[index] = glm::vec4(position, m_lights[index].radius);
+    markDirty(index, POSITION_RADIUS);
+}
+
+void LightStore::setColor(LightHandle handle, const glm::vec3& color)
+{
+    const uint32_t index = checkedIndex(handle);
+    m_lights[index].color = color;
+    m_lights[index].radius = calculateLightRadius(m_lights[index]);
+    writePacked(index);
+    markDirty(index, POSITION_RADIUS);
+    markDirty(index, COLOR);
+}
+
+void LightStore::setAttenuation(LightHandle handle, float linear, float quadratic)
+{
+    const uint32_t index = checkedIndex(handle);
+    m_lights[index].linear = linear;
+    m_lights[index].quadratic = quadratic;
+    m_lights[index].radius = calculateLightRadius(m_lights[index]);
+    writePacked(index);
+    markDirty(index, POSITION_RADIUS);
+    markDirty(index, ATTENUATION);
+}
+
+LightHandle LightStore::handleAt(size_t index) const
+{
+    const uint32_t slot = m_indexToSlot.at(index);
+    return { slot, m_slots[slot].generation };
+}
+
+size_t LightStore::indexOf(LightHandle handle) const
+{
+    return checkedIndex(handle);
+}
+
+void LightStore::upload()
+{
+    m_lastUploadBytes = 0;
+    m_lastUploadRanges = 0;
+    for (int stream = 0; stream < NUM_STREAMS; ++stream)
+        uploadStream(static_cast<Stream>(stream));
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void LightStore::bind(const Shader& shader, GLint firstTextureUnit) const
+{
+    for (size_t stream = 0; stream < NUM_STREAMS; ++stream) {
+        const GLint unit = firstTextureUnit + static_cast<GLint>(stream);
+        glActiveTexture(GL_TEXTURE0 + static_cast<GLenum>(unit));
+        glBindTexture(GL_TEXTURE_BUFFER, m_streams[stream].texture);
+        glUniform1i(shader.getUniformLocation(STREAM_SAMPLERS[stream]), unit);
+    }
+    glUniform1i(shader.getUniformLocation("LightCount"), static_cast<GLint>(m_lights.size()));
+}
+
+uint32_t LightStore::checkedIndex(LightHandle handle) const
+{
+    if (!contains(handle))
+        throw std::out_of_range("LightStore: invalid or stale light handle");
+    return m_slots[handle.slot].index;
+}
+
+void LightStore::writePacked(uint32_t index)
+{
+    const Light& light = m_lights[index];
+    m_positionRadius[index] = glm::vec4(light.position, light.radius);
+    m_color[index] = glm::packHalf(glm::vec4(light.color, 0.0f));
+    m_attenuation[index] = glm::packHalf(glm::vec2(light.linear, light.quadratic));
+}
+
+void LightStore::markDirty(uint32_t index, Stream stream)
+{
+    GpuStream& gpuStream = m_streams[stream];
+    if (index >= gpuStream.isDirty.size())
+        gpuStream.isDirty.resize(std::max<size_t>(index + 1, gpuStream.isDirty.size() * 2), 0);
+
+    if (!gpuStream.isDirty[index]) {
+        gpuStream.isDirty[index] = 1;
+        gpuStream.dirty.push_back(index);
+    }
+}
+
+void LightStore::markAllDirty(uint32_t index)
+{
+    for (int stream = 0; stream < NUM_STREAMS; ++stream)
+        markDirty(index, static_cast<Stream>(stream));
+}
+
+const void* LightStore::streamData(Stream stream) const
+{
+    switch (stream) {
+    case POSITION_RADIUS:
+        return m_positionRadius.data();
+    case COLOR:
+        return m_color.data();
+    default:
+        return m_attenuation.data();
+    }
+}
+
+void LightStore::uploadStream(Stream stream)
+{
+    GpuStream& gpuStream = m_streams[stream];
+    const size_t stride = STREAM_STRIDES[stream];
+    const size_t count = m_lights.size();
+    const auto* data = static_cast<const uint8_t*>(streamData(stream));
+
+    if (gpuStream.buffer == 0) {
+        glGenBuffers(1, &gpuStream.buffer);
+        glGenTextures(1, &gpuStream.texture);
+    }
+
+    // Growing re-creates the store with 50% headroom and sends everything, amortized over many adds.
+    if (count > gpuStream.capacity || gpuStream.capacity == 0) {
+        gpuStream.capacity = std::max<size_t>(count + count / 2, 64);
+        glBindBuffer(GL_TEXTURE_BUFFER, gpuStream.buffer);
+        glBufferData(GL_TEXTURE_BUFFER, static_cast<GLsizeiptr>(gpuStream.capacity * stride), nullptr, GL_DYNAMIC_DRAW);
+        if (count > 0)
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, static_cast<GLsizeiptr>(count * stride), data);
+
+        glBindTexture(GL_TEXTURE_BUFFER, gpuStream.texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, STREAM_FORMATS[stream], gpuStream.buffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+        for (uint32_t index : gpuStream.dirty)
+            gpuStream.isDirty[index] = 0;
+        gpuStream.dirty.clear();
+
+        m_lastUploadBytes += count * stride;
+        ++m_lastUploadRanges;
+        return;
+    }
+
+    if (gpuStream.dirty.empty())
+        return;
+
+    std::sort(gpuStream.dirty.begin(), gpuStream.dirty.end());
+    glBindBuffer(GL_TEXTURE_BUFFER, gpuStream.buffer);
+
+    size_t i = 0;
+    while (i < gpuStream.dirty.size()) {
+        const uint32_t first = gpuStream.dirty[i];
+        uint32_t last = first;
+        gpuStream.isDirty[first] = 0;
+        while (++i < gpuStream.dirty.size() && gpuStream.dirty[i] <= last + MERGE_GAP) {
+            last = gpuStream.dirty[i];
+            gpuStream.isDirty[last] = 0;
+        }
+
+        // Lights that were removed after being marked are past the end now.
+        if (first >= count)
+            continue;
+        last = std::min(last, static_cast<uint32_t>(count - 1));
+
+        const size_t bytes = (last - first + 1) * stride;
+        glBufferSubData(GL_TEXTURE_BUFFER, static_cast<GLintptr>(first * stride), static_cast<GLsizeiptr>(bytes), data + first * stride);
+        m_lastUploadBytes += bytes;
+        ++m_lastUploadRanges;
+    }
+    gpuStream.dirty.clear();
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "protocol.h"
+
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/gtc/type_precision.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+DISABLE_WARNINGS_POP()
+#include <framework/shader.h>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Stable reference to a light in a LightStore. Handles survive adding and removing other lights;
+// the generation counter of the slot detects handles to lights that have been removed.
+struct LightHandle {
+    static constexpr uint32_t INVALID_SLOT = ~0u;
+
+    uint32_t slot = INVALID_SLOT;
+    uint32_t generation = 0;
+
+    bool valid() const { return slot != INVALID_SLOT; }
+    bool operator==(const LightHandle&) const = default;
+};
+
+// Owns all point lights of the scene and mirrors them to the GPU in a packed structure-of-arrays layout.
+//
+// Lights are kept densely packed (removal swaps the last light into the hole) and addressed through a
+// slot map, so handles stay valid while the dense order changes. Every light is stored in three texture
+// buffers that only the affected streams are re-uploaded for:
+//  - lightPositionRadius: RGBA32F (position, radius of influence)    16 bytes
+//  - lightColor:          RGBA16F (color, unused)                     8 bytes
+//  - lightAttenuation:    RG16F   (linear, quadratic)                 4 bytes
+// Changes are recorded per stream as dirty light indices and flushed by upload() as a few coalesced
+// glBufferSubData ranges, so the per-frame cost is proportional to the number of changed lights.
+// The radius is derived data and only recomputed when the color or attenuation of a light changes.
+class LightStore {
+public:
+    LightStore() = default;
+    LightStore(const LightStore&) = delete;
+    ~LightStore();
+
+    LightStore& operator=(const LightStore&) = delete;
+
+    LightHandle add(const Light& light);
+    void remove(LightHandle handle);
+    void clear();
+    void reserve(size_t count);
+
+    bool contains(LightHandle handle) const;
+    const Light& get(LightHandle handle) const;
+
+    void setPosition(LightHandle handle, const glm::vec3& position);
+    void setColor(LightHandle handle, const glm::vec3& color);
+    void setAttenuation(LightHandle handle, float linear, float quadratic);
+
+    size_t size() const { return m_lights.size(); }
+    bool empty() const { return m_lights.empty(); }
+
+    // Dense access, the order changes when lights are removed. Radii are always up to date.
+    const std::vector<Light>& lights() const { return m_lights; }
+    const std::vector<glm::vec4>& positionRadius() const { return m_positionRadius; }
+    LightHandle handleAt(size_t index) const;
+    size_t indexOf(LightHandle handle) const;
+
+    // Flush pending changes to the texture buffers. Call once per frame before bind().
+    void upload();
+
+    // Bind the three texture buffers to firstTextureUnit .. firstTextureUnit + 2 and set LightCount.
+    void bind(const Shader& shader, GLint firstTextureUnit) const;
+
+    // Bytes sent to the GPU by the last upload(), for the profiling panel.
+    size_t lastUploadBytes() const { return m_lastUploadBytes; }
+    size_t lastUploadRanges() const { return m_lastUploadRanges; }
+
+private:
+    enum Stream {
+        POSITION_RADIUS,
+        COLOR,
+        ATTENUATION,
+        NUM_STREAMS
+    };
+
+    struct Slot {
+        uint32_t index = 0;
+        uint32_t generation = 0;
+        bool alive = false;
+    };
+
+    struct GpuStream {
+        GLuint buffer = 0;
+        GLuint texture = 0;
+        size_t capacity = 0;
+        std::vector<uint32_t> dirty;
+        std::vector<uint8_t> isDirty;
+    };
+
+    uint32_t checkedIndex(LightHandle handle) const;
+    void writePacked(uint32_t index);
+    void markDirty(uint32_t index, Stream stream);
+    void markAllDirty(uint32_t index);
+    void uploadStream(Stream stream);
+    const void* streamData(Stream stream) const;
+
+    std::vector<Light> m_lights;
+    std::vector<uint32_t> m_indexToSlot;
+    std::vector<Slot> m_slots;
+    std::vector<uint32_t> m_freeSlots;
+
+    // CPU copies of the GPU streams.
+    std::vector<glm::vec4> m_positionRadius;
+    std::vector<glm::u16vec4> m_color;
+    std::vector<glm::u16vec2> m_attenuation;
+
+    std::array<GpuStream, NUM_STREAMS> m_streams;
+
+    size_t m_lastUploadBytes = 0;
+    size_t m_lastUploadRanges = 0;
+};
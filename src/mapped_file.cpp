@@ -0,0 +1,87 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::filesystem::path& file)
+{
+    m_file = CreateFileW(file.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE) {
+        m_file = nullptr;
+        throw MappedFileException("Cannot open " + file.string());
+    }
+    LARGE_INTEGER size;
+    GetFileSizeEx(m_file, &size);
+    m_size = static_cast<size_t>(size.QuadPart);
+    if (m_size == 0)
+        return;
+
+    m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping)
+        m_data = static_cast<const unsigned char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!m_data) {
+        close();
+        throw MappedFileException("Cannot map " + file.string());
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+void MappedFile::close()
+{
+    if (m_data)
+        UnmapViewOfFile(m_data);
+    if (m_mapping)
+        CloseHandle(m_mapping);
+    if (m_file)
+        CloseHandle(m_file);
+    m_data = nullptr;
+    m_mapping = m_file = nullptr;
+}
+#else
+MappedFile::MappedFile(const std::filesystem::path& file)
+{
+    const int descriptor = open(file.c_str(), O_RDONLY);
+    if (descriptor < 0)
+        throw MappedFileException("Cannot open " + file.string());
+
+    struct stat status;
+    if (fstat(descriptor, &status) == 0 && status.st_size > 0) {
+        m_size = static_cast<size_t>(status.st_size);
+        void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (data != MAP_FAILED) {
+            // Read front to back, let the kernel read ahead
+            madvise(data, m_size, MADV_SEQUENTIAL);
+            m_data = static_cast<const unsigned char*>(data);
+        }
+    }
+    // The mapping stays valid without the descriptor
+    ::close(descriptor);
+    if (m_size > 0 && !m_data)
+        throw MappedFileException("Cannot map " + file.string());
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+void MappedFile::close()
+{
+    if (m_data)
+        munmap(const_cast<unsigned char*>(m_data), m_size);
+    m_data = nullptr;
+}
+#endif
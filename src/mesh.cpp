@@ -25,6 +25,20 @@ GPUMesh::GPUMesh(const Mesh& cpuMesh)
     // Figure out if this mesh has texture coordinates
     m_hasTextureCoords = static_cast<bool>(cpuMesh.material.kdTexture);
 
+    // Centred on the bounding box, wide enough for the vertex furthest from there
+    if (!cpuMesh.vertices.empty()) {
+        glm::vec3 minimum = cpuMesh.vertices[0].position, maximum = minimum;
+        for (const Vertex& vertex : cpuMesh.vertices) {
+            minimum = glm::min(minimum, vertex.position);
+            maximum = glm::max(maximum, vertex.position);
+        }
+        const glm::vec3 center = (minimum + maximum) * 0.5f;
+        float radius = 0.0f;
+        for (const Vertex& vertex : cpuMesh.vertices)
+            radius = std::max(radius, glm::distance(center, vertex.position));
+        m_boundingSphere = glm::vec4(center, radius);
+    }
+
     // Create VAO and bind it so subsequent creations of VBO and IBO are bound to this VAO
     glGenVertexArrays(1, &m_vao);
     glBindVertexArray(m_vao);
@@ -109,6 +123,11 @@ bool GPUMesh::hasTextureCoords() const
     return m_hasTextureCoords;
 }
 
+const glm::vec4& GPUMesh::boundingSphere() const
+{
+    return m_boundingSphere;
+}
+
 GLuint& GPUMesh::getVao(){
     return m_vao;
 }
@@ -120,7 +139,7 @@ GLuint& GPUMesh::getShadowVao()
 
 void GPUMesh::setUBOMaterial(GLuint newUboMaterial)
 {
-    this->m_uboMaterial = std::move(newUboMaterial);
+    this->m_materialBuffer = newUboMaterial;
 }
 
 
@@ -129,7 +148,7 @@ void GPUMesh::draw(const Shader& drawingShader)
 {
     // Bind material data uniform (we assume that the uniform buffer objects is always called 'Material')
     // Yes, we could define the binding inside the shader itself, but that would break on OpenGL versions below 4.2
-    drawingShader.bindUniformBlock("Material", 0, m_uboMaterial);
+    drawingShader.bindUniformBlock("Material", 0, m_materialBuffer != INVALID ? m_materialBuffer : m_uboMaterial);
 
     // Draw the mesh's triangles
     glBindVertexArray(m_vao);
@@ -145,7 +164,7 @@ void GPUMesh::draw(const Shader& drawingShader)
 void GPUMesh::draw(const Shader& drawingShader, GLuint& drawingUBO, bool multiLightShadingEnabled = false)
 {
     // Bind material data uniform
-    drawingShader.bindUniformBlock("Material", 0, m_uboMaterial);
+    drawingShader.bindUniformBlock("Material", 0, m_materialBuffer != INVALID ? m_materialBuffer : m_uboMaterial);
 
     if (!multiLightShadingEnabled) {
         drawingShader.bindUniformBlock("Light", 1, drawingUBO);
@@ -178,11 +197,10 @@ void GPUMesh::draw(const Shader& drawingShader, GLuint& drawingUBO, bool multiLi
     glBindVertexArray(0);
 }
 
-void GPUMesh::drawPBR(const Shader& drawingShader, GLuint& PbrUbo, GLuint& drawingUBO)
+void GPUMesh::drawPBR(const Shader& drawingShader, GLuint& PbrUbo)
 {
-    // Bind material data uniform
+    // Bind material data uniform, lights are read from the clustered light buffers
     drawingShader.bindUniformBlock("PBR_Material", 0, PbrUbo);
-    drawingShader.bindUniformBlock("lights", 1, drawingUBO);
 
     // Draw the mesh's triangles
     glBindVertexArray(m_vao);
@@ -238,10 +256,12 @@ void GPUMesh::moveInto(GPUMesh&& other)
     freeGpuMemory();
     m_numIndices = other.m_numIndices;
     m_hasTextureCoords = other.m_hasTextureCoords;
+    m_boundingSphere = other.m_boundingSphere;
     m_ibo = other.m_ibo;
     m_vbo = other.m_vbo;
     m_vao = other.m_vao;
     m_uboMaterial = other.m_uboMaterial;
+    m_materialBuffer = other.m_materialBuffer;
 
     other.m_numIndices = 0;
     other.m_hasTextureCoords = other.m_hasTextureCoords;
@@ -249,6 +269,7 @@ void GPUMesh::moveInto(GPUMesh&& other)
     other.m_vbo = INVALID;
     other.m_vao = INVALID;
     other.m_uboMaterial = INVALID;
+    other.m_materialBuffer = INVALID;
 }
 
 void GPUMesh::freeGpuMemory()
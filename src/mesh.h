@@ -7,6 +7,7 @@
 #include <framework/shader.h>
 DISABLE_WARNINGS_PUSH()
 #include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
 DISABLE_WARNINGS_POP()
 
 #include <exception>
@@ -46,12 +47,15 @@ public:
     GPUMesh& operator=(GPUMesh&&);
 
     bool hasTextureCoords() const;
+    // Sphere around the vertices in model space, centre in xyz and radius in w
+    const glm::vec4& boundingSphere() const;
 
     // Define new Getter here
     GLuint& getVao();
     GLuint& getShadowVao();
 
     // Define new Setter here
+    // Draws bind this material buffer instead of the mesh's own, which stays owned by the caller
     void setUBOMaterial(GLuint newUboMaterial);
 
 
@@ -59,7 +63,7 @@ public:
     void draw(const Shader& drawingShader);
 
     void draw(const Shader& drawingShader, GLuint& drawingUBO, bool multiLightShadingEnabled);
-    void drawPBR(const Shader& drawingShader, GLuint& PbrUbo, GLuint& drawingUBO);
+    void drawPBR(const Shader& drawingShader, GLuint& PbrUbo);
 
     void drawBasic(const Shader& drawingShader);
 
@@ -76,10 +80,12 @@ private:
 
     GLsizei m_numIndices { 0 };
     bool m_hasTextureCoords { false };
+    glm::vec4 m_boundingSphere { 0.0f };
     GLuint m_ibo { INVALID };
     GLuint m_vbo { INVALID };
     GLuint m_vao { INVALID };
     GLuint m_uboMaterial { INVALID };
+    GLuint m_materialBuffer { INVALID }; // set by setUBOMaterial, not owned
 
     GLuint m_shadowVao{ INVALID }; // Create Separate VAO for shadowMapping
 };
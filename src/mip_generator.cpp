@@ -0,0 +1,234 @@
+#include "mip_generator.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <thread>
+#include <utility>
+
+namespace {
+constexpr float FILTER_RADIUS = 3.0f;
+constexpr float KAISER_ALPHA = 4.0f;
+constexpr float PI = 3.14159265358979f;
+
+// Modified Bessel function of the first kind, order 0
+float besselI0(float x)
+{
+    float sum = 1.0f, term = 1.0f;
+    for (int k = 1; k < 32 && term > sum * 1e-8f; ++k) {
+        term *= (x * x) / (4.0f * float(k * k));
+        sum += term;
+    }
+    return sum;
+}
+
+float kaiserSinc(float x)
+{
+    if (std::abs(x) >= FILTER_RADIUS)
+        return 0.0f;
+    const float sinc = x == 0.0f ? 1.0f : std::sin(PI * x) / (PI * x);
+    const float ratio = x / FILTER_RADIUS;
+    return sinc * besselI0(KAISER_ALPHA * std::sqrt(1.0f - ratio * ratio)) / besselI0(KAISER_ALPHA);
+}
+
+// Normalised taps of every destination texel along one axis, the same number for each (padded with zero
+// weights) so the loops over them have a fixed length
+struct AxisFilter {
+    size_t tapCount = 0;
+    std::vector<size_t> indices;
+    std::vector<float> weights;
+};
+
+AxisFilter axisFilter(int sourceSize, int destinationSize, bool wrap)
+{
+    const float scale = float(sourceSize) / float(destinationSize);
+    std::vector<std::vector<std::pair<size_t, float>>> taps(static_cast<size_t>(destinationSize));
+    AxisFilter filter;
+    for (size_t x = 0; x < taps.size(); ++x) {
+        const float center = (float(x) + 0.5f) * scale;
+        const int first = static_cast<int>(std::floor(center - FILTER_RADIUS * scale));
+        const int last = static_cast<int>(std::ceil(center + FILTER_RADIUS * scale));
+        float total = 0.0f;
+        for (int i = first; i <= last; ++i) {
+            const float weight = kaiserSinc((float(i) + 0.5f - center) / scale);
+            if (weight == 0.0f)
+                continue;
+            const int index = wrap ? ((i % sourceSize) + sourceSize) % sourceSize : std::clamp(i, 0, sourceSize - 1);
+            taps[x].emplace_back(static_cast<size_t>(index), weight);
+            total += weight;
+        }
+        for (auto& tap : taps[x])
+            tap.second /= total;
+        filter.tapCount = std::max(filter.tapCount, taps[x].size());
+    }
+
+    filter.indices.resize(taps.size() * filter.tapCount);
+    filter.weights.resize(filter.indices.size(), 0.0f);
+    for (size_t x = 0; x < taps.size(); ++x) {
+        for (size_t tap = 0; tap < filter.tapCount; ++tap) {
+            const size_t slot = x * filter.tapCount + tap;
+            filter.indices[slot] = taps[x][std::min(tap, taps[x].size() - 1)].first;
+            if (tap < taps[x].size())
+                filter.weights[slot] = taps[x][tap].second;
+        }
+    }
+    return filter;
+}
+
+float srgbToLinear(float c)
+{
+    return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+// Linear values half way between the sRGB bytes, the byte a value rounds to is the number of them below it.
+// Exact, and with a table of where to start counting for 4096 buckets of values a step or two at most
+// instead of evaluating the sRGB curve with pow.
+struct SrgbEncoder {
+    static constexpr size_t BUCKETS = 4096;
+    std::array<float, 256> rounding;
+    std::array<uint8_t, BUCKETS> start;
+
+    SrgbEncoder()
+    {
+        for (size_t i = 0; i < 255; ++i)
+            rounding[i] = srgbToLinear((float(i) + 0.5f) / 255.0f);
+        rounding[255] = 2.0f;
+        for (size_t bucket = 0, byte = 0; bucket < BUCKETS; ++bucket) {
+            while (rounding[byte] <= float(bucket) / float(BUCKETS))
+                ++byte;
+            start[bucket] = static_cast<uint8_t>(byte);
+        }
+    }
+
+    uint8_t encode(float value) const
+    {
+        value = std::clamp(value, 0.0f, 1.0f);
+        size_t byte = start[std::min(static_cast<size_t>(value * float(BUCKETS)), BUCKETS - 1)];
+        while (rounding[byte] <= value)
+            ++byte;
+        return static_cast<uint8_t>(byte);
+    }
+};
+
+uint8_t toByte(float value)
+{
+    return static_cast<uint8_t>(std::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+template <typename Function>
+void parallelRows(int rows, int numThreads, const Function& function)
+{
+    numThreads = std::clamp(numThreads, 1, rows);
+    std::vector<std::thread> threads;
+    for (int thread = 1; thread < numThreads; ++thread)
+        threads.emplace_back(function, static_cast<size_t>(rows * thread / numThreads), static_cast<size_t>(rows * (thread + 1) / numThreads));
+    function(size_t(0), static_cast<size_t>(rows / numThreads));
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+template <size_t Channels>
+void downsampleChannels(const uint8_t* pixels, int width, int height, MipContent content, bool wrap, int numThreads, uint8_t* half)
+{
+    // Channels when there is none
+    constexpr size_t alphaChannel = Channels == 2 || Channels == 4 ? Channels - 1 : Channels;
+    const int halfWidth = std::max(1, width / 2), halfHeight = std::max(1, height / 2);
+    const AxisFilter filterX = axisFilter(width, halfWidth, wrap);
+    const AxisFilter filterY = axisFilter(height, halfHeight, wrap);
+    const size_t sourceRowSize = static_cast<size_t>(width) * Channels;
+    const size_t halfRowSize = static_cast<size_t>(halfWidth) * Channels;
+    static const SrgbEncoder srgbEncoder;
+
+    // Bytes to the space each channel filters in
+    std::array<std::array<float, 256>, Channels> decode;
+    for (size_t channel = 0; channel < Channels; ++channel) {
+        for (size_t value = 0; value < 256; ++value) {
+            if (content == MipContent::SRGB_COLOR && channel != alphaChannel)
+                decode[channel][value] = srgbToLinear(float(value) / 255.0f);
+            else if (content == MipContent::NORMAL && channel != alphaChannel)
+                decode[channel][value] = float(value) / 127.5f - 1.0f;
+            else
+                decode[channel][value] = float(value) / 255.0f;
+        }
+    }
+
+    std::vector<float> decoded(sourceRowSize * static_cast<size_t>(height));
+    parallelRows(height, numThreads, [&](size_t firstRow, size_t endRow) {
+        for (size_t i = firstRow * sourceRowSize; i < endRow * sourceRowSize; i += Channels) {
+            for (size_t channel = 0; channel < Channels; ++channel)
+                decoded[i + channel] = decode[channel][pixels[i + channel]];
+        }
+    });
+
+    // Each row of the level on its own: the vertical pass first, over whole rows of contiguous floats which
+    // vectorises, then the horizontal one, which gathers but only on the rows that are left
+    parallelRows(halfHeight, numThreads, [&](size_t firstRow, size_t endRow) {
+        std::vector<float> column(sourceRowSize), row(halfRowSize);
+        for (size_t y = firstRow; y < endRow; ++y) {
+            std::fill(column.begin(), column.end(), 0.0f);
+            for (size_t tap = 0; tap < filterY.tapCount; ++tap) {
+                const size_t slot = y * filterY.tapCount + tap;
+                const float weight = filterY.weights[slot];
+                const float* source = decoded.data() + filterY.indices[slot] * sourceRowSize;
+                for (size_t i = 0; i < column.size(); ++i)
+                    column[i] += weight * source[i];
+            }
+            for (size_t x = 0; x < static_cast<size_t>(halfWidth); ++x) {
+                const size_t* indices = filterX.indices.data() + x * filterX.tapCount;
+                const float* weights = filterX.weights.data() + x * filterX.tapCount;
+                float sum[Channels] = {};
+                for (size_t tap = 0; tap < filterX.tapCount; ++tap) {
+                    const float* texel = column.data() + indices[tap] * Channels;
+                    for (size_t channel = 0; channel < Channels; ++channel)
+                        sum[channel] += weights[tap] * texel[channel];
+                }
+                std::copy_n(sum, Channels, row.data() + x * Channels);
+            }
+
+            uint8_t* destination = half + y * halfRowSize;
+            for (size_t x = 0; x < static_cast<size_t>(halfWidth); ++x) {
+                const float* texel = row.data() + x * Channels;
+                uint8_t* encoded = destination + x * Channels;
+                if (Channels >= 3 && content == MipContent::NORMAL) {
+                    // Averaged normals get shorter, the shading wants unit ones
+                    const float length = std::sqrt(texel[0] * texel[0] + texel[1] * texel[1] + texel[2] * texel[2]);
+                    const std::array<float, 3> normal = length > 1e-6f ? std::array { texel[0] / length, texel[1] / length, texel[2] / length }
+                                                                       : std::array { 0.0f, 0.0f, 1.0f };
+                    for (size_t channel = 0; channel < 3; ++channel)
+                        encoded[channel] = toByte(normal[channel] * 0.5f + 0.5f);
+                } else {
+                    for (size_t channel = 0; channel < Channels; ++channel)
+                        encoded[channel] = content == MipContent::SRGB_COLOR && channel != alphaChannel ? srgbEncoder.encode(texel[channel]) : toByte(texel[channel]);
+                }
+                if constexpr (alphaChannel < Channels)
+                    encoded[alphaChannel] = toByte(texel[alphaChannel]);
+            }
+        }
+    });
+}
+}
+
+std::vector<uint8_t> downsampleMip(const uint8_t* pixels, int width, int height, int channels, MipContent content, bool wrap, int numThreads)
+{
+    if (numThreads <= 0)
+        numThreads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    if (content == MipContent::NORMAL && channels < 3)
+        content = MipContent::LINEAR;
+
+    std::vector<uint8_t> half(static_cast<size_t>(std::max(1, width / 2)) * static_cast<size_t>(std::max(1, height / 2)) * static_cast<size_t>(channels));
+    switch (channels) {
+    case 1:
+        downsampleChannels<1>(pixels, width, height, content, wrap, numThreads, half.data());
+        break;
+    case 2:
+        downsampleChannels<2>(pixels, width, height, content, wrap, numThreads, half.data());
+        break;
+    case 3:
+        downsampleChannels<3>(pixels, width, height, content, wrap, numThreads, half.data());
+        break;
+    default:
+        downsampleChannels<4>(pixels, width, height, content, wrap, numThreads, half.data());
+        break;
+    }
+    return half;
+}
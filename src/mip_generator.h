@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// How texel values combine when they are filtered
+enum class MipContent {
+    SRGB_COLOR, // RGB filtered in linear light and encoded back, alpha linear
+    LINEAR, // every channel as stored (metallic, roughness, ...)
+    NORMAL, // RGB as a [-1, 1] vector, renormalised after filtering
+};
+
+// Next mip level of an 8 bit image of 1 to 4 channels, max(1, width / 2) x max(1, height / 2). The last
+// channel of 2 and 4 channel images is alpha, NORMAL needs x, y and z in the first three.
+//
+// Separable Kaiser windowed sinc (radius 3 texels of the smaller level, alpha 4), which keeps detail a
+// box filter blurs away without ringing much; results are clamped to [0, 1]. wrap repeats the image at
+// its edges like GL_REPEAT sampling does, otherwise edge texels are repeated (cube faces). Rows are
+// split over numThreads threads (0: one per core).
+std::vector<uint8_t> downsampleMip(const uint8_t* pixels, int width, int height, int channels, MipContent content, bool wrap, int numThreads = 0);
@@ -0,0 +1,160 @@
+#include "profiler.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <imgui/imgui.h>
+DISABLE_WARNINGS_POP()
+
+#include <iostream>
+#include <utility>
+
+GpuTimer::GpuTimer(GpuTimer&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+GpuTimer::~GpuTimer()
+{
+    release();
+}
+
+GpuTimer& GpuTimer::operator=(GpuTimer&& other) noexcept
+{
+    if (this != &other) {
+        release();
+        m_queries = other.m_queries;
+        m_pending = other.m_pending;
+        m_cursor = other.m_cursor;
+        m_initialized = other.m_initialized;
+        m_lastMs = other.m_lastMs;
+        other.m_initialized = false;
+    }
+    return *this;
+}
+
+void GpuTimer::init()
+{
+    glGenQueries(static_cast<GLsizei>(m_queries.size()), m_queries.data());
+    m_pending.fill(false);
+    m_initialized = true;
+}
+
+void GpuTimer::release()
+{
+    if (m_initialized)
+        glDeleteQueries(static_cast<GLsizei>(m_queries.size()), m_queries.data());
+    m_initialized = false;
+}
+
+void GpuTimer::begin()
+{
+    if (!m_initialized)
+        init();
+
+    // Collect the result of the oldest query pair before it is reused. With RING_SIZE frames of latency
+    // the result is normally available already, so this does not block.
+    if (m_pending[m_cursor]) {
+        GLuint64 start = 0, end = 0;
+        glGetQueryObjectui64v(m_queries[m_cursor * 2], GL_QUERY_RESULT, &start);
+        glGetQueryObjectui64v(m_queries[m_cursor * 2 + 1], GL_QUERY_RESULT, &end);
+        m_lastMs = static_cast<float>(static_cast<double>(end - start) / 1.0e6);
+        m_pending[m_cursor] = false;
+    }
+
+    glQueryCounter(m_queries[m_cursor * 2], GL_TIMESTAMP);
+}
+
+void GpuTimer::end()
+{
+    glQueryCounter(m_queries[m_cursor * 2 + 1], GL_TIMESTAMP);
+    m_pending[m_cursor] = true;
+    m_cursor = (m_cursor + 1) % RING_SIZE;
+}
+
+void SweepBenchmark::start(std::string name, std::vector<int> values, ApplyFn apply, int warmupFrames, int measuredFrames)
+{
+    if (values.empty())
+        return;
+
+    m_name = std::move(name);
+    m_values = std::move(values);
+    m_apply = std::move(apply);
+    m_warmupFrames = warmupFrames;
+    m_measuredFrames = measuredFrames;
+    m_results.clear();
+    m_step = 0;
+    m_frame = 0;
+    m_cpuSum = m_gpuSum = m_frameSum = 0.0;
+    m_running = true;
+
+    m_apply(m_values[0]);
+}
+
+void SweepBenchmark::onFrame(float cpuMs, float gpuMs, float frameMs)
+{
+    if (!m_running)
+        return;
+
+    // GPU timer results lag a few frames, the warm-up also absorbs that latency.
+    if (m_frame >= m_warmupFrames) {
+        m_cpuSum += double(cpuMs);
+        m_gpuSum += double(gpuMs);
+        m_frameSum += double(frameMs);
+    }
+
+    if (++m_frame < m_warmupFrames + m_measuredFrames)
+        return;
+
+    m_results.push_back({ m_values[m_step],
+        static_cast<float>(m_cpuSum / m_measuredFrames),
+        static_cast<float>(m_gpuSum / m_measuredFrames),
+        static_cast<float>(m_frameSum / m_measuredFrames) });
+
+    m_frame = 0;
+    m_cpuSum = m_gpuSum = m_frameSum = 0.0;
+
+    if (++m_step < m_values.size())
+        m_apply(m_values[m_step]);
+    else
+        finish();
+}
+
+void SweepBenchmark::finish()
+{
+    m_running = false;
+
+    std::cout << "=== Benchmark: " << m_name << " ===" << std::endl;
+    std::cout << "value\tcpu ms\tgpu ms\tframe ms" << std::endl;
+    for (const Sample& sample : m_results)
+        std::cout << sample.value << "\t" << sample.cpuMs << "\t" << sample.gpuMs << "\t" << sample.frameMs << std::endl;
+}
+
+void SweepBenchmark::imgui() const
+{
+    if (m_running)
+        ImGui::Text("Running %s: step %zu / %zu", m_name.c_str(), m_step + 1, m_values.size());
+
+    if (m_results.empty())
+        return;
+
+    ImGui::Text("%s", m_name.c_str());
+    ImGui::Columns(4, nullptr, false);
+    ImGui::Text("value");
+    ImGui::NextColumn();
+    ImGui::Text("cpu ms");
+    ImGui::NextColumn();
+    ImGui::Text("gpu ms");
+    ImGui::NextColumn();
+    ImGui::Text("frame ms");
+    ImGui::NextColumn();
+    for (const Sample& sample : m_results) {
+        ImGui::Text("%d", sample.value);
+        ImGui::NextColumn();
+        ImGui::Text("%.3f", double(sample.cpuMs));
+        ImGui::NextColumn();
+        ImGui::Text("%.3f", double(sample.gpuMs));
+        ImGui::NextColumn();
+        ImGui::Text("%.3f", double(sample.frameMs));
+        ImGui::NextColumn();
+    }
+    ImGui::Columns(1);
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <framework/opengl_includes.h>
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Measures GPU time between begin() and end() with timestamp queries.
+// Queries are kept in a small ring so reading a result never stalls on the frame that is still in flight;
+// the value returned by lastMs() therefore lags a few frames behind.
+class GpuTimer {
+public:
+    GpuTimer() = default;
+    GpuTimer(const GpuTimer&) = delete;
+    GpuTimer(GpuTimer&& other) noexcept;
+    ~GpuTimer();
+
+    GpuTimer& operator=(const GpuTimer&) = delete;
+    GpuTimer& operator=(GpuTimer&& other) noexcept;
+
+    void begin();
+    void end();
+
+    // Latest resolved GPU duration in milliseconds (0 until the first result is available).
+    float lastMs() const { return m_lastMs; }
+
+private:
+    static constexpr size_t RING_SIZE = 4;
+
+    void init();
+    void release();
+
+    std::array<GLuint, RING_SIZE * 2> m_queries {};
+    std::array<bool, RING_SIZE> m_pending {};
+    size_t m_cursor = 0;
+    bool m_initialized = false;
+    float m_lastMs = 0.0f;
+};
+
+// Wall-clock timer for CPU side work, in milliseconds.
+class CpuTimer {
+public:
+    void begin() { m_start = std::chrono::steady_clock::now(); }
+    float end()
+    {
+        m_lastMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - m_start).count();
+        return m_lastMs;
+    }
+    float lastMs() const { return m_lastMs; }
+
+private:
+    std::chrono::steady_clock::time_point m_start {};
+    float m_lastMs = 0.0f;
+};
+
+// Runs the render loop over a list of parameter values (e.g. light counts) and records the average
+// CPU, GPU and wall-clock frame time for each one. The application calls onFrame() once per frame with the
+// measured times; the benchmark applies the next value through the setter when a step is complete.
+class SweepBenchmark {
+public:
+    struct Sample {
+        int value;
+        float cpuMs;
+        float gpuMs;
+        float frameMs;
+    };
+
+    using ApplyFn = std::function<void(int value)>;
+
+    void start(std::string name, std::vector<int> values, ApplyFn apply, int warmupFrames = 30, int measuredFrames = 120);
+    void onFrame(float cpuMs, float gpuMs, float frameMs);
+
+    bool running() const { return m_running; }
+    const std::string& name() const { return m_name; }
+    const std::vector<Sample>& results() const { return m_results; }
+
+    // Draws the progress / result table into the current ImGui window.
+    void imgui() const;
+
+private:
+    void finish();
+
+    std::string m_name;
+    std::vector<int> m_values;
+    std::vector<Sample> m_results;
+    ApplyFn m_apply;
+
+    int m_warmupFrames = 0;
+    int m_measuredFrames = 0;
+    size_t m_step = 0;
+    int m_frame = 0;
+    double m_cpuSum = 0.0;
+    double m_gpuSum = 0.0;
+    double m_frameSum = 0.0;
+    bool m_running = false;
+};
@@ -12,6 +12,7 @@ DISABLE_WARNINGS_PUSH()
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_inverse.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/mat4x4.hpp>
 #include <imgui/imgui.h>
@@ -20,6 +21,7 @@ DISABLE_WARNINGS_POP()
 #include <framework/shader.h>
 #include <framework/window.h>
 #include <framework/mesh.h>
+#include <algorithm>
 #include <functional>
 #include <array>
 #include <iostream>
@@ -31,6 +33,16 @@ DISABLE_WARNINGS_POP()
 inline const int WIDTH = 1920;
 inline const int HEIGHT = 1080;
 
+inline const float CAMERA_NEAR = 0.1f;
+inline const float CAMERA_FAR = 30.0f;
+
+// Clip planes of Trackball::projectionMatrix(), used by the deferred pipeline
+inline const float TRACKBALL_NEAR = 0.01f;
+inline const float TRACKBALL_FAR = 100.0f;
+
+// Screen tile size in pixels of the tiled deferred lighting pass
+inline const int DEFERRED_TILE_SIZE = 16;
+
 inline const int SHADOWTEX_WIDTH = 800;
 inline const int SHADOWTEX_HEIGHT = 600;
 
@@ -64,6 +76,53 @@ enum class MaterialModel {
 
 inline std::array<const char*, 2> materialModelNames{ "normal","PBR Material" };
 
+enum class DeferredLightingMode {
+    FULLSCREEN,
+    TILED,
+    STENCIL_VOLUMES,
+    CNT,
+};
+
+inline std::array<const char*, 3> deferredLightingModeNames{ "Fullscreen", "Tiled", "Stencil light volumes" };
+
+// Resolution of the SSAO target relative to the G-buffer, a divisor of 1 << value
+enum class SsaoResolution {
+    FULL,
+    HALF,
+    QUARTER,
+    CNT,
+};
+
+inline std::array<const char*, 3> ssaoResolutionNames{ "Full", "Half", "Quarter" };
+
+#define SSAO_MAX_KERNEL_SIZE 64
+
+// Compile time features of the forward shaders, bit i of a ShaderPermutations key is feature i
+enum class ShaderFeature {
+    TEX_COORDS,
+    NORMAL_MAPPING,
+    ENV_MAP,
+    MATERIAL,
+    SHADOW,
+    PCF,
+    HDR_ENV_MAP,
+    IGNORE_LIGHT_DIRECTION,
+    IRRADIANCE_SH,
+    CNT,
+};
+
+inline std::array<const char*, 9> shaderFeatureDefines{ "HAS_TEX_COORDS", "USE_NORMAL_MAPPING", "USE_ENV_MAP", "USE_MATERIAL",
+    "SHADOW_ENABLED", "PCF_ENABLED", "HDR_ENV_MAP_ENABLED", "IGNORE_LIGHT_DIRECTION", "IRRADIANCE_SH" };
+
+// Uniform each feature maps to in the uber-shaders, the shadow switches live in the shadowSetting block
+inline std::array<const char*, 9> shaderFeatureUniforms{ "hasTexCoords", "useNormalMapping", "useEnvMap", "useMaterial",
+    nullptr, nullptr, "hdrEnvMapEnabled", "ignoreLightDirection", "useIrradianceSH" };
+
+constexpr uint32_t shaderFeatureBit(ShaderFeature feature) { return 1u << static_cast<uint32_t>(feature); }
+
+// Longest bloom mip chain, the first mip is half the output size
+#define BLOOM_MAX_MIPS 8
+
 
     #pragma region LightRelated
 
@@ -121,9 +180,6 @@ inline float calculateLightRadius(const Light& light) {
 }
 
 
-inline const int MAXLIGHT = 10;
-inline size_t curLightIndex = 0;
-
 inline Light defaultLight = { glm::vec3(0, 0, 3), glm::vec3(1), -glm::vec3(0, 0, 3), false, false, /*std::nullopt*/};
 
 #pragma endregion
@@ -220,7 +276,18 @@ void genUboBufferObj(std::vector<T>& objLists, GLuint& selUboBuffer, int maxObjL
 
     glBindBuffer(GL_UNIFORM_BUFFER, selUboBuffer);
     glBufferData(GL_UNIFORM_BUFFER, sizeof(T) * maxObjListCnt, nullptr, GL_STATIC_DRAW);
-    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T) * objLists.size(), objLists.data());
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T) * std::min(objLists.size(), static_cast<size_t>(maxObjListCnt)), objLists.data());
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+// Unlike genUboBufferObj, the buffer is only created on the first call and re-filled afterwards.
+template <typename T>
+void updateUboBufferObj(const T& object, GLuint& selUboBuffer) {
+    if (selUboBuffer == 0)
+        glGenBuffers(1, &selUboBuffer);
+
+    glBindBuffer(GL_UNIFORM_BUFFER, selUboBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(T), &object, GL_DYNAMIC_DRAW);
     glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
@@ -292,7 +359,7 @@ inline void renderHDRCubeMap(GLuint& cubeVAO, GLuint& cubeVBO, const float* vert
     glBindVertexArray(0);
 }
 
-inline void renderQuad(GLuint& quadVAO, GLuint& quadVBO, const float* vertices, size_t vertexCount) {
+inline void renderQuadInstanced(GLuint& quadVAO, GLuint& quadVBO, const float* vertices, size_t vertexCount, GLsizei instanceCount) {
     if (quadVAO == 0)
     {
         // setup plane VAO
@@ -307,10 +374,14 @@ inline void renderQuad(GLuint& quadVAO, GLuint& quadVBO, const float* vertices,
         glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
     }
     glBindVertexArray(quadVAO);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, instanceCount);
     glBindVertexArray(0);
 }
 
+inline void renderQuad(GLuint& quadVAO, GLuint& quadVBO, const float* vertices, size_t vertexCount) {
+    renderQuadInstanced(quadVAO, quadVBO, vertices, vertexCount, 1);
+}
+
 inline const float quadVertices[] = {
     // positions        // texture Coords
     -1.0f,  1.0f, 0.0f, 0.0f, 1.0f,
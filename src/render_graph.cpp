@@ -0,0 +1,212 @@
+#include "render_graph.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+void RenderGraph::PassBuilder::read(RenderResource resource)
+{
+    Resource& res = m_graph.resource(resource);
+    if (!res.imported && res.firstPass < 0)
+        throw std::logic_error("RenderGraph: pass reads " + res.name + " before any pass wrote it");
+
+    m_graph.passAt(m_pass).reads.push_back(resource);
+}
+
+void RenderGraph::PassBuilder::write(RenderResource resource)
+{
+    Resource& res = m_graph.resource(resource);
+    // Only used to validate reads here, compile() recomputes the lifetimes over the live passes
+    if (res.firstPass < 0)
+        res.firstPass = m_pass;
+
+    m_graph.passAt(m_pass).writes.push_back(resource);
+}
+
+void RenderGraph::PassBuilder::sideEffect()
+{
+    m_graph.passAt(m_pass).sideEffect = true;
+}
+
+RenderGraph::RenderGraph(RenderTargetPool& pool)
+    : m_pool(pool)
+{
+}
+
+RenderResource RenderGraph::createTexture(const char* name, const RenderTargetDesc& desc)
+{
+    Resource& res = m_resources.emplace_back();
+    res.name = name;
+    res.desc = desc;
+    return static_cast<RenderResource>(m_resources.size() - 1);
+}
+
+RenderResource RenderGraph::importFramebuffer(const char* name, GLuint framebuffer, const glm::ivec2& size)
+{
+    Resource& res = m_resources.emplace_back();
+    res.name = name;
+    res.desc.size = size;
+    res.imported = true;
+    res.framebuffer = framebuffer;
+    return static_cast<RenderResource>(m_resources.size() - 1);
+}
+
+void RenderGraph::addPass(const char* name, const SetupFunc& setup, ExecuteFunc execute)
+{
+    Pass& pass = m_passes.emplace_back();
+    pass.name = name;
+    pass.execute = std::move(execute);
+
+    PassBuilder builder(*this, static_cast<int>(m_passes.size() - 1));
+    setup(builder);
+}
+
+void RenderGraph::compile()
+{
+    // Cull backwards: a pass is needed if it has side effects, writes an imported framebuffer or writes a
+    // texture a later live pass uses. Writes count as uses too since passes draw on top of earlier results.
+    for (Resource& res : m_resources)
+        res.needed = res.imported;
+
+    for (auto pass = m_passes.rbegin(); pass != m_passes.rend(); ++pass) {
+        pass->live = pass->sideEffect || std::any_of(pass->writes.begin(), pass->writes.end(), [&](RenderResource r) { return resource(r).needed; });
+        if (!pass->live)
+            continue;
+
+        for (RenderResource r : pass->reads)
+            resource(r).needed = true;
+        for (RenderResource r : pass->writes)
+            resource(r).needed = true;
+    }
+
+    // Lifetimes over the live passes
+    for (Resource& res : m_resources)
+        res.firstPass = res.lastPass = -1;
+
+    m_stats = {};
+    for (int i = 0; i < static_cast<int>(m_passes.size()); ++i) {
+        const Pass& pass = passAt(i);
+        ++m_stats.numPasses;
+        if (!pass.live) {
+            ++m_stats.numCulledPasses;
+            continue;
+        }
+
+        if (!m_stats.executionOrder.empty())
+            m_stats.executionOrder += " > ";
+        m_stats.executionOrder += pass.name;
+
+        for (const auto* list : { &pass.reads, &pass.writes }) {
+            for (RenderResource r : *list) {
+                Resource& res = resource(r);
+                if (res.firstPass < 0)
+                    res.firstPass = i;
+                res.lastPass = i;
+            }
+        }
+    }
+
+    // Replay the acquire / release order the pool will see to find the memory it ends up allocating
+    std::vector<RenderTargetDesc> freeTargets;
+    for (int i = 0; i < static_cast<int>(m_passes.size()); ++i) {
+        for (const Resource& res : m_resources) {
+            if (res.imported || res.firstPass != i)
+                continue;
+
+            const size_t bytes = RenderTargetPool::bytesPerPixel(res.desc.internalFormat) * static_cast<size_t>(res.desc.size.x) * static_cast<size_t>(res.desc.size.y)
+                * static_cast<size_t>(std::max(res.desc.samples, 1));
+            ++m_stats.numTransients;
+            m_stats.unaliasedBytes += bytes;
+
+            const auto reusable = std::find(freeTargets.begin(), freeTargets.end(), res.desc);
+            if (reusable != freeTargets.end())
+                freeTargets.erase(reusable);
+            else
+                m_stats.peakBytes += bytes;
+        }
+        for (const Resource& res : m_resources) {
+            if (!res.imported && res.lastPass == i)
+                freeTargets.push_back(res.desc);
+        }
+    }
+
+    m_compiled = true;
+}
+
+void RenderGraph::execute()
+{
+    if (!m_compiled)
+        compile();
+
+    for (int i = 0; i < static_cast<int>(m_passes.size()); ++i) {
+        const Pass& pass = passAt(i);
+        if (!pass.live)
+            continue;
+
+        for (Resource& res : m_resources) {
+            if (!res.imported && res.firstPass == i)
+                res.texture = m_pool.acquire(res.desc);
+        }
+
+        bindFramebuffer(pass);
+        pass.execute();
+
+        for (Resource& res : m_resources) {
+            if (!res.imported && res.lastPass == i) {
+                m_pool.release(res.texture);
+                res.texture = 0;
+            }
+        }
+    }
+}
+
+GLuint RenderGraph::texture(RenderResource handle) const
+{
+    // A negative handle wraps around to an index past the end as well
+    const Resource& res = m_resources.at(static_cast<size_t>(handle));
+    if (res.texture == 0)
+        throw std::logic_error("RenderGraph: " + res.name + " is not alive during this pass");
+    return res.texture;
+}
+
+RenderGraph::Resource& RenderGraph::resource(RenderResource handle)
+{
+    if (handle < 0 || handle >= static_cast<RenderResource>(m_resources.size()))
+        throw std::out_of_range("RenderGraph: invalid resource handle");
+    return m_resources[static_cast<size_t>(handle)];
+}
+
+RenderGraph::Pass& RenderGraph::passAt(int index)
+{
+    return m_passes[static_cast<size_t>(index)];
+}
+
+void RenderGraph::bindFramebuffer(const Pass& pass)
+{
+    if (pass.writes.empty())
+        return;
+
+    std::vector<GLuint> colorTargets;
+    GLuint depthTarget = 0;
+    GLuint framebuffer = 0;
+    bool imported = false;
+    for (RenderResource r : pass.writes) {
+        const Resource& res = resource(r);
+        if (res.imported) {
+            imported = true;
+            framebuffer = res.framebuffer;
+        } else if (RenderTargetPool::isDepthFormat(res.desc.internalFormat)) {
+            depthTarget = res.texture;
+        } else {
+            colorTargets.push_back(res.texture);
+        }
+    }
+
+    if (imported && (depthTarget != 0 || !colorTargets.empty()))
+        throw std::logic_error("RenderGraph: pass " + pass.name + " writes an imported framebuffer and transient textures");
+    if (!imported)
+        framebuffer = m_pool.framebuffer(colorTargets, depthTarget);
+
+    const glm::ivec2 size = resource(pass.writes.front()).desc.size;
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, size.x, size.y);
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "render_target_pool.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// Index of a texture declared in a RenderGraph, only meaningful for the graph that returned it.
+using RenderResource = int;
+
+struct RenderGraphStats {
+    int numPasses = 0;
+    int numCulledPasses = 0;
+    int numTransients = 0;
+    // Every transient texture allocated separately for the whole frame, as the fixed FBOs used to be.
+    size_t unaliasedBytes = 0;
+    // Texture memory the pool has to hand out once transients with disjoint lifetimes share textures.
+    size_t peakBytes = 0;
+    // Names of the executed passes in order, culled passes are left out.
+    std::string executionOrder;
+};
+
+// Per frame render graph.
+//
+// Passes are added in submission order and declare the textures they read and write in their setup
+// callback. compile() walks the passes backwards from the ones that write imported framebuffers (or are
+// marked as having side effects) and culls every pass whose writes nobody reads. The remaining passes run
+// in submission order, which is a valid execution order because a pass can only read what an earlier
+// pass wrote. Transient textures live from the first to the last live pass that uses them: execute()
+// acquires them from the RenderTargetPool right before that first pass and releases them right after the
+// last one, so transients with the same description and disjoint lifetimes share a texture. Before every
+// pass the graph binds a framebuffer with the pass' writes attached and sets the viewport to their size.
+class RenderGraph {
+public:
+    class PassBuilder {
+    public:
+        void read(RenderResource resource);
+        // Writes are attached in call order: color formats to the color attachments, a depth format to the depth attachment.
+        void write(RenderResource resource);
+        // Never cull this pass, e.g. it only changes state outside the graph.
+        void sideEffect();
+
+    private:
+        friend class RenderGraph;
+        PassBuilder(RenderGraph& graph, int pass)
+            : m_graph(graph)
+            , m_pass(pass)
+        {
+        }
+
+        RenderGraph& m_graph;
+        int m_pass;
+    };
+
+    using SetupFunc = std::function<void(PassBuilder&)>;
+    using ExecuteFunc = std::function<void()>;
+
+    explicit RenderGraph(RenderTargetPool& pool);
+    RenderGraph(const RenderGraph&) = delete;
+    RenderGraph& operator=(const RenderGraph&) = delete;
+
+    // Texture allocated by the graph for the frame.
+    RenderResource createTexture(const char* name, const RenderTargetDesc& desc);
+    // Framebuffer owned outside the graph (the window), passes writing it are never culled.
+    RenderResource importFramebuffer(const char* name, GLuint framebuffer, const glm::ivec2& size);
+
+    void addPass(const char* name, const SetupFunc& setup, ExecuteFunc execute);
+
+    void compile();
+    void execute();
+
+    // Texture of a transient, valid while a pass that uses it executes.
+    GLuint texture(RenderResource resource) const;
+
+    const RenderGraphStats& stats() const { return m_stats; }
+
+private:
+    struct Resource {
+        std::string name;
+        RenderTargetDesc desc;
+        bool imported = false;
+        GLuint framebuffer = 0; // imported only
+        GLuint texture = 0;
+        int firstPass = -1;
+        int lastPass = -1;
+        bool needed = false; // by a live pass, compile() only
+    };
+
+    struct Pass {
+        std::string name;
+        ExecuteFunc execute;
+        std::vector<RenderResource> reads;
+        std::vector<RenderResource> writes;
+        bool sideEffect = false;
+        bool live = false;
+    };
+
+    // Handles and pass numbers are ints (-1 for none), these turn them into indices
+    Resource& resource(RenderResource handle);
+    Pass& passAt(int index);
+    void bindFramebuffer(const Pass& pass);
+
+    RenderTargetPool& m_pool;
+    std::vector<Resource> m_resources;
+    std::vector<Pass> m_passes;
+    RenderGraphStats m_stats;
+    bool m_compiled = false;
+};
@@ -0,0 +1,275 @@
+#include "render_target_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+struct PixelFormat {
+    GLenum internalFormat;
+    GLenum format;
+    GLenum type;
+    size_t bytesPerPixel;
+};
+
+// Every format a pass asks the pool for; format / type only matter for the (empty) glTexImage2D upload.
+constexpr PixelFormat PIXEL_FORMATS[] = {
+    { GL_R8, GL_RED, GL_UNSIGNED_BYTE, 1 },
+    { GL_RG8, GL_RG, GL_UNSIGNED_BYTE, 2 },
+    { GL_RGB8, GL_RGB, GL_UNSIGNED_BYTE, 4 }, // drivers pad 3 byte texels
+    { GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4 },
+    { GL_RG16, GL_RG, GL_UNSIGNED_SHORT, 4 },
+    { GL_R16F, GL_RED, GL_HALF_FLOAT, 2 },
+    { GL_RG16F, GL_RG, GL_HALF_FLOAT, 4 },
+    { GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, 8 },
+    { GL_R11F_G11F_B10F, GL_RGB, GL_FLOAT, 4 },
+    { GL_R32F, GL_RED, GL_FLOAT, 4 },
+    { GL_RG32F, GL_RG, GL_FLOAT, 8 },
+    { GL_RGBA32F, GL_RGBA, GL_FLOAT, 16 },
+    { GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 4 },
+    { GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT, 4 },
+    { GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, 4 },
+    { GL_DEPTH32F_STENCIL8, GL_DEPTH_STENCIL, GL_FLOAT_32_UNSIGNED_INT_24_8_REV, 8 },
+};
+
+const PixelFormat& pixelFormat(GLenum internalFormat)
+{
+    for (const PixelFormat& format : PIXEL_FORMATS) {
+        if (format.internalFormat == internalFormat)
+            return format;
+    }
+    throw std::invalid_argument("RenderTargetPool: unsupported internal format");
+}
+
+GLenum depthAttachmentPoint(GLenum internalFormat)
+{
+    return pixelFormat(internalFormat).format == GL_DEPTH_STENCIL ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+}
+}
+
+RenderTargetPool::~RenderTargetPool()
+{
+    clear();
+    if (m_linearSampler != 0)
+        glDeleteSamplers(1, &m_linearSampler);
+}
+
+void RenderTargetPool::setOutputSize(const glm::ivec2& size)
+{
+    const glm::ivec2 outputSize = glm::max(size, glm::ivec2(1));
+    if (outputSize == m_outputSize)
+        return;
+
+    m_outputSize = outputSize;
+    updateRenderSize();
+}
+
+void RenderTargetPool::setRenderScale(float scale)
+{
+    if (scale == m_renderScale)
+        return;
+
+    m_renderScale = scale;
+    updateRenderSize();
+}
+
+void RenderTargetPool::updateRenderSize()
+{
+    m_renderSize = glm::max(glm::ivec2(glm::round(glm::vec2(m_outputSize) * m_renderScale)), glm::ivec2(1));
+
+    // Targets of the old size will not be asked for again, free them now instead of after a few frames
+    freeUnused();
+}
+
+GLuint RenderTargetPool::acquire(const RenderTargetDesc& desc)
+{
+    for (Target& target : m_targets) {
+        if (!target.inUse && target.desc == desc) {
+            target.inUse = true;
+            target.lastUsedFrame = m_frame;
+            return target.texture;
+        }
+    }
+
+    Target& target = m_targets.emplace_back();
+    target.desc = desc;
+    target.inUse = true;
+    target.lastUsedFrame = m_frame;
+    createTarget(target);
+    return target.texture;
+}
+
+void RenderTargetPool::release(GLuint texture)
+{
+    for (Target& target : m_targets) {
+        if (target.texture == texture) {
+            target.inUse = false;
+            return;
+        }
+    }
+}
+
+GLuint RenderTargetPool::framebuffer(const std::vector<GLuint>& colorTargets, GLuint depthTarget)
+{
+    std::vector<GLuint> attachments = colorTargets;
+    attachments.push_back(depthTarget);
+
+    for (const CachedFramebuffer& cached : m_framebuffers) {
+        if (cached.attachments == attachments)
+            return cached.framebuffer;
+    }
+
+    CachedFramebuffer& cached = m_framebuffers.emplace_back();
+    cached.attachments = std::move(attachments);
+    glGenFramebuffers(1, &cached.framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, cached.framebuffer);
+
+    std::vector<GLenum> drawBuffers;
+    for (GLuint texture : colorTargets) {
+        const Target& target = findTarget(texture);
+        const GLenum attachment = GL_COLOR_ATTACHMENT0 + static_cast<GLenum>(drawBuffers.size());
+        glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, target.desc.samples > 1 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D, texture, 0);
+        drawBuffers.push_back(attachment);
+    }
+    if (drawBuffers.empty()) {
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+    } else {
+        glDrawBuffers(static_cast<GLsizei>(drawBuffers.size()), drawBuffers.data());
+    }
+
+    if (depthTarget != 0) {
+        const Target& target = findTarget(depthTarget);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, depthAttachmentPoint(target.desc.internalFormat),
+            target.desc.samples > 1 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D, depthTarget, 0);
+    }
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cerr << "RenderTargetPool: framebuffer not complete!" << std::endl;
+
+    return cached.framebuffer;
+}
+
+GLuint RenderTargetPool::linearSampler()
+{
+    if (m_linearSampler == 0) {
+        glGenSamplers(1, &m_linearSampler);
+        glSamplerParameteri(m_linearSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glSamplerParameteri(m_linearSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glSamplerParameteri(m_linearSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(m_linearSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    return m_linearSampler;
+}
+
+void RenderTargetPool::endFrame()
+{
+    for (Target& target : m_targets)
+        target.inUse = false;
+
+    ++m_frame;
+
+    // Only targets left idle for a while are freed, passes that skip a frame keep theirs
+    const uint64_t frame = m_frame;
+    for (size_t i = 0; i < m_targets.size();) {
+        if (frame - m_targets[i].lastUsedFrame > UNUSED_FRAMES_BEFORE_FREE) {
+            destroyTarget(m_targets[i]);
+            m_targets[i] = m_targets.back();
+            m_targets.pop_back();
+        } else {
+            ++i;
+        }
+    }
+}
+
+void RenderTargetPool::clear()
+{
+    for (const Target& target : m_targets)
+        destroyTarget(target);
+    m_targets.clear();
+
+    for (const CachedFramebuffer& cached : m_framebuffers)
+        glDeleteFramebuffers(1, &cached.framebuffer);
+    m_framebuffers.clear();
+}
+
+size_t RenderTargetPool::vramBytes() const
+{
+    size_t bytes = 0;
+    for (const Target& target : m_targets)
+        bytes += target.bytes;
+    return bytes;
+}
+
+size_t RenderTargetPool::bytesPerPixel(GLenum internalFormat)
+{
+    return pixelFormat(internalFormat).bytesPerPixel;
+}
+
+bool RenderTargetPool::isDepthFormat(GLenum internalFormat)
+{
+    const GLenum format = pixelFormat(internalFormat).format;
+    return format == GL_DEPTH_COMPONENT || format == GL_DEPTH_STENCIL;
+}
+
+void RenderTargetPool::createTarget(Target& target)
+{
+    const RenderTargetDesc& desc = target.desc;
+    const PixelFormat& format = pixelFormat(desc.internalFormat);
+
+    glGenTextures(1, &target.texture);
+    if (desc.samples > 1) {
+        glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, target.texture);
+        glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, desc.samples, desc.internalFormat, desc.size.x, desc.size.y, GL_TRUE);
+        glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+    } else {
+        glBindTexture(GL_TEXTURE_2D, target.texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, static_cast<GLint>(desc.internalFormat), desc.size.x, desc.size.y, 0, format.format, format.type, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    target.bytes = format.bytesPerPixel * static_cast<size_t>(desc.size.x) * static_cast<size_t>(desc.size.y) * static_cast<size_t>(std::max(desc.samples, 1));
+}
+
+const RenderTargetPool::Target& RenderTargetPool::findTarget(GLuint texture) const
+{
+    for (const Target& target : m_targets) {
+        if (target.texture == texture)
+            return target;
+    }
+    throw std::invalid_argument("RenderTargetPool: texture is not a pooled render target");
+}
+
+void RenderTargetPool::destroyTarget(const Target& target)
+{
+    // Drop the cached framebuffers that reference the texture, its name may be handed out again by GL
+    for (size_t i = 0; i < m_framebuffers.size();) {
+        const std::vector<GLuint>& attachments = m_framebuffers[i].attachments;
+        if (std::find(attachments.begin(), attachments.end(), target.texture) != attachments.end()) {
+            glDeleteFramebuffers(1, &m_framebuffers[i].framebuffer);
+            m_framebuffers[i] = std::move(m_framebuffers.back());
+            m_framebuffers.pop_back();
+        } else {
+            ++i;
+        }
+    }
+    glDeleteTextures(1, &target.texture);
+}
+
+void RenderTargetPool::freeUnused()
+{
+    for (size_t i = 0; i < m_targets.size();) {
+        if (!m_targets[i].inUse) {
+            destroyTarget(m_targets[i]);
+            m_targets[i] = m_targets.back();
+            m_targets.pop_back();
+        } else {
+            ++i;
+        }
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "protocol.h"
+
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+DISABLE_WARNINGS_POP()
+
+#include <cstdint>
+#include <vector>
+
+// Description of a render target, targets with equal descriptions are interchangeable.
+struct RenderTargetDesc {
+    glm::ivec2 size { 0 };
+    GLenum internalFormat = GL_RGBA8;
+    GLsizei samples = 1;
+
+    bool operator==(const RenderTargetDesc&) const = default;
+};
+
+// Pool of the screen sized textures the passes render into.
+//
+// Passes acquire() a target for the part of the frame they need it and release() it afterwards, so a
+// later pass asking for the same (size, format, samples) gets the same texture instead of a new one.
+// endFrame() returns whatever is still held and frees targets that went unused for a few frames, which
+// also drops targets of an old resolution after a resize. Framebuffers for a set of targets are cached.
+//
+// The pool also owns the output size (the window framebuffer) and the render scale the internal
+// render size is derived from; changing either frees every target that is not currently in use.
+class RenderTargetPool {
+public:
+    RenderTargetPool() = default;
+    RenderTargetPool(const RenderTargetPool&) = delete;
+    ~RenderTargetPool();
+
+    RenderTargetPool& operator=(const RenderTargetPool&) = delete;
+
+    void setOutputSize(const glm::ivec2& size);
+    void setRenderScale(float scale);
+    glm::ivec2 outputSize() const { return m_outputSize; }
+    glm::ivec2 renderSize() const { return m_renderSize; }
+    float renderScale() const { return m_renderScale; }
+
+    // Transient texture, valid until release() or endFrame(). Filtering is nearest, wrapping clamp to edge.
+    GLuint acquire(const RenderTargetDesc& desc);
+    void release(GLuint texture);
+
+    // Framebuffer with the given targets attached (colors in order, then depth or depth-stencil), created on first use.
+    GLuint framebuffer(const std::vector<GLuint>& colorTargets, GLuint depthTarget = 0);
+
+    // Sampler object for bilinear, clamp to edge reads of pooled targets; bind with glBindSampler and unbind afterwards.
+    GLuint linearSampler();
+
+    // Returns every target to the pool and frees the ones not used for UNUSED_FRAMES_BEFORE_FREE frames.
+    void endFrame();
+    void clear();
+
+    size_t vramBytes() const;
+    size_t numTargets() const { return m_targets.size(); }
+
+    static size_t bytesPerPixel(GLenum internalFormat);
+    static bool isDepthFormat(GLenum internalFormat);
+
+    static constexpr uint64_t UNUSED_FRAMES_BEFORE_FREE = 3;
+
+private:
+    struct Target {
+        RenderTargetDesc desc;
+        GLuint texture = 0;
+        size_t bytes = 0;
+        bool inUse = false;
+        uint64_t lastUsedFrame = 0;
+    };
+
+    struct CachedFramebuffer {
+        std::vector<GLuint> attachments; // color targets, then the depth target (or 0)
+        GLuint framebuffer = 0;
+    };
+
+    void createTarget(Target& target);
+    const Target& findTarget(GLuint texture) const;
+    void destroyTarget(const Target& target);
+    void freeUnused();
+    void updateRenderSize();
+
+    std::vector<Target> m_targets;
+    std::vector<CachedFramebuffer> m_framebuffers;
+    uint64_t m_frame = 0;
+    GLuint m_linearSampler = 0;
+
+    glm::ivec2 m_outputSize { 1 };
+    glm::ivec2 m_renderSize { 1 };
+    float m_renderScale = 1.0f;
+};
@@ -0,0 +1,222 @@
+#include "rgbe_decoder.h"
+
+#if defined(__F16C__) || defined(__AVX2__)
+#include <immintrin.h>
+#define RGBE_F16C 1
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+namespace {
+// Next header line without the newline, throws past the end of the file
+std::string readLine(const MappedFile& file, size_t& position)
+{
+    const unsigned char* begin = file.data() + position;
+    const unsigned char* end = static_cast<const unsigned char*>(std::memchr(begin, '\n', file.size() - position));
+    if (!end)
+        throw RgbeLoadingException("Truncated Radiance header");
+    position += static_cast<size_t>(end - begin) + 1;
+    return std::string(reinterpret_cast<const char*>(begin), reinterpret_cast<const char*>(end));
+}
+
+bool startsWith(const std::string& string, const char* prefix)
+{
+    return string.rfind(prefix, 0) == 0;
+}
+
+// Mantissa bytes of a row times 2^(exponent - 136), the same expansion stbi_loadf does. Channels of a
+// texel are stride bytes apart: 1 for the planar rows run-length decoding produces, 4 for flat files.
+void rgbeToFloats(const unsigned char* r, const unsigned char* g, const unsigned char* b, const unsigned char* e, size_t stride, int width, float* destination)
+{
+    for (int x = 0; x < width; ++x) {
+        const size_t i = size_t(x) * stride;
+        // 2^(e - 136) built from its exponent bits, anything below a normal float is black anyway
+        const uint32_t scaleBits = e[i] >= 10 ? uint32_t(e[i] - 9) << 23 : 0u;
+        float scale;
+        std::memcpy(&scale, &scaleBits, sizeof(scale));
+        destination[x * 3 + 0] = r[i] * scale;
+        destination[x * 3 + 1] = g[i] * scale;
+        destination[x * 3 + 2] = b[i] * scale;
+    }
+}
+
+// GL_RGB9_E5 packing as the EXT_texture_shared_exponent spec describes it
+uint32_t floatToRgb9e5(const float* rgb)
+{
+    constexpr int MANTISSA_BITS = 9, EXPONENT_BIAS = 15, MAX_EXPONENT = 31;
+    constexpr float maxValue = float((1 << MANTISSA_BITS) - 1) / (1 << MANTISSA_BITS) * float(1 << (MAX_EXPONENT - EXPONENT_BIAS));
+    const float r = std::clamp(rgb[0], 0.0f, maxValue);
+    const float g = std::clamp(rgb[1], 0.0f, maxValue);
+    const float b = std::clamp(rgb[2], 0.0f, maxValue);
+    const float maxComponent = std::max({ r, g, b });
+    if (maxComponent == 0.0f)
+        return 0;
+
+    int exponent = std::max(-EXPONENT_BIAS - 1, static_cast<int>(std::floor(std::log2(maxComponent)))) + 1 + EXPONENT_BIAS;
+    float scale = std::ldexp(1.0f, exponent - EXPONENT_BIAS - MANTISSA_BITS);
+    if (static_cast<int>(std::floor(maxComponent / scale + 0.5f)) == (1 << MANTISSA_BITS)) {
+        ++exponent;
+        scale *= 2.0f;
+    }
+    const uint32_t rs = static_cast<uint32_t>(std::floor(r / scale + 0.5f));
+    const uint32_t gs = static_cast<uint32_t>(std::floor(g / scale + 0.5f));
+    const uint32_t bs = static_cast<uint32_t>(std::floor(b / scale + 0.5f));
+    return rs | (gs << 9) | (bs << 18) | (uint32_t(exponent) << 27);
+}
+
+// Branch free so the loop over a row vectorises where F16C is not available
+inline uint16_t floatToHalf(float value)
+{
+    uint32_t f;
+    std::memcpy(&f, &value, sizeof(f));
+    const uint32_t sign = (f >> 16) & 0x8000u;
+    f &= 0x7fffffffu;
+
+    // Below the smallest normal half: let the FPU round the mantissa into place
+    float denormalValue;
+    std::memcpy(&denormalValue, &f, sizeof(f));
+    denormalValue += 0.5f;
+    uint32_t denormal;
+    std::memcpy(&denormal, &denormalValue, sizeof(denormal));
+    denormal -= 0x3f000000u;
+
+    // Rebias the exponent, round the dropped 13 bits to nearest even
+    const uint32_t normal = (f + 0xc8000fffu + ((f >> 13) & 1u)) >> 13;
+
+    const uint32_t infinityOrNan = f > 0x7f800000u ? 0x7e00u : 0x7c00u;
+    const uint32_t half = f >= 0x47800000u ? infinityOrNan : (f < 0x38800000u ? denormal : normal);
+    return static_cast<uint16_t>(half | sign);
+}
+}
+
+void floatsToHalf(const float* source, uint16_t* destination, size_t count)
+{
+    size_t i = 0;
+#ifdef RGBE_F16C
+    for (; i + 8 <= count; i += 8) {
+        const __m128i halves = _mm256_cvtps_ph(_mm256_loadu_ps(source + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), halves);
+    }
+#endif
+    for (; i < count; ++i)
+        destination[i] = floatToHalf(source[i]);
+}
+
+RgbeImage::RgbeImage(const std::filesystem::path& file)
+    : m_file(file)
+{
+    size_t position = 0;
+    const std::string signature = readLine(m_file, position);
+    if (!startsWith(signature, "#?RADIANCE") && !startsWith(signature, "#?RGBE"))
+        throw RgbeLoadingException(file.string() + " is not a Radiance file");
+
+    for (std::string line = readLine(m_file, position); !line.empty(); line = readLine(m_file, position)) {
+        if (startsWith(line, "FORMAT=") && line != "FORMAT=32-bit_rle_rgbe")
+            throw RgbeLoadingException(file.string() + ": unsupported " + line);
+    }
+    const std::string resolution = readLine(m_file, position);
+    if (std::sscanf(resolution.c_str(), "-Y %d +X %d", &m_height, &m_width) != 2 || m_width <= 0 || m_height <= 0)
+        throw RgbeLoadingException(file.string() + ": unsupported orientation " + resolution);
+
+    const unsigned char* data = m_file.data();
+    const size_t size = m_file.size();
+    m_scanlines.resize(size_t(m_height));
+
+    // New style run-length encoding has to start on the first scanline, otherwise every texel is stored flat
+    m_runLengthEncoded = m_width >= 8 && m_width < 0x8000 && position + 4 <= size && data[position] == 2 && data[position + 1] == 2
+        && (data[position + 2] & 0x80) == 0;
+    if (!m_runLengthEncoded) {
+        if (size - position < size_t(m_width) * size_t(m_height) * 4)
+            throw RgbeLoadingException(file.string() + " is truncated");
+        for (int row = 0; row < m_height; ++row)
+            m_scanlines[size_t(row)] = position + size_t(row) * size_t(m_width) * 4;
+        return;
+    }
+
+    // Walk the runs to find the next scanline, nothing is decoded yet
+    for (int row = 0; row < m_height; ++row) {
+        if (position + 4 > size || data[position] != 2 || data[position + 1] != 2 || ((data[position + 2] << 8) | data[position + 3]) != m_width)
+            throw RgbeLoadingException(file.string() + ": invalid scanline " + std::to_string(row));
+        m_scanlines[size_t(row)] = position;
+        position += 4;
+        for (int channel = 0; channel < 4; ++channel) {
+            for (int x = 0; x < m_width;) {
+                if (position >= size)
+                    throw RgbeLoadingException(file.string() + " is truncated");
+                int count = data[position++];
+                if (count > 128) {
+                    count -= 128;
+                    position += 1;
+                } else {
+                    if (count == 0)
+                        throw RgbeLoadingException(file.string() + ": invalid run in scanline " + std::to_string(row));
+                    position += size_t(count);
+                }
+                x += count;
+                if (x > m_width)
+                    throw RgbeLoadingException(file.string() + ": run past the end of scanline " + std::to_string(row));
+            }
+        }
+        if (position > size)
+            throw RgbeLoadingException(file.string() + " is truncated");
+    }
+}
+
+void RgbeImage::decode(RgbeOutput output, void* destination, int numThreads) const
+{
+    if (numThreads <= 0)
+        numThreads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    numThreads = std::min(numThreads, m_height);
+
+    const size_t rowSize = size_t(m_width) * texelSize(output);
+    const auto decodeRows = [&](int thread) {
+        std::vector<unsigned char> planar(m_runLengthEncoded ? size_t(m_width) * 4 : 0);
+        std::vector<float> floats(size_t(m_width) * 3);
+        for (int row = m_height * thread / numThreads; row < m_height * (thread + 1) / numThreads; ++row) {
+            const unsigned char* source = m_file.data() + m_scanlines[size_t(row)];
+            if (m_runLengthEncoded) {
+                source += 4;
+                for (int channel = 0; channel < 4; ++channel) {
+                    unsigned char* channelRow = planar.data() + size_t(channel) * size_t(m_width);
+                    for (int x = 0; x < m_width;) {
+                        int count = *source++;
+                        if (count > 128) {
+                            count -= 128;
+                            std::memset(channelRow + x, *source++, size_t(count));
+                        } else {
+                            std::memcpy(channelRow + x, source, size_t(count));
+                            source += count;
+                        }
+                        x += count;
+                    }
+                }
+                const unsigned char* p = planar.data();
+                rgbeToFloats(p, p + m_width, p + 2 * m_width, p + 3 * m_width, 1, m_width, floats.data());
+            } else {
+                rgbeToFloats(source, source + 1, source + 2, source + 3, 4, m_width, floats.data());
+            }
+
+            // Files store the top row first
+            unsigned char* outputRow = static_cast<unsigned char*>(destination) + size_t(m_height - 1 - row) * rowSize;
+            if (output == RgbeOutput::HALF_RGB) {
+                floatsToHalf(floats.data(), reinterpret_cast<uint16_t*>(outputRow), floats.size());
+            } else {
+                uint32_t* texels = reinterpret_cast<uint32_t*>(outputRow);
+                for (int x = 0; x < m_width; ++x)
+                    texels[x] = floatToRgb9e5(&floats[size_t(x) * 3]);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int thread = 1; thread < numThreads; ++thread)
+        threads.emplace_back(decodeRows, thread);
+    decodeRows(0);
+    for (std::thread& thread : threads)
+        thread.join();
+}
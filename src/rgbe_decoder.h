@@ -0,0 +1,47 @@
+#pragma once
+
+#include "mapped_file.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <stdexcept>
+#include <vector>
+
+struct RgbeLoadingException : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// Texel formats the decoder writes, both upload without a driver side conversion
+enum class RgbeOutput {
+    HALF_RGB, // 3 x half float, GL_RGB16F with GL_HALF_FLOAT
+    RGB9E5, // 4 bytes, GL_RGB9_E5 with GL_UNSIGNED_INT_5_9_9_9_REV
+};
+
+// Radiance .hdr (RGBE) image, decoded straight from a memory mapping of the file.
+//
+// The constructor reads the header and finds where every scanline starts, which for run-length encoded
+// files means walking the runs once without decoding them. decode() then splits the scanlines over
+// threads; each decodes its runs into a planar RGBE row and converts that to the output format.
+class RgbeImage {
+public:
+    explicit RgbeImage(const std::filesystem::path& file);
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    static size_t texelSize(RgbeOutput output) { return output == RgbeOutput::HALF_RGB ? 3 * sizeof(uint16_t) : sizeof(uint32_t); }
+    size_t outputSize(RgbeOutput output) const { return size_t(m_width) * size_t(m_height) * texelSize(output); }
+
+    // Writes outputSize(output) bytes to destination, rows bottom to top as GL (and stbi's flip) has them.
+    // numThreads 0 uses one per core.
+    void decode(RgbeOutput output, void* destination, int numThreads = 0) const;
+
+private:
+    MappedFile m_file;
+    int m_width = 0;
+    int m_height = 0;
+    bool m_runLengthEncoded = false;
+    std::vector<size_t> m_scanlines; // file offset of every scanline, top to bottom
+};
+
+// float to IEEE half, rounding to nearest even; count values from source to destination.
+void floatsToHalf(const float* source, uint16_t* destination, size_t count);
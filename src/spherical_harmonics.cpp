@@ -0,0 +1,214 @@
+#include "spherical_harmonics.h"
+
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/geometric.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/packing.hpp>
+DISABLE_WARNINGS_POP()
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+namespace {
+// Texels accumulated side by side in independent lanes, which the compiler turns into SIMD adds
+constexpr size_t LANES = 8;
+
+struct LaneSums {
+    float sums[9][3][LANES];
+};
+
+inline void basis(float x, float y, float z, float* Y)
+{
+    Y[0] = 0.282095f;
+    Y[1] = 0.488603f * y;
+    Y[2] = 0.488603f * z;
+    Y[3] = 0.488603f * x;
+    Y[4] = 1.092548f * x * y;
+    Y[5] = 1.092548f * y * z;
+    Y[6] = 0.315392f * (3.0f * z * z - 1.0f);
+    Y[7] = 1.092548f * x * z;
+    Y[8] = 0.546274f * (x * x - y * y);
+}
+
+inline glm::vec3 loadTexel(const float* texel)
+{
+    return { texel[0], texel[1], texel[2] };
+}
+
+inline glm::vec3 loadTexel(const uint16_t* texel)
+{
+    return { glm::unpackHalf1x16(texel[0]), glm::unpackHalf1x16(texel[1]), glm::unpackHalf1x16(texel[2]) };
+}
+
+template <typename T>
+inline glm::vec3 radiance(const T* texel, bool reinhard)
+{
+    const glm::vec3 color = loadTexel(texel);
+    return reinhard ? color / (color + glm::vec3(1.0f)) : color;
+}
+
+template <typename T>
+inline void addTexel(LaneSums& lanes, size_t lane, float x, float y, float z, float weight, const T* texel, bool reinhard)
+{
+    float Y[9];
+    basis(x, y, z, Y);
+    const glm::vec3 color = radiance(texel, reinhard) * weight;
+    for (size_t k = 0; k < 9; ++k) {
+        lanes.sums[k][0][lane] += Y[k] * color.r;
+        lanes.sums[k][1][lane] += Y[k] * color.g;
+        lanes.sums[k][2][lane] += Y[k] * color.b;
+    }
+}
+
+// Same mapping as SampleSphericalMap in hdr_to_cube_frag.glsl, nearest texel
+template <typename T>
+const T* sampleEquirect(const T* pixels, int width, int height, int channels, const glm::vec3& direction)
+{
+    const float u = std::atan2(direction.z, direction.x) / glm::two_pi<float>() + 0.5f;
+    const float v = std::asin(std::clamp(direction.y, -1.0f, 1.0f)) / glm::pi<float>() + 0.5f;
+    const int x = std::clamp(static_cast<int>(u * static_cast<float>(width)), 0, width - 1);
+    const int y = std::clamp(static_cast<int>(v * static_cast<float>(height)), 0, height - 1);
+    return pixels + (size_t(y) * size_t(width) + size_t(x)) * size_t(channels);
+}
+}
+
+glm::vec3 SphericalHarmonics9::evaluate(const glm::vec3& direction) const
+{
+    float Y[9];
+    basis(direction.x, direction.y, direction.z, Y);
+    glm::vec3 result { 0.0f };
+    for (size_t k = 0; k < coefficients.size(); ++k)
+        result += coefficients[k] * Y[k];
+    return result;
+}
+
+SphericalHarmonics9 SphericalHarmonics9::irradiance() const
+{
+    // Cosine lobe band factors (PI, 2PI/3, PI/4) over PI
+    constexpr float bandWeights[3] = { 1.0f, 2.0f / 3.0f, 0.25f };
+    SphericalHarmonics9 result;
+    for (size_t k = 0; k < coefficients.size(); ++k)
+        result.coefficients[k] = coefficients[k] * bandWeights[k == 0 ? 0 : (k < 4 ? 1 : 2)];
+    return result;
+}
+
+std::array<glm::vec4, 9> SphericalHarmonics9::std140() const
+{
+    std::array<glm::vec4, 9> result;
+    for (size_t k = 0; k < coefficients.size(); ++k)
+        result[k] = glm::vec4(coefficients[k], 0.0f);
+    return result;
+}
+
+namespace {
+template <typename T>
+SphericalHarmonics9 projectEquirectImpl(const T* pixels, int width, int height, int channels, bool reinhard, int numThreads)
+{
+    if (numThreads <= 0)
+        numThreads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    const size_t columns = size_t(width), rows = size_t(height), texelSize = size_t(channels);
+    const size_t threadCount = std::min(size_t(numThreads), rows);
+
+    std::vector<float> cosPhi(columns), sinPhi(columns);
+    for (size_t x = 0; x < columns; ++x) {
+        const float phi = ((float(x) + 0.5f) / float(width) - 0.5f) * glm::two_pi<float>();
+        cosPhi[x] = std::cos(phi);
+        sinPhi[x] = std::sin(phi);
+    }
+    const float texelArea = (glm::two_pi<float>() / float(width)) * (glm::pi<float>() / float(height));
+
+    // Each thread sums a band of rows; lanes are folded into doubles once per row to keep the precision
+    std::vector<std::array<double, 27>> partial(threadCount, std::array<double, 27> {});
+    const auto projectRows = [&](size_t thread) {
+        const size_t firstRow = rows * thread / threadCount;
+        const size_t lastRow = rows * (thread + 1) / threadCount;
+        LaneSums lanes;
+        for (size_t row = firstRow; row < lastRow; ++row) {
+            std::fill(&lanes.sums[0][0][0], &lanes.sums[0][0][0] + 27 * LANES, 0.0f);
+
+            const float latitude = ((float(row) + 0.5f) / float(height) - 0.5f) * glm::pi<float>();
+            const float y = std::sin(latitude);
+            const float cosLatitude = std::cos(latitude);
+            const float weight = texelArea * cosLatitude;
+            const T* rowPixels = pixels + row * columns * texelSize;
+
+            size_t x0 = 0;
+            for (; x0 + LANES <= columns; x0 += LANES) {
+                for (size_t lane = 0; lane < LANES; ++lane) {
+                    const size_t x = x0 + lane;
+                    addTexel(lanes, lane, cosLatitude * cosPhi[x], y, cosLatitude * sinPhi[x], weight, rowPixels + x * texelSize, reinhard);
+                }
+            }
+            for (; x0 < columns; ++x0)
+                addTexel(lanes, 0, cosLatitude * cosPhi[x0], y, cosLatitude * sinPhi[x0], weight, rowPixels + x0 * texelSize, reinhard);
+
+            for (size_t k = 0; k < 9; ++k) {
+                for (size_t c = 0; c < 3; ++c) {
+                    float sum = 0.0f;
+                    for (size_t lane = 0; lane < LANES; ++lane)
+                        sum += lanes.sums[k][c][lane];
+                    partial[thread][k * 3 + c] += double(sum);
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t thread = 1; thread < threadCount; ++thread)
+        threads.emplace_back(projectRows, thread);
+    projectRows(0);
+    for (std::thread& thread : threads)
+        thread.join();
+
+    SphericalHarmonics9 result;
+    for (const auto& sums : partial) {
+        for (size_t k = 0; k < result.coefficients.size(); ++k)
+            result.coefficients[k] += glm::vec3(glm::dvec3(sums[k * 3], sums[k * 3 + 1], sums[k * 3 + 2]));
+    }
+    return result;
+}
+
+template <typename T>
+glm::vec3 integrateIrradianceImpl(const T* pixels, int width, int height, int channels, bool reinhard, const glm::vec3& normal, float sampleDelta)
+{
+    // Loop of hdr_cube_to_irradiance_frag.glsl
+    glm::vec3 up { 0.0f, 1.0f, 0.0f };
+    const glm::vec3 right = glm::normalize(glm::cross(up, normal));
+    up = glm::normalize(glm::cross(normal, right));
+
+    glm::vec3 irradiance { 0.0f };
+    float numSamples = 0.0f;
+    for (float phi = 0.0f; phi < glm::two_pi<float>(); phi += sampleDelta) {
+        for (float theta = 0.0f; theta < glm::half_pi<float>(); theta += sampleDelta) {
+            const glm::vec3 tangentSample { std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta) };
+            const glm::vec3 sampleVec = tangentSample.x * right + tangentSample.y * up + tangentSample.z * normal;
+            irradiance += radiance(sampleEquirect(pixels, width, height, channels, sampleVec), reinhard) * std::cos(theta) * std::sin(theta);
+            numSamples += 1.0f;
+        }
+    }
+    return glm::pi<float>() * irradiance / numSamples;
+}
+}
+
+SphericalHarmonics9 projectEquirect(const float* pixels, int width, int height, int channels, bool reinhard, int numThreads)
+{
+    return projectEquirectImpl(pixels, width, height, channels, reinhard, numThreads);
+}
+
+SphericalHarmonics9 projectEquirect(const uint16_t* pixels, int width, int height, int channels, bool reinhard, int numThreads)
+{
+    return projectEquirectImpl(pixels, width, height, channels, reinhard, numThreads);
+}
+
+glm::vec3 integrateIrradiance(const float* pixels, int width, int height, int channels, bool reinhard, const glm::vec3& normal, float sampleDelta)
+{
+    return integrateIrradianceImpl(pixels, width, height, channels, reinhard, normal, sampleDelta);
+}
+
+glm::vec3 integrateIrradiance(const uint16_t* pixels, int width, int height, int channels, bool reinhard, const glm::vec3& normal, float sampleDelta)
+{
+    return integrateIrradianceImpl(pixels, width, height, channels, reinhard, normal, sampleDelta);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+DISABLE_WARNINGS_POP()
+
+#include <array>
+#include <cstdint>
+
+// Order 2 (9 coefficient) real spherical harmonics of an RGB signal on the sphere.
+struct SphericalHarmonics9 {
+    std::array<glm::vec3, 9> coefficients {};
+
+    glm::vec3 evaluate(const glm::vec3& direction) const;
+
+    // Convolution with the clamped cosine lobe divided by PI, i.e. for radiance coefficients the outgoing
+    // diffuse radiance per unit albedo: what the irradiance cubemap stores for a normal.
+    SphericalHarmonics9 irradiance() const;
+
+    // Layout of the IrradianceSH uniform block (std140, one vec4 per coefficient).
+    std::array<glm::vec4, 9> std140() const;
+};
+
+// Projects an equirectangular RGB(A) float or half float image, rows stored bottom to top as the HDR texture is uploaded,
+// weighting every texel by its solid angle. reinhard applies c / (c + 1) first, matching the environment
+// cube the irradiance map is convolved from. Rows are split over numThreads threads (0: one per core).
+SphericalHarmonics9 projectEquirect(const float* pixels, int width, int height, int channels, bool reinhard, int numThreads = 0);
+SphericalHarmonics9 projectEquirect(const uint16_t* pixels, int width, int height, int channels, bool reinhard, int numThreads = 0);
+
+// Brute force reference for the irradiance shader: the same hemisphere loop over the equirectangular image.
+glm::vec3 integrateIrradiance(const float* pixels, int width, int height, int channels, bool reinhard, const glm::vec3& normal, float sampleDelta);
+glm::vec3 integrateIrradiance(const uint16_t* pixels, int width, int height, int channels, bool reinhard, const glm::vec3& normal, float sampleDelta);
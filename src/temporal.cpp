@@ -0,0 +1,93 @@
+#include "temporal.h"
+
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/matrix.hpp>
+DISABLE_WARNINGS_POP()
+
+#include <iostream>
+
+void TemporalReprojection::beginFrame(const glm::mat4& view, const glm::mat4& projection)
+{
+    m_previousViewProjection = m_viewProjection;
+    m_previousValid = m_started;
+    m_started = true;
+
+    m_viewProjection = projection * view;
+    m_invViewProjection = glm::inverse(m_viewProjection);
+    ++m_frame;
+}
+
+glm::vec2 TemporalReprojection::jitter() const
+{
+    // Index 0 of the Halton sequence is (0, 0), start at 1
+    const uint32_t index = static_cast<uint32_t>(m_frame % JITTER_SEQUENCE_LENGTH) + 1;
+    return glm::vec2(halton(index, 2), halton(index, 3));
+}
+
+float TemporalReprojection::halton(uint32_t index, uint32_t base)
+{
+    float result = 0.0f;
+    float fraction = 1.0f;
+    while (index > 0) {
+        fraction /= static_cast<float>(base);
+        result += fraction * static_cast<float>(index % base);
+        index /= base;
+    }
+    return result;
+}
+
+TemporalHistory::~TemporalHistory()
+{
+    release();
+}
+
+void TemporalHistory::beginFrame(const TemporalReprojection& reprojection, const glm::ivec2& size, GLenum internalFormat)
+{
+    const bool recreate = m_textures[0] == 0 || size != m_size || internalFormat != m_internalFormat;
+    if (recreate)
+        create(size, internalFormat);
+
+    m_valid = !recreate && m_written && reprojection.previousValid() && m_lastFrame + 1 == reprojection.frameIndex();
+    m_current = 1 - m_current;
+    m_lastFrame = reprojection.frameIndex();
+    m_written = true;
+}
+
+void TemporalHistory::create(const glm::ivec2& size, GLenum internalFormat)
+{
+    release();
+    m_size = size;
+    m_internalFormat = internalFormat;
+
+    glGenTextures(2, m_textures.data());
+    glGenFramebuffers(2, m_framebuffers.data());
+    for (size_t i = 0; i < 2; ++i) {
+        glBindTexture(GL_TEXTURE_2D, m_textures[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, static_cast<GLint>(internalFormat), size.x, size.y, 0, GL_RGBA, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffers[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_textures[i], 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cerr << "TemporalHistory: framebuffer not complete!" << std::endl;
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    m_written = false;
+}
+
+void TemporalHistory::release()
+{
+    if (m_textures[0] == 0)
+        return;
+
+    glDeleteFramebuffers(2, m_framebuffers.data());
+    glDeleteTextures(2, m_textures.data());
+    m_textures = {};
+    m_framebuffers = {};
+}
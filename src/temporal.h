@@ -0,0 +1,86 @@
+#pragma once
+
+#include <framework/opengl_includes.h>
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
+DISABLE_WARNINGS_POP()
+
+#include <array>
+#include <cstdint>
+
+// Frame to frame camera state for temporally accumulated effects.
+//
+// beginFrame() is called once per frame with the matrices the frame renders with and keeps the previous
+// ones, so a resolve pass can reproject a pixel into last frame's history. The scene geometry is static,
+// camera motion is the only motion to reproject. Every frame also gets a low discrepancy jitter the noisy
+// effects use to pick a different subset of their samples.
+class TemporalReprojection {
+public:
+    void beginFrame(const glm::mat4& view, const glm::mat4& projection);
+    // Last frame did not render with this camera (another render path, a cut), drop the histories.
+    void invalidate()
+    {
+        m_started = false;
+        m_previousValid = false;
+    }
+
+    uint64_t frameIndex() const { return m_frame; }
+    bool previousValid() const { return m_previousValid; }
+
+    const glm::mat4& viewProjection() const { return m_viewProjection; }
+    const glm::mat4& invViewProjection() const { return m_invViewProjection; }
+    const glm::mat4& previousViewProjection() const { return m_previousViewProjection; }
+
+    // Halton (2, 3) point in [0, 1)^2 for this frame, repeats every JITTER_SEQUENCE_LENGTH frames.
+    glm::vec2 jitter() const;
+
+    static float halton(uint32_t index, uint32_t base);
+
+    static constexpr uint32_t JITTER_SEQUENCE_LENGTH = 16;
+
+private:
+    glm::mat4 m_viewProjection { 1.0f };
+    glm::mat4 m_invViewProjection { 1.0f };
+    glm::mat4 m_previousViewProjection { 1.0f };
+    uint64_t m_frame = 0;
+    bool m_started = false;
+    bool m_previousValid = false;
+};
+
+// Ping-pong pair of history textures of one temporally accumulated effect.
+//
+// The textures persist across frames, unlike the render graph transients, and are sampled bilinearly.
+// beginFrame() swaps the pair: previous() holds last frame's result and current() / currentFramebuffer()
+// receive this frame's. The history is only valid when it was written in the directly preceding frame with
+// the same size and format, and the reprojection has a valid previous camera.
+class TemporalHistory {
+public:
+    TemporalHistory() = default;
+    TemporalHistory(const TemporalHistory&) = delete;
+    ~TemporalHistory();
+
+    TemporalHistory& operator=(const TemporalHistory&) = delete;
+
+    // Float color formats only.
+    void beginFrame(const TemporalReprojection& reprojection, const glm::ivec2& size, GLenum internalFormat);
+
+    GLuint previous() const { return m_textures[1 - m_current]; }
+    GLuint current() const { return m_textures[m_current]; }
+    GLuint currentFramebuffer() const { return m_framebuffers[m_current]; }
+    bool valid() const { return m_valid; }
+
+private:
+    void create(const glm::ivec2& size, GLenum internalFormat);
+    void release();
+
+    std::array<GLuint, 2> m_textures {};
+    std::array<GLuint, 2> m_framebuffers {};
+    size_t m_current = 0;
+    glm::ivec2 m_size { 0 };
+    GLenum m_internalFormat = GL_NONE;
+    uint64_t m_lastFrame = 0;
+    bool m_written = false;
+    bool m_valid = false;
+};
@@ -0,0 +1,47 @@
+#include "texture_array_manager.h"
+#include "texture_loader.h"
+
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <stb/stb_image.h>
+DISABLE_WARNINGS_POP()
+
+#include <algorithm>
+#include <iterator>
+
+TextureArraySlot TextureArrayManager::add(const std::filesystem::path& file, TextureRole role, const glm::vec4& placeholderColor)
+{
+    int width = 0, height = 0, channels = 0;
+    if (!stbi_info(file.string().c_str(), &width, &height, &channels))
+        width = height = channels = 0;
+
+    auto group = std::find_if(m_groups.begin(), m_groups.end(), [&](const Group& candidate) {
+        return width > 0 && candidate.width == width && candidate.height == height && candidate.channels == channels && candidate.role == role;
+    });
+    if (group == m_groups.end()) {
+        m_groups.push_back({ width, height, channels, role, {}, {}, std::make_unique<TextureArray>() });
+        group = std::prev(m_groups.end());
+    }
+    group->files.push_back(file);
+    group->placeholderColors.push_back(placeholderColor);
+    return { group->array.get(), static_cast<int>(group->files.size() - 1) };
+}
+
+void TextureArrayManager::load(TextureLoader& loader, bool streamed)
+{
+    for (Group& group : m_groups) {
+        *group.array = TextureArray(group.placeholderColors);
+        if (streamed)
+            loader.loadArrayStreamed(*group.array, group.files, group.role);
+        else
+            loader.loadArray(*group.array, group.files, group.role);
+    }
+}
+
+size_t TextureArrayManager::layerCount() const
+{
+    size_t layers = 0;
+    for (const Group& group : m_groups)
+        layers += group.files.size();
+    return layers;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Textures/textureArray.h"
+#include "texture_cooker.h"
+
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+class TextureLoader;
+
+// Where a registered texture ends up: the array it shares and its layer there
+struct TextureArraySlot {
+    TextureArray* array = nullptr;
+    int layer = 0;
+};
+
+// Puts image textures of the same size, channel count and role into the layers of one GL_TEXTURE_2D_ARRAY,
+// so draws sampling any of them bind the array once and pass a layer index instead of binding a texture each.
+//
+// Textures are registered up front with add(), which only reads the file's header to find its group. load()
+// then creates every array with placeholder layers and loads each through the TextureLoader as one request,
+// streamed like the mesh textures unless asked otherwise.
+// Files that cannot be read get an array of their own, so the loader reports them and only their
+// placeholder stays. A colour image with alpha in one file but not another of its group cooks to different
+// block formats, which the loader reports as well.
+class TextureArrayManager {
+public:
+    TextureArrayManager() = default;
+    TextureArrayManager(const TextureArrayManager&) = delete;
+
+    TextureArrayManager& operator=(const TextureArrayManager&) = delete;
+
+    // The slot stays valid for the lifetime of the manager; the array holds the placeholder after load().
+    TextureArraySlot add(const std::filesystem::path& file, TextureRole role, const glm::vec4& placeholderColor);
+    void load(TextureLoader& loader, bool streamed = true);
+
+    size_t arrayCount() const { return m_groups.size(); }
+    size_t layerCount() const;
+
+private:
+    struct Group {
+        int width, height, channels; // 0 for a file that could not be read
+        TextureRole role;
+        std::vector<std::filesystem::path> files;
+        std::vector<glm::vec4> placeholderColors;
+        std::unique_ptr<TextureArray> array;
+    };
+
+    std::vector<Group> m_groups;
+};
@@ -0,0 +1,277 @@
+#include "texture_cooker.h"
+#include "profiler.h"
+
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/format.h>
+#include <stb/stb_image.h>
+DISABLE_WARNINGS_POP()
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace {
+// Changes with the cooking so files of an older version are not used
+constexpr uint32_t COOK_VERSION = 2;
+constexpr uint32_t COOK_MARKER = 0x4b4f4f43; // "COOK" in reserved1, files written by this cooker
+
+constexpr uint32_t fourCC(char a, char b, char c, char d)
+{
+    return uint32_t(uint8_t(a)) | (uint32_t(uint8_t(b)) << 8) | (uint32_t(uint8_t(c)) << 16) | (uint32_t(uint8_t(d)) << 24);
+}
+
+// DDS_PIXELFORMAT and DDS_HEADER as the DirectDraw Surface format defines them
+struct DdsPixelFormat {
+    uint32_t size;
+    uint32_t flags;
+    uint32_t fourCC;
+    uint32_t rgbBitCount;
+    uint32_t rBitMask;
+    uint32_t gBitMask;
+    uint32_t bBitMask;
+    uint32_t aBitMask;
+};
+
+struct DdsHeader {
+    uint32_t size;
+    uint32_t flags;
+    uint32_t height;
+    uint32_t width;
+    uint32_t pitchOrLinearSize;
+    uint32_t depth;
+    uint32_t mipMapCount;
+    uint32_t reserved1[11]; // cache key (2 words), source channels, COOK_MARKER
+    DdsPixelFormat pixelFormat;
+    uint32_t caps;
+    uint32_t caps2;
+    uint32_t caps3;
+    uint32_t caps4;
+    uint32_t reserved2;
+};
+static_assert(sizeof(DdsHeader) == 124);
+
+constexpr uint32_t DDS_MAGIC = fourCC('D', 'D', 'S', ' ');
+constexpr uint32_t DDSD_CAPS = 0x1, DDSD_HEIGHT = 0x2, DDSD_WIDTH = 0x4, DDSD_PIXELFORMAT = 0x1000, DDSD_MIPMAPCOUNT = 0x20000, DDSD_LINEARSIZE = 0x80000;
+constexpr uint32_t DDPF_FOURCC = 0x4;
+constexpr uint32_t DDSCAPS_COMPLEX = 0x8, DDSCAPS_TEXTURE = 0x1000, DDSCAPS_MIPMAP = 0x400000;
+
+uint32_t formatFourCC(BlockFormat format)
+{
+    switch (format) {
+    case BlockFormat::BC1:
+        return fourCC('D', 'X', 'T', '1');
+    case BlockFormat::BC3:
+        return fourCC('D', 'X', 'T', '5');
+    case BlockFormat::BC4:
+        return fourCC('A', 'T', 'I', '1');
+    default:
+        return fourCC('A', 'T', 'I', '2');
+    }
+}
+
+uint64_t hashBytes(uint64_t hash, const void* data, size_t size)
+{
+    constexpr uint64_t prime = 1099511628211ull;
+    for (size_t i = 0; i < size; ++i)
+        hash = (hash ^ static_cast<const unsigned char*>(data)[i]) * prime;
+    return hash;
+}
+
+template <typename T>
+uint64_t hashValue(uint64_t hash, const T& value)
+{
+    return hashBytes(hash, &value, sizeof(value));
+}
+
+// Every level down to 1x1, laid out one after the other
+std::vector<CookedLevel> levelLayout(BlockFormat format, int width, int height)
+{
+    std::vector<CookedLevel> levels;
+    size_t offset = 0;
+    for (;;) {
+        const size_t size = compressedSize(format, width, height);
+        levels.push_back({ width, height, offset, size });
+        offset += size;
+        if (width == 1 && height == 1)
+            return levels;
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+    }
+}
+
+// Grey images stay red only, as the uncompressed GL_RED upload of Texture has them
+BlockFormat roleFormat(TextureRole role, int sourceChannels, bool alphaUsed)
+{
+    switch (role) {
+    case TextureRole::COLOR:
+        return sourceChannels == 1 ? BlockFormat::BC4 : alphaUsed ? BlockFormat::BC3 : BlockFormat::BC1;
+    case TextureRole::SINGLE_CHANNEL:
+        return BlockFormat::BC4;
+    default:
+        return BlockFormat::BC5;
+    }
+}
+
+bool readCache(const std::filesystem::path& cacheFile, uint64_t key, TextureRole role, CookedTexture& texture)
+{
+    std::ifstream stream(cacheFile, std::ios::binary);
+    uint32_t magic = 0;
+    DdsHeader header {};
+    if (!stream.read(reinterpret_cast<char*>(&magic), sizeof(magic)) || !stream.read(reinterpret_cast<char*>(&header), sizeof(header)))
+        return false;
+    if (magic != DDS_MAGIC || header.reserved1[3] != COOK_MARKER || header.reserved1[0] != uint32_t(key) || header.reserved1[1] != uint32_t(key >> 32))
+        return false;
+
+    const std::array formats { BlockFormat::BC1, BlockFormat::BC3, BlockFormat::BC4, BlockFormat::BC5 };
+    const auto format = std::find_if(formats.begin(), formats.end(), [&](BlockFormat candidate) { return formatFourCC(candidate) == header.pixelFormat.fourCC; });
+    if (format == formats.end() || roleFormat(role, static_cast<int>(header.reserved1[2]), *format == BlockFormat::BC3) != *format || header.width == 0 || header.height == 0
+        || header.width > 16384 || header.height > 16384)
+        return false;
+
+    texture.format = *format;
+    texture.sourceChannels = static_cast<int>(header.reserved1[2]);
+    texture.levels = levelLayout(texture.format, static_cast<int>(header.width), static_cast<int>(header.height));
+    if (header.mipMapCount != texture.levels.size())
+        return false;
+    texture.data.resize(texture.levels.back().offset + texture.levels.back().size);
+    if (!stream.read(reinterpret_cast<char*>(texture.data.data()), static_cast<std::streamsize>(texture.data.size())))
+        return false;
+    texture.fromCache = true;
+    return true;
+}
+
+void writeCache(const std::filesystem::path& cacheFile, uint64_t key, const CookedTexture& texture)
+{
+    DdsHeader header {};
+    header.size = sizeof(DdsHeader);
+    header.flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE;
+    header.width = static_cast<uint32_t>(texture.levels[0].width);
+    header.height = static_cast<uint32_t>(texture.levels[0].height);
+    header.pitchOrLinearSize = static_cast<uint32_t>(texture.levels[0].size);
+    header.mipMapCount = static_cast<uint32_t>(texture.levels.size());
+    header.reserved1[0] = uint32_t(key);
+    header.reserved1[1] = uint32_t(key >> 32);
+    header.reserved1[2] = static_cast<uint32_t>(texture.sourceChannels);
+    header.reserved1[3] = COOK_MARKER;
+    header.pixelFormat.size = sizeof(DdsPixelFormat);
+    header.pixelFormat.flags = DDPF_FOURCC;
+    header.pixelFormat.fourCC = formatFourCC(texture.format);
+    header.caps = DDSCAPS_TEXTURE | DDSCAPS_MIPMAP | DDSCAPS_COMPLEX;
+
+    // Written next to the final name and renamed, two workers cooking the same file never see half of it
+    std::error_code error;
+    std::filesystem::create_directories(cacheFile.parent_path(), error);
+    std::filesystem::path temporary = cacheFile;
+    temporary += fmt::format(".{:x}.tmp", std::hash<std::thread::id> {}(std::this_thread::get_id()));
+    {
+        std::ofstream stream(temporary, std::ios::binary);
+        stream.write(reinterpret_cast<const char*>(&DDS_MAGIC), sizeof(DDS_MAGIC));
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        stream.write(reinterpret_cast<const char*>(texture.data.data()), static_cast<std::streamsize>(texture.data.size()));
+        if (!stream)
+            return;
+    }
+    std::filesystem::rename(temporary, cacheFile, error);
+    if (error)
+        std::filesystem::remove(temporary, error);
+}
+}
+
+MipContent roleMipContent(TextureRole role)
+{
+    switch (role) {
+    case TextureRole::COLOR:
+        return MipContent::SRGB_COLOR;
+    case TextureRole::SINGLE_CHANNEL:
+        return MipContent::LINEAR;
+    default:
+        return MipContent::NORMAL;
+    }
+}
+
+MipChain buildMipChain(const uint8_t* pixels, int width, int height, int channels, TextureRole role, bool wrap)
+{
+    MipChain chain;
+    size_t offset = 0;
+    for (;;) {
+        const size_t size = static_cast<size_t>(width) * static_cast<size_t>(height) * static_cast<size_t>(channels);
+        chain.levels.push_back({ width, height, offset, size });
+        offset += size;
+        if (width == 1 && height == 1)
+            break;
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+    }
+
+    chain.data.resize(offset);
+    std::memcpy(chain.data.data(), pixels, chain.levels[0].size);
+    for (size_t i = 1; i < chain.levels.size(); ++i) {
+        // Each level from the one above it, the filter's footprint stays the same few texels
+        const CookedLevel& above = chain.levels[i - 1];
+        const std::vector<uint8_t> level = downsampleMip(chain.data.data() + above.offset, above.width, above.height, channels, roleMipContent(role), wrap);
+        std::memcpy(chain.data.data() + chain.levels[i].offset, level.data(), level.size());
+    }
+    return chain;
+}
+
+CookedTexture cookTexture(const std::filesystem::path& file, TextureRole role, const std::filesystem::path& cacheDirectory, bool wrap)
+{
+    std::error_code error;
+    const uintmax_t fileSize = std::filesystem::file_size(file, error);
+    if (error)
+        throw TextureCookingException("Texture file " + file.string() + " does not exist");
+    const auto modified = std::filesystem::last_write_time(file, error).time_since_epoch().count();
+
+    uint64_t key = 14695981039346656037ull;
+    const std::string path = file.lexically_normal().string();
+    key = hashBytes(key, path.data(), path.size());
+    key = hashValue(key, fileSize);
+    key = hashValue(key, modified);
+    key = hashValue(key, role);
+    key = hashValue(key, wrap);
+    key = hashValue(key, COOK_VERSION);
+    const std::filesystem::path cacheFile = cacheDirectory / fmt::format("{:016x}.dds", key);
+
+    CookedTexture texture;
+    if (readCache(cacheFile, key, role, texture))
+        return texture;
+
+    int width = 0, height = 0;
+    const std::unique_ptr<stbi_uc, decltype(&stbi_image_free)> pixels(
+        stbi_load(file.string().c_str(), &width, &height, &texture.sourceChannels, STBI_rgb_alpha), &stbi_image_free);
+    if (!pixels)
+        throw TextureCookingException("Failed to read texture " + file.string() + ": " + stbi_failure_reason());
+
+    bool alphaUsed = false;
+    if (role == TextureRole::COLOR && (texture.sourceChannels == 2 || texture.sourceChannels == 4)) {
+        for (size_t i = 0; i < static_cast<size_t>(width) * static_cast<size_t>(height) && !alphaUsed; ++i)
+            alphaUsed = pixels.get()[i * 4 + 3] != 255;
+    }
+    texture.format = roleFormat(role, texture.sourceChannels, alphaUsed);
+    texture.levels = levelLayout(texture.format, width, height);
+    texture.data.resize(texture.levels.back().offset + texture.levels.back().size);
+
+    CpuTimer timer;
+    timer.begin();
+    const MipChain mips = buildMipChain(pixels.get(), width, height, 4, role, wrap);
+    texture.mipMs = timer.end();
+    timer.begin();
+    for (size_t i = 0; i < texture.levels.size(); ++i) {
+        const CookedLevel& cooked = texture.levels[i];
+        const std::vector<uint8_t> blocks = compressImage(texture.format, mips.data.data() + mips.levels[i].offset, cooked.width, cooked.height);
+        std::memcpy(texture.data.data() + cooked.offset, blocks.data(), blocks.size());
+    }
+    texture.encodeMs = timer.end();
+
+    const std::vector<uint8_t> decoded = decompressImage(texture.format, texture.data.data(), width, height);
+    texture.psnr = blockPsnr(texture.format, pixels.get(), decoded.data(), width, height);
+
+    writeCache(cacheFile, key, texture);
+    return texture;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "block_compression.h"
+#include "mip_generator.h"
+
+#include <filesystem>
+#include <stdexcept>
+#include <vector>
+
+struct TextureCookingException : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// What a texture holds, which decides the block format it is cooked to
+enum class TextureRole {
+    COLOR, // BC1, BC3 when the alpha channel is used, BC4 for grey images
+    SINGLE_CHANNEL, // BC4 of red: specular, metallic, roughness, ao
+    NORMAL, // BC5 of x and y, the shaders rebuild z
+};
+
+struct CookedLevel {
+    int width;
+    int height;
+    size_t offset;
+    size_t size;
+};
+
+struct CookedTexture {
+    BlockFormat format = BlockFormat::BC1;
+    int sourceChannels = 0; // of the image file, what an uncompressed upload would have used
+    std::vector<CookedLevel> levels; // every mip down to 1x1
+    std::vector<uint8_t> data;
+    bool fromCache = false;
+    // Only when cooked now rather than read from the cache
+    float mipMs = 0.0f;
+    float encodeMs = 0.0f;
+    float psnr = 0.0f; // level 0 against the source
+};
+
+// Level 0 and every mip below it down to 1x1, uncompressed
+struct MipChain {
+    std::vector<CookedLevel> levels;
+    std::vector<uint8_t> data;
+};
+
+MipContent roleMipContent(TextureRole role);
+// Filters the mips with downsampleMip as the role needs: colour in linear light, normals renormalised.
+// wrap for textures sampled with GL_REPEAT, cube faces clamp.
+MipChain buildMipChain(const uint8_t* pixels, int width, int height, int channels, TextureRole role, bool wrap);
+
+// Compresses an image file to the block format of its role with a full mip chain (buildMipChain) and
+// keeps the result as a DDS file in cacheDirectory. The file name is a hash of the source's path, size
+// and modification time, the role and wrap, so an unchanged source is read back from the cache instead.
+CookedTexture cookTexture(const std::filesystem::path& file, TextureRole role, const std::filesystem::path& cacheDirectory, bool wrap = true);
@@ -0,0 +1,733 @@
+#include "texture_loader.h"
+#include "profiler.h"
+
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/format.h>
+#include <stb/stb_image.h>
+DISABLE_WARNINGS_POP()
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+
+// A decoded file with every mip level, block compressed when cooked
+struct TextureLoader::Image {
+    GLenum internalFormat = 0;
+    GLenum format = 0; // 0 for block compressed levels
+    int channels = 0; // of the file
+    size_t blockSize = 0;
+    std::vector<CookedLevel> levels;
+    std::vector<uint8_t> levelData;
+    std::string report; // printed once uploaded, for textures cooked now
+
+    // Uploads go by rows of texels, or of blocks (4 texel rows) when compressed
+    int rowHeight() const { return blockSize ? 4 : 1; }
+    int numRows(const CookedLevel& level) const { return (level.height + rowHeight() - 1) / rowHeight(); }
+    size_t rowSize(const CookedLevel& level) const { return level.size / static_cast<size_t>(numRows(level)); }
+    // What a level takes on the GPU, and would take as an uncompressed upload of the file's channels
+    size_t uncompressedSize(const CookedLevel& level) const { return static_cast<size_t>(level.width) * static_cast<size_t>(level.height) * static_cast<size_t>(channels); }
+    size_t gpuSize(const CookedLevel& level) const { return blockSize ? level.size : uncompressedSize(level); }
+};
+
+struct TextureLoader::Request {
+    abstractTexture* target;
+    GLenum bindTarget; // GL_TEXTURE_2D, GL_TEXTURE_CUBE_MAP or GL_TEXTURE_2D_ARRAY
+    std::vector<std::filesystem::path> files;
+    TextureRole role;
+    std::filesystem::path cacheDirectory; // empty: upload uncompressed
+    bool streamed = false;
+    std::atomic<bool> cancelled { false };
+
+    // Written by the worker before the request is handed back
+    std::vector<Image> images;
+    std::string error;
+
+    // Upload progress on the GL thread
+    GLuint texture = 0;
+    size_t image = 0;
+    size_t level = 0;
+    int row = 0;
+};
+
+// A streamed texture once loaded, an image per layer for an array. Every level stays in memory, the GPU has
+// levels residentLevel and coarser.
+struct TextureLoader::Streamed {
+    abstractTexture* target;
+    GLenum bindTarget; // GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY
+    std::string name;
+    std::vector<Image> images;
+    size_t startLevel; // uploaded with the load and never evicted
+    size_t residentLevel; // GL_TEXTURE_BASE_LEVEL
+    size_t wantedLevel; // finest level its draws asked for, when it was last drawn
+    size_t requestedLevel; // by the draws since the last step
+    uint64_t lastUsedFrame = 0;
+    float minLod; // GL_TEXTURE_MIN_LOD, eases down to residentLevel after a level arrives so it does not pop in
+    bool uploading = false; // level residentLevel - 1, clamped away by the base level until done
+    size_t layer = 0; // of the level in flight
+    int row = 0;
+    size_t fullBytes = 0; // with every level resident
+
+    // The layers share their level sizes
+    const CookedLevel& level(size_t index) const { return images[0].levels[index]; }
+    size_t levelCount() const { return images[0].levels.size(); }
+    // Of a level in every layer
+    size_t gpuSize(size_t level) const
+    {
+        size_t size = 0;
+        for (const Image& image : images)
+            size += image.gpuSize(image.levels[level]);
+        return size;
+    }
+    size_t uncompressedSize(size_t level) const
+    {
+        size_t size = 0;
+        for (const Image& image : images)
+            size += image.uncompressedSize(image.levels[level]);
+        return size;
+    }
+};
+
+namespace {
+// Streamed textures start with the levels no larger than this
+constexpr int STREAM_START_SIZE = 64;
+// Levels of GL_TEXTURE_MIN_LOD a new level fades in by per step
+constexpr float STREAM_LOD_FADE = 0.25f;
+
+GLenum channelFormat(int channels)
+{
+    switch (channels) {
+    case 1:
+        return GL_RED;
+    case 2:
+        return GL_RG;
+    case 3:
+        return GL_RGB;
+    default:
+        return GL_RGBA;
+    }
+}
+}
+
+TextureLoader::TextureLoader(int numThreads)
+{
+    if (numThreads <= 0)
+        numThreads = static_cast<int>(std::max(2u, std::thread::hardware_concurrency()) - 1);
+    for (int thread = 0; thread < numThreads; ++thread)
+        m_workers.emplace_back(&TextureLoader::decodeRequests, this);
+}
+
+TextureLoader::~TextureLoader()
+{
+    {
+        std::lock_guard lock(m_mutex);
+        m_stopping = true;
+    }
+    m_decodeAvailable.notify_all();
+    for (std::thread& worker : m_workers)
+        worker.join();
+
+    for (const std::shared_ptr<Request>& request : m_requests) {
+        if (request->texture)
+            glDeleteTextures(1, &request->texture);
+    }
+    for (PixelBuffer& pixelBuffer : m_pixelBuffers) {
+        if (pixelBuffer.fence)
+            glDeleteSync(pixelBuffer.fence);
+        if (pixelBuffer.buffer)
+            glDeleteBuffers(1, &pixelBuffer.buffer);
+    }
+}
+
+void TextureLoader::setCompression(bool enabled, std::filesystem::path cacheDirectory)
+{
+    m_compression = enabled;
+    m_cacheDirectory = std::move(cacheDirectory);
+
+    // RGTC (BC4, BC5) is core, S3TC (BC1, BC3) comes with an extension
+    m_s3tcSupported = false;
+    GLint numExtensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+    for (GLint i = 0; i < numExtensions; ++i) {
+        if (std::strcmp(reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, static_cast<GLuint>(i))), "GL_EXT_texture_compression_s3tc") == 0)
+            m_s3tcSupported = true;
+    }
+}
+
+void TextureLoader::load(abstractTexture& target, std::filesystem::path file, TextureRole role)
+{
+    enqueue(target, GL_TEXTURE_2D, { std::move(file) }, role, false);
+}
+
+void TextureLoader::loadStreamed(abstractTexture& target, std::filesystem::path file, TextureRole role)
+{
+    enqueue(target, GL_TEXTURE_2D, { std::move(file) }, role, true);
+}
+
+void TextureLoader::loadCube(abstractTexture& target, std::vector<std::filesystem::path> faces)
+{
+    enqueue(target, GL_TEXTURE_CUBE_MAP, std::move(faces), TextureRole::COLOR, false);
+}
+
+void TextureLoader::loadArray(abstractTexture& target, std::vector<std::filesystem::path> layers, TextureRole role)
+{
+    enqueue(target, GL_TEXTURE_2D_ARRAY, std::move(layers), role, false);
+}
+
+void TextureLoader::loadArrayStreamed(abstractTexture& target, std::vector<std::filesystem::path> layers, TextureRole role)
+{
+    enqueue(target, GL_TEXTURE_2D_ARRAY, std::move(layers), role, true);
+}
+
+void TextureLoader::enqueue(abstractTexture& target, GLenum bindTarget, std::vector<std::filesystem::path> files, TextureRole role, bool streamed)
+{
+    if (m_requests.empty()) {
+        m_firstRequest = std::chrono::steady_clock::now();
+        m_stats.residentMs = -1.0f;
+    }
+    cancel(target);
+
+    auto request = std::make_shared<Request>();
+    request->target = &target;
+    request->bindTarget = bindTarget;
+    request->files = std::move(files);
+    request->role = role;
+    request->streamed = streamed;
+    if (m_compression && (role != TextureRole::COLOR || m_s3tcSupported))
+        request->cacheDirectory = m_cacheDirectory;
+    m_requests.push_back(request);
+    ++m_stats.requested;
+    {
+        std::lock_guard lock(m_mutex);
+        m_decodeQueue.push_back(std::move(request));
+    }
+    m_decodeAvailable.notify_one();
+}
+
+void TextureLoader::cancel(const abstractTexture& target)
+{
+    // The target keeps the levels it has, a streamed texture just stops streaming and counting against the budget
+    // and the loaded texture memory
+    const auto streamed = m_streamed.find(&target);
+    if (streamed != m_streamed.end()) {
+        const Streamed& texture = *streamed->second;
+        for (size_t level = texture.uploading ? texture.residentLevel - 1 : texture.residentLevel; level < texture.levelCount(); ++level)
+            m_streamingStats.residentBytes -= texture.gpuSize(level);
+        m_streamingStats.fullBytes -= texture.fullBytes;
+        for (size_t level = texture.residentLevel; level < texture.levelCount(); ++level) {
+            m_stats.textureBytes -= texture.gpuSize(level);
+            m_stats.uncompressedTextureBytes -= texture.uncompressedSize(level);
+        }
+        // Layers of an array that are in already for the level in flight
+        for (size_t layer = 0; texture.uploading && layer < texture.layer; ++layer) {
+            const Image& image = texture.images[layer];
+            m_stats.textureBytes -= image.gpuSize(image.levels[texture.residentLevel - 1]);
+            m_stats.uncompressedTextureBytes -= image.uncompressedSize(image.levels[texture.residentLevel - 1]);
+        }
+        m_streamed.erase(streamed);
+        m_streamingStats.textures = static_cast<int>(m_streamed.size());
+    }
+
+    // Ones still with the workers are flagged and dropped when they come back
+    for (const std::shared_ptr<Request>& request : m_requests) {
+        if (request->target == &target)
+            request->cancelled = true;
+    }
+    for (auto it = m_uploads.begin(); it != m_uploads.end();) {
+        if ((*it)->cancelled) {
+            drop(*it);
+            it = m_uploads.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void TextureLoader::decodeRequests()
+{
+    // Only affects this thread, whatever the application sets for its own loads
+    stbi_set_flip_vertically_on_load_thread(0);
+    for (;;) {
+        std::shared_ptr<Request> request;
+        {
+            std::unique_lock lock(m_mutex);
+            m_decodeAvailable.wait(lock, [this]() { return m_stopping || !m_decodeQueue.empty(); });
+            if (m_stopping)
+                return;
+            request = std::move(m_decodeQueue.front());
+            m_decodeQueue.pop_front();
+        }
+
+        CpuTimer timer;
+        timer.begin();
+        float encodeMs = 0.0f;
+        int cacheHits = 0;
+        for (const std::filesystem::path& file : request->files) {
+            if (request->cancelled || !request->error.empty())
+                break;
+            Image& image = request->images.emplace_back();
+            if (!request->cacheDirectory.empty()) {
+                try {
+                    CookedTexture cooked = cookTexture(file, request->role, request->cacheDirectory, request->bindTarget != GL_TEXTURE_CUBE_MAP);
+                    image.internalFormat = blockInternalFormat(cooked.format);
+                    image.channels = cooked.sourceChannels;
+                    image.blockSize = blockBytes(cooked.format);
+                    image.levels = std::move(cooked.levels);
+                    image.levelData = std::move(cooked.data);
+                    if (cooked.fromCache) {
+                        ++cacheHits;
+                    } else {
+                        const CookedLevel& top = image.levels[0];
+                        const double megaTexels = double(top.width) * top.height * 4.0 / 3.0 / 1e6;
+                        image.report = fmt::format("Cooked {}: {} {}x{}, {:.1f} -> {:.1f} MB with mips, mips {:.0f} ms, encoding {:.0f} ms ({:.1f} MTexel/s), PSNR {:.1f} dB",
+                            file.filename().string(), blockFormatName(cooked.format), top.width, top.height,
+                            megaTexels * 1e6 * cooked.sourceChannels / (1024.0 * 1024.0), double(image.levelData.size()) / (1024.0 * 1024.0), cooked.mipMs,
+                            cooked.encodeMs, megaTexels / double(std::max(cooked.encodeMs, 1e-3f)) * 1000.0, cooked.psnr);
+                        encodeMs += cooked.mipMs + cooked.encodeMs;
+                    }
+                } catch (const std::exception& e) {
+                    request->error = e.what();
+                }
+                continue;
+            }
+            int width = 0, height = 0;
+            const std::unique_ptr<stbi_uc, decltype(&stbi_image_free)> pixels(
+                stbi_load(file.string().c_str(), &width, &height, &image.channels, STBI_default), &stbi_image_free);
+            if (!pixels) {
+                request->error = "Failed to read texture " + file.string() + ": " + stbi_failure_reason();
+                continue;
+            }
+            image.internalFormat = image.format = channelFormat(image.channels);
+            // Mips made here rather than by glGenerateMipmap, filtered as the role needs
+            MipChain mips = buildMipChain(pixels.get(), width, height, image.channels, request->role, request->bindTarget != GL_TEXTURE_CUBE_MAP);
+            image.levels = std::move(mips.levels);
+            image.levelData = std::move(mips.data);
+        }
+        // Every layer of an array has the storage of the first
+        if (request->bindTarget == GL_TEXTURE_2D_ARRAY && request->error.empty() && !request->cancelled) {
+            const Image& first = request->images[0];
+            for (size_t layer = 1; layer < request->images.size(); ++layer) {
+                const Image& image = request->images[layer];
+                if (image.internalFormat != first.internalFormat || image.levels[0].width != first.levels[0].width || image.levels[0].height != first.levels[0].height) {
+                    request->error = fmt::format("Texture array layers differ: {} is {}x{} in format 0x{:x}, {} is {}x{} in format 0x{:x}", request->files[0].filename().string(),
+                        first.levels[0].width, first.levels[0].height, first.internalFormat, request->files[layer].filename().string(), image.levels[0].width,
+                        image.levels[0].height, image.internalFormat);
+                    break;
+                }
+            }
+        }
+        const float decodeMs = timer.end();
+
+        {
+            std::lock_guard lock(m_mutex);
+            m_decoded.push_back(std::move(request));
+            m_decodeMs += decodeMs;
+            m_encodeMs += encodeMs;
+            m_cacheHits += cacheHits;
+        }
+        m_decodeFinished.notify_all();
+    }
+}
+
+TextureLoader::PixelBuffer* TextureLoader::acquirePixelBuffer()
+{
+    PixelBuffer& pixelBuffer = m_pixelBuffers[m_nextPixelBuffer];
+    if (pixelBuffer.fence) {
+        // Flushing makes sure the fence gets submitted, finish() has no buffer swap doing that between polls
+        if (glClientWaitSync(pixelBuffer.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+            return nullptr;
+        glDeleteSync(pixelBuffer.fence);
+        pixelBuffer.fence = nullptr;
+    }
+    if (!pixelBuffer.buffer)
+        glGenBuffers(1, &pixelBuffer.buffer);
+    m_nextPixelBuffer = (m_nextPixelBuffer + 1) % PIXEL_BUFFER_COUNT;
+    return &pixelBuffer;
+}
+
+/**
+ * Uploads the next band of rows of one level through one pixel buffer, false when none is free. The level
+ * is allocated with its first rows, for every layer at once with those of the first layer of an array.
+ */
+bool TextureLoader::uploadLevelRows(GLenum bindTarget, GLenum imageTarget, GLuint texture, const Image& image, size_t levelIndex, int& row, int layer, int layerCount)
+{
+    PixelBuffer* pixelBuffer = acquirePixelBuffer();
+    if (!pixelBuffer)
+        return false;
+
+    const CookedLevel& level = image.levels[levelIndex];
+    const GLint mip = static_cast<GLint>(levelIndex);
+    if (row == 0) {
+        // Allocated before the pixel buffer is bound, which would otherwise be read from. Compressed
+        // internal formats are allocated through glTexImage2D too, format and type do not matter then.
+        glBindTexture(bindTarget, texture);
+        if (imageTarget != GL_TEXTURE_2D_ARRAY)
+            glTexImage2D(imageTarget, mip, static_cast<GLint>(image.internalFormat), level.width, level.height, 0, image.format ? image.format : GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        else if (layer == 0)
+            glTexImage3D(imageTarget, mip, static_cast<GLint>(image.internalFormat), level.width, level.height, layerCount, 0, image.format ? image.format : GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    }
+
+    const size_t rowSize = image.rowSize(level);
+    const int rows = std::clamp(static_cast<int>(PIXEL_BUFFER_SIZE / rowSize), 1, image.numRows(level) - row);
+    const size_t size = rowSize * static_cast<size_t>(rows);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer->buffer);
+    if (size > pixelBuffer->size) {
+        pixelBuffer->size = std::max(size, PIXEL_BUFFER_SIZE);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(pixelBuffer->size), nullptr, GL_STREAM_DRAW);
+    }
+    // The fence has passed, invalidating lets the driver skip keeping the old contents
+    void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, static_cast<GLsizeiptr>(size), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (!mapped) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return false;
+    }
+    std::memcpy(mapped, image.levelData.data() + level.offset + rowSize * static_cast<size_t>(row), size);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    glBindTexture(bindTarget, texture);
+    const int y = row * image.rowHeight();
+    const int height = std::min(rows * image.rowHeight(), level.height - y);
+    if (imageTarget == GL_TEXTURE_2D_ARRAY && image.blockSize)
+        glCompressedTexSubImage3D(imageTarget, mip, 0, y, layer, level.width, height, 1, image.internalFormat, static_cast<GLsizei>(size), nullptr);
+    else if (imageTarget == GL_TEXTURE_2D_ARRAY)
+        glTexSubImage3D(imageTarget, mip, 0, y, layer, level.width, height, 1, image.format, GL_UNSIGNED_BYTE, nullptr);
+    else if (image.blockSize)
+        glCompressedTexSubImage2D(imageTarget, mip, 0, y, level.width, height, image.internalFormat, static_cast<GLsizei>(size), nullptr);
+    else
+        glTexSubImage2D(imageTarget, mip, 0, y, level.width, height, image.format, GL_UNSIGNED_BYTE, nullptr);
+    pixelBuffer->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    m_stats.uploadedBytes += size;
+    row += rows;
+    if (row == image.numRows(level)) {
+        m_stats.textureBytes += image.gpuSize(level);
+        m_stats.uncompressedTextureBytes += image.uncompressedSize(level);
+    }
+    return true;
+}
+
+/**
+ * Uploads the next band of rows of a request, false when no pixel buffer is free.
+ */
+bool TextureLoader::uploadRows(Request& request)
+{
+    const GLenum imageTarget = request.bindTarget == GL_TEXTURE_CUBE_MAP ? GLenum(GL_TEXTURE_CUBE_MAP_POSITIVE_X + request.image) : request.bindTarget;
+    if (!request.texture) {
+        glGenTextures(1, &request.texture);
+        glBindTexture(request.bindTarget, request.texture);
+        // Same parameters as the Texture and cubeMapTex constructors, but cube faces come with mips too
+        if (request.bindTarget == GL_TEXTURE_CUBE_MAP) {
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        } else {
+            glTexParameteri(request.bindTarget, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(request.bindTarget, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            glTexParameteri(request.bindTarget, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(request.bindTarget, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        }
+        // Streamed textures go up from their start level, the finer ones follow once drawn
+        if (request.streamed)
+            request.level = streamStartLevel(request.images[0]);
+    }
+
+    Image& image = request.images[request.image];
+    if (!uploadLevelRows(request.bindTarget, imageTarget, request.texture, image, request.level, request.row, static_cast<int>(request.image), static_cast<int>(request.images.size())))
+        return false;
+    if (request.row < image.numRows(image.levels[request.level]))
+        return true;
+
+    request.row = 0;
+    if (++request.level < image.levels.size())
+        return true;
+    // Every layer of a streamed array starts at the same level
+    request.level = request.streamed ? streamStartLevel(image) : 0;
+    if (!image.report.empty())
+        std::cout << image.report << std::endl;
+    // Streamed textures keep theirs for the levels to come
+    if (!request.streamed)
+        image.levelData = {};
+    ++request.image;
+    return true;
+}
+
+void TextureLoader::complete(const std::shared_ptr<Request>& request)
+{
+    glBindTexture(request->bindTarget, request->texture);
+    glTexParameteri(request->bindTarget, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(request->images[0].levels.size() - 1));
+    if (request->streamed) {
+        auto streamed = std::make_unique<Streamed>();
+        streamed->target = request->target;
+        streamed->bindTarget = request->bindTarget;
+        streamed->name = request->files[0].filename().string();
+        if (request->files.size() > 1)
+            streamed->name += fmt::format(" (array of {})", request->files.size());
+        streamed->images = std::move(request->images);
+        streamed->startLevel = streamed->residentLevel = streamed->wantedLevel = streamed->requestedLevel = streamStartLevel(streamed->images[0]);
+        streamed->lastUsedFrame = m_frame;
+        streamed->minLod = static_cast<float>(streamed->startLevel);
+        glTexParameteri(request->bindTarget, GL_TEXTURE_BASE_LEVEL, static_cast<GLint>(streamed->startLevel));
+        glTexParameterf(request->bindTarget, GL_TEXTURE_MIN_LOD, streamed->minLod);
+
+        for (size_t level = 0; level < streamed->levelCount(); ++level)
+            streamed->fullBytes += streamed->gpuSize(level);
+        for (size_t level = streamed->startLevel; level < streamed->levelCount(); ++level)
+            m_streamingStats.residentBytes += streamed->gpuSize(level);
+        m_streamingStats.fullBytes += streamed->fullBytes;
+        m_streamed[request->target] = std::move(streamed);
+        m_streamingStats.textures = static_cast<int>(m_streamed.size());
+    }
+    glBindTexture(request->bindTarget, 0);
+
+    // The target's old texture (placeholder or previous image) goes, the new one takes its place
+    GLuint& texture = request->target->getTextureRef();
+    std::swap(texture, request->texture);
+    if (glIsTexture(request->texture))
+        glDeleteTextures(1, &request->texture);
+    request->texture = 0;
+
+    ++m_stats.completed;
+    m_requests.erase(std::find(m_requests.begin(), m_requests.end(), request));
+}
+
+void TextureLoader::drop(const std::shared_ptr<Request>& request)
+{
+    if (request->texture)
+        glDeleteTextures(1, &request->texture);
+    request->texture = 0;
+    m_requests.erase(std::find(m_requests.begin(), m_requests.end(), request));
+}
+
+bool TextureLoader::step(float budgetMs)
+{
+    CpuTimer timer;
+    timer.begin();
+    {
+        std::lock_guard lock(m_mutex);
+        for (std::shared_ptr<Request>& request : m_decoded)
+            m_uploads.push_back(std::move(request));
+        m_decoded.clear();
+        m_stats.decodeMs = m_decodeMs;
+        m_stats.encodeMs = m_encodeMs;
+        m_stats.cacheHits = m_cacheHits;
+    }
+
+    GLint unpackAlignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    // Levels for the draws of the last frame first, before loads that show placeholders until complete anyway
+    stepStreaming(timer, budgetMs);
+    while (!m_uploads.empty() && timer.end() < budgetMs) {
+        const std::shared_ptr<Request> request = m_uploads.front();
+        if (request->cancelled || !request->error.empty()) {
+            if (!request->cancelled) {
+                std::cerr << request->error << std::endl;
+                ++m_stats.failed;
+            }
+            drop(request);
+            m_uploads.pop_front();
+            continue;
+        }
+        if (!uploadRows(*request))
+            break;
+        if (request->image == request->images.size()) {
+            complete(request);
+            m_uploads.pop_front();
+        }
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+
+    m_stats.lastStepMs = timer.end();
+    m_stats.maxStepMs = std::max(m_stats.maxStepMs, m_stats.lastStepMs);
+    if (m_requests.empty() && m_stats.requested > 0 && m_stats.residentMs < 0.0f)
+        m_stats.residentMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - m_firstRequest).count();
+    return busy();
+}
+
+size_t TextureLoader::streamStartLevel(const Image& image)
+{
+    size_t level = 0;
+    while (level + 1 < image.levels.size() && std::max(image.levels[level].width, image.levels[level].height) > STREAM_START_SIZE)
+        ++level;
+    return level;
+}
+
+void TextureLoader::setStreamingBudget(size_t bytes)
+{
+    m_streamingStats.budgetBytes = bytes;
+}
+
+void TextureLoader::requestDetail(const abstractTexture& target, float screenPixels)
+{
+    const auto streamed = m_streamed.find(&target);
+    if (streamed == m_streamed.end() || !(screenPixels > 0.0f))
+        return;
+    // The level the GPU picks where a texel covers about a pixel, trilinear filtering blends in the next coarser one
+    Streamed& texture = *streamed->second;
+    const float texelsPerPixel = static_cast<float>(texture.level(0).width) / screenPixels;
+    const size_t level = texelsPerPixel <= 1.0f ? 0 : static_cast<size_t>(std::floor(std::log2(texelsPerPixel)));
+    texture.requestedLevel = std::min({ texture.requestedLevel, level, texture.startLevel });
+    texture.lastUsedFrame = m_frame;
+}
+
+/**
+ * Frees the finest resident level of a streamed texture (in every layer of an array), the base level moves up
+ * to the next one first.
+ */
+void TextureLoader::evictLevel(Streamed& texture)
+{
+    const size_t level = texture.residentLevel;
+    const Image& image = texture.images[0];
+    glBindTexture(texture.bindTarget, texture.target->getTextureRef());
+    ++texture.residentLevel;
+    texture.minLod = std::max(texture.minLod, static_cast<float>(texture.residentLevel));
+    glTexParameteri(texture.bindTarget, GL_TEXTURE_BASE_LEVEL, static_cast<GLint>(texture.residentLevel));
+    glTexParameterf(texture.bindTarget, GL_TEXTURE_MIN_LOD, texture.minLod);
+    // An empty image releases the level's storage
+    const GLenum format = image.format ? image.format : GL_RGBA;
+    if (texture.bindTarget == GL_TEXTURE_2D_ARRAY)
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, static_cast<GLint>(level), static_cast<GLint>(image.internalFormat), 0, 0, 0, 0, format, GL_UNSIGNED_BYTE, nullptr);
+    else
+        glTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(level), static_cast<GLint>(image.internalFormat), 0, 0, 0, format, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(texture.bindTarget, 0);
+
+    m_streamingStats.residentBytes -= texture.gpuSize(level);
+    m_stats.textureBytes -= texture.gpuSize(level);
+    m_stats.uncompressedTextureBytes -= texture.uncompressedSize(level);
+    ++m_streamingStats.levelsEvicted;
+}
+
+/**
+ * Evicts levels until bytes more fit in the budget. Levels finer than their texture's draws want go first,
+ * then whole levels of the textures drawn least recently, as long as that was before usedFrame.
+ */
+bool TextureLoader::makeRoom(size_t bytes, uint64_t usedFrame, const Streamed* requester)
+{
+    while (m_streamingStats.residentBytes + bytes > m_streamingStats.budgetBytes) {
+        Streamed* victim = nullptr;
+        bool victimUnwanted = false;
+        for (const auto& [target, candidate] : m_streamed) {
+            if (candidate.get() == requester || candidate->uploading || candidate->residentLevel >= candidate->startLevel)
+                continue;
+            const bool unwanted = candidate->residentLevel < candidate->wantedLevel;
+            if (!unwanted && candidate->lastUsedFrame >= usedFrame)
+                continue;
+            if (!victim || (unwanted && !victimUnwanted) || (unwanted == victimUnwanted && candidate->lastUsedFrame < victim->lastUsedFrame)) {
+                victim = candidate.get();
+                victimUnwanted = unwanted;
+            }
+        }
+        if (!victim)
+            return false;
+        evictLevel(*victim);
+    }
+    return true;
+}
+
+/**
+ * Takes in the detail the draws of the last frame asked for, evicts down to the budget and uploads the next
+ * finer levels of the textures furthest from what their draws asked for, making room as needed.
+ */
+void TextureLoader::stepStreaming(CpuTimer& timer, float budgetMs)
+{
+    ++m_frame;
+    std::vector<Streamed*> candidates;
+    int belowWanted = 0;
+    for (const auto& [target, streamed] : m_streamed) {
+        Streamed& texture = *streamed;
+        if (texture.lastUsedFrame + 1 == m_frame)
+            texture.wantedLevel = texture.requestedLevel;
+        texture.requestedLevel = texture.startLevel;
+
+        // A level that came in eases in over a few frames
+        if (texture.minLod > static_cast<float>(texture.residentLevel)) {
+            texture.minLod = std::max(static_cast<float>(texture.residentLevel), texture.minLod - STREAM_LOD_FADE);
+            glBindTexture(texture.bindTarget, texture.target->getTextureRef());
+            glTexParameterf(texture.bindTarget, GL_TEXTURE_MIN_LOD, texture.minLod);
+        }
+
+        if (texture.wantedLevel < texture.residentLevel)
+            ++belowWanted;
+        // Only for textures still drawn, but a level already in flight is finished regardless
+        if (texture.uploading || (texture.wantedLevel < texture.residentLevel && texture.lastUsedFrame + 1 == m_frame))
+            candidates.push_back(&texture);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    m_streamingStats.belowWanted = belowWanted;
+
+    // A lowered budget, or draws that want less now: what is not needed for the last frame's draws goes
+    makeRoom(0, m_frame - 1, nullptr);
+
+    // The one in flight first, then the ones missing the most levels, most recently drawn among those
+    const auto priority = [](const Streamed* texture) { return std::make_tuple(texture->uploading, texture->uploading ? 0 : texture->residentLevel - texture->wantedLevel, texture->lastUsedFrame); };
+    std::sort(candidates.begin(), candidates.end(), [&](const Streamed* a, const Streamed* b) { return priority(a) > priority(b); });
+    for (Streamed* candidate : candidates) {
+        Streamed& texture = *candidate;
+        while (texture.residentLevel > texture.wantedLevel || texture.uploading) {
+            if (timer.end() >= budgetMs)
+                return;
+            const size_t levelIndex = texture.residentLevel - 1;
+            if (!texture.uploading) {
+                // One that does not fit leaves the room to smaller ones after it
+                const size_t size = texture.gpuSize(levelIndex);
+                if (!makeRoom(size, texture.lastUsedFrame, &texture))
+                    break;
+                texture.uploading = true;
+                texture.layer = 0;
+                texture.row = 0;
+                m_streamingStats.residentBytes += size;
+            }
+            const Image& image = texture.images[texture.layer];
+            if (!uploadLevelRows(texture.bindTarget, texture.bindTarget, texture.target->getTextureRef(), image, levelIndex, texture.row,
+                    static_cast<int>(texture.layer), static_cast<int>(texture.images.size())))
+                return;
+            if (texture.row < image.numRows(image.levels[levelIndex]))
+                continue;
+            // The same level of the next layer of an array
+            if (++texture.layer < texture.images.size()) {
+                texture.row = 0;
+                continue;
+            }
+
+            // In: sampled from now on, faded in through the minimum LOD
+            texture.uploading = false;
+            texture.residentLevel = levelIndex;
+            glBindTexture(texture.bindTarget, texture.target->getTextureRef());
+            glTexParameteri(texture.bindTarget, GL_TEXTURE_BASE_LEVEL, static_cast<GLint>(levelIndex));
+            glTexParameterf(texture.bindTarget, GL_TEXTURE_MIN_LOD, texture.minLod);
+            glBindTexture(texture.bindTarget, 0);
+            ++m_streamingStats.levelsUploaded;
+        }
+    }
+}
+
+std::vector<TextureResidency> TextureLoader::residency() const
+{
+    std::vector<TextureResidency> textures;
+    for (const auto& [target, streamed] : m_streamed) {
+        const CookedLevel& resident = streamed->level(streamed->residentLevel);
+        const CookedLevel& wanted = streamed->level(streamed->wantedLevel);
+        size_t residentBytes = 0;
+        for (size_t level = streamed->residentLevel; level < streamed->levelCount(); ++level)
+            residentBytes += streamed->gpuSize(level);
+        textures.push_back({ streamed->name, resident.width, resident.height, wanted.width, wanted.height, residentBytes, m_frame - streamed->lastUsedFrame });
+    }
+    std::sort(textures.begin(), textures.end(), [](const TextureResidency& a, const TextureResidency& b) { return a.name < b.name; });
+    return textures;
+}
+
+void TextureLoader::finish()
+{
+    while (step(std::numeric_limits<float>::max())) {
+        // Nothing decoded to upload yet, or every pixel buffer still in use by the GPU
+        std::unique_lock lock(m_mutex);
+        m_decodeFinished.wait_for(lock, std::chrono::milliseconds(1), [this]() { return !m_decoded.empty(); });
+    }
+}
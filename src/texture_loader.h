@@ -0,0 +1,171 @@
+#pragma once
+
+#include "Textures/absTexture.h"
+#include "texture_cooker.h"
+
+#include <framework/opengl_includes.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class CpuTimer;
+
+struct TextureLoaderStats {
+    int requested = 0;
+    int completed = 0;
+    int failed = 0;
+    size_t uploadedBytes = 0;
+    // GPU memory of every texture loaded, and what it would be without block compression
+    size_t textureBytes = 0;
+    size_t uncompressedTextureBytes = 0;
+    int cacheHits = 0; // images read from the cooked texture cache
+    float decodeMs = 0.0f; // summed over the worker threads, mips and cooking included
+    float encodeMs = 0.0f; // mips and block compression of the images cooked now
+    float lastStepMs = 0.0f; // GL thread time of the last step()
+    float maxStepMs = 0.0f;
+    float residentMs = -1.0f; // from the first request after being idle until nothing was left to load, -1 while loading
+};
+
+struct TextureStreamingStats {
+    int textures = 0;
+    int belowWanted = 0; // textures with fewer levels resident than their draws asked for
+    int levelsUploaded = 0;
+    int levelsEvicted = 0;
+    // GPU memory of the streamed textures' resident levels (and the one in flight), and with every level in
+    size_t residentBytes = 0;
+    size_t fullBytes = 0;
+    size_t budgetBytes = 0;
+};
+
+// One streamed texture, for listing which levels are in
+struct TextureResidency {
+    std::string name;
+    int residentWidth, residentHeight; // of the finest level on the GPU
+    int wantedWidth, wantedHeight; // of the finest level its draws asked for
+    size_t residentBytes;
+    uint64_t framesSinceUse;
+};
+
+// Loads 2D textures and cube maps from image files without stalling the render loop.
+//
+// load() hands the files to a pool of worker threads that decode them with stb_image and filter their mips
+// (buildMipChain). The GL thread calls step() once per frame, which copies decoded rows into a ring of pixel
+// buffer objects and uploads them level by level with glTexSubImage2D into a new texture until the frame's
+// time budget is used. The target keeps what it shows now (a placeholder, or the previous image) and takes
+// over the new texture once every level is in, so nothing ever samples a half uploaded image. A buffer of
+// the ring is only written again once the fence behind its last upload has passed.
+//
+// With compression on, the workers cook the files (texture_cooker.h) instead of only decoding them, and
+// the blocks of every level go up through the same ring.
+//
+// Streamed textures (loadStreamed) complete with only their levels of up to 64x64 and keep every level in
+// system memory. Draws report how large the texture is on screen with requestDetail(), and step() uploads
+// the next finer level of the texture furthest below what its draws asked for, clamping the others away
+// through GL_TEXTURE_BASE_LEVEL and GL_TEXTURE_MIN_LOD until they are in. When the levels would not fit
+// in the streaming budget, levels finer than asked for go first and then those of the textures drawn
+// least recently; an evicted level is simply uploaded again from memory when wanted. A streamed array
+// (loadArrayStreamed) shares its levels between the layers, so it streams as one texture at the detail of
+// the layer drawn largest.
+class TextureLoader {
+public:
+    // numThreads 0 uses one per core but the GL thread's
+    explicit TextureLoader(int numThreads = 0);
+    TextureLoader(const TextureLoader&) = delete;
+    ~TextureLoader();
+
+    TextureLoader& operator=(const TextureLoader&) = delete;
+
+    // Applies to loads requested afterwards. Without GL_EXT_texture_compression_s3tc colour textures stay uncompressed.
+    void setCompression(bool enabled, std::filesystem::path cacheDirectory);
+
+    // The target has to stay where it is until its load completes or is cancelled.
+    void load(abstractTexture& target, std::filesystem::path file, TextureRole role = TextureRole::COLOR);
+    // Starts with the coarse levels and streams the finer ones in as requestDetail() asks for them
+    void loadStreamed(abstractTexture& target, std::filesystem::path file, TextureRole role = TextureRole::COLOR);
+    // Faces in GL order (+X, -X, +Y, -Y, +Z, -Z)
+    void loadCube(abstractTexture& target, std::vector<std::filesystem::path> faces);
+    // A GL_TEXTURE_2D_ARRAY with a layer per file, which all have to come out the same size and format
+    void loadArray(abstractTexture& target, std::vector<std::filesystem::path> layers, TextureRole role = TextureRole::COLOR);
+    // Streams an array like loadStreamed does a texture, requestDetail() for each layer drawn
+    void loadArrayStreamed(abstractTexture& target, std::vector<std::filesystem::path> layers, TextureRole role = TextureRole::COLOR);
+    // Drops the loads into target; a later load into the same target replaces an earlier one anyway.
+    void cancel(const abstractTexture& target);
+
+    // For a draw sampling target (if streamed) across about screenPixels pixels horizontally, its texture width
+    void requestDetail(const abstractTexture& target, float screenPixels);
+    // GPU memory the streamed textures' levels may take, apart from the start levels which always stay
+    void setStreamingBudget(size_t bytes);
+
+    // Uploads for up to budgetMs of CPU time (the GPU copies run behind it),
+    // returns whether anything is still loading.
+    bool step(float budgetMs);
+    // Blocks until everything requested is in, like loading synchronously would.
+    void finish();
+
+    bool busy() const { return !m_requests.empty(); }
+    const TextureLoaderStats& stats() const { return m_stats; }
+    const TextureStreamingStats& streamingStats() const { return m_streamingStats; }
+    std::vector<TextureResidency> residency() const;
+
+private:
+    struct Image;
+    struct Request;
+    struct Streamed;
+    struct PixelBuffer {
+        GLuint buffer = 0;
+        size_t size = 0;
+        GLsync fence = nullptr;
+    };
+
+    static constexpr size_t PIXEL_BUFFER_COUNT = 4;
+    static constexpr size_t PIXEL_BUFFER_SIZE = 2 << 20;
+
+    void enqueue(abstractTexture& target, GLenum bindTarget, std::vector<std::filesystem::path> files, TextureRole role, bool streamed);
+    void decodeRequests();
+    PixelBuffer* acquirePixelBuffer();
+    bool uploadLevelRows(GLenum bindTarget, GLenum imageTarget, GLuint texture, const Image& image, size_t levelIndex, int& row, int layer = 0, int layerCount = 1);
+    bool uploadRows(Request& request);
+    void complete(const std::shared_ptr<Request>& request);
+    void drop(const std::shared_ptr<Request>& request);
+    static size_t streamStartLevel(const Image& image);
+    void evictLevel(Streamed& texture);
+    bool makeRoom(size_t bytes, uint64_t usedFrame, const Streamed* requester);
+    void stepStreaming(CpuTimer& timer, float budgetMs);
+
+    // GL thread only: every request not completed or dropped yet, and those decoded in upload order
+    std::vector<std::shared_ptr<Request>> m_requests;
+    std::deque<std::shared_ptr<Request>> m_uploads;
+    std::array<PixelBuffer, PIXEL_BUFFER_COUNT> m_pixelBuffers {};
+    size_t m_nextPixelBuffer = 0;
+    TextureLoaderStats m_stats;
+    std::chrono::steady_clock::time_point m_firstRequest {};
+    bool m_compression = false;
+    bool m_s3tcSupported = false;
+    std::filesystem::path m_cacheDirectory;
+    std::unordered_map<const abstractTexture*, std::unique_ptr<Streamed>> m_streamed;
+    TextureStreamingStats m_streamingStats;
+    uint64_t m_frame = 0; // steps so far
+
+    // Shared with the workers
+    std::mutex m_mutex;
+    std::condition_variable m_decodeAvailable;
+    std::condition_variable m_decodeFinished;
+    std::deque<std::shared_ptr<Request>> m_decodeQueue;
+    std::deque<std::shared_ptr<Request>> m_decoded;
+    float m_decodeMs = 0.0f;
+    float m_encodeMs = 0.0f;
+    int m_cacheHits = 0;
+    bool m_stopping = false;
+    std::vector<std::thread> m_workers;
+};
@@ -0,0 +1,43 @@
+#include "uniform_buffer_ring.h"
+
+UniformBufferRing::~UniformBufferRing()
+{
+    for (const std::vector<Buffer>& slot : m_slots) {
+        for (const Buffer& buffer : slot)
+            glDeleteBuffers(1, &buffer.buffer);
+    }
+}
+
+void UniformBufferRing::beginFrame(int frameSlot)
+{
+    m_slot = static_cast<size_t>(frameSlot);
+    m_next = 0;
+}
+
+GLuint UniformBufferRing::push(const void* data, size_t size)
+{
+    std::vector<Buffer>& slot = m_slots[m_slot];
+    if (m_next == slot.size()) {
+        slot.emplace_back();
+        glGenBuffers(1, &slot.back().buffer);
+    }
+
+    Buffer& buffer = slot[m_next++];
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer.buffer);
+    if (size > buffer.capacity) {
+        glBufferData(GL_UNIFORM_BUFFER, static_cast<GLsizeiptr>(size), data, GL_DYNAMIC_DRAW);
+        buffer.capacity = size;
+    } else {
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, static_cast<GLsizeiptr>(size), data);
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    return buffer.buffer;
+}
+
+size_t UniformBufferRing::bufferCount() const
+{
+    size_t count = 0;
+    for (const std::vector<Buffer>& slot : m_slots)
+        count += slot.size();
+    return count;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "frame_pacer.h"
+
+#include <framework/opengl_includes.h>
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+// Uniform buffers for block data the draws of a frame fill anew (materials, shadow settings), a set per
+// FramePacer slot.
+//
+// beginFrame() hands out the buffers of the slot again from the first one. The frame that filled them last
+// has passed its fence by then, so push() overwrites them with glBufferSubData without waiting on the GPU,
+// and no buffer is created per draw: a slot grows to as many buffers as one frame pushes and stays there.
+class UniformBufferRing {
+public:
+    UniformBufferRing() = default;
+    UniformBufferRing(const UniformBufferRing&) = delete;
+    ~UniformBufferRing();
+
+    UniformBufferRing& operator=(const UniformBufferRing&) = delete;
+
+    // frameSlot is FramePacer::slot()
+    void beginFrame(int frameSlot);
+
+    // A buffer holding object for the rest of the frame, bind it with Shader::bindUniformBlock
+    template <typename T>
+    GLuint push(const T& object) { return push(&object, sizeof(T)); }
+    GLuint push(const void* data, size_t size);
+
+    size_t bufferCount() const;
+
+private:
+    struct Buffer {
+        GLuint buffer = 0;
+        size_t capacity = 0;
+    };
+
+    std::array<std::vector<Buffer>, FramePacer::MAX_FRAMES_IN_FLIGHT> m_slots;
+    size_t m_slot = 0;
+    size_t m_next = 0;
+};